@@ -0,0 +1,200 @@
+#version 330 core
+#define MAX_POINT_LIGHTS 8
+#define MAX_SPOT_LIGHTS 8
+#define MAX_DIRECTIONAL_LIGHTS 1
+
+// Light pass of d_DeferredRenderer (ducky_objs.h), built as three variants:
+// DEFERRED_DIRECTIONAL shades ambient and the directional lights over the
+// whole screen, DEFERRED_VOLUME one point or spot light inside its volume and
+// DEFERRED_COMPOSITE copies the result and its depth to the screen.
+
+// std140 layouts, these must match the d_*LightData structs in ducky_gfx.h
+struct PointLight {
+  vec3 pos;
+  float intensity;
+  vec3 color;
+  float a;
+  float b;
+};
+
+struct SpotLight {
+  vec3 pos;
+  float intensity;
+  vec3 color;
+  float outer_cone_angle;
+  vec3 direction;
+  float inner_cone_angle;
+};
+
+struct DirectionalLight {
+  vec3 pos;
+  float intensity;
+  vec3 color;
+  vec3 direction;
+};
+
+layout(std140) uniform FrameData {
+  mat4 view;
+  mat4 projection;
+  vec3 camera_position;
+  vec3 ambient_color;
+  float ambient_strength;
+};
+
+layout(std140) uniform LightData {
+  int point_light_count;
+  int spot_light_count;
+  int directional_light_count;
+  PointLight point_lights[MAX_POINT_LIGHTS];
+  SpotLight spot_lights[MAX_SPOT_LIGHTS];
+  DirectionalLight directional_lights[MAX_DIRECTIONAL_LIGHTS];
+};
+
+// std140 layout, must match d_ShadowData in ducky_gfx.h
+#define SHADOW_MAX_VIEWS 16
+layout(std140) uniform ShadowData {
+  mat4 shadow_matrices[SHADOW_MAX_VIEWS];
+  // uv offset and scale of each view's atlas tile
+  vec4 shadow_rects[SHADOW_MAX_VIEWS];
+  vec4 shadow_cascade_splits;
+  // cascade count, first cascade view, shadowed directional light
+  ivec4 shadow_info;
+};
+
+uniform sampler2DShadow shadow_atlas;
+
+uniform sampler2D gbuffer_albedo;
+uniform sampler2D gbuffer_normal;
+uniform sampler2D gbuffer_depth;
+uniform sampler2D light_buffer;
+// x, y, width, height of the area drawn to
+uniform vec4 viewport_rect;
+
+#ifdef DEFERRED_VOLUME
+// packed as in d_ClusterLightData (ducky_objs.h)
+uniform vec4 volume_light[4];
+#endif
+
+out vec4 FragColor;
+
+// World space position from the G-buffer's view space distance.
+vec3 world_position(vec2 uv, float depth) {
+  vec2 ndc = uv * 2.0 - 1.0;
+  vec3 view_position = vec3(ndc.x * depth / projection[0][0],
+                            ndc.y * depth / projection[1][1], -depth);
+  // the view matrix is rigid, its inverse is the transposed rotation
+  return transpose(mat3(view)) * (view_position - view[3].xyz);
+}
+
+// Same filtering as shadow_visibility in fragment.glsl.
+float shadow_visibility(int view_index, vec3 position, vec3 n,
+                        vec3 light_dir) {
+  float slope = 1.0 - max(dot(n, light_dir), 0.0);
+  vec3 offset_position = position + n * (0.01 + 0.03 * slope);
+  vec4 clip = shadow_matrices[view_index] * vec4(offset_position, 1.0);
+  vec3 coord = clip.xyz / clip.w * 0.5 + 0.5;
+  if (any(lessThan(coord, vec3(0.0))) || any(greaterThan(coord, vec3(1.0)))) {
+    return 1.0;
+  }
+
+  vec4 rect = shadow_rects[view_index];
+  vec2 texel = 1.0 / vec2(textureSize(shadow_atlas, 0));
+  vec2 low = rect.xy + texel;
+  vec2 high = rect.xy + rect.zw - texel;
+  vec2 uv = rect.xy + coord.xy * rect.zw;
+
+  float lit = 0.0;
+  for (int i = 0; i < 4; i++) {
+    vec2 tap = (vec2(float(i & 1), float(i >> 1)) - 0.5) * texel;
+    lit += texture(shadow_atlas, vec3(clamp(uv + tap, low, high), coord.z));
+  }
+  return lit * 0.25;
+}
+
+#ifdef DEFERRED_COMPOSITE
+void main() {
+  vec2 uv = (gl_FragCoord.xy - viewport_rect.xy) / viewport_rect.zw;
+  float depth = texture(gbuffer_depth, uv).r;
+  // nothing drawn, the clear color stays
+  if (depth == 0.0)
+    discard;
+
+  // back to window depth, for the geometry drawn forward afterwards
+  float ndc = (projection[2][2] * -depth + projection[3][2]) / depth;
+  gl_FragDepth = ndc * 0.5 + 0.5;
+  FragColor = vec4(texture(light_buffer, uv).rgb, 1.0);
+}
+#else
+void main() {
+  vec2 uv = (gl_FragCoord.xy - viewport_rect.xy) / viewport_rect.zw;
+  float depth = texture(gbuffer_depth, uv).r;
+  if (depth == 0.0)
+    discard;
+
+  vec4 albedo = texture(gbuffer_albedo, uv);
+  vec4 surface = texture(gbuffer_normal, uv);
+  vec3 position = world_position(uv, depth);
+  vec3 n = normalize(surface.xyz);
+  vec3 view_dir = normalize(camera_position - position);
+
+#ifdef DEFERRED_DIRECTIONAL
+  if (surface.w > 0.5) {
+    FragColor = vec4(albedo.rgb, 1.0);
+    return;
+  }
+
+  vec3 result = ambient_strength * albedo.rgb * ambient_color;
+  for (int i = 0; i < directional_light_count; i++) {
+    vec3 light_dir = normalize(directional_lights[i].direction);
+    float diffuse = max(dot(n, light_dir), 0.0);
+    vec3 halfway = normalize(view_dir + light_dir);
+    float specular = diffuse > 0.0 ? pow(max(dot(n, halfway), 0.0), 8) : 0.0;
+
+    float shadow = 1.0;
+    if (i == shadow_info.z) {
+      float view_depth = -(view * vec4(position, 1.0)).z;
+      for (int c = 0; c < shadow_info.x; c++) {
+        if (view_depth < shadow_cascade_splits[c]) {
+          shadow =
+              shadow_visibility(shadow_info.y + c, position, n, light_dir);
+          break;
+        }
+      }
+    }
+
+    result += directional_lights[i].color * directional_lights[i].intensity *
+              shadow * (diffuse * albedo.rgb + specular * albedo.a);
+  }
+  FragColor = vec4(result, 1.0);
+#else
+  // unlit surfaces were finished by the directional pass
+  if (surface.w > 0.5)
+    discard;
+
+  // same model as shade_light in fragment.glsl
+  vec3 light_vec = volume_light[0].xyz - position;
+  float distance = length(light_vec);
+  vec3 light_dir = light_vec / max(distance, 0.0001);
+
+  float attenuation = 1.0 / (volume_light[3].x * distance * distance +
+                             volume_light[3].y * distance + 1.0);
+  float window =
+      clamp(1.0 - pow(distance / volume_light[0].w, 4.0), 0.0, 1.0);
+  float cone = dot(volume_light[2].xyz, -light_dir);
+  float spot = clamp(cone * volume_light[2].w + volume_light[3].z, 0.0, 1.0);
+
+  float diffuse = max(dot(n, light_dir), 0.0);
+  vec3 halfway = normalize(view_dir + light_dir);
+  float specular = diffuse > 0.0 ? pow(max(dot(n, halfway), 0.0), 8) : 0.0;
+
+  float strength = attenuation * window * window * spot * volume_light[1].w;
+  if (volume_light[3].w >= 0.0 && strength > 0.0) {
+    strength *= shadow_visibility(int(volume_light[3].w), position, n,
+                                  light_dir);
+  }
+  FragColor = vec4(volume_light[1].rgb * strength *
+                       (diffuse * albedo.rgb + specular * albedo.a),
+                   1.0);
+#endif
+}
+#endif
@@ -0,0 +1,25 @@
+#version 330 core
+layout(location = 0) in vec3 aPos;
+
+layout(std140) uniform FrameData {
+  mat4 view;
+  mat4 projection;
+  vec3 camera_position;
+  vec3 ambient_color;
+  float ambient_strength;
+};
+
+#ifdef DEFERRED_VOLUME
+uniform mat4 model;
+#endif
+
+void main() {
+#ifdef DEFERRED_VOLUME
+  gl_Position = projection * view * model * vec4(aPos, 1.0);
+#else
+  // one triangle covering the screen, drawn without vertex data
+  vec2 corner = vec2(float((gl_VertexID & 1) << 2),
+                     float((gl_VertexID & 2) << 1)) - 1.0;
+  gl_Position = vec4(corner, 0.0, 1.0);
+#endif
+}
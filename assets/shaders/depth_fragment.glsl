@@ -0,0 +1,5 @@
+#version 330 core
+// Depth pre-pass, color writes are masked off.
+// No alpha test, the render queue leaves cut-out materials out of the pass.
+
+void main() {}
@@ -0,0 +1,31 @@
+#version 330 core
+// Depth pre-pass of the render queue, reads the position-only vertex arrays.
+// Build with `#define INSTANCED` for instanced runs.
+layout(location = 0) in vec3 aPos;
+#ifdef INSTANCED
+// per instance model matrix, one column per location (3 - 6)
+layout(location = 3) in mat4 aModel;
+#else
+uniform mat4 model;
+#endif
+
+layout(std140) uniform FrameData {
+  mat4 view;
+  mat4 projection;
+  vec3 camera_position;
+  vec3 ambient_color;
+  float ambient_strength;
+};
+
+// the shading pass tests with GL_EQUAL, so the position is computed exactly
+// as in vertex.glsl and vertex_instanced.glsl
+invariant gl_Position;
+
+void main() {
+#ifdef INSTANCED
+  vec3 position = vec3(aModel * vec4(aPos, 1.0));
+#else
+  vec3 position = vec3(model * vec4(aPos, 1.0));
+#endif
+  gl_Position = projection * view * vec4(position, 1.0);
+}
@@ -0,0 +1,43 @@
+#version 330 core
+
+// G-buffer variant of fragment.glsl, see d_DeferredRenderer in ducky_objs.h.
+layout(std140) uniform FrameData {
+  mat4 view;
+  mat4 projection;
+  vec3 camera_position;
+  vec3 ambient_color;
+  float ambient_strength;
+};
+
+// rgb albedo, a specular strength
+layout(location = 0) out vec4 gbuffer_albedo;
+// xyz world space normal, w 1 for unlit surfaces
+layout(location = 1) out vec4 gbuffer_normal;
+// view space distance
+layout(location = 2) out float gbuffer_depth;
+
+in vec2 texture_coord;
+in vec3 normal;
+in vec3 position;
+
+uniform vec3 scale = vec3(1.0, 1.0, 1.0);
+uniform sampler2D diffuse_texture;
+uniform sampler2D specular_texture;
+uniform vec4 color = vec4(1.0, 1.0, 1.0, 1.0);
+uniform float specular_strength = 0.5;
+uniform bool unlit = false;
+
+void main() {
+  vec4 diffuse = texture(diffuse_texture, texture_coord);
+  if (diffuse.a < 0.1)
+    discard;
+
+  float specular =
+      specular_strength * texture(specular_texture, texture_coord).r;
+
+  // unlit surfaces show the plain texture, as in the forward path
+  gbuffer_albedo =
+      vec4(unlit ? diffuse.rgb : diffuse.rgb * vec3(color), specular);
+  gbuffer_normal = vec4(normalize(normal * scale), unlit ? 1.0 : 0.0);
+  gbuffer_depth = -(view * vec4(position, 1.0)).z;
+}
@@ -8,8 +8,17 @@ out vec3 normal;
 out vec3 position;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+layout(std140) uniform FrameData {
+  mat4 view;
+  mat4 projection;
+  vec3 camera_position;
+  vec3 ambient_color;
+  float ambient_strength;
+};
+
+// matches depth_vertex.glsl for the GL_EQUAL test after the depth pre-pass
+invariant gl_Position;
 
 void main() {
   position = vec3(model * vec4(aPos, 1.0));
@@ -0,0 +1,29 @@
+#version 330 core
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec2 aTexCoord;
+layout(location = 2) in vec3 aNormal;
+// per instance model matrix, one column per location (3 - 6)
+layout(location = 3) in mat4 aModel;
+
+out vec2 texture_coord;
+out vec3 normal;
+out vec3 position;
+
+layout(std140) uniform FrameData {
+  mat4 view;
+  mat4 projection;
+  vec3 camera_position;
+  vec3 ambient_color;
+  float ambient_strength;
+};
+
+// matches depth_vertex.glsl for the GL_EQUAL test after the depth pre-pass
+invariant gl_Position;
+
+void main() {
+  position = vec3(aModel * vec4(aPos, 1.0));
+  gl_Position = projection * view * vec4(position, 1.0);
+
+  texture_coord = aTexCoord;
+  normal = mat3(transpose(inverse(aModel))) * aNormal;
+}
\ No newline at end of file
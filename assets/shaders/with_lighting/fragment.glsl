@@ -3,35 +3,77 @@
 #define MAX_SPOT_LIGHTS 8
 #define MAX_DIRECTIONAL_LIGHTS 1
 
+// std140 layouts, these must match the d_*LightData structs in ducky_gfx.h
 struct PointLight {
   vec3 pos;
+  float intensity;
   vec3 color;
   float a;
   float b;
-  float intensity;
 };
-uniform int point_light_count;
-uniform PointLight point_lights[MAX_POINT_LIGHTS];
 
 struct SpotLight {
   vec3 pos;
+  float intensity;
   vec3 color;
-  vec3 direction;
   float outer_cone_angle;
+  vec3 direction;
   float inner_cone_angle;
-  float intensity;
 };
-uniform int spot_light_count;
-uniform SpotLight spot_lights[MAX_SPOT_LIGHTS];
 
 struct DirectionalLight {
   vec3 pos;
+  float intensity;
   vec3 color;
   vec3 direction;
-  float intensity;
 };
-uniform int directional_light_count;
-uniform DirectionalLight directional_lights[MAX_DIRECTIONAL_LIGHTS];
+
+layout(std140) uniform FrameData {
+  mat4 view;
+  mat4 projection;
+  vec3 camera_position;
+  vec3 ambient_color;
+  float ambient_strength;
+};
+
+layout(std140) uniform LightData {
+  int point_light_count;
+  int spot_light_count;
+  int directional_light_count;
+  PointLight point_lights[MAX_POINT_LIGHTS];
+  SpotLight spot_lights[MAX_SPOT_LIGHTS];
+  DirectionalLight directional_lights[MAX_DIRECTIONAL_LIGHTS];
+};
+
+// std140 layout, must match d_ClusterData in ducky_objs.h
+layout(std140) uniform ClusterData {
+  uvec4 cluster_size;
+  // near, far, slice scale, slice bias
+  vec4 cluster_depth;
+  vec4 cluster_viewport;
+};
+
+uniform usamplerBuffer cluster_grid;
+uniform usamplerBuffer cluster_light_indices;
+uniform samplerBuffer cluster_lights;
+
+// std140 layout, must match d_ShadowData in ducky_gfx.h
+#define SHADOW_MAX_VIEWS 16
+layout(std140) uniform ShadowData {
+  mat4 shadow_matrices[SHADOW_MAX_VIEWS];
+  // uv offset and scale of each view's atlas tile
+  vec4 shadow_rects[SHADOW_MAX_VIEWS];
+  vec4 shadow_cascade_splits;
+  // cascade count, first cascade view, shadowed directional light
+  ivec4 shadow_info;
+};
+
+uniform sampler2DShadow shadow_atlas;
+
+#ifdef OBJECT_LIGHTS
+// compiled with d_shader_create_with_defines, see d_DrawItem::lights
+uniform vec4 object_lights[OBJECT_LIGHTS * 4];
+#endif
 
 out vec4 FragColor;
 
@@ -44,92 +86,136 @@ uniform sampler2D diffuse_texture;
 uniform sampler2D specular_texture;
 uniform vec4 color = vec4(1.0, 1.0, 1.0, 1.0);
 uniform float specular_strength = 0.5;
-uniform vec3 camera_position;
-uniform vec3 ambient_color = vec3(1.0, 1.0, 1.0);
-uniform float ambient_strength = 0.2;
 uniform bool unlit = false;
 
 vec3 get_scaled_normal() { return normalize(normal * scale); }
 
-vec4 point_light() {
-  vec3 n = normalize(get_scaled_normal());
-  vec3 view_dir = normalize(camera_position - position);
-
-  vec4 result = vec4(0.0);
-
-  for (int i = 0; i < point_light_count; i++) {
-    vec3 light_vec = point_lights[i].pos - position;
-    float distance = length(light_vec);
-    float point_intensity = 1.0 / (point_lights[i].a * distance * distance +
-                                   point_lights[i].b * distance + 1.0);
-    vec3 light_dir = normalize(light_vec);
+// Lit fraction of the fragment in one view of the shadow atlas (see
+// d_ShadowAtlas in ducky_objs.h), four compared taps kept inside the tile.
+float shadow_visibility(int view_index, vec3 n, vec3 light_dir) {
+  // pushed off the surface, further at grazing angles
+  float slope = 1.0 - max(dot(n, light_dir), 0.0);
+  vec3 offset_position = position + n * (0.01 + 0.03 * slope);
+  vec4 clip = shadow_matrices[view_index] * vec4(offset_position, 1.0);
+  vec3 coord = clip.xyz / clip.w * 0.5 + 0.5;
+  if (any(lessThan(coord, vec3(0.0))) || any(greaterThan(coord, vec3(1.0)))) {
+    return 1.0;
+  }
 
-    float diffuse = max(dot(get_scaled_normal(), light_dir), 0.0);
+  vec4 rect = shadow_rects[view_index];
+  vec2 texel = 1.0 / vec2(textureSize(shadow_atlas, 0));
+  vec2 low = rect.xy + texel;
+  vec2 high = rect.xy + rect.zw - texel;
+  vec2 uv = rect.xy + coord.xy * rect.zw;
 
-    vec3 reflect_dir = reflect(-light_dir, get_scaled_normal());
-    vec3 halfway = normalize(view_dir + light_dir);
-    float specular = pow(max(dot(get_scaled_normal(), halfway), 0.0), 8);
+  float lit = 0.0;
+  for (int i = 0; i < 4; i++) {
+    vec2 tap = (vec2(float(i & 1), float(i >> 1)) - 0.5) * texel;
+    lit += texture(shadow_atlas, vec3(clamp(uv + tap, low, high), coord.z));
+  }
+  return lit * 0.25;
+}
 
-    vec3 dif_res = diffuse * vec3(texture(diffuse_texture, texture_coord));
-    if (diffuse == 0.0) {
-      specular = 0.0;
+// Shadow of the directional light with cascades, from the cascade whose
+// slice of the view holds the fragment.
+float cascade_visibility(vec3 n, vec3 light_dir) {
+  float depth = -(view * vec4(position, 1.0)).z;
+  for (int i = 0; i < shadow_info.x; i++) {
+    if (depth < shadow_cascade_splits[i]) {
+      return shadow_visibility(shadow_info.y + i, n, light_dir);
     }
-    vec3 spec_res = specular_strength * specular *
-                    vec3(texture(specular_texture, texture_coord));
-
-    result += vec4(point_lights[i].color *
-                       (dif_res * point_intensity * point_lights[i].intensity *
-                            vec3(color) +
-                        spec_res * point_intensity * point_lights[i].intensity),
-                   1.0);
   }
+  return 1.0;
+}
 
-  vec3 amb_res = ambient_strength *
-                 vec3(texture(diffuse_texture, texture_coord)) * ambient_color;
+// One point or spot light, packed as in d_ClusterLightData (ducky_objs.h):
+// position and range, color and intensity, direction and spot scale, a, b,
+// spot offset and shadow view.
+vec3 shade_light(vec4 position_range, vec4 color_intensity,
+                 vec4 direction_scale, vec4 falloff, vec3 n, vec3 view_dir,
+                 vec3 diffuse_color, vec3 specular_color) {
+  vec3 light_vec = position_range.xyz - position;
+  float distance = length(light_vec);
+  vec3 light_dir = light_vec / max(distance, 0.0001);
+
+  float attenuation =
+      1.0 / (falloff.x * distance * distance + falloff.y * distance + 1.0);
+  // fades out before the range the light was binned with
+  float window = clamp(1.0 - pow(distance / position_range.w, 4.0), 0.0, 1.0);
+  float cone = dot(direction_scale.xyz, -light_dir);
+  float spot = clamp(cone * direction_scale.w + falloff.z, 0.0, 1.0);
+
+  float diffuse = max(dot(n, light_dir), 0.0);
+  vec3 halfway = normalize(view_dir + light_dir);
+  float specular = pow(max(dot(n, halfway), 0.0), 8);
+  if (diffuse == 0.0) {
+    specular = 0.0;
+  }
 
-  return result + vec4(amb_res, 1.0) * color;
+  float strength = attenuation * window * window * spot * color_intensity.w;
+  if (falloff.w >= 0.0 && strength > 0.0) {
+    strength *= shadow_visibility(int(falloff.w), n, light_dir);
+  }
+  return color_intensity.rgb * strength *
+         (diffuse * diffuse_color * vec3(color) +
+          specular_strength * specular * specular_color);
 }
 
-vec4 spot_light() {
-  vec3 n = normalize(get_scaled_normal());
+// Point and spot lights of the fragment's cluster, see d_ClusterGrid in
+// ducky_objs.h.
+vec4 clustered_lights() {
+  vec3 n = get_scaled_normal();
   vec3 view_dir = normalize(camera_position - position);
+  vec3 diffuse_color = vec3(texture(diffuse_texture, texture_coord));
+  vec3 specular_color = vec3(texture(specular_texture, texture_coord));
+
+  vec2 screen = (gl_FragCoord.xy - cluster_viewport.xy) / cluster_viewport.zw;
+  uvec2 tile = uvec2(clamp(screen, 0.0, 0.999) * vec2(cluster_size.xy));
+  float depth = max(-(view * vec4(position, 1.0)).z, cluster_depth.x);
+  uint slice = uint(clamp(log(depth) * cluster_depth.z + cluster_depth.w, 0.0,
+                          float(cluster_size.z - 1u)));
+  int cluster =
+      int(tile.x + (tile.y + slice * cluster_size.y) * cluster_size.x);
+  uvec2 range = texelFetch(cluster_grid, cluster).xy;
+
+  vec3 result = vec3(0.0);
+
+  for (uint i = 0u; i < range.y; i++) {
+    int light = int(texelFetch(cluster_light_indices, int(range.x + i)).r) * 4;
+    result += shade_light(texelFetch(cluster_lights, light),
+                          texelFetch(cluster_lights, light + 1),
+                          texelFetch(cluster_lights, light + 2),
+                          texelFetch(cluster_lights, light + 3), n, view_dir,
+                          diffuse_color, specular_color);
+  }
 
-  vec4 result = vec4(0.0);
-
-  for (int i = 0; i < spot_light_count; i++) {
-    float cos_inner = cos(spot_lights[i].inner_cone_angle);
-    float cos_outer = cos(spot_lights[i].outer_cone_angle);
-
-    vec3 light_dir = normalize(spot_lights[i].pos - position);
+  vec3 amb_res = ambient_strength * diffuse_color * ambient_color;
 
-    float diffuse = max(dot(get_scaled_normal(), light_dir), 0.0);
-    vec3 reflect_dir = reflect(-light_dir, get_scaled_normal());
-    vec3 halfway = normalize(view_dir + light_dir);
-    float specular = pow(max(dot(get_scaled_normal(), halfway), 0.0), 8);
+  return vec4(result, 1.0) + vec4(amb_res, 1.0) * color;
+}
 
-    vec3 dif_res = diffuse * vec3(texture(diffuse_texture, texture_coord));
-    if (diffuse == 0.0) {
-      specular = 0.0;
-    }
-    vec3 spec_res = specular_strength * specular *
-                    vec3(texture(specular_texture, texture_coord));
+#ifdef OBJECT_LIGHTS
+// The strongest lights at the object, chosen on the CPU by the render queue.
+// Unused slots have no intensity, so the loop count is fixed.
+vec4 object_lights_shade() {
+  vec3 n = get_scaled_normal();
+  vec3 view_dir = normalize(camera_position - position);
+  vec3 diffuse_color = vec3(texture(diffuse_texture, texture_coord));
+  vec3 specular_color = vec3(texture(specular_texture, texture_coord));
 
-    float angle = dot(spot_lights[i].direction, -light_dir);
-    float spot_intensity =
-        clamp((angle - cos_outer) / (cos_inner - cos_outer), 0.0, 1.0);
+  vec3 result = vec3(0.0);
 
-    result += vec4(
-        spot_lights[i].color *
-            (dif_res * spot_intensity * spot_lights[i].intensity * vec3(color) +
-             spec_res * spot_intensity * spot_lights[i].intensity),
-        1.0);
+  for (int i = 0; i < OBJECT_LIGHTS; i++) {
+    result += shade_light(object_lights[i * 4], object_lights[i * 4 + 1],
+                          object_lights[i * 4 + 2], object_lights[i * 4 + 3],
+                          n, view_dir, diffuse_color, specular_color);
   }
 
-  vec3 amb_res = ambient_strength *
-                 vec3(texture(diffuse_texture, texture_coord)) * ambient_color;
+  vec3 amb_res = ambient_strength * diffuse_color * ambient_color;
 
-  return result + vec4(amb_res, 1.0) * color;
+  return vec4(result, 1.0) + vec4(amb_res, 1.0) * color;
 }
+#endif
 
 vec4 directional_light() {
   vec3 n = normalize(get_scaled_normal());
@@ -151,6 +237,11 @@ vec4 directional_light() {
     }
     vec3 spec_res = specular_strength * specular *
                     vec3(texture(specular_texture, texture_coord));
+    if (i == shadow_info.z) {
+      float shadow = cascade_visibility(get_scaled_normal(), light_dir);
+      dif_res *= shadow;
+      spec_res *= shadow;
+    }
 
     result = vec4(directional_lights[i].color *
                       (dif_res * directional_lights[i].intensity * vec3(color) +
@@ -169,7 +260,11 @@ void main() {
     discard;
 
   if (unlit == false) {
-    vec4 lighting = point_light() + spot_light() + directional_light();
+#ifdef OBJECT_LIGHTS
+    vec4 lighting = object_lights_shade() + directional_light();
+#else
+    vec4 lighting = clustered_lights() + directional_light();
+#endif
     FragColor = lighting;
   } else {
     FragColor = texture(diffuse_texture, texture_coord);
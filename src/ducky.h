@@ -1,10 +1,13 @@
 #define DUCKY_CORE_IMPL
 #define DUCKY_CORE_PRINT_ERRORS
+// #define DUCKY_PROFILE
 #include "ducky_core.h"
 #define DUCKY_MATH_IMPL
 #include "ducky_math.h"
 #define DUCKY_WINDOW_IMPL
 #define DUCKY_GLAD_IMPL "glad/glad.h"
+// needs -lEGL, `make headless` builds the offscreen benchmark with it
+// #define DUCKY_HEADLESS
 #include "ducky_window.h"
 #define DUCKY_GFX_IMPL
 #include "ducky_gfx.h"
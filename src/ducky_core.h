@@ -1,7 +1,9 @@
 #ifndef DUCKY_CORE_H
 #define DUCKY_CORE_H
 
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #ifdef DUCKY_CORE_PRINT_ERRORS
@@ -92,6 +94,11 @@ void d_array_add(d_Array *array, void *element);
   (*(type *)d_array_get_internal(array, index))
 
 void *d_array_get_internal(d_Array *array, d_uint index);
+/**
+ * @brief Removes the element at `index`, shifting the following elements down
+ * so their order is kept.
+ */
+void d_array_remove(d_Array *array, d_uint index);
 void d_array_destroy(d_Array **array);
 
 #pragma endregion
@@ -179,12 +186,141 @@ char *d_str_from_int(int target);
 
 bool d_is_path_valid(const char *path);
 
+/**
+ * @brief Creates a directory, including any missing parent directories.
+ *
+ * @param path directory to create, separated with `/`.
+ * @return `true` if the directory exists after the call.
+ */
+bool d_make_directory(const char *path);
+
+#define D_HASH_SEED 14695981039346656037ULL
+
+/**
+ * @brief 64-bit FNV-1a hash of `size` bytes of `data`.
+ *
+ * @param data bytes to hash.
+ * @param size number of bytes.
+ * @param seed `D_HASH_SEED`, or the result of a previous call to chain hashes.
+ * @return The hash.
+ */
+uint64_t d_hash(const void *data, size_t size, uint64_t seed);
+
+#pragma endregion
+
+#pragma region Profiler
+
+// events a thread buffer holds per capture, later ones are dropped
+#define D_PROFILE_BUFFER_EVENTS 65536
+// a thread holds a buffer from its first event until `d_profiler_thread_exit`
+#define D_PROFILE_MAX_BUFFERS 64
+// `thread_id` of GPU timings, shown as their own track
+#define D_PROFILE_GPU_THREAD 0
+
+typedef struct d_ProfileEvent {
+  // must stay valid until the capture is exported, usually a string literal
+  const char *name;
+  // nanoseconds, see `d_profiler_now`
+  uint64_t start;
+  uint64_t duration;
+  d_uint thread_id;
+} ProfileEvent, d_ProfileEvent;
+
+// Written by the one thread that owns it, read by the exporter. `count` is
+// published after each event, so readers never see a partial one.
+typedef struct d_ProfileBuffer {
+  d_ProfileEvent *events;
+  atomic_uint count;
+  atomic_int owned;
+} ProfileBuffer, d_ProfileBuffer;
+
+typedef struct d_ProfileScope {
+  const char *name;
+  // `0` when no capture was running at the start of the scope
+  uint64_t start;
+} ProfileScope, d_ProfileScope;
+
+#ifdef DUCKY_PROFILE
+#define D_PROFILE_CONCAT_INTERNAL(a, b) a##b
+#define D_PROFILE_CONCAT(a, b) D_PROFILE_CONCAT_INTERNAL(a, b)
+/**
+ * @brief Times the rest of the enclosing block while a capture is running.
+ * Compiles to nothing without `DUCKY_PROFILE`.
+ */
+#define D_PROFILE_SCOPE(name)                                                  \
+  d_ProfileScope D_PROFILE_CONCAT(d_profile_scope_, __LINE__)                  \
+      __attribute__((cleanup(d_profile_scope_end))) =                          \
+          d_profile_scope_begin(name)
+#else
+#define D_PROFILE_SCOPE(name)
+#endif
+
+/**
+ * @brief Monotonic time in nanoseconds.
+ */
+uint64_t d_profiler_now();
+/**
+ * @brief Clears every buffer and starts recording. Call between frames, while
+ * no other thread is recording.
+ */
+void d_profiler_begin_capture();
+void d_profiler_end_capture();
+bool d_profiler_capturing();
+/**
+ * @brief Number of the running or last capture, `0` before the first one.
+ */
+d_uint d_profiler_capture_id();
+/**
+ * @brief Small id of the calling thread, assigned on first use. `0` is
+ * `D_PROFILE_GPU_THREAD`.
+ */
+d_uint d_profiler_thread_id();
+/**
+ * @brief Adds an event to the calling thread's buffer. Lock-free, events are
+ * dropped when no capture is running or the buffer is full.
+ */
+void d_profiler_record(const char *name, const uint64_t start,
+                       const uint64_t duration, const d_uint thread_id);
+/**
+ * @brief Adds an event that was measured during capture `capture` but is only
+ * known later, like GPU timings read back frames after they were issued. It
+ * is kept after the capture ended and dropped once another capture started.
+ */
+void d_profiler_record_late(const char *name, const uint64_t start,
+                            const uint64_t duration, const d_uint thread_id,
+                            const d_uint capture);
+d_ProfileScope d_profile_scope_begin(const char *name);
+void d_profile_scope_end(d_ProfileScope *scope);
+/**
+ * @brief Gives the calling thread's buffer back to the pool, its events are
+ * kept. Called by threads that are about to exit.
+ */
+void d_profiler_thread_exit();
+/**
+ * @brief Writes the events of the capture as Chrome trace JSON, for
+ * chrome://tracing or Perfetto.
+ *
+ * @return false if the file could not be written.
+ */
+bool d_profiler_export_chrome_trace(const char *path);
+/**
+ * @brief Frees every buffer. Called by `d_core_shutdown`.
+ */
+void d_profiler_shutdown();
+
 #pragma endregion
 
 #endif
 
 #ifdef DUCKY_CORE_IMPL
 
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
 #pragma region Error Handling
 const d_Error DUCKY_SUCCESS = {0, "DUCKY_SUCCESS"};
 const d_Error DUCKY_FAILURE = {10, "DUCKY_FAILURE"};
@@ -292,6 +428,23 @@ void *d_array_get_internal(d_Array *array, d_uint index) {
   return (char *)array->data + (index * array->element_size);
 }
 
+void d_array_remove(d_Array *array, d_uint index) {
+  if (array == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "array is NULL.");
+    return;
+  }
+
+  if (index >= array->length) {
+    d_throw_error(DUCKY_INDEX_OUT_OF_BOUNDS, "Index out of bounds.");
+    return;
+  }
+
+  char *element = (char *)array->data + (index * array->element_size);
+  memmove(element, element + array->element_size,
+          (array->length - index - 1) * array->element_size);
+  array->length--;
+}
+
 void d_array_destroy(d_Array **array) {
   if (array == NULL) {
     d_throw_error(DUCKY_NULL_REFERENCE, "array (d_Array **) is NULL.");
@@ -469,6 +622,7 @@ void d_core_init() {
 }
 
 void d_core_shutdown() {
+  d_profiler_shutdown();
   d_event_system_destroy(&d_event_system);
   free(d_last_error);
 }
@@ -508,6 +662,8 @@ d_File *d_file_read(const char *path) {
   }
 
   d_file->data = buffer;
+  d_file->path = path;
+  d_file->size = length;
 
   return d_file;
 }
@@ -547,6 +703,28 @@ void d_file_edit(d_File *file, const char *data) {
   file->size = data_length;
 }
 
+void d_file_save(d_File *file) {
+  if (file == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "file is NULL.");
+    return;
+  }
+  if (file->path == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "file->path is NULL.");
+    return;
+  }
+
+  FILE *output = fopen(file->path, "wb");
+  if (output == NULL) {
+    d_throw_error(DUCKY_FAILURE, "Failed to open file for writing.");
+    return;
+  }
+
+  if (file->size > 0 && fwrite(file->data, file->size, 1, output) != 1) {
+    d_throw_error(DUCKY_FAILURE, "Failed to write file.");
+  }
+  fclose(output);
+}
+
 #pragma endregion
 
 #pragma region Utilities
@@ -715,6 +893,261 @@ bool d_is_path_valid(const char *path) {
   return false;
 }
 
+bool d_make_directory(const char *path) {
+  if (path == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "path is NULL.");
+    return false;
+  }
+
+  char partial[1024];
+  size_t length = strlen(path);
+  if (length == 0 || length >= sizeof(partial)) {
+    d_throw_error(DUCKY_FAILURE, "path is empty or too long.");
+    return false;
+  }
+
+  // create every parent first, mkdir fails on an existing directory so the
+  // result is only checked for the full path.
+  for (size_t i = 1; i <= length; i++) {
+    if (path[i] != '/' && path[i] != '\\' && path[i] != '\0')
+      continue;
+
+    memcpy(partial, path, i);
+    partial[i] = '\0';
+#ifdef _WIN32
+    _mkdir(partial);
+#else
+    mkdir(partial, 0755);
+#endif
+  }
+
+  struct stat info;
+  return stat(path, &info) == 0 && (info.st_mode & S_IFDIR) != 0;
+}
+
+uint64_t d_hash(const void *data, size_t size, uint64_t seed) {
+  const unsigned char *bytes = data;
+  uint64_t hash = seed;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+#pragma endregion
+
+#pragma region Profiler
+
+d_ProfileBuffer d_profile_buffers[D_PROFILE_MAX_BUFFERS];
+atomic_bool d_profile_capturing;
+atomic_uint d_profile_capture;
+atomic_uint d_profile_next_thread_id = 1;
+_Thread_local d_ProfileBuffer *d_profile_thread_buffer = NULL;
+_Thread_local d_uint d_profile_thread_id = 0;
+
+uint64_t d_profiler_now() {
+  struct timespec time;
+#ifdef _WIN32
+  timespec_get(&time, TIME_UTC);
+#else
+  clock_gettime(CLOCK_MONOTONIC, &time);
+#endif
+  return (uint64_t)time.tv_sec * 1000000000ULL + (uint64_t)time.tv_nsec;
+}
+
+void d_profiler_begin_capture() {
+  for (d_uint i = 0; i < D_PROFILE_MAX_BUFFERS; i++) {
+    atomic_store(&d_profile_buffers[i].count, 0);
+  }
+  atomic_fetch_add(&d_profile_capture, 1);
+  atomic_store(&d_profile_capturing, true);
+}
+
+void d_profiler_end_capture() { atomic_store(&d_profile_capturing, false); }
+
+bool d_profiler_capturing() { return atomic_load(&d_profile_capturing); }
+
+d_uint d_profiler_capture_id() { return atomic_load(&d_profile_capture); }
+
+d_uint d_profiler_thread_id() {
+  if (d_profile_thread_id == 0) {
+    d_profile_thread_id = atomic_fetch_add(&d_profile_next_thread_id, 1);
+  }
+  return d_profile_thread_id;
+}
+
+// Claims a free buffer for the calling thread, `NULL` when all are taken.
+d_ProfileBuffer *d_profiler_acquire_internal() {
+  for (d_uint i = 0; i < D_PROFILE_MAX_BUFFERS; i++) {
+    d_ProfileBuffer *buffer = &d_profile_buffers[i];
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&buffer->owned, &expected, 1) ==
+        false) {
+      continue;
+    }
+
+    // only the owner touches `events`, so it is allocated on first claim
+    if (buffer->events == NULL) {
+      buffer->events =
+          malloc(sizeof(d_ProfileEvent) * D_PROFILE_BUFFER_EVENTS);
+      if (buffer->events == NULL) {
+        atomic_store(&buffer->owned, 0);
+        return NULL;
+      }
+    }
+    return buffer;
+  }
+  return NULL;
+}
+
+// Appends to the calling thread's buffer whether or not a capture runs.
+void d_profiler_append_internal(const char *name, const uint64_t start,
+                                const uint64_t duration,
+                                const d_uint thread_id) {
+  if (d_profile_thread_buffer == NULL) {
+    d_profile_thread_buffer = d_profiler_acquire_internal();
+    if (d_profile_thread_buffer == NULL) {
+      return;
+    }
+  }
+
+  d_ProfileBuffer *buffer = d_profile_thread_buffer;
+  d_uint count = atomic_load_explicit(&buffer->count, memory_order_relaxed);
+  if (count >= D_PROFILE_BUFFER_EVENTS) {
+    return;
+  }
+
+  d_ProfileEvent *event = &buffer->events[count];
+  event->name = name;
+  event->start = start;
+  event->duration = duration;
+  event->thread_id = thread_id;
+  atomic_store_explicit(&buffer->count, count + 1, memory_order_release);
+}
+
+void d_profiler_record(const char *name, const uint64_t start,
+                       const uint64_t duration, const d_uint thread_id) {
+  if (atomic_load_explicit(&d_profile_capturing, memory_order_relaxed) ==
+      false) {
+    return;
+  }
+  d_profiler_append_internal(name, start, duration, thread_id);
+}
+
+void d_profiler_record_late(const char *name, const uint64_t start,
+                            const uint64_t duration, const d_uint thread_id,
+                            const d_uint capture) {
+  if (capture == 0 || capture != atomic_load(&d_profile_capture)) {
+    return;
+  }
+  d_profiler_append_internal(name, start, duration, thread_id);
+}
+
+d_ProfileScope d_profile_scope_begin(const char *name) {
+  d_ProfileScope scope = {name, 0};
+  if (atomic_load_explicit(&d_profile_capturing, memory_order_relaxed)) {
+    scope.start = d_profiler_now();
+  }
+  return scope;
+}
+
+void d_profile_scope_end(d_ProfileScope *scope) {
+  if (scope->start == 0) {
+    return;
+  }
+  d_profiler_record(scope->name, scope->start,
+                    d_profiler_now() - scope->start, d_profiler_thread_id());
+}
+
+void d_profiler_thread_exit() {
+  if (d_profile_thread_buffer == NULL) {
+    return;
+  }
+  atomic_store(&d_profile_thread_buffer->owned, 0);
+  d_profile_thread_buffer = NULL;
+}
+
+// Event names are plain literals, only quotes, backslashes and control
+// characters need escaping.
+void d_profiler_write_string_internal(FILE *file, const char *string) {
+  fputc('"', file);
+  for (const char *c = string; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      fputc('\\', file);
+      fputc(*c, file);
+    } else if ((unsigned char)*c < 0x20) {
+      fprintf(file, "\\u%04x", (unsigned char)*c);
+    } else {
+      fputc(*c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+bool d_profiler_export_chrome_trace(const char *path) {
+  if (path == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "path is NULL.");
+    return false;
+  }
+
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    d_throw_error(DUCKY_FAILURE, "Failed to open trace file.");
+    return false;
+  }
+
+  // timestamps are relative to the earliest event, in microseconds
+  uint64_t origin = UINT64_MAX;
+  for (d_uint b = 0; b < D_PROFILE_MAX_BUFFERS; b++) {
+    d_ProfileBuffer *buffer = &d_profile_buffers[b];
+    d_uint count = atomic_load_explicit(&buffer->count, memory_order_acquire);
+    for (d_uint i = 0; i < count; i++) {
+      if (buffer->events[i].start < origin)
+        origin = buffer->events[i].start;
+    }
+  }
+
+  fprintf(file, "{\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%u,\"args\":{\"name\":\"GPU\"}}",
+          D_PROFILE_GPU_THREAD);
+  for (d_uint b = 0; b < D_PROFILE_MAX_BUFFERS; b++) {
+    d_ProfileBuffer *buffer = &d_profile_buffers[b];
+    d_uint count = atomic_load_explicit(&buffer->count, memory_order_acquire);
+    for (d_uint i = 0; i < count; i++) {
+      const d_ProfileEvent *event = &buffer->events[i];
+      fprintf(file, ",\n{\"name\":");
+      d_profiler_write_string_internal(file, event->name);
+      fprintf(file,
+              ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,"
+              "\"dur\":%.3f}",
+              event->thread_id, (event->start - origin) / 1000.0,
+              event->duration / 1000.0);
+    }
+  }
+  fprintf(file, "\n]}\n");
+
+  bool written = ferror(file) == 0;
+  fclose(file);
+  if (written == false) {
+    d_throw_error(DUCKY_FAILURE, "Failed to write trace file.");
+  }
+  return written;
+}
+
+void d_profiler_shutdown() {
+  atomic_store(&d_profile_capturing, false);
+  for (d_uint i = 0; i < D_PROFILE_MAX_BUFFERS; i++) {
+    free(d_profile_buffers[i].events);
+    d_profile_buffers[i].events = NULL;
+    atomic_store(&d_profile_buffers[i].count, 0);
+    atomic_store(&d_profile_buffers[i].owned, 0);
+  }
+  d_profile_thread_buffer = NULL;
+}
+
 #pragma endregion
 
 #endif
@@ -5,6 +5,10 @@
 #include "ducky_core.h"
 #endif
 
+#ifndef DUCKY_MATH_H
+#include "ducky_math.h"
+#endif
+
 #ifdef DUCKY_GLAD_IMPL
 #include DUCKY_GLAD_IMPL
 #elif
@@ -49,6 +53,13 @@ bool d_gl_error_internal(const char *message, const char *function,
  */
 #define d_gl_error(message) d_gl_error_internal(message, __FUNCTION__, __FILE__)
 
+/**
+ * @brief Checks the current context's extension list.
+ *
+ * @param name Full extension name, e.g. `"GL_KHR_parallel_shader_compile"`.
+ */
+bool d_gl_has_extension(const char *name);
+
 #pragma endregion
 
 #pragma region Types
@@ -75,12 +86,166 @@ typedef enum d_FaceCullingType {
 } FaceCullingType,
     d_FaceCullingType;
 
+#define D_UNIFORM_BLOCK_FRAME 0
+#define D_UNIFORM_BLOCK_LIGHTS 1
+#define D_UNIFORM_BLOCK_CLUSTERS 2
+#define D_UNIFORM_BLOCK_SHADOWS 3
+
+// Texture units of the shadow atlas and the clustered lighting buffer
+// textures, clear of the material's units.
+#define D_TEXTURE_UNIT_SHADOW_ATLAS 12
+#define D_TEXTURE_UNIT_CLUSTER_GRID 13
+#define D_TEXTURE_UNIT_CLUSTER_INDICES 14
+#define D_TEXTURE_UNIT_CLUSTER_LIGHTS 15
+
+typedef struct d_UniformBuffer {
+  d_uint id;
+  d_uint binding;
+  size_t size;
+} UniformBuffer, d_UniformBuffer;
+
+// number of frames a stream buffer can have queued on the GPU
+#define D_STREAM_FRAMES 3
+
+// Ring allocator for per-frame dynamic data (instance transforms, particles,
+// uniforms). The buffer is split into `D_STREAM_FRAMES` regions, each guarded
+// by a fence, so writing the current frame never waits on one the GPU is
+// still reading. Uses a persistently mapped buffer when `glBufferStorage` is
+// available, otherwise writes into `staging` and orphans the buffer each frame.
+typedef struct d_StreamBuffer {
+  GLuint id;
+  GLenum target;
+  // bytes per frame region
+  size_t frame_size;
+
+  d_uint frame;
+  // bytes used in the current frame region
+  size_t head;
+  // bytes of the current frame already uploaded (orphaning path)
+  size_t flushed;
+
+  bool persistent;
+  char *mapped;
+  char *staging;
+  GLsync fences[D_STREAM_FRAMES];
+} StreamBuffer, d_StreamBuffer;
+
+// `FrameData` block (std140), shared by every program on
+// `D_UNIFORM_BLOCK_FRAME`.
+typedef struct d_FrameData {
+  float view[16];
+  float projection[16];
+  float camera_position[3];
+  float padding_0;
+  float ambient_color[3];
+  float ambient_strength;
+} FrameData, d_FrameData;
+
+// Elements of the `LightData` block (std140), shared by every program on
+// `D_UNIFORM_BLOCK_LIGHTS`.
+typedef struct d_PointLightData {
+  float position[3];
+  float intensity;
+  float color[3];
+  float a;
+  float b;
+  float padding[3];
+} PointLightData, d_PointLightData;
+
+typedef struct d_SpotLightData {
+  float position[3];
+  float intensity;
+  float color[3];
+  float outer_cone_angle;
+  float direction[3];
+  float inner_cone_angle;
+} SpotLightData, d_SpotLightData;
+
+typedef struct d_DirectionalLightData {
+  float position[3];
+  float intensity;
+  float color[3];
+  float padding_0;
+  float direction[3];
+  float padding_1;
+} DirectionalLightData, d_DirectionalLightData;
+
+// directional light cascades, each one a view in the shadow atlas
+#define D_SHADOW_CASCADES 4
+// shadow views (atlas tiles) per frame, shared by cascades and spot lights
+#define D_SHADOW_MAX_VIEWS 16
+
+// `ShadowData` block (std140), shared by every program on
+// `D_UNIFORM_BLOCK_SHADOWS`. Filled by the shadow atlas in ducky_objs.h,
+// zeroed (no shadows) until one renders.
+typedef struct d_ShadowData {
+  // world to shadow clip space per view
+  float matrices[D_SHADOW_MAX_VIEWS][16];
+  // atlas tile per view, uv offset in `xy` and uv scale in `zw`
+  float rects[D_SHADOW_MAX_VIEWS][4];
+  // view space far distance of each cascade
+  float cascade_splits[D_SHADOW_CASCADES];
+  // cascade count, first cascade view, shadowed directional light, unused
+  int info[4];
+} ShadowData, d_ShadowData;
+
+typedef enum d_LightType {
+  DUCKY_LIGHT_POINT,
+  DUCKY_LIGHT_SPOT,
+  DUCKY_LIGHT_DIRECTIONAL
+} LightType,
+    d_LightType;
+
+typedef struct d_Light {
+  d_LightType type;
+  d_Vec3 position;
+  d_Vec3 direction;
+  d_Color color;
+  float intensity;
+  // point light falloff, `1 / (a * d^2 + b * d + 1)`
+  float a;
+  float b;
+  // spot light cone, in radians
+  float inner_cone_angle;
+  float outer_cone_angle;
+  // rendered into the shadow atlas, directional and spot lights only
+  bool cast_shadows;
+  // first shadow atlas view of the light this frame, `-1` for none
+  int shadow_view;
+  // set by the `d_light_set_*` functions, cleared once uploaded
+  bool dirty;
+} Light, d_Light;
+
+typedef struct d_LightManager {
+  // d_Light *, one array per light type so each maps straight onto its
+  // array in the `LightData` block
+  d_Array *point_lights;
+  d_Array *spot_lights;
+  d_Array *directional_lights;
+
+  d_UniformBuffer *buffer;
+  // CPU copy of the `LightData` block
+  char *data;
+  // forces every light to be rewritten on the next upload
+  bool dirty;
+} LightManager, d_LightManager;
+
+typedef enum d_RenderPath {
+  // every light is shaded per fragment while the geometry is drawn
+  DUCKY_RENDER_FORWARD,
+  // opaque geometry goes to a G-buffer first, lights are shaded afterwards
+  // (see d_DeferredRenderer in ducky_objs.h)
+  DUCKY_RENDER_DEFERRED
+} RenderPath,
+    d_RenderPath;
+
 typedef struct d_Renderer {
   d_uint max_directional_lights;
   d_uint max_point_lights;
   d_uint max_spot_lights;
 
   d_Color ambient_color;
+  float ambient_strength;
 
   d_FaceCullingType face_culling;
   bool depth_testing;
@@ -89,6 +254,21 @@ typedef struct d_Renderer {
 
   d_uint shadow_map_size_w;
   d_uint shadow_map_size_h;
+
+  d_RenderPath render_path;
+  // opaque forward draws lay down depth with `depth_shader` first and are then
+  // shaded with `GL_EQUAL`, so each pixel runs the fragment shader once
+  bool depth_prepass;
+  // position-only program of the pre-pass (e.g. assets/shaders/depth_*.glsl),
+  // with an `instanced` variant for instanced runs
+  struct d_Shader *depth_shader;
+
+  // directory linked program binaries are cached in, `NULL` disables caching
+  const char *shader_cache_path;
+
+  d_UniformBuffer *frame_uniforms;
+  d_UniformBuffer *shadow_uniforms;
+  d_LightManager *light_manager;
 } Renderer, d_Renderer;
 
 typedef struct d_VAO {
@@ -106,10 +286,134 @@ typedef struct d_EBO {
   bool bound;
 } EBO, d_EBO;
 
+#define D_GEOMETRY_MAX_ATTRIBS 8
+
+// A free run of vertices or indices in a geometry buffer
+typedef struct d_GeometryBlock {
+  d_uint start;
+  d_uint count;
+} GeometryBlock, d_GeometryBlock;
+
+// Where a mesh lives in a geometry buffer, drawn with
+// `glDrawElementsBaseVertex(..., first_index, base_vertex)`.
+typedef struct d_GeometryRange {
+  d_uint id;
+  d_uint base_vertex;
+  d_uint vertex_count;
+  d_uint first_index;
+  d_uint index_count;
+} GeometryRange, d_GeometryRange;
+
+typedef struct d_VertexAttrib {
+  d_uint location;
+  d_uint size;
+  GLenum type;
+  size_t offset;
+} VertexAttrib, d_VertexAttrib;
+
+// One large vertex and index buffer shared by every mesh with the same vertex
+// layout, so switching meshes does not change any GL state.
+typedef struct d_GeometryBuffer {
+  d_VAO *vao;
+  d_VBO *vbo;
+  d_EBO *ebo;
+
+  // packed copy of each vertex's position for depth-only passes, sharing `ebo`
+  // so the same ranges draw from either array. `NULL` until
+  // `d_geometry_buffer_add_position_stream`.
+  d_VAO *position_vao;
+  d_VBO *position_vbo;
+  size_t position_offset;
+
+  size_t vertex_stride;
+  d_VertexAttrib attribs[D_GEOMETRY_MAX_ATTRIBS];
+  d_uint attrib_count;
+
+  // capacities in vertices and indices
+  d_uint vertex_capacity;
+  d_uint index_capacity;
+
+  // d_GeometryBlock, sorted by start
+  d_Array *free_vertices;
+  d_Array *free_indices;
+
+  d_uint next_id;
+} GeometryBuffer, d_GeometryBuffer;
+
+// An active uniform of a linked program, with the last value uploaded to it
+// so setters can skip uploads that would not change anything.
+typedef struct d_Uniform {
+  char *name;
+  uint64_t hash;
+  GLint location;
+  GLenum type;
+  bool set;
+  union {
+    float f[16];
+    GLint i[4];
+  } value;
+} Uniform, d_Uniform;
+
+typedef enum d_ShaderStatus {
+  DUCKY_SHADER_PENDING,
+  DUCKY_SHADER_READY,
+  DUCKY_SHADER_FAILED
+} ShaderStatus,
+    d_ShaderStatus;
+
 typedef struct d_Shader {
   d_uint id;
+  d_ShaderStatus status;
+  // used in place of this shader while it is not `DUCKY_SHADER_READY`
+  struct d_Shader *fallback;
+  // same program reading the model matrix from per-instance attributes
+  // (e.g. assets/shaders/vertex_instanced.glsl), `NULL` disables instancing
+  struct d_Shader *instanced;
+  // same material writing the G-buffer (e.g. assets/shaders/gbuffer.glsl),
+  // used for opaque draws in `DUCKY_RENDER_DEFERRED`, `NULL` draws forward
+  struct d_Shader *deferred;
+  // lights the program's `object_lights` array holds (four vec4 each), `0`
+  // for programs that use the cluster grid
+  d_uint object_light_count;
+
+  // stages of a program that is still compiling, `0` once finished
+  d_uint vertex_id;
+  d_uint fragment_id;
+  uint64_t cache_key;
+
+  // open addressing table keyed by `d_Uniform.hash`, empty slots have a `NULL`
+  // name. `uniform_capacity` is always a power of two.
+  d_Uniform *uniforms;
+  d_uint uniform_capacity;
+  d_uint uniform_count;
 } Shader, d_Shader;
 
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+typedef struct d_ShaderBatch {
+  d_Renderer *renderer;
+  // d_Shader *, programs that have not been finished yet
+  d_Array *pending;
+  d_Shader *fallback;
+  // `GL_KHR_parallel_shader_compile` (or the ARB version) is available
+  bool parallel;
+} ShaderBatch, d_ShaderBatch;
+
+#define D_SHADER_CACHE_MAGIC 0x4B435544u
+
+// Stored in front of the driver's program binary in each cache file.
+typedef struct d_ShaderCacheHeader {
+  d_uint magic;
+  GLenum format;
+  uint64_t key;
+  uint64_t length;
+} ShaderCacheHeader, d_ShaderCacheHeader;
+
 typedef enum d_TextureBlendMode {
   NEAREST = 0,
   LINEAR = 1
@@ -119,6 +423,8 @@ typedef enum d_TextureBlendMode {
 typedef struct d_Texture {
   d_uint id;
   d_TextureBlendMode blend_mode;
+  // has texels below the 0.1 alpha the fragment shaders discard
+  bool cutout;
 } Texture, d_Texture;
 
 typedef struct d_Material {
@@ -133,8 +439,129 @@ typedef struct d_Material {
   d_uint specular_strength_uniform;
   d_uint color_uniform;
   GLboolean unlit_uniform;
+
+  // unique per material, used to group draws
+  d_uint id;
 } Material, d_Material;
 
+// Offscreen render target: an RGBA8 color texture and a depth-stencil
+// renderbuffer.
+typedef struct d_Framebuffer {
+  GLuint id;
+  GLuint color_texture;
+  GLuint depth_stencil;
+  d_uint width;
+  d_uint height;
+} Framebuffer, d_Framebuffer;
+
+#pragma endregion
+
+#pragma region GL State
+
+#define D_GL_MAX_TEXTURE_UNITS 16
+// shadowed binding whose real value is not known, the next bind is issued
+#define D_GL_STATE_UNKNOWN 0xFFFFFFFFu
+
+// Fixed-function raster state applied together by `d_pipeline_state_apply`.
+// Created once with `d_pipeline_state_create` and not changed afterwards.
+typedef struct d_PipelineState {
+  d_FaceCullingType cull_mode;
+  bool blending;
+  GLenum blend_src;
+  GLenum blend_dst;
+  bool depth_test;
+  bool depth_write;
+  GLenum depth_func;
+  // `GL_FILL`, `GL_LINE` or `GL_POINT`
+  GLenum polygon_mode;
+
+  // unique per created state, `0` for descriptions
+  d_uint id;
+} PipelineState, d_PipelineState;
+
+typedef struct d_GLStateCounters {
+  d_uint calls_issued;
+  d_uint calls_skipped;
+} GLStateCounters, d_GLStateCounters;
+
+// Shadow copy of the bindings of the current context. Binding through the
+// `d_gl_*` functions below skips calls that would not change anything.
+typedef struct d_GLState {
+  GLuint program;
+  GLuint vertex_array;
+  GLuint array_buffer;
+  // part of the vertex array state, unknown after each vertex array change
+  GLuint element_buffer;
+  GLuint uniform_buffer;
+  d_uint active_texture;
+  GLuint textures[D_GL_MAX_TEXTURE_UNITS];
+  // last applied raster state, only valid while `pipeline_known` is true
+  d_PipelineState pipeline;
+  bool pipeline_known;
+
+  d_GLStateCounters counters;
+} GLState, d_GLState;
+
+d_GLState d_gl_state;
+
+/**
+ * @brief Marks every shadowed binding as unknown. Call after binding objects
+ * with raw GL calls or switching contexts.
+ */
+void d_gl_state_reset();
+d_GLStateCounters d_gl_state_get_counters();
+void d_gl_state_reset_counters();
+/**
+ * @brief Updates the shadow for an object that is about to be deleted, so a
+ * new object reusing its name is not skipped.
+ *
+ * @param type `GL_PROGRAM`, `GL_VERTEX_ARRAY`, `GL_BUFFER` or `GL_TEXTURE`.
+ * @param id The object name.
+ */
+void d_gl_state_forget(const GLenum type, const GLuint id);
+
+void d_gl_use_program(const GLuint program);
+void d_gl_bind_vertex_array(const GLuint vertex_array);
+/**
+ * @brief Binds a buffer. `GL_ARRAY_BUFFER`, `GL_ELEMENT_ARRAY_BUFFER` and
+ * `GL_UNIFORM_BUFFER` are shadowed, other targets are always bound.
+ */
+void d_gl_bind_buffer(const GLenum target, const GLuint buffer);
+void d_gl_active_texture(const d_uint unit);
+/**
+ * @brief Binds a `GL_TEXTURE_2D` to a texture unit, only switching the active
+ * unit when the binding actually changes.
+ */
+void d_gl_bind_texture(const d_uint unit, const GLuint texture);
+
+#pragma endregion
+
+#pragma region Pipeline State Functions
+/**
+ * @brief Description of opaque geometry: back face culling, depth test and
+ * write, no blending, filled polygons.
+ */
+d_PipelineState d_pipeline_state_opaque();
+/**
+ * @brief Description of transparent geometry: alpha blending, depth test
+ * without depth write.
+ */
+d_PipelineState d_pipeline_state_transparent();
+/**
+ * @brief Description of a shadow/depth pass: front face culling, depth only.
+ */
+d_PipelineState d_pipeline_state_shadow();
+/**
+ * @brief Creates an immutable copy of `description` with a unique `id`.
+ */
+const d_PipelineState *
+d_pipeline_state_create(const d_PipelineState *description);
+void d_pipeline_state_destroy(const d_PipelineState **state);
+/**
+ * @brief Applies the raster state, only issuing the GL calls for values that
+ * differ from the last applied state.
+ */
+void d_pipeline_state_apply(const d_PipelineState *state);
 #pragma endregion
 
 #pragma region Color Functions
@@ -155,6 +582,8 @@ d_Color d_color(const float r, const float g, const float b, const float a);
  *
  * `ambient_color` - `0.1f, 0.1f, 0.1f, 1.0f`
  *
+ * `ambient_strength` - `0.2f`
+ *
  * `face_culling` - `DUCKY_CULL_BACK`
  *
  * `depth_testing` - `true`
@@ -162,6 +591,12 @@ d_Color d_color(const float r, const float g, const float b, const float a);
  * `blending` - `true`
  *
  * `line_smoothing` - `true`
+ *
+ * `shader_cache_path` - `"cache/shaders"`
+ *
+ * `render_path` - `DUCKY_RENDER_FORWARD`
+ *
+ * `depth_prepass` - `false`
  */
 d_Renderer *d_renderer_create();
 void d_renderer_destroy(d_Renderer **renderer);
@@ -175,8 +610,141 @@ void d_renderer_set_face_culling(d_Renderer *renderer,
 void d_renderer_set_blending(d_Renderer *renderer, const bool enabled);
 void d_renderer_set_depth_testing(d_Renderer *renderer, const bool enabled);
 void d_renderer_set_line_smoothing(d_Renderer *renderer, const bool enabled);
+/**
+ * @brief Sets the directory linked shader programs are cached in.
+ *
+ * @param renderer
+ * @param path Cache directory, created on first save. `NULL` disables the
+ * cache.
+ */
+void d_renderer_set_shader_cache(d_Renderer *renderer, const char *path);
+/**
+ * @brief Switches between forward and deferred shading. Deferred shading
+ * needs a `d_DeferredRenderer` on the render queue and a `deferred` variant
+ * of each opaque shader, anything else is still drawn forward.
+ */
+void d_renderer_set_render_path(d_Renderer *renderer,
+                                const d_RenderPath render_path);
+/**
+ * @brief Enables the depth pre-pass of the render queue. Needs
+ * `renderer->depth_shader`, items drawn forward with a depth writing pipeline
+ * are drawn into depth only first. Materials that discard pixels should not
+ * write depth, their holes would be filled by the pre-pass.
+ */
+void d_renderer_set_depth_prepass(d_Renderer *renderer, const bool enabled);
+/**
+ * @brief Clears the bound framebuffer's color and depth. Depth writes are
+ * turned on first, through the pipeline state shadow.
+ */
 void d_renderer_clear(const d_Color color);
+/**
+ * @brief Uploads the per-frame uniform blocks, call once per frame before
+ * drawing. `FrameData` is written with a single `glBufferSubData`, and only
+ * the lights that changed since the last call are written to `LightData`.
+ *
+ * @param renderer
+ * @param view Camera view matrix.
+ * @param projection Camera projection matrix.
+ * @param camera_position World space camera position.
+ */
+void d_renderer_update_frame(d_Renderer *renderer, const d_Mat4 *view,
+                             const d_Mat4 *projection,
+                             const d_Vec3 camera_position);
+
+#pragma endregion
+
+#pragma region Uniform Buffer Functions
+/**
+ * @brief Creates a uniform buffer of `size` bytes and binds it to uniform
+ * block binding point `binding`.
+ */
+d_UniformBuffer *d_uniform_buffer_create(const size_t size,
+                                         const d_uint binding);
+void d_uniform_buffer_destroy(d_UniformBuffer **buffer);
+/**
+ * @brief Reallocates the buffer storage, discarding its contents.
+ */
+void d_uniform_buffer_resize(d_UniformBuffer *buffer, const size_t size);
+void d_uniform_buffer_update(d_UniformBuffer *buffer, const size_t offset,
+                             const size_t size, const void *data);
+#pragma endregion
+
+#pragma region Stream Buffer Functions
+/**
+ * @brief Creates a stream buffer for `target` with `frame_size` bytes per
+ * frame.
+ */
+d_StreamBuffer *d_stream_buffer_create(const GLenum target,
+                                       const size_t frame_size);
+void d_stream_buffer_destroy(d_StreamBuffer **buffer);
+/**
+ * @brief Moves to the next frame region, waiting for the GPU only if it is
+ * still reading the frame that last used it.
+ */
+void d_stream_buffer_begin_frame(d_StreamBuffer *buffer);
+/**
+ * @brief Reserves `size` bytes aligned to `alignment` in the current frame.
+ *
+ * #### Parameters
+ * - `offset`: receives the byte offset of the reservation in the GL buffer,
+ *   to use as attribute pointer or `glBindBufferRange` offset.
+ *
+ * @return Memory to write the data into, valid until the next flush. NULL if
+ * the frame region is full.
+ */
+void *d_stream_buffer_alloc(d_StreamBuffer *buffer, const size_t size,
+                            const size_t alignment, size_t *offset);
+/**
+ * @brief Makes everything allocated so far visible to the GPU, call before
+ * drawing from it.
+ */
+void d_stream_buffer_flush(d_StreamBuffer *buffer);
+/**
+ * @brief Flushes and fences the current frame region, call after the last draw
+ * that reads from it.
+ */
+void d_stream_buffer_end_frame(d_StreamBuffer *buffer);
+/**
+ * @brief Binds `size` bytes at `offset` to uniform block binding point
+ * `binding`.
+ */
+void d_stream_buffer_bind_uniform(d_StreamBuffer *buffer, const d_uint binding,
+                                  const size_t offset, const size_t size);
+/**
+ * @brief Required alignment of uniform block offsets.
+ */
+size_t d_stream_buffer_uniform_alignment();
+#pragma endregion
 
+#pragma region Light Functions
+d_LightManager *d_light_manager_create();
+void d_light_manager_destroy(d_LightManager **manager);
+/**
+ * @brief Creates a light owned by the manager.
+ *
+ * @return The new light, with a white color, an intensity of `1.0f` and
+ * pointing down `-Y`.
+ */
+d_Light *d_light_manager_add(d_LightManager *manager, const d_LightType type);
+/**
+ * @brief Removes and frees a light created with `d_light_manager_add`.
+ */
+void d_light_manager_remove(d_LightManager *manager, d_Light **light);
+/**
+ * @brief Writes dirty lights to the `LightData` block. Lights beyond the
+ * renderer's `max_*_lights` are not uploaded.
+ */
+void d_light_manager_upload(d_LightManager *manager, d_Renderer *renderer);
+size_t d_light_manager_block_size(d_Renderer *renderer);
+
+void d_light_set_position(d_Light *light, const d_Vec3 position);
+void d_light_set_direction(d_Light *light, const d_Vec3 direction);
+void d_light_set_color(d_Light *light, const d_Color color);
+void d_light_set_intensity(d_Light *light, const float intensity);
+void d_light_set_attenuation(d_Light *light, const float a, const float b);
+void d_light_set_cone(d_Light *light, const float inner_cone_angle,
+                      const float outer_cone_angle);
+void d_light_set_shadows(d_Light *light, const bool cast_shadows);
 #pragma endregion
 
 #pragma region VAO Functions
@@ -241,11 +809,175 @@ void d_ebo_bind(d_EBO *ebo);
 void d_ebo_unbind(d_EBO *ebo);
 #pragma endregion
 
+#pragma region Geometry Buffer Functions
+/**
+ * @brief Creates a geometry buffer for vertices of `vertex_stride` bytes.
+ * Capacities are in vertices and indices, the buffers grow when full.
+ */
+d_GeometryBuffer *d_geometry_buffer_create(const size_t vertex_stride,
+                                           const d_uint vertex_capacity,
+                                           const d_uint index_capacity);
+void d_geometry_buffer_destroy(d_GeometryBuffer **buffer);
+/**
+ * @brief Adds an attribute to the buffer's vertex layout.
+ */
+void d_geometry_buffer_add_attrib(d_GeometryBuffer *buffer,
+                                  const d_uint location, const d_uint size,
+                                  const GLenum type, const size_t offset);
+/**
+ * @brief Keeps a position-only copy of the vertices in `position_vao`
+ * (three floats at location 0), read from the three floats at `offset` in each
+ * vertex. Must be added before the first `d_geometry_buffer_alloc`.
+ */
+void d_geometry_buffer_add_position_stream(d_GeometryBuffer *buffer,
+                                           const size_t offset);
+/**
+ * @brief Uploads a mesh into the first free ranges large enough for it.
+ * `indices` are relative to the mesh's first vertex.
+ *
+ * @return false if the buffer could not grow.
+ */
+bool d_geometry_buffer_alloc(d_GeometryBuffer *buffer, const void *vertices,
+                             const d_uint vertex_count, const d_uint *indices,
+                             const d_uint index_count,
+                             d_GeometryRange *range);
+/**
+ * @brief Returns the range to the free lists, merging it with its neighbours.
+ */
+void d_geometry_buffer_free(d_GeometryBuffer *buffer, d_GeometryRange *range);
+#pragma endregion
+
 #pragma region Shader Functions
+/**
+ * @brief Compiles and links a shader program, or loads it from the program
+ * binary cache when `renderer->shader_cache_path` holds a binary for the same
+ * sources, defines and driver.
+ */
 d_Shader *d_shader_create(d_Renderer *renderer, const char *vertex_file_path,
                           const char *fragment_file_path);
+/**
+ * @brief Like `d_shader_create`, with `defines` (e.g.
+ * `"#define OBJECT_LIGHTS 4\n"`) inserted after the `#version` line of both
+ * stages, to build variants of the same files.
+ */
+d_Shader *d_shader_create_with_defines(d_Renderer *renderer,
+                                       const char *vertex_file_path,
+                                       const char *fragment_file_path,
+                                       const char *defines);
+/**
+ * @brief Whether the driver can save and load program binaries (GL 4.1 or
+ * `GL_ARB_get_program_binary`, with at least one binary format).
+ */
+bool d_shader_cache_supported();
+/**
+ * @brief Hashes the final shader sources, the define set and the GL
+ * vendor/renderer/version strings into a cache key.
+ */
+uint64_t d_shader_cache_key(const char *vertex_source,
+                            const char *fragment_source, const char *defines);
+/**
+ * @brief Loads a cached program binary.
+ *
+ * @return The linked program, or `0` if there is no usable binary for `key`.
+ */
+GLuint d_shader_cache_load(d_Renderer *renderer, uint64_t key);
+/**
+ * @brief Saves the binary of a linked `program` under `key`. The program should
+ * have been linked with `GL_PROGRAM_BINARY_RETRIEVABLE_HINT` set.
+ */
+void d_shader_cache_save(d_Renderer *renderer, uint64_t key, GLuint program);
 void d_shader_destroy(d_Shader **shader);
+/**
+ * @brief Makes the shader the active program. A shader that is still
+ * compiling activates its fallback instead, or nothing if it has none.
+ */
 void d_shader_activate(d_Shader *shader);
+/**
+ * @brief Whether the shader finished compiling and linking successfully.
+ */
+bool d_shader_is_ready(d_Shader *shader);
+/**
+ * @brief The shader that is actually used for `shader`, its fallback while it
+ * is not ready.
+ */
+d_Shader *d_shader_resolve(d_Shader *shader);
+
+/**
+ * @brief Creates a batch that compiles many programs at once. Every program
+ * is submitted to the driver before any status is read back, and with
+ * `GL_KHR_parallel_shader_compile` the status is polled without blocking.
+ *
+ * @param renderer
+ * @param fallback A ready shader that pending shaders activate in their place,
+ * can be `NULL`.
+ */
+d_ShaderBatch *d_shader_batch_create(d_Renderer *renderer, d_Shader *fallback);
+/**
+ * @brief Destroys the batch, the shaders it created are not destroyed. Pending
+ * shaders are finished first.
+ */
+void d_shader_batch_destroy(d_ShaderBatch **batch);
+/**
+ * @brief Starts compiling a program. Programs found in the binary cache are
+ * ready immediately.
+ *
+ * @return The shader, `DUCKY_SHADER_PENDING` until polled as complete.
+ */
+d_Shader *d_shader_batch_add(d_ShaderBatch *batch, const char *vertex_file_path,
+                             const char *fragment_file_path);
+/**
+ * @brief Finishes every program the driver reports as complete, without
+ * blocking. Without parallel compile support every program is finished.
+ *
+ * @return `true` when no programs are pending.
+ */
+bool d_shader_batch_poll(d_ShaderBatch *batch);
+/**
+ * @brief Blocks until every program in the batch is finished.
+ */
+void d_shader_batch_wait(d_ShaderBatch *batch);
+
+/**
+ * @brief Fills the shader's uniform table from `glGetActiveUniform`. Called by
+ * `d_shader_create` after linking. Arrays are added both per element
+ * (`lights[1].pos`, `values[2]`) and by their base name (`values`).
+ */
+void d_shader_load_uniforms(d_Shader *shader);
+/**
+ * @brief Points the program's `FrameData`, `LightData` and `ClusterData`
+ * blocks at their shared binding points, and its cluster samplers at their
+ * texture units. Called by `d_shader_create`.
+ */
+void d_shader_bind_uniform_blocks(d_Shader *shader);
+/**
+ * @brief Looks up an active uniform by name.
+ *
+ * @return The uniform, or `NULL` if the program has no active uniform called
+ * `name`.
+ */
+d_Uniform *d_shader_get_uniform(d_Shader *shader, const char *name);
+/**
+ * @brief Looks up the location of an active uniform by name.
+ *
+ * @return The location, or `-1` when the uniform is not active.
+ */
+GLint d_shader_get_uniform_location(d_Shader *shader, const char *name);
+
+/*
+  Typed uniform setters. The shader must be the active program. A value that
+  matches the one last uploaded through these setters is not uploaded again,
+  and names that are not active uniforms are ignored.
+*/
+void d_shader_set_int(d_Shader *shader, const char *name, const int value);
+void d_shader_set_bool(d_Shader *shader, const char *name, const bool value);
+void d_shader_set_float(d_Shader *shader, const char *name, const float value);
+void d_shader_set_vec2(d_Shader *shader, const char *name, const d_Vec2 value);
+void d_shader_set_vec3(d_Shader *shader, const char *name, const d_Vec3 value);
+void d_shader_set_vec4(d_Shader *shader, const char *name, const d_Vec4 value);
+void d_shader_set_color(d_Shader *shader, const char *name,
+                        const d_Color value);
+void d_shader_set_mat4(d_Shader *shader, const char *name,
+                       const d_Mat4 *value);
 #pragma endregion
 
 #pragma region Texture Functions
@@ -256,7 +988,18 @@ unsigned char *d_texture_custom_data(d_uint width, d_uint height,
 
 d_Texture *d_texture_create(const char *path, d_TextureBlendMode blend_mode);
 void d_texture_destroy(d_Texture **texture);
+/**
+ * @brief Binds the texture on the active texture unit.
+ */
 void d_texture_bind(d_Texture *texture);
+/**
+ * @brief Binds the texture on texture unit `unit` (`0` is `GL_TEXTURE0`).
+ * Nothing is issued if it is already bound there.
+ */
+void d_texture_bind_unit(d_Texture *texture, const d_uint unit);
+/**
+ * @brief Unbinds the texture from every unit it is bound to.
+ */
 void d_texture_unbind(d_Texture *texture);
 
 #pragma endregion
@@ -267,11 +1010,92 @@ d_Material *d_material_create(const char *diffuse_path,
                               const char *specular_path, d_Color color);
 void d_material_destroy(d_Material **material);
 void d_material_get_uniforms(d_Material *material, d_Shader *shader);
+/**
+ * @brief Sets the material's uniforms on the active `shader`, the diffuse and
+ * specular textures are expected on units `0` and `1`.
+ */
+void d_material_set_uniforms(d_Material *material, d_Shader *shader);
 void d_material_bind(d_Material *material);
 void d_material_unbind(d_Material *material);
 
 #pragma endregion
 
+#pragma region Framebuffer Functions
+
+/**
+ * @brief Creates a `width` x `height` render target. Its color texture is
+ * linearly filtered, for sampling or blitting it scaled.
+ */
+d_Framebuffer *d_framebuffer_create(const d_uint width, const d_uint height);
+void d_framebuffer_destroy(d_Framebuffer **framebuffer);
+/**
+ * @brief Reallocates the attachments at a new size, their contents are lost.
+ * Nothing happens if the size is unchanged.
+ */
+void d_framebuffer_resize(d_Framebuffer *framebuffer, const d_uint width,
+                          const d_uint height);
+
+#pragma endregion
+
+#pragma region GPU Profiler Functions
+
+// `GL_TIME_ELAPSED` queries in flight, results are read back frames later
+#define D_PROFILE_GPU_QUERIES 64
+
+typedef struct d_GpuTimerQuery {
+  GLuint id;
+  const char *name;
+  // CPU time the pass was issued at, the GPU event is placed there
+  uint64_t cpu_start;
+  // capture the query was issued in, its result may arrive after it ended
+  d_uint capture;
+  bool pending;
+} GpuTimerQuery, d_GpuTimerQuery;
+
+// Ring of timer queries. Only one `GL_TIME_ELAPSED` query can be active, so
+// GPU scopes do not nest.
+typedef struct d_GpuProfiler {
+  d_GpuTimerQuery queries[D_PROFILE_GPU_QUERIES];
+  d_uint next;
+  // query between `d_gpu_profiler_begin` and `d_gpu_profiler_end`, only
+  // valid while `timing`
+  d_uint active;
+  bool timing;
+  bool created;
+} GpuProfiler, d_GpuProfiler;
+
+d_GpuProfiler d_gpu_profiler;
+
+#ifdef DUCKY_PROFILE
+#define D_PROFILE_GPU_BEGIN(name) d_gpu_profiler_begin(name)
+#define D_PROFILE_GPU_END() d_gpu_profiler_end()
+#else
+#define D_PROFILE_GPU_BEGIN(name)
+#define D_PROFILE_GPU_END()
+#endif
+
+/**
+ * @brief Starts timing the GL commands issued until `d_gpu_profiler_end`.
+ * Does nothing while no capture is running, or when every query is still
+ * waiting for its result.
+ */
+void d_gpu_profiler_begin(const char *name);
+void d_gpu_profiler_end();
+/**
+ * @brief Records the results of finished queries on the
+ * `D_PROFILE_GPU_THREAD` track without waiting on the GPU. Called by
+ * `d_renderer_update_frame`. Results arrive a few frames late, so render a
+ * few more frames after `d_profiler_end_capture` before exporting.
+ */
+void d_gpu_profiler_collect();
+/**
+ * @brief Deletes the queries. Called by `d_renderer_destroy`, while the GL
+ * context still exists.
+ */
+void d_gpu_profiler_destroy();
+
+#pragma endregion
+
 #endif
 
 #ifdef DUCKY_GFX_IMPL
@@ -333,74 +1157,414 @@ bool d_gl_error_internal(const char *message, const char *function,
   return false;
 }
 
-#pragma endregion
-
-#pragma region Color Functions
-d_Color d_color(const float r, const float g, const float b, const float a) {
-  d_Color color;
-  if (r < 0.0f || r > 1.0f) {
-    d_throw_error(DUCKY_WARNING, "Red component out of range (0.0f - 1.0f).");
-    color.r = 0.0f;
-  } else {
-    color.r = r;
-  }
-
-  if (g < 0.0f || g > 1.0f) {
-    d_throw_error(DUCKY_WARNING, "Green component out of range (0.0f - 1.0f).");
-    color.g = 0.0f;
-  } else {
-    color.g = g;
-  }
-
-  if (b < 0.0f || b > 1.0f) {
-    d_throw_error(DUCKY_WARNING, "Blue component out of range (0.0f - 1.0f).");
-    color.b = 0.0f;
-  } else {
-    color.b = b;
+bool d_gl_has_extension(const char *name) {
+  if (name == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "name is NULL.");
+    return false;
   }
 
-  if (a < 0.0f || a > 1.0f) {
-    d_throw_error(DUCKY_WARNING, "Alpha component out of range (0.0f - 1.0f).");
-    color.a = 1.0f;
-  } else {
-    color.a = a;
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; i++) {
+    const char *extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+    if (extension != NULL && strcmp(extension, name) == 0) {
+      return true;
+    }
   }
 
-  return color;
+  return false;
 }
+
 #pragma endregion
 
-#pragma region Renderer Functions
-d_Renderer *d_renderer_create() {
-  d_Renderer *renderer = malloc(sizeof(d_Renderer));
-  if (renderer == NULL) {
-    d_throw_error(DUCKY_MEMORY_FAILURE, "malloc failed.");
-    return NULL;
+#pragma region GL State
+d_GLState d_gl_state = {D_GL_STATE_UNKNOWN,
+                        D_GL_STATE_UNKNOWN,
+                        D_GL_STATE_UNKNOWN,
+                        D_GL_STATE_UNKNOWN,
+                        D_GL_STATE_UNKNOWN,
+                        D_GL_STATE_UNKNOWN,
+                        {D_GL_STATE_UNKNOWN, D_GL_STATE_UNKNOWN,
+                         D_GL_STATE_UNKNOWN, D_GL_STATE_UNKNOWN,
+                         D_GL_STATE_UNKNOWN, D_GL_STATE_UNKNOWN,
+                         D_GL_STATE_UNKNOWN, D_GL_STATE_UNKNOWN,
+                         D_GL_STATE_UNKNOWN, D_GL_STATE_UNKNOWN,
+                         D_GL_STATE_UNKNOWN, D_GL_STATE_UNKNOWN,
+                         D_GL_STATE_UNKNOWN, D_GL_STATE_UNKNOWN,
+                         D_GL_STATE_UNKNOWN, D_GL_STATE_UNKNOWN},
+                        {0},
+                        false,
+                        {0, 0}};
+
+void d_gl_state_reset() {
+  d_gl_state.program = D_GL_STATE_UNKNOWN;
+  d_gl_state.vertex_array = D_GL_STATE_UNKNOWN;
+  d_gl_state.array_buffer = D_GL_STATE_UNKNOWN;
+  d_gl_state.element_buffer = D_GL_STATE_UNKNOWN;
+  d_gl_state.uniform_buffer = D_GL_STATE_UNKNOWN;
+  d_gl_state.active_texture = D_GL_STATE_UNKNOWN;
+  for (int i = 0; i < D_GL_MAX_TEXTURE_UNITS; i++) {
+    d_gl_state.textures[i] = D_GL_STATE_UNKNOWN;
   }
+  d_gl_state.pipeline_known = false;
+}
 
-  renderer->max_directional_lights = 1;
-  renderer->max_point_lights = 8;
-  renderer->max_spot_lights = 8;
+d_GLStateCounters d_gl_state_get_counters() { return d_gl_state.counters; }
 
-  d_renderer_set_ambient_color(renderer, d_color(0.1f, 0.1f, 0.1f, 1.0f));
-  d_renderer_set_face_culling(renderer, DUCKY_CULL_BACK);
-  d_renderer_set_blending(renderer, true);
-  d_renderer_set_depth_testing(renderer, true);
-  d_renderer_set_line_smoothing(renderer, true);
+void d_gl_state_reset_counters() {
+  d_gl_state.counters.calls_issued = 0;
+  d_gl_state.counters.calls_skipped = 0;
+}
 
-  return renderer;
+void d_gl_state_forget(const GLenum type, const GLuint id) {
+  switch (type) {
+  case GL_PROGRAM:
+    // a deleted program stays in use until another one is, and its name can
+    // be handed out again, so the binding can no longer be trusted.
+    if (d_gl_state.program == id)
+      d_gl_state.program = D_GL_STATE_UNKNOWN;
+    break;
+  case GL_VERTEX_ARRAY:
+    if (d_gl_state.vertex_array == id) {
+      d_gl_state.vertex_array = 0;
+      d_gl_state.element_buffer = D_GL_STATE_UNKNOWN;
+    }
+    break;
+  case GL_BUFFER:
+    // deleting a bound buffer reverts the binding to 0
+    if (d_gl_state.array_buffer == id)
+      d_gl_state.array_buffer = 0;
+    if (d_gl_state.element_buffer == id)
+      d_gl_state.element_buffer = 0;
+    if (d_gl_state.uniform_buffer == id)
+      d_gl_state.uniform_buffer = 0;
+    break;
+  case GL_TEXTURE:
+    for (int i = 0; i < D_GL_MAX_TEXTURE_UNITS; i++) {
+      if (d_gl_state.textures[i] == id)
+        d_gl_state.textures[i] = 0;
+    }
+    break;
+  default:
+    d_throw_error(DUCKY_WARNING, "Unknown object type.");
+    break;
+  }
 }
 
-void d_renderer_destroy(d_Renderer **renderer) {
-  if (renderer == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "renderer (d_Renderer **) is NULL.");
+void d_gl_use_program(const GLuint program) {
+  if (d_gl_state.program == program) {
+    d_gl_state.counters.calls_skipped++;
     return;
   }
-  if (*renderer == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "renderer (d_Renderer *) is NULL.");
+
+  glUseProgram(program);
+  d_gl_state.program = program;
+  d_gl_state.counters.calls_issued++;
+}
+
+void d_gl_bind_vertex_array(const GLuint vertex_array) {
+  if (d_gl_state.vertex_array == vertex_array) {
+    d_gl_state.counters.calls_skipped++;
+    return;
+  }
+
+  glBindVertexArray(vertex_array);
+  d_gl_state.vertex_array = vertex_array;
+  d_gl_state.element_buffer = D_GL_STATE_UNKNOWN;
+  d_gl_state.counters.calls_issued++;
+}
+
+void d_gl_bind_buffer(const GLenum target, const GLuint buffer) {
+  GLuint *shadow = NULL;
+  switch (target) {
+  case GL_ARRAY_BUFFER:
+    shadow = &d_gl_state.array_buffer;
+    break;
+  case GL_ELEMENT_ARRAY_BUFFER:
+    shadow = &d_gl_state.element_buffer;
+    break;
+  case GL_UNIFORM_BUFFER:
+    shadow = &d_gl_state.uniform_buffer;
+    break;
+  default:
+    break;
+  }
+
+  if (shadow != NULL && *shadow == buffer) {
+    d_gl_state.counters.calls_skipped++;
+    return;
+  }
+
+  glBindBuffer(target, buffer);
+  if (shadow != NULL)
+    *shadow = buffer;
+  d_gl_state.counters.calls_issued++;
+}
+
+void d_gl_active_texture(const d_uint unit) {
+  if (unit >= D_GL_MAX_TEXTURE_UNITS) {
+    d_throw_error(DUCKY_INDEX_OUT_OF_BOUNDS, "Texture unit out of range.");
+    return;
+  }
+
+  if (d_gl_state.active_texture == unit) {
+    d_gl_state.counters.calls_skipped++;
+    return;
+  }
+
+  glActiveTexture(GL_TEXTURE0 + unit);
+  d_gl_state.active_texture = unit;
+  d_gl_state.counters.calls_issued++;
+}
+
+void d_gl_bind_texture(const d_uint unit, const GLuint texture) {
+  if (unit >= D_GL_MAX_TEXTURE_UNITS) {
+    d_throw_error(DUCKY_INDEX_OUT_OF_BOUNDS, "Texture unit out of range.");
+    return;
+  }
+
+  if (d_gl_state.textures[unit] == texture) {
+    d_gl_state.counters.calls_skipped++;
+    return;
+  }
+
+  d_gl_active_texture(unit);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  d_gl_state.textures[unit] = texture;
+  d_gl_state.counters.calls_issued++;
+}
+
+#pragma endregion
+
+#pragma region Pipeline State Functions
+d_PipelineState d_pipeline_state_opaque() {
+  d_PipelineState state;
+  state.cull_mode = DUCKY_CULL_BACK;
+  state.blending = false;
+  state.blend_src = GL_SRC_ALPHA;
+  state.blend_dst = GL_ONE_MINUS_SRC_ALPHA;
+  state.depth_test = true;
+  state.depth_write = true;
+  state.depth_func = GL_LESS;
+  state.polygon_mode = GL_FILL;
+  state.id = 0;
+  return state;
+}
+
+d_PipelineState d_pipeline_state_transparent() {
+  d_PipelineState state = d_pipeline_state_opaque();
+  state.blending = true;
+  state.depth_write = false;
+  return state;
+}
+
+d_PipelineState d_pipeline_state_shadow() {
+  d_PipelineState state = d_pipeline_state_opaque();
+  state.cull_mode = DUCKY_CULL_FRONT;
+  return state;
+}
+
+const d_PipelineState *
+d_pipeline_state_create(const d_PipelineState *description) {
+  static d_uint next_id = 1;
+
+  if (description == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "description is NULL.");
+    return NULL;
+  }
+
+  d_PipelineState *state = malloc(sizeof(d_PipelineState));
+  if (state == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "malloc failed.");
+    return NULL;
+  }
+
+  *state = *description;
+  state->id = next_id++;
+  return state;
+}
+
+void d_pipeline_state_destroy(const d_PipelineState **state) {
+  if (state == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "state (d_PipelineState **) is NULL.");
+    return;
+  }
+  if (*state == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "state (d_PipelineState *) is NULL.");
+    return;
+  }
+
+  free((d_PipelineState *)*state);
+  *state = NULL;
+}
+
+void d_pipeline_state_apply(const d_PipelineState *state) {
+  if (state == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "state is NULL.");
+    return;
+  }
+
+  const d_PipelineState *current =
+      d_gl_state.pipeline_known == true ? &d_gl_state.pipeline : NULL;
+  d_uint issued = 0;
+
+  bool cull_was_enabled =
+      current != NULL && current->cull_mode != DUCKY_CULL_NONE;
+  if (state->cull_mode == DUCKY_CULL_NONE) {
+    if (current == NULL || cull_was_enabled) {
+      glDisable(GL_CULL_FACE);
+      issued++;
+    }
+  } else {
+    if (current == NULL || cull_was_enabled == false) {
+      glEnable(GL_CULL_FACE);
+      issued++;
+    }
+    if (current == NULL || current->cull_mode != state->cull_mode) {
+      glCullFace(state->cull_mode == DUCKY_CULL_FRONT ? GL_FRONT : GL_BACK);
+      issued++;
+    }
+  }
+
+  if (current == NULL || current->blending != state->blending) {
+    if (state->blending == true) {
+      glEnable(GL_BLEND);
+    } else {
+      glDisable(GL_BLEND);
+    }
+    issued++;
+  }
+  // the blend function is only kept up to date while blending is enabled, so
+  // it is issued again whenever blending gets turned on
+  if (state->blending == true &&
+      (current == NULL || current->blending == false ||
+       current->blend_src != state->blend_src ||
+       current->blend_dst != state->blend_dst)) {
+    glBlendFunc(state->blend_src, state->blend_dst);
+    issued++;
+  }
+
+  if (current == NULL || current->depth_test != state->depth_test) {
+    if (state->depth_test == true) {
+      glEnable(GL_DEPTH_TEST);
+    } else {
+      glDisable(GL_DEPTH_TEST);
+    }
+    issued++;
+  }
+  if (current == NULL || current->depth_write != state->depth_write) {
+    glDepthMask(state->depth_write == true ? GL_TRUE : GL_FALSE);
+    issued++;
+  }
+  if (current == NULL || current->depth_func != state->depth_func) {
+    glDepthFunc(state->depth_func);
+    issued++;
+  }
+
+  if (current == NULL || current->polygon_mode != state->polygon_mode) {
+    glPolygonMode(GL_FRONT_AND_BACK, state->polygon_mode);
+    issued++;
+  }
+
+  d_gl_state.counters.calls_issued += issued;
+  if (issued == 0) {
+    d_gl_state.counters.calls_skipped++;
+  }
+
+  d_gl_state.pipeline = *state;
+  d_gl_state.pipeline_known = true;
+}
+#pragma endregion
+
+#pragma region Color Functions
+d_Color d_color(const float r, const float g, const float b, const float a) {
+  d_Color color;
+  if (r < 0.0f || r > 1.0f) {
+    d_throw_error(DUCKY_WARNING, "Red component out of range (0.0f - 1.0f).");
+    color.r = 0.0f;
+  } else {
+    color.r = r;
+  }
+
+  if (g < 0.0f || g > 1.0f) {
+    d_throw_error(DUCKY_WARNING, "Green component out of range (0.0f - 1.0f).");
+    color.g = 0.0f;
+  } else {
+    color.g = g;
+  }
+
+  if (b < 0.0f || b > 1.0f) {
+    d_throw_error(DUCKY_WARNING, "Blue component out of range (0.0f - 1.0f).");
+    color.b = 0.0f;
+  } else {
+    color.b = b;
+  }
+
+  if (a < 0.0f || a > 1.0f) {
+    d_throw_error(DUCKY_WARNING, "Alpha component out of range (0.0f - 1.0f).");
+    color.a = 1.0f;
+  } else {
+    color.a = a;
+  }
+
+  return color;
+}
+#pragma endregion
+
+#pragma region Renderer Functions
+d_Renderer *d_renderer_create() {
+  d_Renderer *renderer = malloc(sizeof(d_Renderer));
+  if (renderer == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "malloc failed.");
+    return NULL;
+  }
+
+  renderer->max_directional_lights = 1;
+  renderer->max_point_lights = 8;
+  renderer->max_spot_lights = 8;
+  renderer->shader_cache_path = "cache/shaders";
+  renderer->ambient_strength = 0.2f;
+  renderer->shadow_map_size_w = 4096;
+  renderer->shadow_map_size_h = 4096;
+  renderer->render_path = DUCKY_RENDER_FORWARD;
+  renderer->depth_prepass = false;
+  renderer->depth_shader = NULL;
+  renderer->frame_uniforms =
+      d_uniform_buffer_create(sizeof(d_FrameData), D_UNIFORM_BLOCK_FRAME);
+
+  // programs read the block even when nothing casts shadows
+  d_ShadowData shadows = {0};
+  renderer->shadow_uniforms =
+      d_uniform_buffer_create(sizeof(d_ShadowData), D_UNIFORM_BLOCK_SHADOWS);
+  d_uniform_buffer_update(renderer->shadow_uniforms, 0, sizeof(shadows),
+                          &shadows);
+  renderer->light_manager = d_light_manager_create();
+
+  d_renderer_set_ambient_color(renderer, d_color(0.1f, 0.1f, 0.1f, 1.0f));
+  d_renderer_set_face_culling(renderer, DUCKY_CULL_BACK);
+  d_renderer_set_blending(renderer, true);
+  d_renderer_set_depth_testing(renderer, true);
+  d_renderer_set_line_smoothing(renderer, true);
+
+  return renderer;
+}
+
+void d_renderer_destroy(d_Renderer **renderer) {
+  if (renderer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "renderer (d_Renderer **) is NULL.");
+    return;
+  }
+  if (*renderer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "renderer (d_Renderer *) is NULL.");
     return;
   }
 
+  d_uniform_buffer_destroy(&(*renderer)->frame_uniforms);
+  d_uniform_buffer_destroy(&(*renderer)->shadow_uniforms);
+  d_light_manager_destroy(&(*renderer)->light_manager);
+  d_gpu_profiler_destroy();
+
   free(*renderer);
   *renderer = NULL;
 }
@@ -417,6 +1581,11 @@ void d_renderer_set_max_lights(d_Renderer *renderer,
   renderer->max_directional_lights = max_directional_lights;
   renderer->max_point_lights = max_point_lights;
   renderer->max_spot_lights = max_spot_lights;
+
+  // the LightData block layout depends on the maximums
+  if (renderer->light_manager != NULL) {
+    renderer->light_manager->dirty = true;
+  }
 }
 
 void d_renderer_set_ambient_color(d_Renderer *renderer, const d_Color color) {
@@ -453,6 +1622,8 @@ void d_renderer_set_face_culling(d_Renderer *renderer,
     glCullFace(GL_BACK);
     break;
   }
+  // changed behind the pipeline state shadow's back
+  d_gl_state.pipeline_known = false;
 }
 
 void d_renderer_set_blending(d_Renderer *renderer, bool enabled) {
@@ -467,6 +1638,7 @@ void d_renderer_set_blending(d_Renderer *renderer, bool enabled) {
   } else {
     glDisable(GL_BLEND);
   }
+  d_gl_state.pipeline_known = false;
 }
 
 void d_renderer_set_depth_testing(d_Renderer *renderer, const bool enabled) {
@@ -480,6 +1652,7 @@ void d_renderer_set_depth_testing(d_Renderer *renderer, const bool enabled) {
   } else {
     glDisable(GL_DEPTH_TEST);
   }
+  d_gl_state.pipeline_known = false;
 }
 
 void d_renderer_set_line_smoothing(d_Renderer *renderer, const bool enabled) {
@@ -495,278 +1668,1923 @@ void d_renderer_set_line_smoothing(d_Renderer *renderer, const bool enabled) {
   }
 }
 
+void d_renderer_set_shader_cache(d_Renderer *renderer, const char *path) {
+  if (renderer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "renderer is NULL.");
+    return;
+  }
+  renderer->shader_cache_path = path;
+}
+
+void d_renderer_set_render_path(d_Renderer *renderer,
+                                const d_RenderPath render_path) {
+  if (renderer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "renderer is NULL.");
+    return;
+  }
+  renderer->render_path = render_path;
+}
+
+void d_renderer_set_depth_prepass(d_Renderer *renderer, const bool enabled) {
+  if (renderer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "renderer is NULL.");
+    return;
+  }
+  renderer->depth_prepass = enabled;
+}
+
 void d_renderer_clear(const d_Color color) {
+  // depth is only cleared while depth writes are on, passes like occlusion
+  // queries or depth-equal shading leave them off
+  if (d_gl_state.pipeline_known == false ||
+      d_gl_state.pipeline.depth_write == false) {
+    glDepthMask(GL_TRUE);
+    d_gl_state.pipeline.depth_write = true;
+  }
   glClearColor(color.r, color.g, color.b, color.a);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
+
+void d_renderer_update_frame(d_Renderer *renderer, const d_Mat4 *view,
+                             const d_Mat4 *projection,
+                             const d_Vec3 camera_position) {
+  if (renderer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "renderer is NULL.");
+    return;
+  }
+  if (view == NULL || projection == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "view or projection is NULL.");
+    return;
+  }
+
+  d_FrameData frame;
+  memcpy(frame.view, view->data, sizeof(frame.view));
+  memcpy(frame.projection, projection->data, sizeof(frame.projection));
+  memcpy(frame.camera_position, camera_position.data,
+         sizeof(frame.camera_position));
+  frame.padding_0 = 0.0f;
+  memcpy(frame.ambient_color, renderer->ambient_color.data,
+         sizeof(frame.ambient_color));
+  frame.ambient_strength = renderer->ambient_strength;
+
+  d_uniform_buffer_update(renderer->frame_uniforms, 0, sizeof(frame), &frame);
+  d_light_manager_upload(renderer->light_manager, renderer);
+
+  // once per frame, so the results of earlier frames are in by now
+  d_gpu_profiler_collect();
+}
 #pragma endregion
 
-#pragma region VAO Functions
-d_VAO *d_vao_create() {
-  d_VAO *vao = malloc(sizeof(d_VAO));
-  if (vao == NULL) {
+#pragma region Uniform Buffer Functions
+d_UniformBuffer *d_uniform_buffer_create(const size_t size,
+                                         const d_uint binding) {
+  d_UniformBuffer *buffer = malloc(sizeof(d_UniformBuffer));
+  if (buffer == NULL) {
     d_throw_error(DUCKY_MEMORY_FAILURE, "malloc failed.");
     return NULL;
   }
-  glGenVertexArrays(1, &vao->id);
-  return vao;
+
+  buffer->binding = binding;
+  buffer->size = 0;
+  glGenBuffers(1, &buffer->id);
+  d_uniform_buffer_resize(buffer, size);
+
+  return buffer;
 }
 
-void d_vao_destroy(d_VAO **vao) {
-  if (vao == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "vao (d_VAO **) is NULL.");
+void d_uniform_buffer_destroy(d_UniformBuffer **buffer) {
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "buffer (d_UniformBuffer **) is NULL.");
     return;
   }
-  if (*vao == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "vao (d_VAO *) is NULL.");
+  if (*buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer (d_UniformBuffer *) is NULL.");
     return;
   }
-  glDeleteVertexArrays(1, &(*vao)->id);
-  free(*vao);
-  *vao = NULL;
-}
 
-void d_vao_bind(d_VAO *vao) {
-  if (vao == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "vao is NULL.");
-    return;
-  }
-  glBindVertexArray(vao->id);
-  vao->bound = true;
+  d_gl_state_forget(GL_BUFFER, (*buffer)->id);
+  glDeleteBuffers(1, &(*buffer)->id);
+  free(*buffer);
+  *buffer = NULL;
 }
 
-void d_vao_unbind(d_VAO *vao) {
-  if (vao == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "vao is NULL.");
+void d_uniform_buffer_resize(d_UniformBuffer *buffer, const size_t size) {
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer is NULL.");
     return;
   }
-  glBindVertexArray(0);
-  vao->bound = false;
+
+  d_gl_bind_buffer(GL_UNIFORM_BUFFER, buffer->id);
+  glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, buffer->binding, buffer->id);
+  buffer->size = size;
+  d_gl_error("Failed to allocate uniform buffer ");
 }
 
-void d_vao_link_attrib(const d_VAO *vao, const d_VBO *vbo, const d_uint layout,
-                       const d_uint size, const d_uint type,
-                       const d_uint stride, const void *offset) {
-  if (vao == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "(d_vao_link_attrib) vao is NULL.");
+void d_uniform_buffer_update(d_UniformBuffer *buffer, const size_t offset,
+                             const size_t size, const void *data) {
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer is NULL.");
     return;
   }
-  if (vbo == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "(d_vao_link_attrib) vbo is NULL.");
+  if (offset + size > buffer->size) {
+    d_throw_error(DUCKY_INDEX_OUT_OF_BOUNDS,
+                  "Update is larger than the uniform buffer.");
+    return;
   }
-  // bind vbo
-  glVertexAttribPointer(layout, size, type, GL_FALSE, stride, offset);
-  glEnableVertexAttribArray(layout);
-  // unbind vbo
+
+  d_gl_bind_buffer(GL_UNIFORM_BUFFER, buffer->id);
+  glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
 }
 #pragma endregion
 
-#pragma region VBO Functions
-d_VBO *d_vbo_create(const float *vertices, const size_t size) {
-  d_VBO *vbo = malloc(sizeof(d_VBO));
-  if (vbo == NULL) {
+#pragma region Stream Buffer Functions
+d_StreamBuffer *d_stream_buffer_create(const GLenum target,
+                                       const size_t frame_size) {
+  d_StreamBuffer *buffer = malloc(sizeof(d_StreamBuffer));
+  if (buffer == NULL) {
     d_throw_error(DUCKY_MEMORY_FAILURE, "malloc failed.");
     return NULL;
   }
-  glGenBuffers(1, &vbo->id);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo->id);
-  glBufferData(GL_ARRAY_BUFFER, size, vertices, GL_STATIC_DRAW);
-  return vbo;
+
+  buffer->target = target;
+  buffer->frame_size = frame_size;
+  buffer->frame = 0;
+  buffer->head = 0;
+  buffer->flushed = 0;
+  buffer->mapped = NULL;
+  buffer->staging = NULL;
+  for (d_uint i = 0; i < D_STREAM_FRAMES; i++) {
+    buffer->fences[i] = NULL;
+  }
+
+  // glBufferStorage is only loaded when the context is 4.4 or newer
+  buffer->persistent = glBufferStorage != NULL;
+
+  glGenBuffers(1, &buffer->id);
+  d_gl_bind_buffer(GL_COPY_WRITE_BUFFER, buffer->id);
+  if (buffer->persistent == true) {
+    GLbitfield flags =
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_COPY_WRITE_BUFFER, frame_size * D_STREAM_FRAMES, NULL,
+                    flags);
+    buffer->mapped = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0,
+                                      frame_size * D_STREAM_FRAMES, flags);
+    if (buffer->mapped == NULL) {
+      // drivers may expose glBufferStorage but refuse the mapping, start over
+      // with a buffer that can be orphaned
+      d_gl_state_forget(GL_BUFFER, buffer->id);
+      glDeleteBuffers(1, &buffer->id);
+      glGenBuffers(1, &buffer->id);
+      d_gl_bind_buffer(GL_COPY_WRITE_BUFFER, buffer->id);
+      buffer->persistent = false;
+    }
+  }
+  if (buffer->persistent == false) {
+    glBufferData(GL_COPY_WRITE_BUFFER, frame_size, NULL, GL_STREAM_DRAW);
+    buffer->staging = malloc(frame_size);
+    if (buffer->staging == NULL) {
+      d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc staging.");
+    }
+  }
+  d_gl_bind_buffer(GL_COPY_WRITE_BUFFER, 0);
+
+  return buffer;
 }
 
-void d_vbo_destroy(d_VBO **vbo) {
-  if (vbo == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "vbo (d_VBO **) is NULL.");
+void d_stream_buffer_destroy(d_StreamBuffer **buffer) {
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer (d_StreamBuffer **) is NULL.");
     return;
   }
-  if (*vbo == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "vbo (d_VBO *) is NULL.");
+  if (*buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer (d_StreamBuffer *) is NULL.");
     return;
   }
-  glDeleteBuffers(1, &(*vbo)->id);
-  free(*vbo);
-  *vbo = NULL;
+
+  for (d_uint i = 0; i < D_STREAM_FRAMES; i++) {
+    if ((*buffer)->fences[i] != NULL) {
+      glDeleteSync((*buffer)->fences[i]);
+    }
+  }
+  if ((*buffer)->mapped != NULL) {
+    d_gl_bind_buffer(GL_COPY_WRITE_BUFFER, (*buffer)->id);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    d_gl_bind_buffer(GL_COPY_WRITE_BUFFER, 0);
+  }
+  d_gl_state_forget(GL_BUFFER, (*buffer)->id);
+  glDeleteBuffers(1, &(*buffer)->id);
+  free((*buffer)->staging);
+  free(*buffer);
+  *buffer = NULL;
+}
+
+void d_stream_buffer_begin_frame(d_StreamBuffer *buffer) {
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer is NULL.");
+    return;
+  }
+
+  buffer->head = 0;
+  buffer->flushed = 0;
+
+  if (buffer->persistent == false) {
+    // orphaning gives the driver a fresh allocation, the GPU keeps reading
+    // the old one
+    d_gl_bind_buffer(GL_COPY_WRITE_BUFFER, buffer->id);
+    glBufferData(GL_COPY_WRITE_BUFFER, buffer->frame_size, NULL,
+                 GL_STREAM_DRAW);
+    d_gl_bind_buffer(GL_COPY_WRITE_BUFFER, 0);
+    return;
+  }
+
+  buffer->frame = (buffer->frame + 1) % D_STREAM_FRAMES;
+  GLsync fence = buffer->fences[buffer->frame];
+  if (fence == NULL) {
+    return;
+  }
+
+  GLenum result = glClientWaitSync(fence, 0, 0);
+  while (result == GL_TIMEOUT_EXPIRED) {
+    // only reached when the CPU is D_STREAM_FRAMES frames ahead
+    result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+  }
+  if (result == GL_WAIT_FAILED) {
+    d_throw_error(DUCKY_FAILURE, "Waiting on stream buffer fence failed.");
+  }
+  glDeleteSync(fence);
+  buffer->fences[buffer->frame] = NULL;
+}
+
+void *d_stream_buffer_alloc(d_StreamBuffer *buffer, const size_t size,
+                            const size_t alignment, size_t *offset) {
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer is NULL.");
+    return NULL;
+  }
+  if (offset == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "offset is NULL.");
+    return NULL;
+  }
+
+  size_t base = buffer->persistent == true
+                    ? (size_t)buffer->frame * buffer->frame_size
+                    : 0;
+  size_t start = buffer->head;
+  if (alignment > 1) {
+    // alignment is relative to the GL buffer, regions start at any offset
+    size_t absolute = base + start;
+    absolute = (absolute + alignment - 1) / alignment * alignment;
+    start = absolute - base;
+  }
+  if (start + size > buffer->frame_size) {
+    return NULL;
+  }
+
+  buffer->head = start + size;
+  *offset = base + start;
+  if (buffer->persistent == true) {
+    return buffer->mapped + base + start;
+  }
+  if (buffer->staging == NULL) {
+    return NULL;
+  }
+  return buffer->staging + start;
+}
+
+void d_stream_buffer_flush(d_StreamBuffer *buffer) {
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer is NULL.");
+    return;
+  }
+  // the persistent mapping is coherent, nothing to do
+  if (buffer->persistent == true || buffer->head == buffer->flushed) {
+    return;
+  }
+
+  d_gl_bind_buffer(GL_COPY_WRITE_BUFFER, buffer->id);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, buffer->flushed,
+                  buffer->head - buffer->flushed,
+                  buffer->staging + buffer->flushed);
+  d_gl_bind_buffer(GL_COPY_WRITE_BUFFER, 0);
+  buffer->flushed = buffer->head;
+}
+
+void d_stream_buffer_end_frame(d_StreamBuffer *buffer) {
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer is NULL.");
+    return;
+  }
+
+  d_stream_buffer_flush(buffer);
+  if (buffer->persistent == true) {
+    if (buffer->fences[buffer->frame] != NULL) {
+      glDeleteSync(buffer->fences[buffer->frame]);
+    }
+    buffer->fences[buffer->frame] =
+        glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+}
+
+void d_stream_buffer_bind_uniform(d_StreamBuffer *buffer, const d_uint binding,
+                                  const size_t offset, const size_t size) {
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer is NULL.");
+    return;
+  }
+
+  glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer->id, offset, size);
+  // glBindBufferRange also binds the generic GL_UNIFORM_BUFFER target
+  d_gl_state.uniform_buffer = buffer->id;
+}
+
+size_t d_stream_buffer_uniform_alignment() {
+  static GLint alignment = 0;
+  if (alignment == 0) {
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    if (alignment <= 0)
+      alignment = 256;
+  }
+  return (size_t)alignment;
+}
+
+#pragma endregion
+
+#pragma region Light Functions
+d_LightManager *d_light_manager_create() {
+  d_LightManager *manager = malloc(sizeof(d_LightManager));
+  if (manager == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "malloc failed.");
+    return NULL;
+  }
+
+  manager->point_lights = d_array_create(d_Light *, 8);
+  manager->spot_lights = d_array_create(d_Light *, 8);
+  manager->directional_lights = d_array_create(d_Light *, 1);
+  manager->buffer = NULL;
+  manager->data = NULL;
+  manager->dirty = true;
+
+  return manager;
+}
+
+void d_light_manager_destroy(d_LightManager **manager) {
+  if (manager == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "manager (d_LightManager **) is NULL.");
+    return;
+  }
+  if (*manager == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "manager (d_LightManager *) is NULL.");
+    return;
+  }
+
+  d_Array *arrays[3] = {(*manager)->point_lights, (*manager)->spot_lights,
+                        (*manager)->directional_lights};
+  for (int i = 0; i < 3; i++) {
+    for (size_t j = 0; j < arrays[i]->length; j++) {
+      free(d_array_get(arrays[i], d_Light *, j));
+    }
+    d_array_destroy(&arrays[i]);
+  }
+
+  if ((*manager)->buffer != NULL) {
+    d_uniform_buffer_destroy(&(*manager)->buffer);
+  }
+  free((*manager)->data);
+  free(*manager);
+  *manager = NULL;
+}
+
+d_Array *d_light_manager_get_array_internal(d_LightManager *manager,
+                                            const d_LightType type) {
+  switch (type) {
+  case DUCKY_LIGHT_SPOT:
+    return manager->spot_lights;
+  case DUCKY_LIGHT_DIRECTIONAL:
+    return manager->directional_lights;
+  case DUCKY_LIGHT_POINT:
+  default:
+    return manager->point_lights;
+  }
+}
+
+d_Light *d_light_manager_add(d_LightManager *manager, const d_LightType type) {
+  if (manager == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "manager is NULL.");
+    return NULL;
+  }
+
+  d_Light *light = malloc(sizeof(d_Light));
+  if (light == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "malloc failed.");
+    return NULL;
+  }
+
+  light->type = type;
+  light->position = d_vec3(0.0f, 0.0f, 0.0f);
+  light->direction = d_vec3(0.0f, -1.0f, 0.0f);
+  light->color = d_color(1.0f, 1.0f, 1.0f, 1.0f);
+  light->intensity = 1.0f;
+  light->a = 0.05f;
+  light->b = 0.01f;
+  light->inner_cone_angle = d_to_radians(25.0f);
+  light->outer_cone_angle = d_to_radians(30.0f);
+  light->cast_shadows = false;
+  light->shadow_view = -1;
+  light->dirty = true;
+
+  d_array_add(d_light_manager_get_array_internal(manager, type), &light);
+  // the count changed
+  manager->dirty = true;
+
+  return light;
+}
+
+void d_light_manager_remove(d_LightManager *manager, d_Light **light) {
+  if (manager == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "manager is NULL.");
+    return;
+  }
+  if (light == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "light (d_Light **) is NULL.");
+    return;
+  }
+  if (*light == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "light (d_Light *) is NULL.");
+    return;
+  }
+
+  d_Array *lights = d_light_manager_get_array_internal(manager, (*light)->type);
+  for (size_t i = 0; i < lights->length; i++) {
+    if (d_array_get(lights, d_Light *, i) == *light) {
+      d_array_remove(lights, i);
+      // every light after it moved down a slot
+      manager->dirty = true;
+      free(*light);
+      *light = NULL;
+      return;
+    }
+  }
+
+  d_throw_error(DUCKY_WARNING, "light is not owned by this manager.");
+}
+
+size_t d_light_manager_block_size(d_Renderer *renderer) {
+  return sizeof(int) * 4 +
+         renderer->max_point_lights * sizeof(d_PointLightData) +
+         renderer->max_spot_lights * sizeof(d_SpotLightData) +
+         renderer->max_directional_lights * sizeof(d_DirectionalLightData);
+}
+
+void d_light_write_internal(const d_Light *light, char *destination) {
+  switch (light->type) {
+  case DUCKY_LIGHT_SPOT: {
+    d_SpotLightData data;
+    memcpy(data.position, light->position.data, sizeof(data.position));
+    memcpy(data.color, light->color.data, sizeof(data.color));
+    memcpy(data.direction, light->direction.data, sizeof(data.direction));
+    data.intensity = light->intensity;
+    data.inner_cone_angle = light->inner_cone_angle;
+    data.outer_cone_angle = light->outer_cone_angle;
+    memcpy(destination, &data, sizeof(data));
+    break;
+  }
+  case DUCKY_LIGHT_DIRECTIONAL: {
+    d_DirectionalLightData data = {0};
+    memcpy(data.position, light->position.data, sizeof(data.position));
+    memcpy(data.color, light->color.data, sizeof(data.color));
+    memcpy(data.direction, light->direction.data, sizeof(data.direction));
+    data.intensity = light->intensity;
+    memcpy(destination, &data, sizeof(data));
+    break;
+  }
+  case DUCKY_LIGHT_POINT:
+  default: {
+    d_PointLightData data = {0};
+    memcpy(data.position, light->position.data, sizeof(data.position));
+    memcpy(data.color, light->color.data, sizeof(data.color));
+    data.intensity = light->intensity;
+    data.a = light->a;
+    data.b = light->b;
+    memcpy(destination, &data, sizeof(data));
+    break;
+  }
+  }
+}
+
+void d_light_manager_upload(d_LightManager *manager, d_Renderer *renderer) {
+  if (manager == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "manager is NULL.");
+    return;
+  }
+  if (renderer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "renderer is NULL.");
+    return;
+  }
+
+  size_t size = d_light_manager_block_size(renderer);
+  if (manager->buffer == NULL || manager->buffer->size != size) {
+    char *data = realloc(manager->data, size);
+    if (data == NULL) {
+      d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to realloc light data.");
+      return;
+    }
+    manager->data = data;
+    memset(manager->data, 0, size);
+
+    if (manager->buffer == NULL) {
+      manager->buffer = d_uniform_buffer_create(size, D_UNIFORM_BLOCK_LIGHTS);
+    } else {
+      d_uniform_buffer_resize(manager->buffer, size);
+    }
+    manager->dirty = true;
+  }
+
+  d_Array *arrays[3] = {manager->point_lights, manager->spot_lights,
+                        manager->directional_lights};
+  d_uint maximums[3] = {renderer->max_point_lights, renderer->max_spot_lights,
+                        renderer->max_directional_lights};
+  size_t strides[3] = {sizeof(d_PointLightData), sizeof(d_SpotLightData),
+                       sizeof(d_DirectionalLightData)};
+
+  // only the byte range covering dirty lights is uploaded
+  size_t dirty_start = size;
+  size_t dirty_end = 0;
+
+  if (manager->dirty == true) {
+    int *counts = (int *)manager->data;
+    for (int i = 0; i < 3; i++) {
+      counts[i] = arrays[i]->length < maximums[i] ? arrays[i]->length
+                                                  : maximums[i];
+    }
+    dirty_start = 0;
+    dirty_end = sizeof(int) * 4;
+  }
+
+  size_t offset = sizeof(int) * 4;
+  for (int i = 0; i < 3; i++) {
+    for (size_t j = 0; j < arrays[i]->length && j < maximums[i]; j++) {
+      d_Light *light = d_array_get(arrays[i], d_Light *, j);
+      if (light->dirty == false && manager->dirty == false) {
+        continue;
+      }
+
+      size_t light_offset = offset + j * strides[i];
+      d_light_write_internal(light, manager->data + light_offset);
+      light->dirty = false;
+
+      if (light_offset < dirty_start)
+        dirty_start = light_offset;
+      if (light_offset + strides[i] > dirty_end)
+        dirty_end = light_offset + strides[i];
+    }
+    offset += maximums[i] * strides[i];
+  }
+  manager->dirty = false;
+
+  if (dirty_start < dirty_end) {
+    d_uniform_buffer_update(manager->buffer, dirty_start,
+                            dirty_end - dirty_start,
+                            manager->data + dirty_start);
+  }
+}
+
+void d_light_set_position(d_Light *light, const d_Vec3 position) {
+  if (light == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "light is NULL.");
+    return;
+  }
+  light->position = position;
+  light->dirty = true;
+}
+
+void d_light_set_direction(d_Light *light, const d_Vec3 direction) {
+  if (light == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "light is NULL.");
+    return;
+  }
+  light->direction = d_vec3_normalized(&direction);
+  light->dirty = true;
+}
+
+void d_light_set_color(d_Light *light, const d_Color color) {
+  if (light == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "light is NULL.");
+    return;
+  }
+  light->color = color;
+  light->dirty = true;
+}
+
+void d_light_set_intensity(d_Light *light, const float intensity) {
+  if (light == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "light is NULL.");
+    return;
+  }
+  light->intensity = intensity;
+  light->dirty = true;
+}
+
+void d_light_set_attenuation(d_Light *light, const float a, const float b) {
+  if (light == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "light is NULL.");
+    return;
+  }
+  light->a = a;
+  light->b = b;
+  light->dirty = true;
+}
+
+void d_light_set_cone(d_Light *light, const float inner_cone_angle,
+                      const float outer_cone_angle) {
+  if (light == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "light is NULL.");
+    return;
+  }
+  light->inner_cone_angle = inner_cone_angle;
+  light->outer_cone_angle = outer_cone_angle;
+  light->dirty = true;
+}
+
+void d_light_set_shadows(d_Light *light, const bool cast_shadows) {
+  if (light == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "light is NULL.");
+    return;
+  }
+  light->cast_shadows = cast_shadows;
+  light->dirty = true;
+}
+#pragma endregion
+
+#pragma region VAO Functions
+d_VAO *d_vao_create() {
+  d_VAO *vao = malloc(sizeof(d_VAO));
+  if (vao == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "malloc failed.");
+    return NULL;
+  }
+  glGenVertexArrays(1, &vao->id);
+  return vao;
+}
+
+void d_vao_destroy(d_VAO **vao) {
+  if (vao == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "vao (d_VAO **) is NULL.");
+    return;
+  }
+  if (*vao == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "vao (d_VAO *) is NULL.");
+    return;
+  }
+  d_gl_state_forget(GL_VERTEX_ARRAY, (*vao)->id);
+  glDeleteVertexArrays(1, &(*vao)->id);
+  free(*vao);
+  *vao = NULL;
+}
+
+void d_vao_bind(d_VAO *vao) {
+  if (vao == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "vao is NULL.");
+    return;
+  }
+  d_gl_bind_vertex_array(vao->id);
+  vao->bound = true;
+}
+
+void d_vao_unbind(d_VAO *vao) {
+  if (vao == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "vao is NULL.");
+    return;
+  }
+  d_gl_bind_vertex_array(0);
+  vao->bound = false;
+}
+
+void d_vao_link_attrib(const d_VAO *vao, const d_VBO *vbo, const d_uint layout,
+                       const d_uint size, const d_uint type,
+                       const d_uint stride, const void *offset) {
+  if (vao == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "(d_vao_link_attrib) vao is NULL.");
+    return;
+  }
+  if (vbo == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "(d_vao_link_attrib) vbo is NULL.");
+  }
+  // bind vbo
+  glVertexAttribPointer(layout, size, type, GL_FALSE, stride, offset);
+  glEnableVertexAttribArray(layout);
+  // unbind vbo
+}
+#pragma endregion
+
+#pragma region VBO Functions
+d_VBO *d_vbo_create(const float *vertices, const size_t size) {
+  d_VBO *vbo = malloc(sizeof(d_VBO));
+  if (vbo == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "malloc failed.");
+    return NULL;
+  }
+  glGenBuffers(1, &vbo->id);
+  d_gl_bind_buffer(GL_ARRAY_BUFFER, vbo->id);
+  glBufferData(GL_ARRAY_BUFFER, size, vertices, GL_STATIC_DRAW);
+  return vbo;
+}
+
+void d_vbo_destroy(d_VBO **vbo) {
+  if (vbo == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "vbo (d_VBO **) is NULL.");
+    return;
+  }
+  if (*vbo == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "vbo (d_VBO *) is NULL.");
+    return;
+  }
+  d_gl_state_forget(GL_BUFFER, (*vbo)->id);
+  glDeleteBuffers(1, &(*vbo)->id);
+  free(*vbo);
+  *vbo = NULL;
+}
+
+void d_vbo_bind(d_VBO *vbo) {}
+void d_vbo_unbind(d_VBO *vbo);
+#pragma endregion
+
+#pragma region EBO Functions
+d_EBO *d_ebo_create(const d_uint *indices, const size_t size) {
+  d_EBO *ebo = malloc(sizeof(d_EBO));
+  if (ebo == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "malloc failed.");
+    return NULL;
+  }
+  glGenBuffers(1, &ebo->id);
+  d_gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ebo->id);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, indices, GL_STATIC_DRAW);
+  return ebo;
+}
+
+void d_ebo_destroy(d_EBO **ebo) {
+  if (ebo == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "ebo (d_EBO **) is NULL.");
+    return;
+  }
+  if (*ebo == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "ebo (d_EBO *) is NULL.");
+    return;
+  }
+
+  d_gl_state_forget(GL_BUFFER, (*ebo)->id);
+  glDeleteBuffers(1, &(*ebo)->id);
+  free(*ebo);
+  *ebo = NULL;
+}
+
+void d_ebo_bind(d_EBO *ebo) {
+  if (ebo == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "ebo is NULL.");
+    return;
+  }
+  d_gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ebo->id);
+  ebo->bound = true;
+}
+
+void d_ebo_unbind(d_EBO *ebo) {
+  if (ebo == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "ebo is NULL.");
+    return;
+  }
+  d_gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  ebo->bound = false;
+}
+
+#pragma endregion
+
+#pragma region Geometry Buffer Functions
+d_GeometryBuffer *d_geometry_buffer_create(const size_t vertex_stride,
+                                           const d_uint vertex_capacity,
+                                           const d_uint index_capacity) {
+  d_GeometryBuffer *buffer = malloc(sizeof(d_GeometryBuffer));
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "malloc failed.");
+    return NULL;
+  }
+
+  buffer->vertex_stride = vertex_stride;
+  buffer->attrib_count = 0;
+  buffer->vertex_capacity = vertex_capacity > 0 ? vertex_capacity : 1;
+  buffer->index_capacity = index_capacity > 0 ? index_capacity : 1;
+  buffer->next_id = 1;
+  buffer->position_vao = NULL;
+  buffer->position_vbo = NULL;
+  buffer->position_offset = 0;
+
+  buffer->free_vertices = d_array_create(d_GeometryBlock, 16);
+  buffer->free_indices = d_array_create(d_GeometryBlock, 16);
+  d_GeometryBlock vertex_block = {0, buffer->vertex_capacity};
+  d_GeometryBlock index_block = {0, buffer->index_capacity};
+  d_array_add(buffer->free_vertices, &vertex_block);
+  d_array_add(buffer->free_indices, &index_block);
+
+  buffer->vao = d_vao_create();
+  d_vao_bind(buffer->vao);
+  buffer->vbo =
+      d_vbo_create(NULL, (size_t)buffer->vertex_capacity * vertex_stride);
+  buffer->ebo =
+      d_ebo_create(NULL, (size_t)buffer->index_capacity * sizeof(d_uint));
+  d_vao_unbind(buffer->vao);
+
+  return buffer;
+}
+
+void d_geometry_buffer_destroy(d_GeometryBuffer **buffer) {
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "buffer (d_GeometryBuffer **) is NULL.");
+    return;
+  }
+  if (*buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer (d_GeometryBuffer *) is NULL.");
+    return;
+  }
+
+  d_vao_destroy(&(*buffer)->vao);
+  d_vbo_destroy(&(*buffer)->vbo);
+  d_ebo_destroy(&(*buffer)->ebo);
+  if ((*buffer)->position_vao != NULL) {
+    d_vao_destroy(&(*buffer)->position_vao);
+    d_vbo_destroy(&(*buffer)->position_vbo);
+  }
+  d_array_destroy(&(*buffer)->free_vertices);
+  d_array_destroy(&(*buffer)->free_indices);
+  free(*buffer);
+  *buffer = NULL;
+}
+
+void d_geometry_buffer_link_internal(d_GeometryBuffer *buffer) {
+  d_vao_bind(buffer->vao);
+  d_gl_bind_buffer(GL_ARRAY_BUFFER, buffer->vbo->id);
+  for (d_uint i = 0; i < buffer->attrib_count; i++) {
+    d_VertexAttrib *attrib = &buffer->attribs[i];
+    d_vao_link_attrib(buffer->vao, buffer->vbo, attrib->location, attrib->size,
+                      attrib->type, buffer->vertex_stride,
+                      (void *)(uintptr_t)attrib->offset);
+  }
+  d_vao_unbind(buffer->vao);
+
+  if (buffer->position_vao != NULL) {
+    d_vao_bind(buffer->position_vao);
+    d_gl_bind_buffer(GL_ARRAY_BUFFER, buffer->position_vbo->id);
+    d_vao_link_attrib(buffer->position_vao, buffer->position_vbo, 0, 3,
+                      GL_FLOAT, 3 * sizeof(float), (void *)0);
+    d_vao_unbind(buffer->position_vao);
+  }
+}
+
+void d_geometry_buffer_add_attrib(d_GeometryBuffer *buffer,
+                                  const d_uint location, const d_uint size,
+                                  const GLenum type, const size_t offset) {
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer is NULL.");
+    return;
+  }
+  if (buffer->attrib_count >= D_GEOMETRY_MAX_ATTRIBS) {
+    d_throw_error(DUCKY_FAILURE, "Too many vertex attributes.");
+    return;
+  }
+
+  d_VertexAttrib *attrib = &buffer->attribs[buffer->attrib_count++];
+  attrib->location = location;
+  attrib->size = size;
+  attrib->type = type;
+  attrib->offset = offset;
+  d_geometry_buffer_link_internal(buffer);
+}
+
+void d_geometry_buffer_add_position_stream(d_GeometryBuffer *buffer,
+                                           const size_t offset) {
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer is NULL.");
+    return;
+  }
+  if (buffer->position_vao != NULL) {
+    return;
+  }
+  // the positions of uploaded meshes are only on the GPU
+  if (buffer->free_vertices->length != 1 ||
+      d_array_get(buffer->free_vertices, d_GeometryBlock, 0).count !=
+          buffer->vertex_capacity) {
+    d_throw_error(DUCKY_FAILURE,
+                  "Position stream added after vertices were uploaded.");
+    return;
+  }
+
+  buffer->position_offset = offset;
+  buffer->position_vao = d_vao_create();
+  d_vao_bind(buffer->position_vao);
+  buffer->position_vbo =
+      d_vbo_create(NULL, (size_t)buffer->vertex_capacity * 3 * sizeof(float));
+  d_ebo_bind(buffer->ebo);
+  d_vao_unbind(buffer->position_vao);
+  d_geometry_buffer_link_internal(buffer);
+}
+
+// First fit, returns the start of the taken run or -1.
+int64_t d_geometry_take_internal(d_Array *free_list, const d_uint count) {
+  d_GeometryBlock *blocks = (d_GeometryBlock *)free_list->data;
+  for (size_t i = 0; i < free_list->length; i++) {
+    if (blocks[i].count < count) {
+      continue;
+    }
+
+    d_uint start = blocks[i].start;
+    blocks[i].start += count;
+    blocks[i].count -= count;
+    if (blocks[i].count == 0) {
+      d_array_remove(free_list, i);
+    }
+    return start;
+  }
+  return -1;
+}
+
+void d_geometry_give_internal(d_Array *free_list, const d_uint start,
+                              const d_uint count) {
+  if (count == 0) {
+    return;
+  }
+
+  d_GeometryBlock *blocks = (d_GeometryBlock *)free_list->data;
+  size_t i = 0;
+  while (i < free_list->length && blocks[i].start < start) {
+    i++;
+  }
+
+  bool merge_previous =
+      i > 0 && blocks[i - 1].start + blocks[i - 1].count == start;
+  bool merge_next = i < free_list->length && start + count == blocks[i].start;
+
+  if (merge_previous == true && merge_next == true) {
+    blocks[i - 1].count += count + blocks[i].count;
+    d_array_remove(free_list, i);
+  } else if (merge_previous == true) {
+    blocks[i - 1].count += count;
+  } else if (merge_next == true) {
+    blocks[i].start = start;
+    blocks[i].count += count;
+  } else {
+    d_GeometryBlock block = {start, count};
+    d_array_add(free_list, &block);
+    // keep the list sorted, the new block belongs at i
+    blocks = (d_GeometryBlock *)free_list->data;
+    memmove(&blocks[i + 1], &blocks[i],
+            (free_list->length - 1 - i) * sizeof(d_GeometryBlock));
+    blocks[i] = block;
+  }
+}
+
+// Copies the contents of `*id` into a new buffer of `new_size` bytes.
+void d_geometry_grow_internal(GLuint *id, const size_t old_size,
+                              const size_t new_size) {
+  GLuint grown;
+  glGenBuffers(1, &grown);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+  glBufferData(GL_COPY_WRITE_BUFFER, new_size, NULL, GL_STATIC_DRAW);
+  glBindBuffer(GL_COPY_READ_BUFFER, *id);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                      old_size);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  d_gl_state_forget(GL_BUFFER, *id);
+  glDeleteBuffers(1, id);
+  *id = grown;
+}
+
+bool d_geometry_buffer_alloc(d_GeometryBuffer *buffer, const void *vertices,
+                             const d_uint vertex_count, const d_uint *indices,
+                             const d_uint index_count,
+                             d_GeometryRange *range) {
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer is NULL.");
+    return false;
+  }
+  if (range == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "range is NULL.");
+    return false;
+  }
+
+  int64_t base_vertex =
+      d_geometry_take_internal(buffer->free_vertices, vertex_count);
+  if (base_vertex < 0) {
+    d_uint old_capacity = buffer->vertex_capacity;
+    d_uint capacity = old_capacity * 2;
+    while (capacity - old_capacity < vertex_count)
+      capacity *= 2;
+
+    d_geometry_grow_internal(&buffer->vbo->id,
+                             (size_t)old_capacity * buffer->vertex_stride,
+                             (size_t)capacity * buffer->vertex_stride);
+    if (buffer->position_vbo != NULL) {
+      d_geometry_grow_internal(&buffer->position_vbo->id,
+                               (size_t)old_capacity * 3 * sizeof(float),
+                               (size_t)capacity * 3 * sizeof(float));
+    }
+    buffer->vertex_capacity = capacity;
+    d_geometry_give_internal(buffer->free_vertices, old_capacity,
+                             capacity - old_capacity);
+    // the attribute pointers still source the old buffer
+    d_geometry_buffer_link_internal(buffer);
+
+    base_vertex = d_geometry_take_internal(buffer->free_vertices, vertex_count);
+    if (base_vertex < 0) {
+      d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to grow vertex buffer.");
+      return false;
+    }
+  }
+
+  int64_t first_index =
+      d_geometry_take_internal(buffer->free_indices, index_count);
+  if (first_index < 0) {
+    d_uint old_capacity = buffer->index_capacity;
+    d_uint capacity = old_capacity * 2;
+    while (capacity - old_capacity < index_count)
+      capacity *= 2;
+
+    d_geometry_grow_internal(&buffer->ebo->id,
+                             (size_t)old_capacity * sizeof(d_uint),
+                             (size_t)capacity * sizeof(d_uint));
+    buffer->index_capacity = capacity;
+    d_geometry_give_internal(buffer->free_indices, old_capacity,
+                             capacity - old_capacity);
+    // the element buffer binding is part of the vertex array
+    d_vao_bind(buffer->vao);
+    d_ebo_bind(buffer->ebo);
+    d_vao_unbind(buffer->vao);
+    if (buffer->position_vao != NULL) {
+      d_vao_bind(buffer->position_vao);
+      d_ebo_bind(buffer->ebo);
+      d_vao_unbind(buffer->position_vao);
+    }
+
+    first_index = d_geometry_take_internal(buffer->free_indices, index_count);
+    if (first_index < 0) {
+      d_geometry_give_internal(buffer->free_vertices, (d_uint)base_vertex,
+                               vertex_count);
+      d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to grow index buffer.");
+      return false;
+    }
+  }
+
+  d_gl_bind_buffer(GL_ARRAY_BUFFER, buffer->vbo->id);
+  glBufferSubData(GL_ARRAY_BUFFER,
+                  (GLintptr)base_vertex * buffer->vertex_stride,
+                  (GLsizeiptr)vertex_count * buffer->vertex_stride, vertices);
+  if (buffer->position_vbo != NULL && vertex_count > 0) {
+    float *positions = malloc((size_t)vertex_count * 3 * sizeof(float));
+    if (positions == NULL) {
+      d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc positions.");
+    } else {
+      const char *source = (const char *)vertices + buffer->position_offset;
+      for (d_uint i = 0; i < vertex_count; i++) {
+        memcpy(&positions[i * 3], source + (size_t)i * buffer->vertex_stride,
+               3 * sizeof(float));
+      }
+      d_gl_bind_buffer(GL_ARRAY_BUFFER, buffer->position_vbo->id);
+      glBufferSubData(GL_ARRAY_BUFFER,
+                      (GLintptr)base_vertex * 3 * sizeof(float),
+                      (GLsizeiptr)vertex_count * 3 * sizeof(float), positions);
+      free(positions);
+    }
+  }
+  // uploading through GL_ELEMENT_ARRAY_BUFFER would change whichever vertex
+  // array is bound
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer->ebo->id);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)first_index * sizeof(d_uint),
+                  (GLsizeiptr)index_count * sizeof(d_uint), indices);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  range->id = buffer->next_id++;
+  range->base_vertex = (d_uint)base_vertex;
+  range->vertex_count = vertex_count;
+  range->first_index = (d_uint)first_index;
+  range->index_count = index_count;
+  return true;
+}
+
+void d_geometry_buffer_free(d_GeometryBuffer *buffer, d_GeometryRange *range) {
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer is NULL.");
+    return;
+  }
+  if (range == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "range is NULL.");
+    return;
+  }
+
+  d_geometry_give_internal(buffer->free_vertices, range->base_vertex,
+                           range->vertex_count);
+  d_geometry_give_internal(buffer->free_indices, range->first_index,
+                           range->index_count);
+  range->vertex_count = 0;
+  range->index_count = 0;
+}
+
+#pragma endregion
+
+#pragma region Shader Functions
+bool d_shader_cache_supported() {
+  if (glProgramBinary == NULL || glGetProgramBinary == NULL) {
+    return false;
+  }
+
+  GLint format_count = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+  return format_count > 0;
+}
+
+uint64_t d_shader_cache_key(const char *vertex_source,
+                            const char *fragment_source, const char *defines) {
+  uint64_t key = D_HASH_SEED;
+  key = d_hash(vertex_source, strlen(vertex_source) + 1, key);
+  key = d_hash(fragment_source, strlen(fragment_source) + 1, key);
+  if (defines != NULL) {
+    key = d_hash(defines, strlen(defines) + 1, key);
+  }
+
+  // a binary is only valid for the driver that produced it
+  const char *driver_strings[3] = {(const char *)glGetString(GL_VENDOR),
+                                   (const char *)glGetString(GL_RENDERER),
+                                   (const char *)glGetString(GL_VERSION)};
+  for (int i = 0; i < 3; i++) {
+    if (driver_strings[i] != NULL) {
+      key = d_hash(driver_strings[i], strlen(driver_strings[i]) + 1, key);
+    }
+  }
+
+  return key;
+}
+
+char *d_shader_cache_path_internal(d_Renderer *renderer, uint64_t key) {
+  char file_name[32];
+  snprintf(file_name, sizeof(file_name), "/%016llx.bin",
+           (unsigned long long)key);
+  return d_str_append(renderer->shader_cache_path, file_name);
+}
+
+GLuint d_shader_cache_load(d_Renderer *renderer, uint64_t key) {
+  if (renderer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "renderer is NULL.");
+    return 0;
+  }
+  if (renderer->shader_cache_path == NULL || !d_shader_cache_supported()) {
+    return 0;
+  }
+
+  char *path = d_shader_cache_path_internal(renderer, key);
+  if (d_is_path_valid(path) == false) {
+    free(path);
+    return 0;
+  }
+
+  d_File *file = d_file_read(path);
+  free(path);
+  if (file == NULL) {
+    return 0;
+  }
+
+  d_ShaderCacheHeader header;
+  if (file->size < sizeof(header)) {
+    d_file_destroy(&file);
+    return 0;
+  }
+  memcpy(&header, file->data, sizeof(header));
+
+  if (header.magic != D_SHADER_CACHE_MAGIC || header.key != key ||
+      header.length != file->size - sizeof(header)) {
+    d_file_destroy(&file);
+    return 0;
+  }
+
+  GLuint program = glCreateProgram();
+  glProgramBinary(program, header.format, file->data + sizeof(header),
+                  (GLsizei)header.length);
+  d_file_destroy(&file);
+
+  // the driver rejects binaries it can no longer use (e.g. after an update),
+  // that is not an error, the caller just compiles from source again.
+  GLint success = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  if (success == GL_FALSE) {
+    glDeleteProgram(program);
+    while (glGetError() != GL_NO_ERROR) {
+    }
+    return 0;
+  }
+
+  return program;
+}
+
+void d_shader_cache_save(d_Renderer *renderer, uint64_t key, GLuint program) {
+  if (renderer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "renderer is NULL.");
+    return;
+  }
+  if (renderer->shader_cache_path == NULL || !d_shader_cache_supported()) {
+    return;
+  }
+
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return;
+  }
+
+  char *data = malloc(sizeof(d_ShaderCacheHeader) + length);
+  if (data == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc data.");
+    return;
+  }
+
+  d_ShaderCacheHeader header;
+  header.magic = D_SHADER_CACHE_MAGIC;
+  header.key = key;
+  glGetProgramBinary(program, length, &length, &header.format,
+                     data + sizeof(header));
+  header.length = length;
+  memcpy(data, &header, sizeof(header));
+
+  if (d_gl_error("Failed to get program binary ") == true ||
+      d_make_directory(renderer->shader_cache_path) == false) {
+    free(data);
+    return;
+  }
+
+  char *path = d_shader_cache_path_internal(renderer, key);
+  d_File file = {data, path, sizeof(header) + length};
+  d_file_save(&file);
+
+  free(path);
+  free(data);
+}
+
+d_Shader *d_shader_alloc_internal() {
+  d_Shader *shader = malloc(sizeof(d_Shader));
+
+  if (shader == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "malloc failed.");
+    return NULL;
+  }
+  shader->id = 0;
+  shader->uniforms = NULL;
+  shader->uniform_capacity = 0;
+  shader->uniform_count = 0;
+  shader->status = DUCKY_SHADER_PENDING;
+  shader->fallback = NULL;
+  shader->instanced = NULL;
+  shader->deferred = NULL;
+  shader->object_light_count = 0;
+  shader->vertex_id = 0;
+  shader->fragment_id = 0;
+  shader->cache_key = 0;
+
+  return shader;
+}
+
+// Reads both stages and applies the renderer's light defines and `defines`
+// (can be `NULL`). The files must be destroyed by the caller.
+void d_shader_read_sources_internal(d_Renderer *renderer,
+                                    const char *vertex_file_path,
+                                    const char *fragment_file_path,
+                                    const char *defines,
+                                    d_File **vertex_shader,
+                                    d_File **fragment_shader,
+                                    uint64_t *cache_key) {
+  *fragment_shader = d_file_read(fragment_file_path);
+  if (*fragment_shader == NULL) {
+    d_throw_error(DUCKY_FAILURE, "Failed to read fragment shader.");
+
+    d_core_shutdown();
+  }
+
+  *vertex_shader = d_file_read(vertex_file_path);
+  if (*vertex_shader == NULL) {
+    d_throw_error(DUCKY_FAILURE, "Failed to read vertex shader.");
+
+    d_core_shutdown();
+  }
+
+  char *number = malloc(sizeof(char) * 4);
+  if (number == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc number.");
+  }
+
+  sprintf(number, "%d", renderer->max_point_lights);
+  char *res = d_str_append("#define MAX_POINT_LIGHTS ", number);
+  (*fragment_shader)->data = d_str_replace((*fragment_shader)->data,
+                                           "#define MAX_POINT_LIGHTS 8", res);
+
+  sprintf(number, "%d", renderer->max_spot_lights);
+  res = d_str_append("#define MAX_SPOT_LIGHTS ", number);
+  (*fragment_shader)->data = d_str_replace((*fragment_shader)->data,
+                                           "#define MAX_SPOT_LIGHTS 8", res);
+
+  sprintf(number, "%d", renderer->max_directional_lights);
+  res = d_str_append("#define MAX_DIRECTIONAL_LIGHTS ", number);
+  (*fragment_shader)->data = d_str_replace(
+      (*fragment_shader)->data, "#define MAX_DIRECTIONAL_LIGHTS 1", res);
+
+  free(number);
+  free(res);
+
+  // `#version` has to stay the first line
+  if (defines != NULL && defines[0] != '\0') {
+    char *version = d_str_append("#version 330 core\n", defines);
+    d_File *files[2] = {*vertex_shader, *fragment_shader};
+    for (int i = 0; i < 2; i++) {
+      char *data =
+          d_str_replace(files[i]->data, "#version 330 core\n", version);
+      if (data != NULL) {
+        free(files[i]->data);
+        files[i]->data = data;
+      }
+    }
+    free(version);
+  }
+
+  // the extra defines are part of the sources, so they are hashed anyway
+  char light_defines[128];
+  snprintf(light_defines, sizeof(light_defines), "%u;%u;%u",
+           renderer->max_point_lights, renderer->max_spot_lights,
+           renderer->max_directional_lights);
+
+  *cache_key = d_shader_cache_key((*vertex_shader)->data,
+                                  (*fragment_shader)->data, light_defines);
+}
+
+// Issues the compile and link commands without reading any status back, so
+// drivers with background compiler threads can work on several programs.
+void d_shader_submit_internal(d_Renderer *renderer, d_Shader *shader,
+                              const char *vert_src, const char *frag_src) {
+  shader->vertex_id = glCreateShader(GL_VERTEX_SHADER);
+  glShaderSource(shader->vertex_id, 1, &vert_src, NULL);
+  glCompileShader(shader->vertex_id);
+
+  shader->fragment_id = glCreateShader(GL_FRAGMENT_SHADER);
+  glShaderSource(shader->fragment_id, 1, &frag_src, NULL);
+  glCompileShader(shader->fragment_id);
+
+  shader->id = glCreateProgram();
+  glAttachShader(shader->id, shader->vertex_id);
+  glAttachShader(shader->id, shader->fragment_id);
+
+  if (renderer->shader_cache_path != NULL && d_shader_cache_supported()) {
+    glProgramParameteri(shader->id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                        GL_TRUE);
+  }
+
+  glLinkProgram(shader->id);
+}
+
+// Checks the results of `d_shader_submit_internal`, this blocks until the
+// driver is done with the program.
+bool d_shader_finish_internal(d_Renderer *renderer, d_Shader *shader) {
+  bool success = true;
+  if (d_check_shader_compile(shader->vertex_id, "VERTEX_SHADER") == -1) {
+    d_throw_error(DUCKY_FAILURE, "Failed to compile vertex shader.");
+    success = false;
+  } else if (d_check_shader_compile(shader->fragment_id, "FRAGMENT_SHADER") ==
+             -1) {
+    d_throw_error(DUCKY_FAILURE, "Failed to compile fragment shader.");
+    success = false;
+  } else if (d_check_shader_link(shader->id) == -1) {
+    d_throw_error(DUCKY_FAILURE, "Failed to link shader program.");
+    success = false;
+  } else if (glIsProgram(shader->id) == GL_FALSE) {
+    d_throw_error(DUCKY_FAILURE, "Shader progam is NOT valid!");
+    success = false;
+  }
+
+  glDetachShader(shader->id, shader->vertex_id);
+  glDetachShader(shader->id, shader->fragment_id);
+  glDeleteShader(shader->vertex_id);
+  glDeleteShader(shader->fragment_id);
+  shader->vertex_id = 0;
+  shader->fragment_id = 0;
+
+  if (success == false) {
+    glDeleteProgram(shader->id);
+    shader->id = 0;
+    shader->status = DUCKY_SHADER_FAILED;
+    return false;
+  }
+
+  d_shader_cache_save(renderer, shader->cache_key, shader->id);
+  d_shader_load_uniforms(shader);
+  d_shader_bind_uniform_blocks(shader);
+  shader->status = DUCKY_SHADER_READY;
+  return true;
+}
+
+// Creates the shader and either loads it from the cache (ready) or submits it
+// for compilation (pending).
+d_Shader *d_shader_begin_internal(d_Renderer *renderer,
+                                  const char *vertex_file_path,
+                                  const char *fragment_file_path,
+                                  const char *defines) {
+  if (renderer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "renderer is NULL.");
+    return NULL;
+  }
+
+  d_Shader *shader = d_shader_alloc_internal();
+  if (shader == NULL) {
+    return NULL;
+  }
+
+  d_File *vertex_shader;
+  d_File *fragment_shader;
+  d_shader_read_sources_internal(renderer, vertex_file_path, fragment_file_path,
+                                 defines, &vertex_shader, &fragment_shader,
+                                 &shader->cache_key);
+
+  shader->id = d_shader_cache_load(renderer, shader->cache_key);
+  if (shader->id != 0) {
+    d_shader_load_uniforms(shader);
+    d_shader_bind_uniform_blocks(shader);
+    shader->status = DUCKY_SHADER_READY;
+  } else {
+    d_shader_submit_internal(renderer, shader, vertex_shader->data,
+                             fragment_shader->data);
+  }
+
+  d_file_destroy(&vertex_shader);
+  d_file_destroy(&fragment_shader);
+  return shader;
+}
+
+d_Shader *d_shader_create(d_Renderer *renderer, const char *vertex_file_path,
+                          const char *fragment_file_path) {
+  return d_shader_create_with_defines(renderer, vertex_file_path,
+                                      fragment_file_path, NULL);
+}
+
+d_Shader *d_shader_create_with_defines(d_Renderer *renderer,
+                                       const char *vertex_file_path,
+                                       const char *fragment_file_path,
+                                       const char *defines) {
+  D_PROFILE_SCOPE("d_shader_create");
+  d_Shader *shader = d_shader_begin_internal(renderer, vertex_file_path,
+                                             fragment_file_path, defines);
+  if (shader == NULL) {
+    return NULL;
+  }
+
+  if (shader->status == DUCKY_SHADER_PENDING &&
+      d_shader_finish_internal(renderer, shader) == false) {
+    free(shader);
+    return NULL;
+  }
+
+  return shader;
+}
+void d_shader_destroy(d_Shader **shader) {
+  if (shader == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "shader (d_Shader **) is NULL.");
+    return;
+  }
+  if (*shader == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "shader (d_Shader *) is NULL.");
+    return;
+  }
+
+  if ((*shader)->vertex_id != 0) {
+    glDeleteShader((*shader)->vertex_id);
+  }
+  if ((*shader)->fragment_id != 0) {
+    glDeleteShader((*shader)->fragment_id);
+  }
+  if ((*shader)->id != 0) {
+    d_gl_state_forget(GL_PROGRAM, (*shader)->id);
+    glDeleteProgram((*shader)->id);
+  }
+
+  for (d_uint i = 0; i < (*shader)->uniform_capacity; i++) {
+    free((*shader)->uniforms[i].name);
+  }
+  free((*shader)->uniforms);
+
+  free(*shader);
+  *shader = NULL;
+}
+
+d_Shader *d_shader_resolve(d_Shader *shader) {
+  if (shader == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "shader is NULL.");
+    return NULL;
+  }
+
+  if (shader->status != DUCKY_SHADER_READY && shader->fallback != NULL) {
+    return shader->fallback;
+  }
+
+  return shader;
+}
+
+void d_shader_activate(d_Shader *shader) {
+  if (shader == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "shader is NULL.");
+    return;
+  }
+
+  shader = d_shader_resolve(shader);
+  if (shader->status != DUCKY_SHADER_READY) {
+    return;
+  }
+
+  if (d_gl_state.program == shader->id) {
+    d_gl_state.counters.calls_skipped++;
+    return;
+  }
+
+  d_gl_use_program(shader->id);
+
+  GLenum error = glGetError();
+  char *error_str = d_str_from_int(error);
+  if (error != GL_NO_ERROR) {
+    char *message =
+        d_str_append("Failed to use shader program. OpenGL Error: ", error_str);
+    d_throw_error(DUCKY_FAILURE, message);
+    // the program was not made current
+    d_gl_state.program = D_GL_STATE_UNKNOWN;
+  }
+  free(error_str);
+}
+
+bool d_shader_is_ready(d_Shader *shader) {
+  if (shader == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "shader is NULL.");
+    return false;
+  }
+
+  return shader->status == DUCKY_SHADER_READY;
+}
+
+d_ShaderBatch *d_shader_batch_create(d_Renderer *renderer, d_Shader *fallback) {
+  if (renderer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "renderer is NULL.");
+    return NULL;
+  }
+
+  d_ShaderBatch *batch = malloc(sizeof(d_ShaderBatch));
+  if (batch == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "malloc failed.");
+    return NULL;
+  }
+
+  batch->renderer = renderer;
+  batch->pending = d_array_create(d_Shader *, 8);
+  batch->fallback = fallback;
+  batch->parallel = d_gl_has_extension("GL_KHR_parallel_shader_compile") ||
+                    d_gl_has_extension("GL_ARB_parallel_shader_compile");
+
+  // the default thread count is implementation defined, and the setter is not
+  // in the loader, so the driver's default is kept.
+
+  return batch;
+}
+
+void d_shader_batch_destroy(d_ShaderBatch **batch) {
+  if (batch == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "batch (d_ShaderBatch **) is NULL.");
+    return;
+  }
+  if (*batch == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "batch (d_ShaderBatch *) is NULL.");
+    return;
+  }
+
+  d_shader_batch_wait(*batch);
+  d_array_destroy(&(*batch)->pending);
+  free(*batch);
+  *batch = NULL;
 }
 
-void d_vbo_bind(d_VBO *vbo) {}
-void d_vbo_unbind(d_VBO *vbo);
-#pragma endregion
+d_Shader *d_shader_batch_add(d_ShaderBatch *batch, const char *vertex_file_path,
+                             const char *fragment_file_path) {
+  if (batch == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "batch is NULL.");
+    return NULL;
+  }
 
-#pragma region EBO Functions
-d_EBO *d_ebo_create(const d_uint *indices, const size_t size) {
-  d_EBO *ebo = malloc(sizeof(d_EBO));
-  if (ebo == NULL) {
-    d_throw_error(DUCKY_MEMORY_FAILURE, "malloc failed.");
+  d_Shader *shader = d_shader_begin_internal(batch->renderer, vertex_file_path,
+                                             fragment_file_path, NULL);
+  if (shader == NULL) {
     return NULL;
   }
-  glGenBuffers(1, &ebo->id);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo->id);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, indices, GL_STATIC_DRAW);
-  return ebo;
+
+  shader->fallback = batch->fallback;
+  if (shader->status == DUCKY_SHADER_PENDING) {
+    d_array_add(batch->pending, &shader);
+  }
+
+  return shader;
 }
 
-void d_ebo_destroy(d_EBO **ebo) {
-  if (ebo == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "ebo (d_EBO **) is NULL.");
-    return;
+bool d_shader_batch_poll(d_ShaderBatch *batch) {
+  if (batch == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "batch is NULL.");
+    return true;
   }
-  if (*ebo == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "ebo (d_EBO *) is NULL.");
-    return;
+
+  size_t i = 0;
+  while (i < batch->pending->length) {
+    d_Shader *shader = d_array_get(batch->pending, d_Shader *, i);
+
+    if (batch->parallel == true) {
+      GLint complete = GL_FALSE;
+      glGetProgramiv(shader->id, GL_COMPLETION_STATUS_KHR, &complete);
+      if (complete == GL_FALSE) {
+        i++;
+        continue;
+      }
+    }
+
+    d_shader_finish_internal(batch->renderer, shader);
+    d_array_remove(batch->pending, i);
   }
 
-  glDeleteBuffers(1, &(*ebo)->id);
-  free(*ebo);
-  *ebo = NULL;
+  return batch->pending->length == 0;
 }
 
-void d_ebo_bind(d_EBO *ebo) {
-  if (ebo == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "ebo is NULL.");
+void d_shader_batch_wait(d_ShaderBatch *batch) {
+  if (batch == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "batch is NULL.");
     return;
   }
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo->id);
-  ebo->bound = true;
+
+  while (batch->pending->length > 0) {
+    d_Shader *shader = d_array_get(batch->pending, d_Shader *, 0);
+    d_shader_finish_internal(batch->renderer, shader);
+    d_array_remove(batch->pending, 0);
+  }
 }
 
-void d_ebo_unbind(d_EBO *ebo) {
-  if (ebo == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "ebo is NULL.");
+void d_shader_add_uniform_internal(d_Shader *shader, const char *name,
+                                   GLenum type) {
+  GLint location = glGetUniformLocation(shader->id, name);
+  if (location == -1) {
     return;
   }
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-  ebo->bound = false;
-}
 
-#pragma endregion
+  uint64_t hash = d_hash(name, strlen(name), D_HASH_SEED);
+  d_uint mask = shader->uniform_capacity - 1;
+  d_uint slot = (d_uint)hash & mask;
+  while (shader->uniforms[slot].name != NULL) {
+    if (shader->uniforms[slot].hash == hash &&
+        strcmp(shader->uniforms[slot].name, name) == 0) {
+      return;
+    }
+    slot = (slot + 1) & mask;
+  }
 
-#pragma region Shader Functions
-d_Shader *d_shader_create(d_Renderer *renderer, const char *vertex_file_path,
-                          const char *fragment_file_path) {
-  d_Shader *shader = malloc(sizeof(d_Shader));
+  d_Uniform *uniform = &shader->uniforms[slot];
+  uniform->name = d_str_append(name, "");
+  uniform->hash = hash;
+  uniform->location = location;
+  uniform->type = type;
+  uniform->set = false;
+  shader->uniform_count++;
+}
 
+void d_shader_load_uniforms(d_Shader *shader) {
   if (shader == NULL) {
-    d_throw_error(DUCKY_MEMORY_FAILURE, "malloc failed.");
-    return NULL;
+    d_throw_error(DUCKY_NULL_REFERENCE, "shader is NULL.");
+    return;
   }
 
-  d_File *fragment_shader = d_file_read(fragment_file_path);
-  if (fragment_shader == NULL) {
-    d_throw_error(DUCKY_FAILURE, "Failed to read fragment shader.");
+  GLint active_count = 0;
+  glGetProgramiv(shader->id, GL_ACTIVE_UNIFORMS, &active_count);
 
-    d_core_shutdown();
+  // count array elements too so the table stays at most half full
+  d_uint entry_count = 0;
+  for (GLint i = 0; i < active_count; i++) {
+    GLint size;
+    GLenum type;
+    glGetActiveUniform(shader->id, i, 0, NULL, &size, &type, NULL);
+    entry_count += size > 1 ? size + 1 : 1;
   }
 
-  d_File *vertex_shader = d_file_read(vertex_file_path);
-  if (vertex_shader == NULL) {
-    d_throw_error(DUCKY_FAILURE, "Failed to read vertex shader.");
+  d_uint capacity = 16;
+  while (capacity < entry_count * 2) {
+    capacity *= 2;
+  }
 
-    d_core_shutdown();
+  shader->uniforms = calloc(capacity, sizeof(d_Uniform));
+  if (shader->uniforms == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to calloc uniforms.");
+    shader->uniform_capacity = 0;
+    return;
+  }
+  shader->uniform_capacity = capacity;
+  shader->uniform_count = 0;
+
+  for (GLint i = 0; i < active_count; i++) {
+    GLchar name[256];
+    GLint size;
+    GLenum type;
+    glGetActiveUniform(shader->id, i, sizeof(name), NULL, &size, &type, name);
+
+    // built-in uniforms have no location
+    if (strncmp(name, "gl_", 3) == 0) {
+      continue;
+    }
+
+    d_shader_add_uniform_internal(shader, name, type);
+
+    if (strcmp(name, "object_lights[0]") == 0) {
+      shader->object_light_count = size / 4;
+    }
+
+    // arrays are reported once as `name[0]`
+    char *bracket = strrchr(name, '[');
+    if (size > 1 && bracket != NULL && strcmp(bracket, "[0]") == 0) {
+      *bracket = '\0';
+      d_shader_add_uniform_internal(shader, name, type);
+
+      char element[288];
+      for (GLint j = 1; j < size; j++) {
+        snprintf(element, sizeof(element), "%s[%d]", name, j);
+        d_shader_add_uniform_internal(shader, element, type);
+      }
+    }
   }
+}
 
-  char *number = malloc(sizeof(char) * 4);
-  if (number == NULL) {
-    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc number.");
+void d_shader_bind_uniform_blocks(d_Shader *shader) {
+  if (shader == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "shader is NULL.");
+    return;
   }
 
-  sprintf(number, "%d", renderer->max_point_lights);
-  char *res = d_str_append("#define MAX_POINT_LIGHTS ", number);
-  fragment_shader->data =
-      d_str_replace(fragment_shader->data, "#define MAX_POINT_LIGHTS 8", res);
+  // GLSL 330 has no `layout(binding = N)`, so bind from here
+  GLuint frame_index = glGetUniformBlockIndex(shader->id, "FrameData");
+  if (frame_index != GL_INVALID_INDEX) {
+    glUniformBlockBinding(shader->id, frame_index, D_UNIFORM_BLOCK_FRAME);
+  }
 
-  sprintf(number, "%d", renderer->max_spot_lights);
-  res = d_str_append("#define MAX_SPOT_LIGHTS ", number);
-  fragment_shader->data =
-      d_str_replace(fragment_shader->data, "#define MAX_SPOT_LIGHTS 8", res);
+  GLuint light_index = glGetUniformBlockIndex(shader->id, "LightData");
+  if (light_index != GL_INVALID_INDEX) {
+    glUniformBlockBinding(shader->id, light_index, D_UNIFORM_BLOCK_LIGHTS);
+  }
 
-  sprintf(number, "%d", renderer->max_directional_lights);
-  res = d_str_append("#define MAX_DIRECTIONAL_LIGHTS ", number);
-  fragment_shader->data = d_str_replace(
-      fragment_shader->data, "#define MAX_DIRECTIONAL_LIGHTS 1", res);
+  GLuint cluster_index = glGetUniformBlockIndex(shader->id, "ClusterData");
+  if (cluster_index != GL_INVALID_INDEX) {
+    glUniformBlockBinding(shader->id, cluster_index,
+                          D_UNIFORM_BLOCK_CLUSTERS);
+  }
 
-  free(number);
-  free(res);
+  GLuint shadow_index = glGetUniformBlockIndex(shader->id, "ShadowData");
+  if (shadow_index != GL_INVALID_INDEX) {
+    glUniformBlockBinding(shader->id, shadow_index, D_UNIFORM_BLOCK_SHADOWS);
+  }
 
-  GLuint vert = glCreateShader(GL_VERTEX_SHADER);
-  const char *vert_src = vertex_shader->data;
-  glShaderSource(vert, 1, &vert_src, NULL);
-  glCompileShader(vert);
-  if (d_check_shader_compile(vert, "VERTEX_SHADER") == -1) {
-    d_throw_error(DUCKY_FAILURE, "Failed to compile vertex shader.");
-    free(shader);
-    d_file_destroy(&vertex_shader);
-    d_file_destroy(&fragment_shader);
-    return NULL;
+  // the same goes for sampler units, which need the program to be current
+  const char *samplers[4] = {"cluster_grid", "cluster_light_indices",
+                             "cluster_lights", "shadow_atlas"};
+  const int units[4] = {
+      D_TEXTURE_UNIT_CLUSTER_GRID, D_TEXTURE_UNIT_CLUSTER_INDICES,
+      D_TEXTURE_UNIT_CLUSTER_LIGHTS, D_TEXTURE_UNIT_SHADOW_ATLAS};
+  for (int i = 0; i < 4; i++) {
+    GLint location = glGetUniformLocation(shader->id, samplers[i]);
+    if (location != -1) {
+      d_gl_use_program(shader->id);
+      glUniform1i(location, units[i]);
+    }
   }
+}
 
-  GLuint frag = glCreateShader(GL_FRAGMENT_SHADER);
-  const char *frag_src = fragment_shader->data;
-  glShaderSource(frag, 1, &frag_src, NULL);
-  glCompileShader(frag);
-  if (d_check_shader_compile(frag, "FRAGMENT_SHADER") == -1) {
-    d_throw_error(DUCKY_FAILURE, "Failed to compile fragment shader.");
-    free(shader);
-    d_file_destroy(&vertex_shader);
-    d_file_destroy(&fragment_shader);
+d_Uniform *d_shader_get_uniform(d_Shader *shader, const char *name) {
+  if (shader == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "shader is NULL.");
+    return NULL;
+  }
+  shader = d_shader_resolve(shader);
+  if (name == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "name is NULL.");
+    return NULL;
+  }
+  if (shader->uniform_capacity == 0) {
     return NULL;
   }
-  d_file_destroy(&vertex_shader);
-  d_file_destroy(&fragment_shader);
 
-  shader->id = glCreateProgram();
+  uint64_t hash = d_hash(name, strlen(name), D_HASH_SEED);
+  d_uint mask = shader->uniform_capacity - 1;
+  d_uint slot = (d_uint)hash & mask;
+  while (shader->uniforms[slot].name != NULL) {
+    if (shader->uniforms[slot].hash == hash &&
+        strcmp(shader->uniforms[slot].name, name) == 0) {
+      return &shader->uniforms[slot];
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  return NULL;
+}
 
-  glAttachShader(shader->id, vert);
-  glDeleteShader(vert);
+GLint d_shader_get_uniform_location(d_Shader *shader, const char *name) {
+  d_Uniform *uniform = d_shader_get_uniform(shader, name);
+  if (uniform == NULL) {
+    return -1;
+  }
 
-  glAttachShader(shader->id, frag);
-  glDeleteShader(frag);
+  return uniform->location;
+}
 
-  glLinkProgram(shader->id);
-  if (d_check_shader_link(shader->id) == -1) {
-    d_throw_error(DUCKY_FAILURE, "Failed to link shader program.");
-    free(shader);
+// returns the uniform when `size` bytes of `data` differ from its shadow value,
+// updating the shadow, or `NULL` when the upload can be skipped.
+d_Uniform *d_shader_update_uniform_internal(d_Shader *shader, const char *name,
+                                            const void *data, size_t size) {
+  d_Uniform *uniform = d_shader_get_uniform(shader, name);
+  if (uniform == NULL) {
     return NULL;
   }
 
-  if (glIsProgram(shader->id) == GL_FALSE) {
-    d_throw_error(DUCKY_FAILURE, "Shader progam is NOT valid!");
-    free(shader);
+  if (uniform->set == true && memcmp(&uniform->value, data, size) == 0) {
     return NULL;
   }
 
-  return shader;
+  memcpy(&uniform->value, data, size);
+  uniform->set = true;
+  return uniform;
 }
-void d_shader_destroy(d_Shader **shader) {
-  if (shader == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "shader (d_Shader **) is NULL.");
-    return;
+
+void d_shader_set_int(d_Shader *shader, const char *name, const int value) {
+  GLint data = value;
+  d_Uniform *uniform =
+      d_shader_update_uniform_internal(shader, name, &data, sizeof(data));
+  if (uniform != NULL) {
+    glUniform1i(uniform->location, data);
   }
-  if (*shader == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "shader (d_Shader *) is NULL.");
-    return;
+}
+
+void d_shader_set_bool(d_Shader *shader, const char *name, const bool value) {
+  d_shader_set_int(shader, name, value == true ? 1 : 0);
+}
+
+void d_shader_set_float(d_Shader *shader, const char *name, const float value) {
+  d_Uniform *uniform =
+      d_shader_update_uniform_internal(shader, name, &value, sizeof(value));
+  if (uniform != NULL) {
+    glUniform1f(uniform->location, value);
   }
+}
 
-  glDeleteProgram((*shader)->id);
+void d_shader_set_vec2(d_Shader *shader, const char *name, const d_Vec2 value) {
+  d_Uniform *uniform = d_shader_update_uniform_internal(
+      shader, name, value.data, sizeof(value.data));
+  if (uniform != NULL) {
+    glUniform2fv(uniform->location, 1, value.data);
+  }
+}
 
-  free(*shader);
-  *shader = NULL;
+void d_shader_set_vec3(d_Shader *shader, const char *name, const d_Vec3 value) {
+  d_Uniform *uniform = d_shader_update_uniform_internal(
+      shader, name, value.data, sizeof(value.data));
+  if (uniform != NULL) {
+    glUniform3fv(uniform->location, 1, value.data);
+  }
 }
-void d_shader_activate(d_Shader *shader) {
-  if (shader == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "shader is NULL.");
-    return;
+
+void d_shader_set_vec4(d_Shader *shader, const char *name, const d_Vec4 value) {
+  d_Uniform *uniform = d_shader_update_uniform_internal(
+      shader, name, value.data, sizeof(value.data));
+  if (uniform != NULL) {
+    glUniform4fv(uniform->location, 1, value.data);
+  }
+}
+
+void d_shader_set_color(d_Shader *shader, const char *name,
+                        const d_Color value) {
+  d_Uniform *uniform = d_shader_update_uniform_internal(
+      shader, name, value.data, sizeof(value.data));
+  if (uniform != NULL) {
+    glUniform4fv(uniform->location, 1, value.data);
   }
+}
 
-  glUseProgram(shader->id);
+void d_shader_set_mat4(d_Shader *shader, const char *name,
+                       const d_Mat4 *value) {
+  if (value == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "value is NULL.");
+    return;
+  }
 
-  GLenum error = glGetError();
-  char *error_str = d_str_from_int(error);
-  if (error != GL_NO_ERROR) {
-    char *message =
-        d_str_append("Failed to use shader program. OpenGL Error: ", error_str);
-    d_throw_error(DUCKY_FAILURE, message);
+  d_Uniform *uniform = d_shader_update_uniform_internal(
+      shader, name, value->data, sizeof(value->data));
+  if (uniform != NULL) {
+    glUniformMatrix4fv(uniform->location, 1, GL_FALSE, value->data);
   }
-  free(error_str);
 }
 #pragma endregion
 
@@ -849,7 +3667,7 @@ d_Texture *d_texture_create(const char *path, d_TextureBlendMode blend_mode) {
     return NULL;
   }
 
-  glBindTexture(GL_TEXTURE_2D, texture->id);
+  d_gl_bind_texture(0, texture->id);
   if (d_gl_error("Failed to bind texture ") == true) {
     d_texture_destroy(&texture);
     return NULL;
@@ -890,10 +3708,21 @@ d_Texture *d_texture_create(const char *path, d_TextureBlendMode blend_mode) {
   }
 
   texture->blend_mode = blend_mode;
+  texture->cutout = false;
 
   if (invalid_path == false) {
     GLenum format = channels == 4 ? GL_RGBA : GL_RGB;
 
+    if (channels == 4) {
+      for (int i = 0; i < width * height; i++) {
+        // same threshold as `alpha < 0.1` in the shaders
+        if (data[i * 4 + 3] < 26) {
+          texture->cutout = true;
+          break;
+        }
+      }
+    }
+
     glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
                  GL_UNSIGNED_BYTE, data);
     if (d_gl_error("glTexImage2D failed ") == true) {
@@ -946,6 +3775,7 @@ void d_texture_destroy(d_Texture **texture) {
     return;
   }
 
+  d_gl_state_forget(GL_TEXTURE, (*texture)->id);
   glDeleteTextures(1, &(*texture)->id);
   (*texture)->id = 0;
   free(*texture);
@@ -958,7 +3788,24 @@ void d_texture_bind(d_Texture *texture) {
     return;
   }
 
-  glBindTexture(GL_TEXTURE_2D, texture->id);
+  d_texture_bind_unit(texture, d_gl_state.active_texture == D_GL_STATE_UNKNOWN
+                                    ? 0
+                                    : d_gl_state.active_texture);
+}
+
+void d_texture_bind_unit(d_Texture *texture, const d_uint unit) {
+  if (texture == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "texture is NULL.");
+    return;
+  }
+
+  if (unit < D_GL_MAX_TEXTURE_UNITS &&
+      d_gl_state.textures[unit] == texture->id) {
+    d_gl_state.counters.calls_skipped++;
+    return;
+  }
+
+  d_gl_bind_texture(unit, texture->id);
   d_gl_error("Bind texture ");
 }
 
@@ -968,8 +3815,11 @@ void d_texture_unbind(d_Texture *texture) {
     return;
   }
 
-  glBindTexture(GL_TEXTURE_2D, 0);
-  d_gl_error("Unbind texture ");
+  for (int i = 0; i < D_GL_MAX_TEXTURE_UNITS; i++) {
+    if (d_gl_state.textures[i] == texture->id) {
+      d_gl_bind_texture(i, 0);
+    }
+  }
 }
 
 #pragma endregion
@@ -978,13 +3828,22 @@ void d_texture_unbind(d_Texture *texture) {
 
 d_Material *d_material_create(const char *diffuse_path,
                               const char *specular_path, d_Color color) {
+  static d_uint next_id = 1;
+
   d_Material *material = malloc(sizeof(d_Material));
+  if (material == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "malloc failed.");
+    return NULL;
+  }
 
   material->diffuse = d_texture_create(diffuse_path, NEAREST);
   material->specular = d_texture_create(specular_path, NEAREST);
   material->color = color;
   material->specular_strength = 0.5f;
   material->unlit = false;
+  material->id = next_id++;
+
+  return material;
 }
 
 void d_material_destroy(d_Material **material) {
@@ -1017,22 +3876,26 @@ void d_material_get_uniforms(d_Material *material, d_Shader *shader) {
   }
 
   material->diffuse_uniform =
-      glGetUniformLocation(shader->id, "diffuse_texture");
-  d_gl_error("Failed to get diffuse texture uniform ");
-
+      d_shader_get_uniform_location(shader, "diffuse_texture");
   material->specular_uniform =
-      glGetUniformLocation(shader->id, "specular_texture");
-  d_gl_error("Failed to get specular texture uniform ");
-
-  material->color_uniform = glGetUniformLocation(shader->id, "color");
-  d_gl_error("Failed to get color uniform ");
-
+      d_shader_get_uniform_location(shader, "specular_texture");
+  material->color_uniform = d_shader_get_uniform_location(shader, "color");
   material->specular_strength_uniform =
-      glGetUniformLocation(shader->id, "specular_strength");
-  d_gl_error("Failed to get specular strength uniform ");
+      d_shader_get_uniform_location(shader, "specular_strength");
+  material->unlit_uniform = d_shader_get_uniform_location(shader, "unlit");
+}
+
+void d_material_set_uniforms(d_Material *material, d_Shader *shader) {
+  if (material == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "material is NULL.");
+    return;
+  }
 
-  material->unlit_uniform = glGetUniformLocation(shader->id, "unlit");
-  d_gl_error("Failed to get unlit uniform ");
+  d_shader_set_int(shader, "diffuse_texture", 0);
+  d_shader_set_int(shader, "specular_texture", 1);
+  d_shader_set_color(shader, "color", material->color);
+  d_shader_set_float(shader, "specular_strength", material->specular_strength);
+  d_shader_set_bool(shader, "unlit", material->unlit);
 }
 
 void d_material_bind(d_Material *material) {
@@ -1041,11 +3904,8 @@ void d_material_bind(d_Material *material) {
     return;
   }
 
-  glActiveTexture(GL_TEXTURE0);
-  d_texture_bind(material->diffuse);
-
-  glActiveTexture(GL_TEXTURE1);
-  d_texture_bind(material->specular);
+  d_texture_bind_unit(material->diffuse, 0);
+  d_texture_bind_unit(material->specular, 1);
 }
 
 void d_material_unbind(d_Material *material) {
@@ -1061,4 +3921,190 @@ void d_material_unbind(d_Material *material) {
 
 #pragma endregion
 
+#pragma region Framebuffer Functions
+
+void d_framebuffer_release_internal(d_Framebuffer *framebuffer) {
+  if (framebuffer->id == 0) {
+    return;
+  }
+
+  glDeleteFramebuffers(1, &framebuffer->id);
+  d_gl_state_forget(GL_TEXTURE, framebuffer->color_texture);
+  glDeleteTextures(1, &framebuffer->color_texture);
+  glDeleteRenderbuffers(1, &framebuffer->depth_stencil);
+  framebuffer->id = 0;
+  framebuffer->color_texture = 0;
+  framebuffer->depth_stencil = 0;
+  framebuffer->width = 0;
+  framebuffer->height = 0;
+}
+
+void d_framebuffer_allocate_internal(d_Framebuffer *framebuffer,
+                                     const d_uint width, const d_uint height) {
+  framebuffer->width = width;
+  framebuffer->height = height;
+
+  glGenFramebuffers(1, &framebuffer->id);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer->id);
+
+  // bound through the state cache, so it knows what unit 0 holds
+  glGenTextures(1, &framebuffer->color_texture);
+  d_gl_bind_texture(0, framebuffer->color_texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         framebuffer->color_texture, 0);
+
+  glGenRenderbuffers(1, &framebuffer->depth_stencil);
+  glBindRenderbuffer(GL_RENDERBUFFER, framebuffer->depth_stencil);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                            GL_RENDERBUFFER, framebuffer->depth_stencil);
+
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    d_throw_error(DUCKY_FAILURE, "Framebuffer is incomplete.");
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, d_window_framebuffer);
+}
+
+d_Framebuffer *d_framebuffer_create(const d_uint width, const d_uint height) {
+  if (width == 0 || height == 0) {
+    d_throw_error(DUCKY_FAILURE, "Framebuffer size must be positive.");
+    return NULL;
+  }
+
+  d_Framebuffer *framebuffer = malloc(sizeof(d_Framebuffer));
+  if (framebuffer == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc framebuffer.");
+    return NULL;
+  }
+
+  d_framebuffer_allocate_internal(framebuffer, width, height);
+  return framebuffer;
+}
+
+void d_framebuffer_destroy(d_Framebuffer **framebuffer) {
+  if (framebuffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "framebuffer (d_Framebuffer **) is NULL.");
+    return;
+  }
+  if (*framebuffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "framebuffer (d_Framebuffer *) is NULL.");
+    return;
+  }
+
+  d_framebuffer_release_internal(*framebuffer);
+  free(*framebuffer);
+  *framebuffer = NULL;
+}
+
+void d_framebuffer_resize(d_Framebuffer *framebuffer, const d_uint width,
+                          const d_uint height) {
+  if (framebuffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "framebuffer is NULL.");
+    return;
+  }
+  if (width == 0 || height == 0) {
+    d_throw_error(DUCKY_FAILURE, "Framebuffer size must be positive.");
+    return;
+  }
+  if (width == framebuffer->width && height == framebuffer->height) {
+    return;
+  }
+
+  d_framebuffer_release_internal(framebuffer);
+  d_framebuffer_allocate_internal(framebuffer, width, height);
+}
+
+#pragma endregion
+
+#pragma region GPU Profiler Functions
+
+void d_gpu_profiler_begin(const char *name) {
+  if (d_profiler_capturing() == false || d_gpu_profiler.timing == true) {
+    return;
+  }
+  if (d_gpu_profiler.created == false) {
+    for (d_uint i = 0; i < D_PROFILE_GPU_QUERIES; i++) {
+      glGenQueries(1, &d_gpu_profiler.queries[i].id);
+      d_gpu_profiler.queries[i].pending = false;
+    }
+    d_gpu_profiler.next = 0;
+    d_gpu_profiler.created = true;
+  }
+
+  d_GpuTimerQuery *query = &d_gpu_profiler.queries[d_gpu_profiler.next];
+  if (query->pending == true) {
+    return;
+  }
+
+  query->name = name;
+  query->cpu_start = d_profiler_now();
+  query->capture = d_profiler_capture_id();
+  query->pending = true;
+  glBeginQuery(GL_TIME_ELAPSED, query->id);
+  d_gpu_profiler.active = d_gpu_profiler.next;
+  d_gpu_profiler.timing = true;
+  d_gpu_profiler.next = (d_gpu_profiler.next + 1) % D_PROFILE_GPU_QUERIES;
+}
+
+void d_gpu_profiler_end() {
+  if (d_gpu_profiler.timing == false) {
+    return;
+  }
+  glEndQuery(GL_TIME_ELAPSED);
+  d_gpu_profiler.timing = false;
+}
+
+void d_gpu_profiler_collect() {
+  if (d_gpu_profiler.created == false) {
+    return;
+  }
+
+  for (d_uint i = 0; i < D_PROFILE_GPU_QUERIES; i++) {
+    d_GpuTimerQuery *query = &d_gpu_profiler.queries[i];
+    if (query->pending == false ||
+        (d_gpu_profiler.timing == true && i == d_gpu_profiler.active)) {
+      continue;
+    }
+
+    GLint available = GL_FALSE;
+    glGetQueryObjectiv(query->id, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available == GL_FALSE) {
+      continue;
+    }
+
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(query->id, GL_QUERY_RESULT, &elapsed);
+    query->pending = false;
+    // recorded even when the capture has ended since the query was issued
+    d_profiler_record_late(query->name, query->cpu_start, elapsed,
+                           D_PROFILE_GPU_THREAD, query->capture);
+  }
+}
+
+void d_gpu_profiler_destroy() {
+  if (d_gpu_profiler.created == false) {
+    return;
+  }
+
+  if (d_gpu_profiler.timing == true) {
+    glEndQuery(GL_TIME_ELAPSED);
+    d_gpu_profiler.timing = false;
+  }
+  for (d_uint i = 0; i < D_PROFILE_GPU_QUERIES; i++) {
+    glDeleteQueries(1, &d_gpu_profiler.queries[i].id);
+    d_gpu_profiler.queries[i].pending = false;
+  }
+  d_gpu_profiler.created = false;
+}
+
+#pragma endregion
+
 #endif
\ No newline at end of file
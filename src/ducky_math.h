@@ -66,6 +66,12 @@ typedef union d_Vec4 {
 typedef struct d_Mat4 {
   float data[16];
 } Mat4, Matrix4, d_Mat4;
+
+// Six planes (normal xyz, distance w) with normals pointing inwards, in the
+// order left, right, bottom, top, near, far.
+typedef struct d_Frustum {
+  d_Vec4 planes[6];
+} Frustum, d_Frustum;
 #pragma endregion
 
 #pragma region Math Functions
@@ -127,6 +133,13 @@ void d_mat4_look_at(d_Mat4 *a, const d_Vec3 *position,
                     const d_Vec3 *target_position, const d_Vec3 *forward);
 void d_mat4_inverse(d_Mat4 *a);
 #pragma endregion
+
+#pragma region Frustum Functions
+/**
+ * @brief Extracts the normalized frustum planes of a projection * view matrix.
+ */
+d_Frustum d_frustum_from_matrix(const d_Mat4 *view_projection);
+#pragma endregion
 #endif
 
 #ifdef DUCKY_MATH_IMPL
@@ -677,4 +690,41 @@ d_Mat4 d_mat4_multiply(const d_Mat4 *a, const d_Mat4 *b) {
 }
 #pragma endregion
 
+#pragma region Frustum Functions
+d_Frustum d_frustum_from_matrix(const d_Mat4 *view_projection) {
+  d_Frustum frustum;
+  if (view_projection == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "view_projection is NULL.");
+    memset(&frustum, 0, sizeof(d_Frustum));
+    return frustum;
+  }
+
+  // rows of the column major matrix
+  const float *m = view_projection->data;
+  d_Vec4 rows[4];
+  for (int row = 0; row < 4; row++) {
+    rows[row] = d_vec4(m[row], m[4 + row], m[8 + row], m[12 + row]);
+  }
+
+  for (int i = 0; i < 6; i++) {
+    // left/right use row 0, bottom/top row 1, near/far row 2
+    float sign = i % 2 == 0 ? 1.0f : -1.0f;
+    const d_Vec4 *row = &rows[i / 2];
+    d_Vec4 plane = d_vec4(rows[3].x + sign * row->x, rows[3].y + sign * row->y,
+                          rows[3].z + sign * row->z,
+                          rows[3].w + sign * row->w);
+
+    float length =
+        sqrtf(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+    if (length > 0.0f) {
+      for (int j = 0; j < 4; j++)
+        plane.data[j] /= length;
+    }
+    frustum.planes[i] = plane;
+  }
+
+  return frustum;
+}
+#pragma endregion
+
 #endif
\ No newline at end of file
@@ -9,12 +9,20 @@
 #include "ducky_math.h"
 #endif
 
+#ifndef DUCKY_WINDOW_H
+#include "ducky_window.h"
+#endif
+
 #ifndef DUCKY_GFX_H
 #include "ducky_gfx.h"
 #endif
 
 #include "ufbx/ufbx.h"
 
+#include <float.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #pragma region ObjectManager
 
 #pragma endregion
@@ -35,6 +43,10 @@ void d_transform_destroy(d_Transform **target);
 void d_transform_add_child(d_Transform *target, d_Transform *child);
 void d_transform_remove_child(d_Transform *target, d_Transform *child);
 void d_transform_update(d_Transform *target);
+/**
+ * @brief Builds the model matrix (translation * rotation * scale).
+ */
+d_Mat4 d_transform_get_matrix(const d_Transform *target);
 
 #pragma endregion
 
@@ -49,6 +61,54 @@ typedef struct d_Vertex {
 
 d_Vertex d_vertex_create(d_Vec3 pos, d_Vec3 norm, d_Vec2 UV, d_uint idx);
 
+// Axis aligned bounding box
+typedef struct d_AABB {
+  d_Vec3 min;
+  d_Vec3 max;
+} AABB, d_AABB;
+
+/**
+ * @brief An empty box, growing it with any point gives a box around that point.
+ */
+d_AABB d_aabb_empty();
+void d_aabb_grow(d_AABB *box, const d_Vec3 *point);
+d_Vec3 d_aabb_center(const d_AABB *box);
+/**
+ * @brief Box around `box` after transforming it by `matrix`.
+ */
+d_AABB d_aabb_transform(const d_AABB *box, const d_Mat4 *matrix);
+
+// Geometry buffer with the d_Vertex layout shared by every mesh renderer and
+// static batch, so drawing different meshes needs no vertex array switch.
+d_GeometryBuffer *d_mesh_geometry;
+
+/**
+ * @brief Returns `d_mesh_geometry`, creating it on first use. Needs a GL
+ * context.
+ */
+d_GeometryBuffer *d_mesh_geometry_get();
+/**
+ * @brief Destroys `d_mesh_geometry`, call before the GL context goes away.
+ */
+void d_mesh_geometry_destroy();
+
+// most levels a mesh gets, including the full detail one
+#define D_MAX_LODS 4
+// fraction a screen size must pass a threshold by before the level switches
+#define D_LOD_HYSTERESIS 0.15f
+
+// Projected bounding sphere diameter, as a fraction of the viewport height,
+// below which level `i + 1` is used instead of level `i`.
+float d_lod_screen_sizes[D_MAX_LODS - 1];
+
+// A range of `d_Mesh::indices`, all levels index the same vertices.
+typedef struct d_MeshLOD {
+  d_uint first_index;
+  d_uint index_count;
+  // largest quadric error of the collapses that produced the level
+  float error;
+} MeshLOD, d_MeshLOD;
+
 typedef struct d_Mesh {
   const char *path;
 
@@ -58,10 +118,62 @@ typedef struct d_Mesh {
   d_uint vertex_count;
   d_uint edge_count;
   d_uint face_count;
+
+  // object space bounds, computed on load
+  d_AABB bounds;
+  d_Vec3 sphere_center;
+  float sphere_radius;
+
+  // level 0 is the loaded mesh, the rest are appended to `indices` by
+  // `d_mesh_generate_lods`
+  d_MeshLOD lods[D_MAX_LODS];
+  d_uint lod_count;
 } Mesh, d_Mesh;
 
+/**
+ * @brief Loads the full detail level only. Mesh renderers go through
+ * `d_mesh_acquire`, which also builds the LODs once per path.
+ */
 d_Mesh *d_mesh_load(const char *path);
 void d_mesh_destroy(d_Mesh **mesh);
+/**
+ * @brief Simplifies level 0 into up to `levels` coarser levels, each with
+ * about half the triangles of the previous one, and appends them to
+ * `mesh->indices`, replacing levels generated before. Called by
+ * `d_mesh_acquire`, must run before the mesh is uploaded.
+ */
+void d_mesh_generate_lods(d_Mesh *mesh, const d_uint levels);
+/**
+ * @brief Picks the level for a projected size (see `d_lod_screen_sizes`),
+ * staying at `current` until the size is clearly past a threshold.
+ */
+d_uint d_mesh_select_lod(const d_Mesh *mesh, const d_uint current,
+                         const float screen_size);
+
+// A mesh loaded for mesh renderers and its range in `d_mesh_geometry`. Every
+// renderer of the same path shares one entry, so the file is loaded and its
+// LODs are built once, and their draw items get the same mesh id and can be
+// instanced together.
+typedef struct d_MeshCacheEntry {
+  char *path;
+  d_Mesh *mesh;
+  d_GeometryRange geometry;
+  d_uint references;
+} MeshCacheEntry, d_MeshCacheEntry;
+
+// d_MeshCacheEntry *, `NULL` until the first mesh is acquired
+d_Array *d_mesh_cache;
+
+/**
+ * @brief Returns the entry for `path`, loading and uploading the mesh the
+ * first time. Every call needs a matching `d_mesh_release`.
+ */
+d_MeshCacheEntry *d_mesh_acquire(const char *path);
+/**
+ * @brief Drops a reference taken by `d_mesh_acquire`, the last one frees the
+ * mesh and its geometry range.
+ */
+void d_mesh_release(d_Mesh *mesh);
 
 #pragma endregion
 
@@ -81,18 +193,42 @@ void d_object_destroy(d_Object **target);
 
 typedef struct d_MeshRenderer {
   d_Transform *transform;
+  // shared through `d_mesh_acquire`
   d_Mesh *mesh;
 
+  // borrowed, the same material can be set on many renderers, so its owner
+  // destroys it
   d_Material *material;
+  d_Shader *shader;
+  // raster state to draw with, `NULL` for the render queue's opaque default
+  const d_PipelineState *pipeline;
 
-  d_VAO *vao;
-  d_VBO *vbo;
-  d_EBO *ebo;
+  // range of the mesh in `d_mesh_geometry`, shared with every renderer of
+  // the mesh, empty without a mesh
+  d_GeometryRange geometry;
+
+  // never moves, can be merged by `d_static_batch_build`
+  bool is_static;
+  // merged into a static batch, `d_mesh_renderer_submit` skips it and
+  // `mesh` is released
+  bool batched;
+  // tested with a hardware occlusion query, worth it for large meshes
+  bool occlusion_query;
+  // level of detail drawn last, see `d_mesh_select_lod`
+  d_uint lod;
 } MeshRenderer, d_MeshRenderer;
 
+struct d_RenderQueue;
+
 d_MeshRenderer *d_mesh_renderer_create(const char *mesh_path);
 void d_mesh_renderer_destroy(d_MeshRenderer **mesh_renderer);
 void d_mesh_renderer_update(d_MeshRenderer *mesh_renderer);
+/**
+ * @brief Adds a draw item for the mesh renderer to `queue`. Needs a material
+ * and a shader.
+ */
+void d_mesh_renderer_submit(d_MeshRenderer *mesh_renderer,
+                            struct d_RenderQueue *queue);
 
 #pragma endregion
 
@@ -112,6 +248,898 @@ typedef struct d_Camera {
 
 d_Camera *d_camera_create(float fov, float near, float far);
 void d_camera_destroy(d_Camera **camera);
+/**
+ * @brief Rebuilds `projection` and `view` from the camera settings and its
+ * transform.
+ */
+void d_camera_update(d_Camera *camera, const float aspect_ratio);
+
+#pragma endregion
+
+#pragma region Culling
+
+#if defined(__SSE__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define D_CULL_SSE
+#include <xmmintrin.h>
+#endif
+
+// World space bounds stored as separate arrays (structure of arrays) so the
+// frustum test can work on four boxes at once. Arrays are padded to a
+// multiple of four.
+typedef struct d_CullSet {
+  float *center_x;
+  float *center_y;
+  float *center_z;
+  float *extent_x;
+  float *extent_y;
+  float *extent_z;
+
+  d_uint count;
+  d_uint capacity;
+
+  // bit `i` is set when bounds `i` intersect the frustum, filled in by
+  // `d_cull_set_test`
+  uint32_t *visible;
+} CullSet, d_CullSet;
+
+d_CullSet *d_cull_set_create(const d_uint capacity);
+void d_cull_set_destroy(d_CullSet **set);
+void d_cull_set_clear(d_CullSet *set);
+/**
+ * @brief Adds world space bounds, `NULL` for bounds that are always visible.
+ *
+ * @return Index of the bounds in the set.
+ */
+d_uint d_cull_set_add(d_CullSet *set, const d_AABB *bounds);
+/**
+ * @brief Tests every bounds in the set against the frustum planes and fills
+ * `visible`.
+ */
+void d_cull_set_test(d_CullSet *set, const d_Frustum *frustum);
+bool d_cull_set_is_visible(const d_CullSet *set, const d_uint index);
+
+#pragma endregion
+
+#pragma region SpatialTree
+
+#define D_TREE_NULL 0xFFFFFFFFu
+// how far leaf bounds are grown so small movements need no tree update
+#define D_TREE_MARGIN 0.1f
+
+typedef struct d_TreeNode {
+  // fattened by the tree margin for leaves
+  d_AABB bounds;
+  d_uint parent;
+  // `D_TREE_NULL` for leaves, `left` links the free list for unused nodes
+  d_uint left;
+  d_uint right;
+  // 0 for leaves
+  int height;
+  // transform id of a leaf
+  d_uint id;
+} TreeNode, d_TreeNode;
+
+// Dynamic AABB tree over scene objects, keyed by `d_Transform.id`. Inserts
+// pick the sibling with the smallest surface area cost and tree rotations
+// keep it balanced, so queries stay logarithmic in the object count.
+typedef struct d_SpatialTree {
+  d_TreeNode *nodes;
+  d_uint node_capacity;
+  d_uint root;
+  d_uint free_list;
+
+  // leaf node of every transform id, `D_TREE_NULL` when not in the tree
+  d_uint *leaves;
+  d_uint leaf_capacity;
+
+  // traversal stack shared by queries, a tree is not safe to query from
+  // several threads at once
+  d_uint *stack;
+  d_uint stack_capacity;
+
+  d_uint count;
+} SpatialTree, d_SpatialTree;
+
+/**
+ * @brief Called for every object found by a query.
+ *
+ * @return false to stop the query.
+ */
+typedef bool (*d_SpatialTreeCallback)(d_uint id, void *user_data);
+
+d_SpatialTree *d_spatial_tree_create();
+void d_spatial_tree_destroy(d_SpatialTree **tree);
+/**
+ * @brief Adds the transform's object with world space `bounds`.
+ */
+void d_spatial_tree_insert(d_SpatialTree *tree, const d_Transform *transform,
+                           const d_AABB *bounds);
+void d_spatial_tree_remove(d_SpatialTree *tree, const d_Transform *transform);
+/**
+ * @brief Refits the object after its transform changed. Cheap when the new
+ * bounds still fit in the leaf's fattened bounds.
+ *
+ * @return true if the object had to be moved in the tree.
+ */
+bool d_spatial_tree_update(d_SpatialTree *tree, const d_Transform *transform,
+                           const d_AABB *bounds);
+void d_spatial_tree_query_box(d_SpatialTree *tree, const d_AABB *box,
+                              d_SpatialTreeCallback callback, void *user_data);
+void d_spatial_tree_query_frustum(d_SpatialTree *tree,
+                                  const d_Frustum *frustum,
+                                  d_SpatialTreeCallback callback,
+                                  void *user_data);
+/**
+ * @brief Finds objects whose bounds the ray hits within `max_distance`.
+ * `direction` does not need to be normalized, `max_distance` is in multiples
+ * of it.
+ */
+void d_spatial_tree_query_ray(d_SpatialTree *tree, const d_Vec3 origin,
+                              const d_Vec3 direction, const float max_distance,
+                              d_SpatialTreeCallback callback, void *user_data);
+
+#pragma endregion
+
+#pragma region Occlusion
+
+#define D_OCCLUSION_MAX_LEVELS 12
+
+// Positions-only copy of a mesh's full detail level, rasterized into the
+// occlusion buffer. It must never cover pixels the drawn mesh does not, so
+// simplified levels, which can grow the silhouette, are not used.
+typedef struct d_Occluder {
+  d_Vec3 *positions;
+  d_uint vertex_count;
+  d_uint *indices;
+  d_uint index_count;
+} Occluder, d_Occluder;
+
+typedef struct d_OcclusionDraw {
+  const d_Occluder *occluder;
+  d_Mat4 model;
+} OcclusionDraw, d_OcclusionDraw;
+
+// Screen space triangle, depth in [0, 1]
+typedef struct d_OcclusionTriangle {
+  float x[3];
+  float y[3];
+  float z[3];
+} OcclusionTriangle, d_OcclusionTriangle;
+
+// Small CPU depth buffer that occluders are rasterized into, and a depth
+// pyramid built from it that object bounds are tested against. Needs no GPU
+// readback.
+typedef struct d_OcclusionBuffer {
+  // width is a multiple of 4 so rows can be rasterized 4 pixels at a time
+  d_uint width;
+  d_uint height;
+
+  // level 0 is the depth buffer, each further level holds the farthest depth
+  // of 2x2 texels of the level below
+  float *levels[D_OCCLUSION_MAX_LEVELS];
+  d_uint level_widths[D_OCCLUSION_MAX_LEVELS];
+  d_uint level_heights[D_OCCLUSION_MAX_LEVELS];
+  d_uint level_count;
+
+  d_Mat4 view_projection;
+  // d_OcclusionDraw queued since `d_occlusion_buffer_begin`
+  d_Array *draws;
+  d_OcclusionTriangle *triangles;
+  d_uint triangle_count;
+  d_uint triangle_capacity;
+  // rows rasterized by each `d_parallel_for` task
+  d_uint band_height;
+} OcclusionBuffer, d_OcclusionBuffer;
+
+/**
+ * @brief Copies the positions of the mesh's full detail level. To rasterize
+ * fewer triangles pass a hand made proxy mesh that lies inside the real one.
+ */
+d_Occluder *d_occluder_create(const d_Mesh *mesh);
+void d_occluder_destroy(d_Occluder **occluder);
+
+d_OcclusionBuffer *d_occlusion_buffer_create(const d_uint width,
+                                             const d_uint height);
+void d_occlusion_buffer_destroy(d_OcclusionBuffer **buffer);
+/**
+ * @brief Clears the buffer for a new frame seen through `view_projection`.
+ */
+void d_occlusion_buffer_begin(d_OcclusionBuffer *buffer,
+                              const d_Mat4 *view_projection);
+void d_occlusion_buffer_add_occluder(d_OcclusionBuffer *buffer,
+                                     const d_Occluder *occluder,
+                                     const d_Mat4 *model);
+/**
+ * @brief Rasterizes every added occluder across worker threads and builds the
+ * depth pyramid.
+ */
+void d_occlusion_buffer_rasterize(d_OcclusionBuffer *buffer);
+/**
+ * @brief Tests world space bounds against the depth pyramid.
+ *
+ * @return false only when the bounds are certainly hidden.
+ */
+bool d_occlusion_buffer_test(const d_OcclusionBuffer *buffer,
+                             const d_AABB *bounds);
+
+#pragma endregion
+
+#pragma region OcclusionQueries
+
+// query objects per object, results are read back up to this many frames late
+#define D_QUERY_FRAMES 3
+// visible objects are only re-tested every this many frames
+#define D_QUERY_VISIBLE_INTERVAL 4
+
+typedef struct d_OcclusionQuery {
+  GLuint ids[D_QUERY_FRAMES];
+  bool pending[D_QUERY_FRAMES];
+  // result of the newest query that finished
+  bool visible;
+  // box test requested for this frame
+  bool requested;
+  d_AABB bounds;
+} OcclusionQuery, d_OcclusionQuery;
+
+// `GL_ANY_SAMPLES_PASSED` queries for large objects or groups, keyed by
+// transform id. Results are never waited on: an object keeps the visibility of
+// its last finished query, hidden objects are tested with their bounding box
+// every frame and visible ones every `D_QUERY_VISIBLE_INTERVAL` frames.
+typedef struct d_OcclusionQueryManager {
+  d_OcclusionQuery *queries;
+  d_uint capacity;
+  // ids with a box test requested this frame
+  d_Array *requests;
+
+  d_uint frame;
+  d_Mat4 view_projection;
+  d_Vec3 camera_position;
+
+  GLuint program;
+  GLint mvp_location;
+  const d_PipelineState *pipeline;
+  d_VAO *vao;
+  d_VBO *vbo;
+  d_EBO *ebo;
+} OcclusionQueryManager, d_OcclusionQueryManager;
+
+d_OcclusionQueryManager *d_occlusion_query_manager_create();
+void d_occlusion_query_manager_destroy(d_OcclusionQueryManager **manager);
+/**
+ * @brief Collects every query result that is available without waiting.
+ */
+void d_occlusion_query_manager_begin(d_OcclusionQueryManager *manager,
+                                     d_Camera *camera);
+/**
+ * @brief Last known visibility of the object, queuing a bounding box test for
+ * this frame when one is due. Objects never tested are visible.
+ */
+bool d_occlusion_query_manager_test(d_OcclusionQueryManager *manager,
+                                    const d_uint id, const d_AABB *bounds);
+/**
+ * @brief Draws the bounding boxes of this frame's tests against the depth
+ * buffer, without writing color or depth. Call after the opaque geometry.
+ */
+void d_occlusion_query_manager_issue(d_OcclusionQueryManager *manager);
+
+#pragma endregion
+
+#pragma region RenderQueue
+
+typedef enum d_RenderPass {
+  DUCKY_PASS_OPAQUE = 0,
+  DUCKY_PASS_TRANSPARENT = 1
+} RenderPass,
+    d_RenderPass;
+
+/*
+  Sort key layout, most significant bits first.
+
+  Opaque (state first, then front to back):
+  - `63-62` pass
+  - `61-56` pipeline state id
+  - `55-46` shader program
+  - `45-34` material id
+  - `33-22` mesh (vertex array)
+  - `21-0`  depth
+
+  Transparent (back to front first, then state):
+  - `63-62` pass
+  - `61-40` inverted depth
+  - `39-34` pipeline state id
+  - `33-24` shader program
+  - `23-12` material id
+  - `11-0`  mesh (geometry range id)
+*/
+#define D_SORT_DEPTH_BITS 22
+
+// most lights a per-object light shader (`OBJECT_LIGHTS`) may use
+#define D_OBJECT_MAX_LIGHTS 8
+
+struct d_ClusterLightData;
+
+// Everything needed to issue one draw call.
+typedef struct d_DrawItem {
+  d_RenderPass pass;
+  const d_PipelineState *pipeline;
+  d_Shader *shader;
+  d_Material *material;
+  d_VAO *vao;
+  // position-only view of `vao` for the depth pre-pass, `NULL` to use `vao`
+  d_VAO *position_vao;
+  // identifies the mesh for sorting and instancing
+  d_uint mesh_id;
+  d_uint index_count;
+  d_uint first_index;
+  d_uint base_vertex;
+  d_Mat4 model;
+  // world space bounds for frustum culling, only used when `has_bounds`
+  d_AABB bounds;
+  bool has_bounds;
+  // key of the item's hardware occlusion query, `0` for none
+  d_uint query_id;
+  // distance from the camera, filled in by `d_render_queue_push`
+  float depth;
+  // indices into the queue's `lights`, strongest first, chosen at submit for
+  // shaders with an `object_lights` array
+  d_uint lights[D_OBJECT_MAX_LIGHTS];
+  d_uint light_count;
+} DrawItem, d_DrawItem;
+
+typedef struct d_RenderQueueEntry {
+  uint64_t key;
+  d_uint item;
+} RenderQueueEntry, d_RenderQueueEntry;
+
+// `GL_EQUAL` copy of a pipeline, for items whose depth is already written
+typedef struct d_EqualPipeline {
+  d_uint source_id;
+  const d_PipelineState *state;
+} EqualPipeline, d_EqualPipeline;
+
+// attribute locations of the per-instance model matrix, one per column
+#define D_INSTANCE_ATTRIB_LOCATION 3
+// smallest run of identical draws that is drawn instanced
+#define D_INSTANCING_MIN_COUNT 2
+
+typedef struct d_RenderQueue {
+  d_DrawItem *items;
+  d_RenderQueueEntry *entries;
+  // radix sort ping-pong buffer
+  d_RenderQueueEntry *scratch;
+  d_uint count;
+  d_uint capacity;
+  bool sorted;
+
+  const d_PipelineState *default_pipeline;
+  d_Vec3 camera_position;
+  float far_plane;
+  // projection[1][1], turns a sphere radius over distance into a fraction of
+  // the viewport height, 0 without a camera (always the full detail level)
+  float projection_scale;
+
+  // per-instance model matrices of this frame's instanced runs, written
+  // straight into the stream buffer at `instance_offset`
+  d_StreamBuffer *instance_stream;
+  size_t instance_offset;
+
+  // bounds of every pushed item, at the item's index
+  d_CullSet *cull;
+  d_Frustum frustum;
+  // set by `d_render_queue_begin` when given a camera
+  bool culling;
+  // rasterized occluders items are tested against, `NULL` to skip
+  const d_OcclusionBuffer *occlusion;
+  // hardware queries for items with a `query_id`, `NULL` to skip
+  d_OcclusionQueryManager *queries;
+
+  // lights to choose each item's `lights` from, `NULL` to skip
+  d_LightManager *light_manager;
+  // every point and spot light of `light_manager`, packed at submit
+  struct d_ClusterLightData *lights;
+  d_uint light_count;
+  d_uint light_capacity;
+
+  // G-buffer and light pass for `DUCKY_RENDER_DEFERRED`, `NULL` to always
+  // draw forward
+  struct d_DeferredRenderer *deferred;
+
+  // renderer whose `depth_prepass` and `depth_shader` are used, `NULL` to
+  // never run the pre-pass
+  d_Renderer *renderer;
+  // d_EqualPipeline, created the first time a pipeline is pre-passed
+  d_Array *equal_pipelines;
+} RenderQueue, d_RenderQueue;
+
+d_RenderQueue *d_render_queue_create();
+void d_render_queue_destroy(d_RenderQueue **queue);
+/**
+ * @brief Clears the queue for a new frame.
+ *
+ * @param queue
+ * @param camera Used for depth sorting, `far_plane` is the depth range, and
+ * for frustum culling. Its `view` and `projection` must be up to date.
+ */
+void d_render_queue_begin(d_RenderQueue *queue, d_Camera *camera);
+/**
+ * @brief Copies a draw item into the queue and computes its sort key.
+ */
+void d_render_queue_push(d_RenderQueue *queue, const d_DrawItem *item);
+uint64_t d_render_queue_make_key(d_RenderQueue *queue, const d_DrawItem *item);
+/**
+ * @brief Radix sorts the queued items by key.
+ */
+void d_render_queue_sort(d_RenderQueue *queue);
+/**
+ * @brief Drops items outside the camera frustum, or hidden behind the
+ * occluders of `queue->occlusion`, from the queue.
+ */
+void d_render_queue_cull(d_RenderQueue *queue);
+/**
+ * @brief Culls, sorts (if needed) and draws every queued item, binding only
+ * the state that changes between consecutive items. Consecutive opaque items
+ * with the same pipeline, shader, material and mesh are drawn with one
+ * `glDrawElementsInstanced` when the shader has an `instanced` variant.
+ * Items whose shader has an `object_lights` array get the strongest lights of
+ * `light_manager` at their bounds uploaded with them. In a deferred frame the
+ * opaque items with a `deferred` shader variant are drawn into the G-buffer
+ * and shaded first, then everything else is drawn forward on top. With
+ * `renderer->depth_prepass` the opaque forward items are drawn into depth only
+ * first and then shaded with `GL_EQUAL` and no depth write; items whose
+ * diffuse texture has cut-out texels skip the pre-pass. The queue's
+ * opaque default pipeline state is left applied.
+ */
+void d_render_queue_submit(d_RenderQueue *queue);
+
+#pragma endregion
+
+#pragma region StaticBatch
+
+// Static mesh renderers sharing a material, shader and pipeline state, merged
+// into one world space vertex/index buffer.
+typedef struct d_StaticBatch {
+  d_Material *material;
+  d_Shader *shader;
+  const d_PipelineState *pipeline;
+
+  // range of the merged meshes in `d_mesh_geometry`
+  d_GeometryRange geometry;
+
+  // world space bounds of every merged mesh
+  d_AABB bounds;
+} StaticBatch, d_StaticBatch;
+
+/**
+ * @brief Merges every static mesh renderer (`is_static`) into batches, one
+ * per material/shader/pipeline combination. Vertices are pre-transformed into
+ * world space, so merged renderers must not move afterwards. Merged renderers
+ * are flagged `batched` and release their mesh, the batch keeps the only
+ * copy of their geometry. Materials are borrowed like the renderers' are.
+ *
+ * @return d_StaticBatch *, destroy with `d_static_batches_destroy`.
+ */
+d_Array *d_static_batch_build(d_MeshRenderer **mesh_renderers,
+                              const d_uint count);
+void d_static_batch_destroy(d_StaticBatch **batch);
+/**
+ * @brief Destroys every batch in the array returned by
+ * `d_static_batch_build`, then the array.
+ */
+void d_static_batches_destroy(d_Array **batches);
+void d_static_batch_submit(d_StaticBatch *batch, d_RenderQueue *queue);
+
+#pragma endregion
+
+#pragma region Clusters
+
+// view space cluster grid: tiles across the screen, slices spaced
+// logarithmically between the camera's near and far planes
+#define D_CLUSTER_X 16
+#define D_CLUSTER_Y 9
+#define D_CLUSTER_Z 24
+#define D_CLUSTER_COUNT (D_CLUSTER_X * D_CLUSTER_Y * D_CLUSTER_Z)
+// lights past this are dropped from a cluster
+#define D_CLUSTER_MAX_LIGHTS 128
+// light contribution at which a light's range ends
+#define D_CLUSTER_LIGHT_CUTOFF (1.0f / 256.0f)
+
+// `ClusterData` block (std140), shared by every program on
+// `D_UNIFORM_BLOCK_CLUSTERS`.
+typedef struct d_ClusterData {
+  // x, y and z cluster counts, light count
+  d_uint size[4];
+  // near, far, slice scale, slice bias
+  float depth[4];
+  // x, y, width, height of the viewport the grid covers
+  float viewport[4];
+} ClusterData, d_ClusterData;
+
+// One light of the `cluster_lights` buffer texture, four RGBA32F texels.
+// Point lights have a `spot_scale` of 0 and a `spot_offset` of 1, lights
+// without a shadow a `shadow_view` of -1.
+typedef struct d_ClusterLightData {
+  float position[3];
+  float range;
+  float color[3];
+  float intensity;
+  float direction[3];
+  float spot_scale;
+  float a;
+  float b;
+  float spot_offset;
+  float shadow_view;
+} ClusterLightData, d_ClusterLightData;
+
+// Point and spot lights binned into a view space grid every frame, so a
+// fragment only shades the lights of its own cluster.
+typedef struct d_ClusterGrid {
+  d_ClusterLightData *lights;
+  // view space bounding spheres (xyz center, w range), same order
+  d_Vec4 *spheres;
+  d_uint light_count;
+  d_uint light_capacity;
+
+  // view space bounds of each cluster, rebuilt when the projection changes
+  d_AABB *bounds;
+  d_Mat4 projection;
+  float near_plane;
+  float far_plane;
+
+  // offset and count into `indices` per cluster
+  d_uint *grid;
+  // light indices, one list per slice while binning, then packed in place
+  // into one list that `grid` offsets into
+  d_uint *indices;
+  d_uint slice_counts[D_CLUSTER_Z];
+  d_uint index_count;
+
+  GLuint grid_buffer;
+  GLuint grid_texture;
+  GLuint index_buffer;
+  GLuint index_texture;
+  size_t index_buffer_size;
+  GLuint light_buffer;
+  GLuint light_texture;
+  size_t light_buffer_size;
+  d_UniformBuffer *uniforms;
+} ClusterGrid, d_ClusterGrid;
+
+d_ClusterGrid *d_cluster_grid_create();
+void d_cluster_grid_destroy(d_ClusterGrid **grid);
+/**
+ * @brief Bins every point and spot light of `manager` into the grid, one
+ * slice per `d_parallel_for` index, uploads the light lists and binds them
+ * for the fragment shader. Call once per frame after `d_camera_update`.
+ *
+ * @param grid
+ * @param manager Lights to bin, all of them regardless of the renderer's
+ * `max_*_lights`.
+ * @param camera Its `view` and `projection` must be up to date.
+ * @param viewport Area the camera renders to.
+ */
+void d_cluster_grid_build(d_ClusterGrid *grid, d_LightManager *manager,
+                          d_Camera *camera, const d_Viewport *viewport);
+/**
+ * @brief Packs a point or spot light the way the `cluster_lights` texture
+ * and the `object_lights` uniform read it.
+ *
+ * @param light
+ * @param far Range of lights without falloff.
+ * @param data
+ */
+void d_cluster_light_write(const d_Light *light, const float far,
+                           d_ClusterLightData *data);
+
+#pragma endregion
+
+#pragma region Shadows
+
+// atlas tiles per side, one shadow view each
+#define D_SHADOW_ATLAS_TILES 4
+// cascade split spacing, 1 is logarithmic and 0 uniform
+#define D_SHADOW_SPLIT_LAMBDA 0.75f
+// cascades snap to this fraction of their radius, so the cached static tile
+// of a cascade is only redrawn once the camera has moved that far
+#define D_SHADOW_CACHE_STEP 0.25f
+// near plane of spot light shadows
+#define D_SHADOW_SPOT_NEAR 0.05f
+
+// A mesh range drawn into the shadow atlas.
+typedef struct d_ShadowCaster {
+  d_VAO *vao;
+  d_uint index_count;
+  d_uint first_index;
+  d_uint base_vertex;
+  d_Mat4 model;
+  // world space bounds, tested against each view
+  d_AABB bounds;
+} ShadowCaster, d_ShadowCaster;
+
+// One tile of the atlas, a directional light cascade or a spot light.
+typedef struct d_ShadowView {
+  d_Mat4 view_projection;
+  d_Frustum frustum;
+  // matrix the static casters of the cached tile were drawn with
+  d_Mat4 cached;
+  bool cache_valid;
+} ShadowView, d_ShadowView;
+
+// Depth atlas shared by every shadow casting light. Static casters are drawn
+// into a second atlas that is kept between frames and only redrawn for a view
+// whose matrix changed or whose casters moved, then each frame it is copied
+// into the sampled atlas and the dynamic casters are drawn on top.
+typedef struct d_ShadowAtlas {
+  d_Renderer *renderer;
+
+  d_uint width;
+  d_uint height;
+  d_uint tile_width;
+  d_uint tile_height;
+
+  // sampled by the shaders through `shadow_atlas`, with depth comparison
+  GLuint texture;
+  GLuint framebuffer;
+  // static casters only
+  GLuint static_texture;
+  GLuint static_framebuffer;
+
+  d_ShadowView views[D_SHADOW_MAX_VIEWS];
+  d_uint view_count;
+
+  // d_ShadowCaster, cleared by `d_shadow_atlas_begin`
+  d_Array *static_casters;
+  d_Array *dynamic_casters;
+  // hash of the static casters, a change invalidates every cached tile
+  uint64_t static_hash;
+  uint64_t cached_static_hash;
+
+  // cascades end here or at the camera's far plane, whichever is closer
+  float max_distance;
+
+  // CPU copy of the `ShadowData` block
+  d_ShadowData data;
+
+  GLuint program;
+  GLint model_location;
+  GLint view_projection_location;
+  const d_PipelineState *pipeline;
+} ShadowAtlas, d_ShadowAtlas;
+
+/**
+ * @brief Creates an atlas of `renderer->shadow_map_size_w` by
+ * `renderer->shadow_map_size_h` depth texels. The two depth textures are only
+ * allocated by the first `d_shadow_atlas_render` with a shadow view, so a
+ * scene without shadow casting lights does not pay for them.
+ */
+d_ShadowAtlas *d_shadow_atlas_create(d_Renderer *renderer);
+void d_shadow_atlas_destroy(d_ShadowAtlas **atlas);
+/**
+ * @brief Places this frame's shadow views: the cascades of the first
+ * directional light and one view per spot light that casts shadows, as far
+ * as the atlas has tiles. Sets each light's `shadow_view`, so call it before
+ * the light data is packed (`d_cluster_grid_build`, `d_render_queue_submit`).
+ * Point lights cast no shadows.
+ *
+ * @param atlas
+ * @param camera Its `view` and `projection` must be up to date.
+ */
+void d_shadow_atlas_begin(d_ShadowAtlas *atlas, d_Camera *camera);
+/**
+ * @brief Adds a caster for this frame. Static casters are only redrawn when
+ * a view changes or the static casters differ from the previous frame.
+ */
+void d_shadow_atlas_add(d_ShadowAtlas *atlas, const d_ShadowCaster *caster,
+                        const bool is_static);
+/**
+ * @brief Adds the mesh renderer's full detail mesh, static when `is_static`.
+ * Skipped once merged into a static batch.
+ */
+void d_mesh_renderer_cast_shadow(d_MeshRenderer *mesh_renderer,
+                                 d_ShadowAtlas *atlas);
+void d_static_batch_cast_shadow(d_StaticBatch *batch, d_ShadowAtlas *atlas);
+/**
+ * @brief Forces the cached static tiles overlapping `bounds` to be redrawn,
+ * every tile when `bounds` is `NULL`.
+ */
+void d_shadow_atlas_invalidate(d_ShadowAtlas *atlas, const d_AABB *bounds);
+/**
+ * @brief Draws the views, uploads the `ShadowData` block and binds the atlas
+ * to `D_TEXTURE_UNIT_SHADOW_ATLAS`. Call after `d_shadow_atlas_begin` and the
+ * casters, before the frame is drawn.
+ *
+ * @param atlas
+ * @param viewport Restored once the atlas is drawn.
+ */
+void d_shadow_atlas_render(d_ShadowAtlas *atlas, const d_Viewport *viewport);
+
+#pragma endregion
+
+#pragma region Deferred
+
+// texture units the light pass reads the G-buffer from
+#define D_DEFERRED_UNIT_ALBEDO 0
+#define D_DEFERRED_UNIT_NORMAL 1
+#define D_DEFERRED_UNIT_DEPTH 2
+#define D_DEFERRED_UNIT_LIGHT 3
+// light volume tessellation
+#define D_DEFERRED_SPHERE_RINGS 8
+#define D_DEFERRED_SPHERE_SEGMENTS 12
+#define D_DEFERRED_CONE_SEGMENTS 16
+
+// Deferred shading for `DUCKY_RENDER_DEFERRED`. Opaque geometry writes its
+// surface into the G-buffer, then the directional lights and ambient are
+// shaded over the whole screen and every point and spot light draws its
+// volume (a sphere or a cone). Each volume is drawn twice: first into the
+// stencil only, counting where a G-buffer surface lies inside it, then
+// shading just those pixels, so a light costs what it covers on screen.
+// The result is copied to the default framebuffer together with its depth,
+// so forward drawn geometry (transparent, no `deferred` shader) composes on
+// top.
+typedef struct d_DeferredRenderer {
+  d_Renderer *renderer;
+
+  // G-buffer size, follows the viewport given to `d_deferred_renderer_begin`
+  d_uint width;
+  d_uint height;
+  int viewport[4];
+
+  GLuint framebuffer;
+  // rgb albedo, a specular strength
+  GLuint albedo_texture;
+  // xyz world space normal, w 1 for unlit surfaces
+  GLuint normal_texture;
+  // view space distance, 0 where nothing was drawn
+  GLuint depth_texture;
+  // shaded result
+  GLuint light_texture;
+  GLuint depth_stencil;
+
+  // camera of the frame, lights outside its frustum are skipped
+  d_Mat4 view_projection;
+  d_Frustum frustum;
+  float far_plane;
+
+  // ambient and directional lights, point and spot light volumes, and the
+  // copy to the default framebuffer, variants of one light shader
+  d_Shader *directional_shader;
+  d_Shader *volume_shader;
+  d_Shader *composite_shader;
+
+  // position only program of the stencil pass
+  GLuint stencil_program;
+  GLint stencil_mvp_location;
+
+  d_VAO *sphere_vao;
+  d_VBO *sphere_vbo;
+  d_EBO *sphere_ebo;
+  d_uint sphere_index_count;
+  d_VAO *cone_vao;
+  d_VBO *cone_vbo;
+  d_EBO *cone_ebo;
+  d_uint cone_index_count;
+  // full screen triangles come from `gl_VertexID`, but need a vertex array
+  d_VAO *empty_vao;
+
+  const d_PipelineState *stencil_pipeline;
+  const d_PipelineState *volume_pipeline;
+  const d_PipelineState *fullscreen_pipeline;
+  const d_PipelineState *composite_pipeline;
+} DeferredRenderer, d_DeferredRenderer;
+
+/**
+ * @brief Creates the light pass. The G-buffer is allocated by the first
+ * `d_deferred_renderer_begin`.
+ *
+ * @param renderer Shading only happens in its `DUCKY_RENDER_DEFERRED` mode.
+ * @param vertex_file_path Light shader, e.g.
+ * assets/shaders/deferred/light_vertex.glsl.
+ * @param fragment_file_path e.g. assets/shaders/deferred/light_fragment.glsl.
+ */
+d_DeferredRenderer *d_deferred_renderer_create(d_Renderer *renderer,
+                                               const char *vertex_file_path,
+                                               const char *fragment_file_path);
+void d_deferred_renderer_destroy(d_DeferredRenderer **deferred);
+/**
+ * @brief Sets up the frame, resizing the G-buffer to the viewport. Call after
+ * `d_camera_update`.
+ */
+void d_deferred_renderer_begin(d_DeferredRenderer *deferred, d_Camera *camera,
+                               const d_Viewport *viewport);
+/**
+ * @brief Binds and clears the G-buffer. Called by `d_render_queue_submit`
+ * before the opaque geometry.
+ */
+void d_deferred_renderer_begin_geometry(d_DeferredRenderer *deferred);
+/**
+ * @brief Shades the G-buffer with every light of the renderer's light manager
+ * and writes the result and its depth to the default framebuffer. Called by
+ * `d_render_queue_submit` after the opaque geometry.
+ */
+void d_deferred_renderer_shade(d_DeferredRenderer *deferred);
+
+#pragma endregion
+
+#pragma region DynamicResolution
+
+// frames of GPU timestamps in flight, a result is read this many frames late
+#define D_DYNAMIC_RESOLUTION_QUERIES 4
+// scale steps, a new scale also resizes the G-buffer
+#define D_DYNAMIC_RESOLUTION_STEP 0.05f
+
+// Renders the scene into an offscreen target at a fraction of the viewport's
+// size and scales it up into the viewport. The fraction follows the GPU time
+// of past frames, measured with timestamp queries, so heavy scenes keep their
+// frame rate by losing sharpness instead. The timestamps also span time the
+// GPU waits for the CPU, so the scale is only lowered when the GPU took
+// clearly longer than the CPU spent submitting the frame.
+//
+// Between `d_dynamic_resolution_begin` and `d_dynamic_resolution_end` the
+// viewport holds the scaled rectangle and `d_window_framebuffer` the target,
+// so the camera, clusters, shadows, G-buffer and render queue follow without
+// knowing about it.
+typedef struct d_DynamicResolution {
+  // sized for `max_scale` of the viewport, frames only use its lower left
+  d_Framebuffer *target;
+
+  // fraction of the viewport's width and height rendered
+  float scale;
+  float min_scale;
+  float max_scale;
+  // GPU time a frame should take, in nanoseconds
+  double target_gpu_time;
+  // smoothed GPU time of finished frames at the current scale, 0 until one
+  // finished
+  double gpu_time;
+  // smoothed CPU time between `begin` and `end` of the same frames
+  double cpu_time;
+  d_uint frames_since_change;
+
+  // start and end timestamp of each frame in flight
+  GLuint queries[D_DYNAMIC_RESOLUTION_QUERIES][2];
+  // CPU time between `begin` and `end` of each frame in flight
+  uint64_t cpu_spans[D_DYNAMIC_RESOLUTION_QUERIES];
+  uint64_t cpu_start;
+  bool pending[D_DYNAMIC_RESOLUTION_QUERIES];
+  d_uint next;
+  bool timing;
+
+  // between `begin` and `end`: the viewport and its own rectangle, and the
+  // framebuffer frames went to before
+  d_Viewport *viewport;
+  int window_rect[4];
+  d_uint window_framebuffer;
+  bool active;
+} DynamicResolution, d_DynamicResolution;
+
+/**
+ * @brief Creates the scaler, starting at full resolution. The target is
+ * allocated by the first `d_dynamic_resolution_begin`.
+ *
+ * @param target_frame_time GPU time per frame to hold, in milliseconds,
+ * e.g. 16.0 for 60 fps with some headroom.
+ */
+d_DynamicResolution *d_dynamic_resolution_create(const float target_frame_time);
+void d_dynamic_resolution_destroy(d_DynamicResolution **resolution);
+/**
+ * @brief Limits the scale, `0.5` to `1.0` by default. A `max_scale` above 1
+ * supersamples.
+ */
+void d_dynamic_resolution_set_scale_range(d_DynamicResolution *resolution,
+                                          const float min_scale,
+                                          const float max_scale);
+/**
+ * @brief Picks the frame's scale from finished timings and redirects drawing
+ * into the target. Call after `d_window_update` and before anything reads
+ * the viewport.
+ */
+void d_dynamic_resolution_begin(d_DynamicResolution *resolution,
+                                d_Viewport *viewport);
+/**
+ * @brief Restores the viewport and scales the frame up into it. Call before
+ * `d_window_swap_buffers`.
+ */
+void d_dynamic_resolution_end(d_DynamicResolution *resolution);
 
 #pragma endregion
 
@@ -130,6 +1158,10 @@ d_Transform *d_transform_create() {
 
   transform->children = d_array_create(d_Transform, 1);
 
+  // ids start at 1, 0 is never a valid transform
+  static d_uint next_id = 1;
+  transform->id = next_id++;
+
   return transform;
 }
 
@@ -172,6 +1204,25 @@ void d_transform_update(d_Transform *target) {
     target->rotation.z += 360;
 }
 
+d_Mat4 d_transform_get_matrix(const d_Transform *target) {
+  if (target == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "target is NULL.");
+    return d_mat4(true);
+  }
+
+  d_Mat4 translation = d_mat4(true);
+  d_mat4_translate(&translation, &target->position);
+
+  d_Mat4 rotation = d_mat4(true);
+  d_mat4_rotate(&rotation, &target->rotation);
+
+  d_Mat4 scale = d_mat4(true);
+  d_mat4_scale(&scale, &target->scale);
+
+  d_Mat4 translation_rotation = d_mat4_multiply(&translation, &rotation);
+  return d_mat4_multiply(&translation_rotation, &scale);
+}
+
 #pragma endregion
 
 #pragma region Mesh
@@ -182,6 +1233,81 @@ d_Vertex d_vertex_create(d_Vec3 pos, d_Vec3 norm, d_Vec2 UV, d_uint idx) {
   return vertex;
 }
 
+d_AABB d_aabb_empty() {
+  d_AABB box;
+  box.min = d_vec3(INFINITY, INFINITY, INFINITY);
+  box.max = d_vec3(-INFINITY, -INFINITY, -INFINITY);
+  return box;
+}
+
+void d_aabb_grow(d_AABB *box, const d_Vec3 *point) {
+  for (int i = 0; i < 3; i++) {
+    if (point->data[i] < box->min.data[i])
+      box->min.data[i] = point->data[i];
+    if (point->data[i] > box->max.data[i])
+      box->max.data[i] = point->data[i];
+  }
+}
+
+d_Vec3 d_aabb_center(const d_AABB *box) {
+  return d_vec3((box->min.x + box->max.x) * 0.5f,
+                (box->min.y + box->max.y) * 0.5f,
+                (box->min.z + box->max.z) * 0.5f);
+}
+
+d_AABB d_aabb_transform(const d_AABB *box, const d_Mat4 *matrix) {
+  const float *m = matrix->data;
+  d_Vec3 center = d_aabb_center(box);
+  d_Vec3 extent = d_vec3((box->max.x - box->min.x) * 0.5f,
+                         (box->max.y - box->min.y) * 0.5f,
+                         (box->max.z - box->min.z) * 0.5f);
+
+  // the new extent along each axis is the extent projected by |M|
+  d_AABB result;
+  for (int row = 0; row < 3; row++) {
+    float c = m[row] * center.x + m[4 + row] * center.y +
+              m[8 + row] * center.z + m[12 + row];
+    float e = fabsf(m[row]) * extent.x + fabsf(m[4 + row]) * extent.y +
+              fabsf(m[8 + row]) * extent.z;
+    result.min.data[row] = c - e;
+    result.max.data[row] = c + e;
+  }
+  return result;
+}
+
+d_GeometryBuffer *d_mesh_geometry = NULL;
+
+float d_lod_screen_sizes[D_MAX_LODS - 1] = {0.5f, 0.25f, 0.1f};
+
+d_GeometryBuffer *d_mesh_geometry_get() {
+  if (d_mesh_geometry != NULL) {
+    return d_mesh_geometry;
+  }
+
+  d_mesh_geometry = d_geometry_buffer_create(sizeof(d_Vertex), 65536, 196608);
+  if (d_mesh_geometry == NULL) {
+    return NULL;
+  }
+  // layouts match assets/shaders/vertex.glsl
+  d_geometry_buffer_add_attrib(d_mesh_geometry, 0, 3, GL_FLOAT,
+                               offsetof(d_Vertex, position));
+  // for assets/shaders/depth_vertex.glsl
+  d_geometry_buffer_add_position_stream(d_mesh_geometry,
+                                        offsetof(d_Vertex, position));
+  d_geometry_buffer_add_attrib(d_mesh_geometry, 1, 2, GL_FLOAT,
+                               offsetof(d_Vertex, uv));
+  d_geometry_buffer_add_attrib(d_mesh_geometry, 2, 3, GL_FLOAT,
+                               offsetof(d_Vertex, normal));
+  return d_mesh_geometry;
+}
+
+void d_mesh_geometry_destroy() {
+  if (d_mesh_geometry == NULL) {
+    return;
+  }
+  d_geometry_buffer_destroy(&d_mesh_geometry);
+}
+
 d_Mesh *d_mesh_load(const char *path) {
   if (path == NULL) {
     d_throw_error(DUCKY_NULL_REFERENCE, "path is NULL.");
@@ -255,6 +1381,33 @@ d_Mesh *d_mesh_load(const char *path) {
   }
 
   ufbx_free_scene(scene);
+
+  // bounding sphere around the box center, tighter than the box's half
+  // diagonal for most meshes
+  mesh->bounds = d_aabb_empty();
+  for (size_t i = 0; i < mesh->vertices->length; i++) {
+    d_Vertex *vertex = &((d_Vertex *)mesh->vertices->data)[i];
+    d_aabb_grow(&mesh->bounds, &vertex->position);
+  }
+  if (mesh->vertices->length == 0) {
+    mesh->bounds.min = d_vec3(0.0f, 0.0f, 0.0f);
+    mesh->bounds.max = d_vec3(0.0f, 0.0f, 0.0f);
+  }
+  mesh->sphere_center = d_aabb_center(&mesh->bounds);
+  mesh->sphere_radius = 0.0f;
+  for (size_t i = 0; i < mesh->vertices->length; i++) {
+    d_Vertex *vertex = &((d_Vertex *)mesh->vertices->data)[i];
+    d_Vec3 offset = d_vec3_sub(&vertex->position, &mesh->sphere_center);
+    float distance = d_vec3_len(&offset);
+    if (distance > mesh->sphere_radius)
+      mesh->sphere_radius = distance;
+  }
+
+  mesh->lods[0].first_index = 0;
+  mesh->lods[0].index_count = mesh->indices->length;
+  mesh->lods[0].error = 0.0f;
+  mesh->lod_count = 1;
+
   return mesh;
 }
 
@@ -268,84 +1421,598 @@ void d_mesh_destroy(d_Mesh **mesh) {
     return;
   }
 
+  d_array_destroy(&(*mesh)->vertices);
+  d_array_destroy(&(*mesh)->indices);
   free(*mesh);
   *mesh = NULL;
 }
 
-#pragma endregion
+d_Array *d_mesh_cache = NULL;
 
-#pragma region Object
+d_MeshCacheEntry *d_mesh_acquire(const char *path) {
+  if (path == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "path is NULL.");
+    return NULL;
+  }
 
-d_Object *d_object_create(char *name) {
-  if (name == NULL) {
-    name = "new_object";
+  if (d_mesh_cache != NULL) {
+    for (d_uint i = 0; i < d_mesh_cache->length; i++) {
+      d_MeshCacheEntry *entry =
+          d_array_get(d_mesh_cache, d_MeshCacheEntry *, i);
+      if (strcmp(entry->path, path) == 0) {
+        entry->references++;
+        return entry;
+      }
+    }
   }
 
-  d_Object *new_object = malloc(sizeof(d_Object));
-  if (new_object == NULL) {
-    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc new_object.");
+  d_Mesh *mesh = d_mesh_load(path);
+  if (mesh == NULL) {
     return NULL;
   }
+  // the simplification is the expensive part of loading, it runs once here
+  // and every renderer of the path shares the levels
+  d_mesh_generate_lods(mesh, D_MAX_LODS - 1);
 
-  new_object->name = name;
-  new_object->transform = d_transform_create();
+  d_MeshCacheEntry *entry = malloc(sizeof(d_MeshCacheEntry));
+  if (entry == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc mesh cache entry.");
+    d_mesh_destroy(&mesh);
+    return NULL;
+  }
+  entry->path = d_str_append("", path);
+  entry->mesh = mesh;
+  entry->references = 1;
+  memset(&entry->geometry, 0, sizeof(d_GeometryRange));
+  d_geometry_buffer_alloc(d_mesh_geometry_get(), mesh->vertices->data,
+                          mesh->vertices->length,
+                          (const d_uint *)mesh->indices->data,
+                          mesh->indices->length, &entry->geometry);
 
-  return new_object;
+  if (d_mesh_cache == NULL) {
+    d_mesh_cache = d_array_create(d_MeshCacheEntry *, 8);
+  }
+  d_array_add(d_mesh_cache, &entry);
+  return entry;
 }
 
-void d_object_destroy(d_Object **target) {
-  if (target == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "target (d_Object **) is NULL.");
+void d_mesh_release(d_Mesh *mesh) {
+  if (mesh == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "mesh is NULL.");
     return;
   }
-  if (*target == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE, "target (d_Object *) is NULL");
+  if (d_mesh_cache == NULL) {
+    d_throw_error(DUCKY_FAILURE, "mesh was not acquired.");
     return;
   }
 
-  d_transform_destroy(&(*target)->transform);
-  free(*target);
-  *target = NULL;
+  for (d_uint i = 0; i < d_mesh_cache->length; i++) {
+    d_MeshCacheEntry *entry = d_array_get(d_mesh_cache, d_MeshCacheEntry *, i);
+    if (entry->mesh != mesh) {
+      continue;
+    }
+
+    entry->references--;
+    if (entry->references > 0) {
+      return;
+    }
+
+    if (d_mesh_geometry != NULL) {
+      d_geometry_buffer_free(d_mesh_geometry, &entry->geometry);
+    }
+    d_mesh_destroy(&entry->mesh);
+    free(entry->path);
+    free(entry);
+    d_array_remove(d_mesh_cache, i);
+    if (d_mesh_cache->length == 0) {
+      d_array_destroy(&d_mesh_cache);
+    }
+    return;
+  }
+
+  d_throw_error(DUCKY_FAILURE, "mesh was not acquired.");
 }
 
 #pragma endregion
 
-#pragma region MeshRenderer
+#pragma region LOD
 
-d_MeshRenderer *d_mesh_renderer_create(const char *mesh_path) {
+// Symmetric 4x4 quadric, upper triangle:
+// a00 a01 a02 a03 a11 a12 a13 a22 a23 a33
+typedef struct d_Quadric {
+  double a[10];
+} Quadric, d_Quadric;
 
-  d_MeshRenderer *mesh_renderer = malloc(sizeof(d_MeshRenderer));
+typedef struct d_LODEdge {
+  uint64_t key;
+  d_uint triangle;
+  d_uint corner;
+} LODEdge, d_LODEdge;
 
-  mesh_renderer->transform = d_transform_create();
-  mesh_renderer->mesh = d_mesh_load(mesh_path);
-  mesh_renderer->material = NULL;
+typedef struct d_LODCollapse {
+  double cost;
+  d_uint from;
+  d_uint to;
+} LODCollapse, d_LODCollapse;
 
-  return mesh_renderer;
+void d_quadric_add_plane_internal(d_Quadric *q, const double a, const double b,
+                                  const double c, const double d,
+                                  const double weight) {
+  q->a[0] += weight * a * a;
+  q->a[1] += weight * a * b;
+  q->a[2] += weight * a * c;
+  q->a[3] += weight * a * d;
+  q->a[4] += weight * b * b;
+  q->a[5] += weight * b * c;
+  q->a[6] += weight * b * d;
+  q->a[7] += weight * c * c;
+  q->a[8] += weight * c * d;
+  q->a[9] += weight * d * d;
 }
 
-void d_mesh_renderer_destroy(d_MeshRenderer **mesh_renderer) {
-  if (mesh_renderer == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE,
-                  "mesh_renderer (d_MeshRenderer **) is NULL.");
-    return;
-  }
-  if (*mesh_renderer == NULL) {
-    d_throw_error(DUCKY_NULL_REFERENCE,
-                  "mesh_renderer (d_MeshRenderer *) is NULL.");
-    return;
-  }
+double d_quadric_error_internal(const d_Quadric *q, const d_Vec3 *p) {
+  double x = p->x, y = p->y, z = p->z;
+  const double *a = q->a;
+  double error = a[0] * x * x + 2.0 * a[1] * x * y + 2.0 * a[2] * x * z +
+                 2.0 * a[3] * x + a[4] * y * y + 2.0 * a[5] * y * z +
+                 2.0 * a[6] * y + a[7] * z * z + 2.0 * a[8] * z + a[9];
+  return error > 0.0 ? error : 0.0;
+}
 
-  d_transform_destroy(&(*mesh_renderer)->transform);
-  d_mesh_destroy(&(*mesh_renderer)->mesh);
+int d_lod_compare_edges_internal(const void *a, const void *b) {
+  uint64_t ka = ((const d_LODEdge *)a)->key;
+  uint64_t kb = ((const d_LODEdge *)b)->key;
+  return ka < kb ? -1 : ka > kb;
+}
 
-  d_material_destroy(&(*mesh_renderer)->material);
+int d_lod_compare_collapses_internal(const void *a, const void *b) {
+  double ca = ((const d_LODCollapse *)a)->cost;
+  double cb = ((const d_LODCollapse *)b)->cost;
+  return ca < cb ? -1 : ca > cb;
+}
 
-  free(*mesh_renderer);
-  *mesh_renderer = NULL;
+d_Vec3 d_lod_cross_internal(const d_Vec3 *p0, const d_Vec3 *p1,
+                            const d_Vec3 *p2) {
+  d_Vec3 e0 = d_vec3_sub(p1, p0);
+  d_Vec3 e1 = d_vec3_sub(p2, p0);
+  return d_vec3(e0.y * e1.z - e0.z * e1.y, e0.z * e1.x - e0.x * e1.z,
+                e0.x * e1.y - e0.y * e1.x);
 }
 
-void d_mesh_renderer_update(d_MeshRenderer *mesh_renderer) {
-  if (mesh_renderer == NULL) {
+// Maps every vertex to the first vertex with the same position, so UV and
+// normal seams do not stop collapses.
+void d_lod_weld_internal(const d_Vertex *vertices, const d_uint vertex_count,
+                         d_uint *remap) {
+  d_uint table_size = 16;
+  while (table_size < vertex_count * 2)
+    table_size *= 2;
+  d_uint *table = malloc(sizeof(d_uint) * table_size);
+  if (table == NULL) {
+    for (d_uint i = 0; i < vertex_count; i++)
+      remap[i] = i;
+    return;
+  }
+  memset(table, 0xFF, sizeof(d_uint) * table_size);
+
+  for (d_uint i = 0; i < vertex_count; i++) {
+    const d_Vec3 *position = &vertices[i].position;
+    d_uint slot = (d_uint)d_hash(position, sizeof(d_Vec3), D_HASH_SEED) &
+                  (table_size - 1);
+    while (true) {
+      d_uint other = table[slot];
+      if (other == 0xFFFFFFFFu) {
+        table[slot] = i;
+        remap[i] = i;
+        break;
+      }
+      if (memcmp(&vertices[other].position, position, sizeof(d_Vec3)) == 0) {
+        remap[i] = other;
+        break;
+      }
+      slot = (slot + 1) & (table_size - 1);
+    }
+  }
+  free(table);
+}
+
+// Quadric error simplification by half-edge collapses. Vertices only ever
+// collapse onto existing vertices, so the result indexes the same vertex
+// buffer. `result` must hold `count` indices.
+d_uint d_lod_simplify_internal(const d_Vertex *vertices,
+                               const d_uint vertex_count, const d_uint *remap,
+                               const d_uint *indices, const d_uint count,
+                               const d_uint target, d_uint *result,
+                               float *error) {
+  d_uint triangle_count = count / 3;
+  memcpy(result, indices, sizeof(d_uint) * triangle_count * 3);
+  *error = 0.0f;
+
+  d_Quadric *quadrics = calloc(vertex_count, sizeof(d_Quadric));
+  d_uint *collapse = malloc(sizeof(d_uint) * vertex_count);
+  bool *locked = malloc(sizeof(bool) * vertex_count);
+  d_uint *offsets = malloc(sizeof(d_uint) * (vertex_count + 1));
+  d_uint *adjacency = malloc(sizeof(d_uint) * triangle_count * 3);
+  d_LODEdge *edges = malloc(sizeof(d_LODEdge) * triangle_count * 3);
+  d_LODCollapse *collapses = malloc(sizeof(d_LODCollapse) * triangle_count * 3);
+  if (quadrics == NULL || collapse == NULL || locked == NULL ||
+      offsets == NULL || adjacency == NULL || edges == NULL ||
+      collapses == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc LOD data.");
+    triangle_count = 0;
+    goto cleanup;
+  }
+
+  // face quadrics, weighted by area
+  for (d_uint t = 0; t < triangle_count; t++) {
+    const d_Vec3 *p0 = &vertices[result[t * 3 + 0]].position;
+    const d_Vec3 *p1 = &vertices[result[t * 3 + 1]].position;
+    const d_Vec3 *p2 = &vertices[result[t * 3 + 2]].position;
+    d_Vec3 normal = d_lod_cross_internal(p0, p1, p2);
+    double length = d_vec3_len(&normal);
+    if (length <= 0.0) {
+      continue;
+    }
+
+    double a = normal.x / length, b = normal.y / length, c = normal.z / length;
+    double d = -(a * p0->x + b * p0->y + c * p0->z);
+    for (int k = 0; k < 3; k++) {
+      d_quadric_add_plane_internal(&quadrics[remap[result[t * 3 + k]]], a, b,
+                                   c, d, length * 0.5);
+    }
+  }
+
+  // open borders get a plane perpendicular to their face, so they do not
+  // shrink inwards
+  for (d_uint t = 0; t < triangle_count; t++) {
+    for (d_uint k = 0; k < 3; k++) {
+      d_uint u = remap[result[t * 3 + k]];
+      d_uint v = remap[result[t * 3 + (k + 1) % 3]];
+      edges[t * 3 + k].key =
+          u < v ? (uint64_t)u << 32 | v : (uint64_t)v << 32 | u;
+      edges[t * 3 + k].triangle = t;
+      edges[t * 3 + k].corner = k;
+    }
+  }
+  qsort(edges, triangle_count * 3, sizeof(d_LODEdge),
+        d_lod_compare_edges_internal);
+  for (d_uint i = 0; i < triangle_count * 3;) {
+    d_uint run = 1;
+    while (i + run < triangle_count * 3 && edges[i + run].key == edges[i].key)
+      run++;
+
+    if (run == 1) {
+      d_uint t = edges[i].triangle;
+      d_uint k = edges[i].corner;
+      const d_Vec3 *p0 = &vertices[result[t * 3 + k]].position;
+      const d_Vec3 *p1 = &vertices[result[t * 3 + (k + 1) % 3]].position;
+      const d_Vec3 *p2 = &vertices[result[t * 3 + (k + 2) % 3]].position;
+      d_Vec3 normal = d_lod_cross_internal(p0, p1, p2);
+      d_Vec3 edge = d_vec3_sub(p1, p0);
+      // perpendicular to the face, containing the edge
+      d_Vec3 side = d_vec3(edge.y * normal.z - edge.z * normal.y,
+                           edge.z * normal.x - edge.x * normal.z,
+                           edge.x * normal.y - edge.y * normal.x);
+      double length = d_vec3_len(&side);
+      if (length > 0.0) {
+        double a = side.x / length, b = side.y / length, c = side.z / length;
+        double d = -(a * p0->x + b * p0->y + c * p0->z);
+        double weight = 10.0 * d_vec3_len(&edge) * d_vec3_len(&edge);
+        d_quadric_add_plane_internal(&quadrics[edges[i].key >> 32], a, b, c, d,
+                                     weight);
+        d_quadric_add_plane_internal(&quadrics[edges[i].key & 0xFFFFFFFFu], a,
+                                     b, c, d, weight);
+      }
+    }
+    i += run;
+  }
+
+  d_uint target_triangles = target / 3;
+  for (int pass = 0; pass < 64 && triangle_count > target_triangles; pass++) {
+    // vertex -> triangle adjacency of the current triangles
+    memset(offsets, 0, sizeof(d_uint) * (vertex_count + 1));
+    for (d_uint i = 0; i < triangle_count * 3; i++)
+      offsets[remap[result[i]] + 1]++;
+    for (d_uint v = 0; v < vertex_count; v++)
+      offsets[v + 1] += offsets[v];
+    for (d_uint i = 0; i < triangle_count * 3; i++)
+      adjacency[offsets[remap[result[i]]]++] = i / 3;
+    // the fill moved every offset to the start of the next vertex
+    for (d_uint v = vertex_count; v > 0; v--)
+      offsets[v] = offsets[v - 1];
+    offsets[0] = 0;
+
+    d_uint collapse_count = 0;
+    for (d_uint t = 0; t < triangle_count; t++) {
+      for (d_uint k = 0; k < 3; k++) {
+        d_uint u = remap[result[t * 3 + k]];
+        d_uint v = remap[result[t * 3 + (k + 1) % 3]];
+        // interior edges show up twice, locking drops the second one
+        if (u == v) {
+          continue;
+        }
+
+        d_Quadric sum = quadrics[u];
+        for (int j = 0; j < 10; j++)
+          sum.a[j] += quadrics[v].a[j];
+        double cost_uv = d_quadric_error_internal(&sum, &vertices[v].position);
+        double cost_vu = d_quadric_error_internal(&sum, &vertices[u].position);
+
+        d_LODCollapse *entry = &collapses[collapse_count++];
+        entry->cost = cost_uv <= cost_vu ? cost_uv : cost_vu;
+        entry->from = cost_uv <= cost_vu ? u : v;
+        entry->to = cost_uv <= cost_vu ? v : u;
+      }
+    }
+    qsort(collapses, collapse_count, sizeof(d_LODCollapse),
+          d_lod_compare_collapses_internal);
+
+    for (d_uint v = 0; v < vertex_count; v++) {
+      collapse[v] = v;
+      locked[v] = false;
+    }
+
+    d_uint removed = 0;
+    d_uint applied = 0;
+    for (d_uint i = 0; i < collapse_count; i++) {
+      if (triangle_count - removed <= target_triangles) {
+        break;
+      }
+
+      d_uint from = collapses[i].from;
+      d_uint to = collapses[i].to;
+      if (locked[from] == true || locked[to] == true) {
+        continue;
+      }
+
+      // reject collapses that flip a remaining triangle
+      bool flips = false;
+      d_uint shared = 0;
+      for (d_uint a = offsets[from]; a < offsets[from + 1]; a++) {
+        d_uint t = adjacency[a];
+        d_uint corners[3] = {remap[result[t * 3]], remap[result[t * 3 + 1]],
+                             remap[result[t * 3 + 2]]};
+        if (corners[0] == to || corners[1] == to || corners[2] == to) {
+          shared++;
+          continue;
+        }
+
+        d_Vec3 before[3], after[3];
+        for (int k = 0; k < 3; k++) {
+          before[k] = vertices[corners[k]].position;
+          after[k] = corners[k] == from ? vertices[to].position : before[k];
+        }
+        d_Vec3 n0 = d_lod_cross_internal(&before[0], &before[1], &before[2]);
+        d_Vec3 n1 = d_lod_cross_internal(&after[0], &after[1], &after[2]);
+        if (n0.x * n1.x + n0.y * n1.y + n0.z * n1.z <= 0.0f) {
+          flips = true;
+          break;
+        }
+      }
+      if (flips == true) {
+        continue;
+      }
+
+      collapse[from] = to;
+      for (int j = 0; j < 10; j++)
+        quadrics[to].a[j] += quadrics[from].a[j];
+      // everything around `from` changes, keep it out of this pass
+      for (d_uint a = offsets[from]; a < offsets[from + 1]; a++) {
+        d_uint t = adjacency[a];
+        for (int k = 0; k < 3; k++)
+          locked[remap[result[t * 3 + k]]] = true;
+      }
+      locked[to] = true;
+
+      removed += shared;
+      applied++;
+      if ((float)sqrt(collapses[i].cost) > *error)
+        *error = (float)sqrt(collapses[i].cost);
+    }
+
+    if (applied == 0) {
+      break;
+    }
+
+    // apply the collapses and drop triangles that became degenerate
+    d_uint kept = 0;
+    for (d_uint t = 0; t < triangle_count; t++) {
+      d_uint corners[3];
+      for (int k = 0; k < 3; k++) {
+        d_uint index = result[t * 3 + k];
+        d_uint welded = remap[index];
+        corners[k] = collapse[welded] != welded ? collapse[welded] : index;
+      }
+      if (remap[corners[0]] == remap[corners[1]] ||
+          remap[corners[1]] == remap[corners[2]] ||
+          remap[corners[2]] == remap[corners[0]]) {
+        continue;
+      }
+      for (int k = 0; k < 3; k++)
+        result[kept * 3 + k] = corners[k];
+      kept++;
+    }
+    triangle_count = kept;
+  }
+
+cleanup:
+  free(quadrics);
+  free(collapse);
+  free(locked);
+  free(offsets);
+  free(adjacency);
+  free(edges);
+  free(collapses);
+  return triangle_count * 3;
+}
+
+void d_mesh_generate_lods(d_Mesh *mesh, const d_uint levels) {
+  if (mesh == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "mesh is NULL.");
+    return;
+  }
+
+  d_uint index_count = mesh->lods[0].index_count;
+  d_uint vertex_count = mesh->vertices->length;
+  mesh->lod_count = 1;
+  mesh->indices->length = index_count;
+  if (index_count < 3 || vertex_count == 0) {
+    return;
+  }
+
+  d_uint *remap = malloc(sizeof(d_uint) * vertex_count);
+  d_uint *source = malloc(sizeof(d_uint) * index_count);
+  d_uint *simplified = malloc(sizeof(d_uint) * index_count);
+  if (remap == NULL || source == NULL || simplified == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc LOD data.");
+    free(remap);
+    free(source);
+    free(simplified);
+    return;
+  }
+
+  const d_Vertex *vertices = (const d_Vertex *)mesh->vertices->data;
+  d_lod_weld_internal(vertices, vertex_count, remap);
+  memcpy(source, mesh->indices->data, sizeof(d_uint) * index_count);
+  d_uint source_count = index_count;
+
+  // each level simplifies the previous one to half its triangles
+  for (d_uint level = 1; level <= levels && level < D_MAX_LODS; level++) {
+    d_uint target = source_count / 2;
+    float error = 0.0f;
+    d_uint count =
+        d_lod_simplify_internal(vertices, vertex_count, remap, source,
+                                source_count, target, simplified, &error);
+    // not worth a level when the simplifier got stuck
+    if (count == 0 || count > source_count * 3 / 4) {
+      break;
+    }
+
+    d_MeshLOD *lod = &mesh->lods[mesh->lod_count++];
+    lod->first_index = mesh->indices->length;
+    lod->index_count = count;
+    lod->error = error;
+    for (d_uint i = 0; i < count; i++) {
+      d_array_add(mesh->indices, &simplified[i]);
+    }
+
+    memcpy(source, simplified, sizeof(d_uint) * count);
+    source_count = count;
+  }
+
+  free(remap);
+  free(source);
+  free(simplified);
+}
+
+d_uint d_mesh_select_lod(const d_Mesh *mesh, const d_uint current,
+                         const float screen_size) {
+  if (mesh == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "mesh is NULL.");
+    return 0;
+  }
+
+  d_uint lod = current < mesh->lod_count ? current : mesh->lod_count - 1;
+  // a level is left only once the size is clearly past its threshold, so
+  // objects near a threshold do not switch every frame
+  while (lod + 1 < mesh->lod_count &&
+         screen_size < d_lod_screen_sizes[lod] * (1.0f - D_LOD_HYSTERESIS)) {
+    lod++;
+  }
+  while (lod > 0 && screen_size > d_lod_screen_sizes[lod - 1] *
+                                       (1.0f + D_LOD_HYSTERESIS)) {
+    lod--;
+  }
+  return lod;
+}
+
+#pragma endregion
+
+#pragma region Object
+
+d_Object *d_object_create(char *name) {
+  if (name == NULL) {
+    name = "new_object";
+  }
+
+  d_Object *new_object = malloc(sizeof(d_Object));
+  if (new_object == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc new_object.");
+    return NULL;
+  }
+
+  new_object->name = name;
+  new_object->transform = d_transform_create();
+
+  return new_object;
+}
+
+void d_object_destroy(d_Object **target) {
+  if (target == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "target (d_Object **) is NULL.");
+    return;
+  }
+  if (*target == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "target (d_Object *) is NULL");
+    return;
+  }
+
+  d_transform_destroy(&(*target)->transform);
+  free(*target);
+  *target = NULL;
+}
+
+#pragma endregion
+
+#pragma region MeshRenderer
+
+d_MeshRenderer *d_mesh_renderer_create(const char *mesh_path) {
+
+  d_MeshRenderer *mesh_renderer = malloc(sizeof(d_MeshRenderer));
+
+  mesh_renderer->transform = d_transform_create();
+  mesh_renderer->mesh = NULL;
+  mesh_renderer->material = NULL;
+  mesh_renderer->shader = NULL;
+  mesh_renderer->pipeline = NULL;
+  memset(&mesh_renderer->geometry, 0, sizeof(d_GeometryRange));
+  mesh_renderer->is_static = false;
+  mesh_renderer->batched = false;
+  mesh_renderer->occlusion_query = false;
+  mesh_renderer->lod = 0;
+
+  d_MeshCacheEntry *entry = d_mesh_acquire(mesh_path);
+  if (entry != NULL) {
+    mesh_renderer->mesh = entry->mesh;
+    mesh_renderer->geometry = entry->geometry;
+  }
+
+  return mesh_renderer;
+}
+
+void d_mesh_renderer_destroy(d_MeshRenderer **mesh_renderer) {
+  if (mesh_renderer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "mesh_renderer (d_MeshRenderer **) is NULL.");
+    return;
+  }
+  if (*mesh_renderer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "mesh_renderer (d_MeshRenderer *) is NULL.");
+    return;
+  }
+
+  d_transform_destroy(&(*mesh_renderer)->transform);
+  if ((*mesh_renderer)->mesh != NULL) {
+    d_mesh_release((*mesh_renderer)->mesh);
+  }
+
+  free(*mesh_renderer);
+  *mesh_renderer = NULL;
+}
+
+void d_mesh_renderer_update(d_MeshRenderer *mesh_renderer) {
+  D_PROFILE_SCOPE("d_mesh_renderer_update");
+  if (mesh_renderer == NULL) {
     d_throw_error(DUCKY_NULL_REFERENCE, "mesh_renderer is NULL");
     return;
   }
@@ -358,6 +2025,77 @@ void d_mesh_renderer_update(d_MeshRenderer *mesh_renderer) {
   }
 }
 
+void d_mesh_renderer_submit(d_MeshRenderer *mesh_renderer,
+                            d_RenderQueue *queue) {
+  if (mesh_renderer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "mesh_renderer is NULL");
+    return;
+  }
+  if (mesh_renderer->material == NULL || mesh_renderer->shader == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "material and shader must not be NULL!");
+    return;
+  }
+  if (mesh_renderer->geometry.index_count == 0 ||
+      mesh_renderer->batched == true) {
+    return;
+  }
+
+  d_DrawItem item;
+  item.pipeline = mesh_renderer->pipeline;
+  item.pass = item.pipeline != NULL && item.pipeline->blending == true
+                  ? DUCKY_PASS_TRANSPARENT
+                  : DUCKY_PASS_OPAQUE;
+  item.shader = mesh_renderer->shader;
+  item.material = mesh_renderer->material;
+  item.vao = d_mesh_geometry->vao;
+  item.position_vao = d_mesh_geometry->position_vao;
+  item.mesh_id = mesh_renderer->geometry.id;
+  item.base_vertex = mesh_renderer->geometry.base_vertex;
+  item.model = d_transform_get_matrix(mesh_renderer->transform);
+
+  const d_Mesh *mesh = mesh_renderer->mesh;
+  if (queue->projection_scale > 0.0f && mesh->lod_count > 1) {
+    // largest axis scale of the model matrix
+    const float *m = item.model.data;
+    float scale = 0.0f;
+    for (int axis = 0; axis < 3; axis++) {
+      const float *c = &m[axis * 4];
+      float length = c[0] * c[0] + c[1] * c[1] + c[2] * c[2];
+      if (length > scale)
+        scale = length;
+    }
+    scale = sqrtf(scale);
+
+    d_Vec3 center = d_vec3(
+        m[0] * mesh->sphere_center.x + m[4] * mesh->sphere_center.y +
+            m[8] * mesh->sphere_center.z + m[12],
+        m[1] * mesh->sphere_center.x + m[5] * mesh->sphere_center.y +
+            m[9] * mesh->sphere_center.z + m[13],
+        m[2] * mesh->sphere_center.x + m[6] * mesh->sphere_center.y +
+            m[10] * mesh->sphere_center.z + m[14]);
+    d_Vec3 offset = d_vec3_sub(&center, &queue->camera_position);
+    float distance = d_vec3_len(&offset);
+    float radius = mesh->sphere_radius * scale;
+    float screen_size = distance > radius
+                            ? radius * queue->projection_scale / distance
+                            : FLT_MAX;
+    mesh_renderer->lod =
+        d_mesh_select_lod(mesh, mesh_renderer->lod, screen_size);
+  } else {
+    mesh_renderer->lod = 0;
+  }
+  const d_MeshLOD *lod = &mesh->lods[mesh_renderer->lod];
+  item.first_index = mesh_renderer->geometry.first_index + lod->first_index;
+  item.index_count = lod->index_count;
+  item.bounds = d_aabb_transform(&mesh_renderer->mesh->bounds, &item.model);
+  item.has_bounds = true;
+  item.query_id =
+      mesh_renderer->occlusion_query == true ? mesh_renderer->transform->id : 0;
+
+  d_render_queue_push(queue, &item);
+}
+
 #pragma endregion
 
 #pragma region Camera
@@ -376,7 +2114,12 @@ d_Camera *d_camera_create(float fov, float near, float far) {
   }
 
   d_Camera *camera = malloc(sizeof(d_Camera));
+  if (camera == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc camera.");
+    return NULL;
+  }
 
+  camera->transform = d_transform_create();
   camera->field_of_view = fov;
   camera->near_plane = near;
   camera->far_plane = far;
@@ -386,6 +2129,4167 @@ d_Camera *d_camera_create(float fov, float near, float far) {
   // done in the d_camera_update function
 
   camera->view = d_mat4(true);
+
+  return camera;
+}
+
+void d_camera_destroy(d_Camera **camera) {
+  if (camera == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "camera (d_Camera **) is NULL.");
+    return;
+  }
+  if (*camera == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "camera (d_Camera *) is NULL.");
+    return;
+  }
+
+  d_transform_destroy(&(*camera)->transform);
+  free(*camera);
+  *camera = NULL;
+}
+
+void d_camera_update(d_Camera *camera, const float aspect_ratio) {
+  if (camera == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "camera is NULL.");
+    return;
+  }
+
+  camera->projection = d_mat4(false);
+  d_mat4_perspective(&camera->projection, camera->field_of_view, aspect_ratio,
+                     camera->near_plane, camera->far_plane);
+
+  // the view is the inverse of the camera's rigid transform, scale is ignored
+  d_Mat4 translation = d_mat4(true);
+  d_mat4_translate(&translation, &camera->transform->position);
+  d_Mat4 rotation = d_mat4(true);
+  d_mat4_rotate(&rotation, &camera->transform->rotation);
+
+  camera->view = d_mat4_multiply(&translation, &rotation);
+  d_mat4_inverse(&camera->view);
+}
+
+#pragma endregion
+
+#pragma region Culling
+
+bool d_cull_set_reserve_internal(d_CullSet *set, d_uint capacity) {
+  // padded so the SIMD loop can always read whole groups of four
+  capacity = (capacity + 3) & ~3u;
+
+  float **arrays[6] = {&set->center_x, &set->center_y, &set->center_z,
+                       &set->extent_x, &set->extent_y, &set->extent_z};
+  for (int i = 0; i < 6; i++) {
+    float *array = realloc(*arrays[i], sizeof(float) * capacity);
+    if (array == NULL) {
+      d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to realloc cull bounds.");
+      return false;
+    }
+    *arrays[i] = array;
+  }
+
+  uint32_t *visible = realloc(set->visible, sizeof(uint32_t) *
+                                                ((capacity + 31) / 32));
+  if (visible == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to realloc visibility.");
+    return false;
+  }
+  set->visible = visible;
+  set->capacity = capacity;
+  return true;
+}
+
+d_CullSet *d_cull_set_create(const d_uint capacity) {
+  d_CullSet *set = malloc(sizeof(d_CullSet));
+  if (set == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc cull set.");
+    return NULL;
+  }
+
+  set->count = 0;
+  set->capacity = 0;
+  set->center_x = NULL;
+  set->center_y = NULL;
+  set->center_z = NULL;
+  set->extent_x = NULL;
+  set->extent_y = NULL;
+  set->extent_z = NULL;
+  set->visible = NULL;
+
+  d_cull_set_reserve_internal(set, capacity > 0 ? capacity : 4);
+  return set;
+}
+
+void d_cull_set_destroy(d_CullSet **set) {
+  if (set == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "set (d_CullSet **) is NULL.");
+    return;
+  }
+  if (*set == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "set (d_CullSet *) is NULL.");
+    return;
+  }
+
+  free((*set)->center_x);
+  free((*set)->center_y);
+  free((*set)->center_z);
+  free((*set)->extent_x);
+  free((*set)->extent_y);
+  free((*set)->extent_z);
+  free((*set)->visible);
+  free(*set);
+  *set = NULL;
+}
+
+void d_cull_set_clear(d_CullSet *set) {
+  if (set == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "set is NULL.");
+    return;
+  }
+  set->count = 0;
+}
+
+d_uint d_cull_set_add(d_CullSet *set, const d_AABB *bounds) {
+  if (set == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "set is NULL.");
+    return 0;
+  }
+
+  if (set->count >= set->capacity &&
+      d_cull_set_reserve_internal(set, set->capacity * 2) == false) {
+    return 0;
+  }
+
+  d_uint index = set->count++;
+  if (bounds == NULL) {
+    // FLT_MAX rather than infinity, `0 * inf` would be NaN in the plane test
+    set->center_x[index] = 0.0f;
+    set->center_y[index] = 0.0f;
+    set->center_z[index] = 0.0f;
+    set->extent_x[index] = FLT_MAX;
+    set->extent_y[index] = FLT_MAX;
+    set->extent_z[index] = FLT_MAX;
+    return index;
+  }
+
+  set->center_x[index] = (bounds->min.x + bounds->max.x) * 0.5f;
+  set->center_y[index] = (bounds->min.y + bounds->max.y) * 0.5f;
+  set->center_z[index] = (bounds->min.z + bounds->max.z) * 0.5f;
+  set->extent_x[index] = (bounds->max.x - bounds->min.x) * 0.5f;
+  set->extent_y[index] = (bounds->max.y - bounds->min.y) * 0.5f;
+  set->extent_z[index] = (bounds->max.z - bounds->min.z) * 0.5f;
+  return index;
+}
+
+void d_cull_set_test(d_CullSet *set, const d_Frustum *frustum) {
+  if (set == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "set is NULL.");
+    return;
+  }
+  if (frustum == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "frustum is NULL.");
+    return;
+  }
+
+  d_uint groups = (set->count + 3) / 4;
+  // padding lanes of the last group are tested too, keep them defined
+  for (d_uint i = set->count; i < groups * 4; i++) {
+    set->center_x[i] = set->center_y[i] = set->center_z[i] = 0.0f;
+    set->extent_x[i] = set->extent_y[i] = set->extent_z[i] = 0.0f;
+  }
+  memset(set->visible, 0, sizeof(uint32_t) * ((groups * 4 + 31) / 32));
+
+  // A box is outside when it is completely behind any plane:
+  // dot(n, center) + w + dot(|n|, extent) < 0
+  for (d_uint group = 0; group < groups; group++) {
+    d_uint i = group * 4;
+#ifdef D_CULL_SSE
+    __m128 cx = _mm_loadu_ps(&set->center_x[i]);
+    __m128 cy = _mm_loadu_ps(&set->center_y[i]);
+    __m128 cz = _mm_loadu_ps(&set->center_z[i]);
+    __m128 ex = _mm_loadu_ps(&set->extent_x[i]);
+    __m128 ey = _mm_loadu_ps(&set->extent_y[i]);
+    __m128 ez = _mm_loadu_ps(&set->extent_z[i]);
+    __m128 outside = _mm_setzero_ps();
+
+    for (int p = 0; p < 6; p++) {
+      const d_Vec4 *plane = &frustum->planes[p];
+      __m128 nx = _mm_set1_ps(plane->x);
+      __m128 ny = _mm_set1_ps(plane->y);
+      __m128 nz = _mm_set1_ps(plane->z);
+
+      __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)),
+          _mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(plane->w)));
+      __m128 radius = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(fabsf(plane->x)), ex),
+                     _mm_mul_ps(_mm_set1_ps(fabsf(plane->y)), ey)),
+          _mm_mul_ps(_mm_set1_ps(fabsf(plane->z)), ez));
+
+      __m128 behind =
+          _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps());
+      outside = _mm_or_ps(outside, behind);
+    }
+
+    uint32_t mask = (uint32_t)(~_mm_movemask_ps(outside) & 0xF);
+#else
+    uint32_t mask = 0;
+    for (d_uint lane = 0; lane < 4; lane++) {
+      d_uint j = i + lane;
+      bool inside = true;
+      for (int p = 0; p < 6 && inside == true; p++) {
+        const d_Vec4 *plane = &frustum->planes[p];
+        float distance = plane->x * set->center_x[j] +
+                         plane->y * set->center_y[j] +
+                         plane->z * set->center_z[j] + plane->w;
+        float radius = fabsf(plane->x) * set->extent_x[j] +
+                       fabsf(plane->y) * set->extent_y[j] +
+                       fabsf(plane->z) * set->extent_z[j];
+        inside = distance + radius >= 0.0f;
+      }
+      if (inside == true)
+        mask |= 1u << lane;
+    }
+#endif
+
+    set->visible[i / 32] |= mask << (i % 32);
+  }
+}
+
+bool d_cull_set_is_visible(const d_CullSet *set, const d_uint index) {
+  if (set == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "set is NULL.");
+    return false;
+  }
+  if (index >= set->count) {
+    return false;
+  }
+  return (set->visible[index / 32] >> (index % 32) & 1u) != 0;
+}
+
+#pragma endregion
+
+#pragma region SpatialTree
+
+d_SpatialTree *d_spatial_tree_create() {
+  d_SpatialTree *tree = malloc(sizeof(d_SpatialTree));
+  if (tree == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc tree.");
+    return NULL;
+  }
+
+  tree->root = D_TREE_NULL;
+  tree->free_list = D_TREE_NULL;
+  tree->node_capacity = 0;
+  tree->nodes = NULL;
+  tree->leaves = NULL;
+  tree->leaf_capacity = 0;
+  tree->stack_capacity = 64;
+  tree->stack = malloc(sizeof(d_uint) * tree->stack_capacity);
+  tree->count = 0;
+
+  if (tree->stack == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc tree stack.");
+    free(tree);
+    return NULL;
+  }
+
+  return tree;
+}
+
+void d_spatial_tree_destroy(d_SpatialTree **tree) {
+  if (tree == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "tree (d_SpatialTree **) is NULL.");
+    return;
+  }
+  if (*tree == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "tree (d_SpatialTree *) is NULL.");
+    return;
+  }
+
+  free((*tree)->nodes);
+  free((*tree)->leaves);
+  free((*tree)->stack);
+  free(*tree);
+  *tree = NULL;
+}
+
+d_AABB d_tree_union_internal(const d_AABB *a, const d_AABB *b) {
+  d_AABB result;
+  for (int i = 0; i < 3; i++) {
+    result.min.data[i] = fminf(a->min.data[i], b->min.data[i]);
+    result.max.data[i] = fmaxf(a->max.data[i], b->max.data[i]);
+  }
+  return result;
+}
+
+float d_tree_area_internal(const d_AABB *box) {
+  float x = box->max.x - box->min.x;
+  float y = box->max.y - box->min.y;
+  float z = box->max.z - box->min.z;
+  return 2.0f * (x * y + y * z + z * x);
+}
+
+bool d_tree_contains_internal(const d_AABB *outer, const d_AABB *inner) {
+  for (int i = 0; i < 3; i++) {
+    if (inner->min.data[i] < outer->min.data[i] ||
+        inner->max.data[i] > outer->max.data[i])
+      return false;
+  }
+  return true;
+}
+
+bool d_tree_overlaps_internal(const d_AABB *a, const d_AABB *b) {
+  for (int i = 0; i < 3; i++) {
+    if (a->max.data[i] < b->min.data[i] || a->min.data[i] > b->max.data[i])
+      return false;
+  }
+  return true;
+}
+
+d_uint d_tree_alloc_node_internal(d_SpatialTree *tree) {
+  if (tree->free_list == D_TREE_NULL) {
+    d_uint capacity = tree->node_capacity > 0 ? tree->node_capacity * 2 : 64;
+    d_TreeNode *nodes = realloc(tree->nodes, sizeof(d_TreeNode) * capacity);
+    if (nodes == NULL) {
+      d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to realloc tree nodes.");
+      return D_TREE_NULL;
+    }
+    tree->nodes = nodes;
+
+    // chain the new nodes into the free list
+    for (d_uint i = tree->node_capacity; i < capacity; i++) {
+      tree->nodes[i].left = i + 1 < capacity ? i + 1 : D_TREE_NULL;
+      tree->nodes[i].height = -1;
+    }
+    tree->free_list = tree->node_capacity;
+    tree->node_capacity = capacity;
+  }
+
+  d_uint index = tree->free_list;
+  d_TreeNode *node = &tree->nodes[index];
+  tree->free_list = node->left;
+  node->parent = D_TREE_NULL;
+  node->left = D_TREE_NULL;
+  node->right = D_TREE_NULL;
+  node->height = 0;
+  node->id = 0;
+  return index;
+}
+
+void d_tree_free_node_internal(d_SpatialTree *tree, const d_uint index) {
+  tree->nodes[index].left = tree->free_list;
+  tree->nodes[index].height = -1;
+  tree->free_list = index;
+}
+
+// Rotates the taller grandchild of `a` up when its children's heights differ
+// by more than one. Returns the node now at `a`'s position.
+d_uint d_tree_balance_internal(d_SpatialTree *tree, const d_uint index_a) {
+  d_TreeNode *nodes = tree->nodes;
+  d_TreeNode *a = &nodes[index_a];
+  if (a->left == D_TREE_NULL || a->height < 2) {
+    return index_a;
+  }
+
+  d_uint index_b = a->left;
+  d_uint index_c = a->right;
+  d_TreeNode *b = &nodes[index_b];
+  d_TreeNode *c = &nodes[index_c];
+  int balance = c->height - b->height;
+
+  if (balance > 1) {
+    // rotate c up
+    d_uint index_f = c->left;
+    d_uint index_g = c->right;
+    d_TreeNode *f = &nodes[index_f];
+    d_TreeNode *g = &nodes[index_g];
+
+    c->left = index_a;
+    c->parent = a->parent;
+    a->parent = index_c;
+    if (c->parent == D_TREE_NULL) {
+      tree->root = index_c;
+    } else if (nodes[c->parent].left == index_a) {
+      nodes[c->parent].left = index_c;
+    } else {
+      nodes[c->parent].right = index_c;
+    }
+
+    if (f->height > g->height) {
+      c->right = index_f;
+      a->right = index_g;
+      g->parent = index_a;
+      a->bounds = d_tree_union_internal(&b->bounds, &g->bounds);
+      c->bounds = d_tree_union_internal(&a->bounds, &f->bounds);
+      a->height = 1 + (b->height > g->height ? b->height : g->height);
+      c->height = 1 + (a->height > f->height ? a->height : f->height);
+    } else {
+      c->right = index_g;
+      a->right = index_f;
+      f->parent = index_a;
+      a->bounds = d_tree_union_internal(&b->bounds, &f->bounds);
+      c->bounds = d_tree_union_internal(&a->bounds, &g->bounds);
+      a->height = 1 + (b->height > f->height ? b->height : f->height);
+      c->height = 1 + (a->height > g->height ? a->height : g->height);
+    }
+    return index_c;
+  }
+
+  if (balance < -1) {
+    // rotate b up
+    d_uint index_d = b->left;
+    d_uint index_e = b->right;
+    d_TreeNode *d = &nodes[index_d];
+    d_TreeNode *e = &nodes[index_e];
+
+    b->left = index_a;
+    b->parent = a->parent;
+    a->parent = index_b;
+    if (b->parent == D_TREE_NULL) {
+      tree->root = index_b;
+    } else if (nodes[b->parent].left == index_a) {
+      nodes[b->parent].left = index_b;
+    } else {
+      nodes[b->parent].right = index_b;
+    }
+
+    if (d->height > e->height) {
+      b->right = index_d;
+      a->left = index_e;
+      e->parent = index_a;
+      a->bounds = d_tree_union_internal(&c->bounds, &e->bounds);
+      b->bounds = d_tree_union_internal(&a->bounds, &d->bounds);
+      a->height = 1 + (c->height > e->height ? c->height : e->height);
+      b->height = 1 + (a->height > d->height ? a->height : d->height);
+    } else {
+      b->right = index_e;
+      a->left = index_d;
+      d->parent = index_a;
+      a->bounds = d_tree_union_internal(&c->bounds, &d->bounds);
+      b->bounds = d_tree_union_internal(&a->bounds, &e->bounds);
+      a->height = 1 + (c->height > d->height ? c->height : d->height);
+      b->height = 1 + (a->height > e->height ? a->height : e->height);
+    }
+    return index_b;
+  }
+
+  return index_a;
+}
+
+// Rebalances and refits every node from `index` up to the root.
+void d_tree_refit_internal(d_SpatialTree *tree, d_uint index) {
+  while (index != D_TREE_NULL) {
+    index = d_tree_balance_internal(tree, index);
+
+    d_TreeNode *node = &tree->nodes[index];
+    d_TreeNode *left = &tree->nodes[node->left];
+    d_TreeNode *right = &tree->nodes[node->right];
+    node->height =
+        1 + (left->height > right->height ? left->height : right->height);
+    node->bounds = d_tree_union_internal(&left->bounds, &right->bounds);
+
+    index = node->parent;
+  }
+}
+
+void d_tree_insert_leaf_internal(d_SpatialTree *tree, const d_uint leaf) {
+  if (tree->root == D_TREE_NULL) {
+    tree->root = leaf;
+    tree->nodes[leaf].parent = D_TREE_NULL;
+    return;
+  }
+
+  // walk down to the sibling that grows the total surface area the least
+  d_AABB leaf_bounds = tree->nodes[leaf].bounds;
+  d_uint index = tree->root;
+  while (tree->nodes[index].left != D_TREE_NULL) {
+    d_TreeNode *node = &tree->nodes[index];
+    float area = d_tree_area_internal(&node->bounds);
+    d_AABB combined = d_tree_union_internal(&node->bounds, &leaf_bounds);
+    float combined_area = d_tree_area_internal(&combined);
+
+    // cost of making a new parent for this node and the leaf
+    float cost = 2.0f * combined_area;
+    // cost pushed down to the children by growing this node
+    float inheritance = 2.0f * (combined_area - area);
+
+    float child_costs[2];
+    d_uint children[2] = {node->left, node->right};
+    for (int i = 0; i < 2; i++) {
+      d_TreeNode *child = &tree->nodes[children[i]];
+      d_AABB grown = d_tree_union_internal(&child->bounds, &leaf_bounds);
+      child_costs[i] = d_tree_area_internal(&grown) + inheritance;
+      if (child->left != D_TREE_NULL) {
+        child_costs[i] -= d_tree_area_internal(&child->bounds);
+      }
+    }
+
+    if (cost < child_costs[0] && cost < child_costs[1]) {
+      break;
+    }
+    index = child_costs[0] < child_costs[1] ? children[0] : children[1];
+  }
+
+  d_uint sibling = index;
+  d_uint new_parent = d_tree_alloc_node_internal(tree);
+  if (new_parent == D_TREE_NULL) {
+    return;
+  }
+
+  d_TreeNode *nodes = tree->nodes;
+  d_uint old_parent = nodes[sibling].parent;
+  nodes[new_parent].parent = old_parent;
+  nodes[new_parent].bounds =
+      d_tree_union_internal(&leaf_bounds, &nodes[sibling].bounds);
+  nodes[new_parent].height = nodes[sibling].height + 1;
+  nodes[new_parent].left = sibling;
+  nodes[new_parent].right = leaf;
+
+  if (old_parent == D_TREE_NULL) {
+    tree->root = new_parent;
+  } else if (nodes[old_parent].left == sibling) {
+    nodes[old_parent].left = new_parent;
+  } else {
+    nodes[old_parent].right = new_parent;
+  }
+  nodes[sibling].parent = new_parent;
+  nodes[leaf].parent = new_parent;
+
+  d_tree_refit_internal(tree, new_parent);
+}
+
+void d_tree_remove_leaf_internal(d_SpatialTree *tree, const d_uint leaf) {
+  if (leaf == tree->root) {
+    tree->root = D_TREE_NULL;
+    return;
+  }
+
+  d_TreeNode *nodes = tree->nodes;
+  d_uint parent = nodes[leaf].parent;
+  d_uint grand_parent = nodes[parent].parent;
+  d_uint sibling =
+      nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+
+  if (grand_parent == D_TREE_NULL) {
+    tree->root = sibling;
+    nodes[sibling].parent = D_TREE_NULL;
+    d_tree_free_node_internal(tree, parent);
+    return;
+  }
+
+  if (nodes[grand_parent].left == parent) {
+    nodes[grand_parent].left = sibling;
+  } else {
+    nodes[grand_parent].right = sibling;
+  }
+  nodes[sibling].parent = grand_parent;
+  d_tree_free_node_internal(tree, parent);
+
+  d_tree_refit_internal(tree, grand_parent);
+}
+
+d_AABB d_tree_fatten_internal(const d_AABB *bounds) {
+  d_AABB fat = *bounds;
+  for (int i = 0; i < 3; i++) {
+    fat.min.data[i] -= D_TREE_MARGIN;
+    fat.max.data[i] += D_TREE_MARGIN;
+  }
+  return fat;
+}
+
+void d_spatial_tree_insert(d_SpatialTree *tree, const d_Transform *transform,
+                           const d_AABB *bounds) {
+  if (tree == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "tree is NULL.");
+    return;
+  }
+  if (transform == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "transform is NULL.");
+    return;
+  }
+  if (bounds == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "bounds is NULL.");
+    return;
+  }
+
+  d_uint id = transform->id;
+  if (id >= tree->leaf_capacity) {
+    d_uint capacity = tree->leaf_capacity > 0 ? tree->leaf_capacity : 64;
+    while (capacity <= id)
+      capacity *= 2;
+    d_uint *leaves = realloc(tree->leaves, sizeof(d_uint) * capacity);
+    if (leaves == NULL) {
+      d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to realloc tree leaves.");
+      return;
+    }
+    for (d_uint i = tree->leaf_capacity; i < capacity; i++) {
+      leaves[i] = D_TREE_NULL;
+    }
+    tree->leaves = leaves;
+    tree->leaf_capacity = capacity;
+  }
+  if (tree->leaves[id] != D_TREE_NULL) {
+    d_spatial_tree_update(tree, transform, bounds);
+    return;
+  }
+
+  d_uint leaf = d_tree_alloc_node_internal(tree);
+  if (leaf == D_TREE_NULL) {
+    return;
+  }
+  tree->nodes[leaf].bounds = d_tree_fatten_internal(bounds);
+  tree->nodes[leaf].id = id;
+  tree->leaves[id] = leaf;
+  tree->count++;
+
+  d_tree_insert_leaf_internal(tree, leaf);
+}
+
+void d_spatial_tree_remove(d_SpatialTree *tree, const d_Transform *transform) {
+  if (tree == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "tree is NULL.");
+    return;
+  }
+  if (transform == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "transform is NULL.");
+    return;
+  }
+  if (transform->id >= tree->leaf_capacity ||
+      tree->leaves[transform->id] == D_TREE_NULL) {
+    return;
+  }
+
+  d_uint leaf = tree->leaves[transform->id];
+  d_tree_remove_leaf_internal(tree, leaf);
+  d_tree_free_node_internal(tree, leaf);
+  tree->leaves[transform->id] = D_TREE_NULL;
+  tree->count--;
+}
+
+bool d_spatial_tree_update(d_SpatialTree *tree, const d_Transform *transform,
+                           const d_AABB *bounds) {
+  if (tree == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "tree is NULL.");
+    return false;
+  }
+  if (transform == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "transform is NULL.");
+    return false;
+  }
+  if (bounds == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "bounds is NULL.");
+    return false;
+  }
+  if (transform->id >= tree->leaf_capacity ||
+      tree->leaves[transform->id] == D_TREE_NULL) {
+    d_spatial_tree_insert(tree, transform, bounds);
+    return true;
+  }
+
+  d_uint leaf = tree->leaves[transform->id];
+  if (d_tree_contains_internal(&tree->nodes[leaf].bounds, bounds) == true) {
+    return false;
+  }
+
+  d_tree_remove_leaf_internal(tree, leaf);
+  tree->nodes[leaf].bounds = d_tree_fatten_internal(bounds);
+  d_tree_insert_leaf_internal(tree, leaf);
+  return true;
+}
+
+bool d_tree_push_internal(d_SpatialTree *tree, d_uint *top,
+                          const d_uint value) {
+  if (*top >= tree->stack_capacity) {
+    d_uint capacity = tree->stack_capacity * 2;
+    d_uint *stack = realloc(tree->stack, sizeof(d_uint) * capacity);
+    if (stack == NULL) {
+      d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to realloc tree stack.");
+      return false;
+    }
+    tree->stack = stack;
+    tree->stack_capacity = capacity;
+  }
+  tree->stack[(*top)++] = value;
+  return true;
+}
+
+void d_spatial_tree_query_box(d_SpatialTree *tree, const d_AABB *box,
+                              d_SpatialTreeCallback callback, void *user_data) {
+  if (tree == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "tree is NULL.");
+    return;
+  }
+  if (box == NULL || callback == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "box and callback must not be NULL!");
+    return;
+  }
+  if (tree->root == D_TREE_NULL) {
+    return;
+  }
+
+  d_uint top = 0;
+  d_tree_push_internal(tree, &top, tree->root);
+  while (top > 0) {
+    d_TreeNode *node = &tree->nodes[tree->stack[--top]];
+    if (d_tree_overlaps_internal(&node->bounds, box) == false) {
+      continue;
+    }
+
+    if (node->left == D_TREE_NULL) {
+      if (callback(node->id, user_data) == false)
+        return;
+    } else if (d_tree_push_internal(tree, &top, node->left) == false ||
+               d_tree_push_internal(tree, &top, node->right) == false) {
+      return;
+    }
+  }
+}
+
+// 0 outside, 1 intersecting, 2 inside
+int d_tree_classify_internal(const d_AABB *box, const d_Frustum *frustum) {
+  int result = 2;
+  for (int p = 0; p < 6; p++) {
+    const d_Vec4 *plane = &frustum->planes[p];
+    float distance = 0.0f;
+    float radius = 0.0f;
+    for (int i = 0; i < 3; i++) {
+      float center = (box->min.data[i] + box->max.data[i]) * 0.5f;
+      float extent = (box->max.data[i] - box->min.data[i]) * 0.5f;
+      distance += plane->data[i] * center;
+      radius += fabsf(plane->data[i]) * extent;
+    }
+    distance += plane->w;
+
+    if (distance + radius < 0.0f)
+      return 0;
+    if (distance - radius < 0.0f)
+      result = 1;
+  }
+  return result;
+}
+
+// high bit of a stack entry, set when the node is known to be inside
+#define D_TREE_INSIDE_BIT 0x80000000u
+
+void d_spatial_tree_query_frustum(d_SpatialTree *tree,
+                                  const d_Frustum *frustum,
+                                  d_SpatialTreeCallback callback,
+                                  void *user_data) {
+  if (tree == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "tree is NULL.");
+    return;
+  }
+  if (frustum == NULL || callback == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "frustum and callback must not be NULL!");
+    return;
+  }
+  if (tree->root == D_TREE_NULL) {
+    return;
+  }
+
+  d_uint top = 0;
+  d_tree_push_internal(tree, &top, tree->root);
+  while (top > 0) {
+    d_uint entry = tree->stack[--top];
+    d_TreeNode *node = &tree->nodes[entry & ~D_TREE_INSIDE_BIT];
+
+    // subtrees of a node inside the frustum are reported without testing
+    d_uint inside = entry & D_TREE_INSIDE_BIT;
+    if (inside == 0) {
+      int classification = d_tree_classify_internal(&node->bounds, frustum);
+      if (classification == 0)
+        continue;
+      if (classification == 2)
+        inside = D_TREE_INSIDE_BIT;
+    }
+
+    if (node->left == D_TREE_NULL) {
+      if (callback(node->id, user_data) == false)
+        return;
+    } else if (d_tree_push_internal(tree, &top, node->left | inside) == false ||
+               d_tree_push_internal(tree, &top, node->right | inside) ==
+                   false) {
+      return;
+    }
+  }
+}
+
+bool d_tree_ray_hits_internal(const d_AABB *box, const d_Vec3 *origin,
+                              const d_Vec3 *inverse_direction,
+                              const float max_distance) {
+  float near = 0.0f;
+  float far = max_distance;
+  for (int i = 0; i < 3; i++) {
+    float inverse = inverse_direction->data[i];
+    float t0 = (box->min.data[i] - origin->data[i]) * inverse;
+    float t1 = (box->max.data[i] - origin->data[i]) * inverse;
+    // fminf/fmaxf drop the NaN of a ray lying in a slab plane
+    near = fmaxf(near, fminf(t0, t1));
+    far = fminf(far, fmaxf(t0, t1));
+  }
+  return near <= far;
+}
+
+void d_spatial_tree_query_ray(d_SpatialTree *tree, const d_Vec3 origin,
+                              const d_Vec3 direction, const float max_distance,
+                              d_SpatialTreeCallback callback, void *user_data) {
+  if (tree == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "tree is NULL.");
+    return;
+  }
+  if (callback == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "callback is NULL.");
+    return;
+  }
+  if (tree->root == D_TREE_NULL) {
+    return;
+  }
+
+  d_Vec3 inverse_direction =
+      d_vec3(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+  d_uint top = 0;
+  d_tree_push_internal(tree, &top, tree->root);
+  while (top > 0) {
+    d_TreeNode *node = &tree->nodes[tree->stack[--top]];
+    if (d_tree_ray_hits_internal(&node->bounds, &origin, &inverse_direction,
+                                 max_distance) == false) {
+      continue;
+    }
+
+    if (node->left == D_TREE_NULL) {
+      if (callback(node->id, user_data) == false)
+        return;
+    } else if (d_tree_push_internal(tree, &top, node->left) == false ||
+               d_tree_push_internal(tree, &top, node->right) == false) {
+      return;
+    }
+  }
+}
+
+#pragma endregion
+
+#pragma region Occlusion
+
+d_Occluder *d_occluder_create(const d_Mesh *mesh) {
+  if (mesh == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "mesh is NULL.");
+    return NULL;
+  }
+
+  d_Occluder *occluder = malloc(sizeof(d_Occluder));
+  if (occluder == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc occluder.");
+    return NULL;
+  }
+
+  const d_MeshLOD *lod = &mesh->lods[0];
+  const d_uint *source = (const d_uint *)mesh->indices->data + lod->first_index;
+  const d_Vertex *vertices = (const d_Vertex *)mesh->vertices->data;
+
+  occluder->vertex_count = 0;
+  occluder->index_count = lod->index_count;
+  occluder->positions = malloc(sizeof(d_Vec3) * mesh->vertices->length);
+  occluder->indices = malloc(sizeof(d_uint) * occluder->index_count);
+  // new index of each mesh vertex, 0xFFFFFFFF until level 0 uses it
+  d_uint *remap = malloc(sizeof(d_uint) * mesh->vertices->length);
+  if (occluder->positions == NULL || occluder->indices == NULL ||
+      remap == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc occluder data.");
+    free(occluder->positions);
+    free(occluder->indices);
+    free(remap);
+    free(occluder);
+    return NULL;
+  }
+
+  memset(remap, 0xFF, sizeof(d_uint) * mesh->vertices->length);
+  for (d_uint i = 0; i < occluder->index_count; i++) {
+    d_uint index = source[i];
+    if (remap[index] == 0xFFFFFFFFu) {
+      remap[index] = occluder->vertex_count;
+      occluder->positions[occluder->vertex_count++] =
+          vertices[index].position;
+    }
+    occluder->indices[i] = remap[index];
+  }
+  free(remap);
+
+  return occluder;
+}
+
+void d_occluder_destroy(d_Occluder **occluder) {
+  if (occluder == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "occluder (d_Occluder **) is NULL.");
+    return;
+  }
+  if (*occluder == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "occluder (d_Occluder *) is NULL.");
+    return;
+  }
+
+  free((*occluder)->positions);
+  free((*occluder)->indices);
+  free(*occluder);
+  *occluder = NULL;
+}
+
+d_OcclusionBuffer *d_occlusion_buffer_create(const d_uint width,
+                                             const d_uint height) {
+  d_OcclusionBuffer *buffer = malloc(sizeof(d_OcclusionBuffer));
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc occlusion buffer.");
+    return NULL;
+  }
+
+  buffer->width = (width + 3) & ~3u;
+  buffer->height = height > 0 ? height : 1;
+  buffer->view_projection = d_mat4(true);
+  buffer->draws = d_array_create(d_OcclusionDraw, 16);
+  buffer->triangles = NULL;
+  buffer->triangle_count = 0;
+  buffer->triangle_capacity = 0;
+  buffer->band_height = 8;
+
+  d_uint level_width = buffer->width;
+  d_uint level_height = buffer->height;
+  buffer->level_count = 0;
+  while (buffer->level_count < D_OCCLUSION_MAX_LEVELS) {
+    d_uint level = buffer->level_count++;
+    buffer->level_widths[level] = level_width;
+    buffer->level_heights[level] = level_height;
+    buffer->levels[level] =
+        malloc(sizeof(float) * level_width * level_height);
+    if (buffer->levels[level] == NULL) {
+      d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc depth level.");
+      buffer->level_count--;
+      break;
+    }
+    if (level_width == 1 && level_height == 1) {
+      break;
+    }
+    level_width = (level_width + 1) / 2;
+    level_height = (level_height + 1) / 2;
+  }
+
+  return buffer;
+}
+
+void d_occlusion_buffer_destroy(d_OcclusionBuffer **buffer) {
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "buffer (d_OcclusionBuffer **) is NULL.");
+    return;
+  }
+  if (*buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "buffer (d_OcclusionBuffer *) is NULL.");
+    return;
+  }
+
+  for (d_uint i = 0; i < (*buffer)->level_count; i++) {
+    free((*buffer)->levels[i]);
+  }
+  d_array_destroy(&(*buffer)->draws);
+  free((*buffer)->triangles);
+  free(*buffer);
+  *buffer = NULL;
+}
+
+void d_occlusion_buffer_begin(d_OcclusionBuffer *buffer,
+                              const d_Mat4 *view_projection) {
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer is NULL.");
+    return;
+  }
+  if (view_projection == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "view_projection is NULL.");
+    return;
+  }
+
+  buffer->view_projection = *view_projection;
+  buffer->draws->length = 0;
+  buffer->triangle_count = 0;
+}
+
+void d_occlusion_buffer_add_occluder(d_OcclusionBuffer *buffer,
+                                     const d_Occluder *occluder,
+                                     const d_Mat4 *model) {
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer is NULL.");
+    return;
+  }
+  if (occluder == NULL || model == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "occluder and model must not be NULL!");
+    return;
+  }
+
+  d_OcclusionDraw draw;
+  draw.occluder = occluder;
+  draw.model = *model;
+  d_array_add(buffer->draws, &draw);
+}
+
+// Projects the occluder triangles into screen space. Triangles crossing the
+// near plane are dropped, which only makes the buffer less occluding.
+void d_occlusion_setup_internal(d_OcclusionBuffer *buffer) {
+  float width = (float)buffer->width;
+  float height = (float)buffer->height;
+
+  for (size_t d = 0; d < buffer->draws->length; d++) {
+    d_OcclusionDraw *draw = &((d_OcclusionDraw *)buffer->draws->data)[d];
+    const d_Occluder *occluder = draw->occluder;
+    d_Mat4 matrix = d_mat4_multiply(&buffer->view_projection, &draw->model);
+    const float *m = matrix.data;
+
+    for (d_uint i = 0; i + 2 < occluder->index_count; i += 3) {
+      d_OcclusionTriangle triangle;
+      bool clipped = false;
+
+      for (int v = 0; v < 3 && clipped == false; v++) {
+        d_Vec3 p = occluder->positions[occluder->indices[i + v]];
+        float x = m[0] * p.x + m[4] * p.y + m[8] * p.z + m[12];
+        float y = m[1] * p.x + m[5] * p.y + m[9] * p.z + m[13];
+        float z = m[2] * p.x + m[6] * p.y + m[10] * p.z + m[14];
+        float w = m[3] * p.x + m[7] * p.y + m[11] * p.z + m[15];
+        if (w <= 0.0f || z < -w) {
+          clipped = true;
+          break;
+        }
+
+        triangle.x[v] = (x / w * 0.5f + 0.5f) * width;
+        triangle.y[v] = (y / w * 0.5f + 0.5f) * height;
+        triangle.z[v] = z / w * 0.5f + 0.5f;
+      }
+      if (clipped == true) {
+        continue;
+      }
+
+      if (buffer->triangle_count >= buffer->triangle_capacity) {
+        d_uint capacity = buffer->triangle_capacity > 0
+                              ? buffer->triangle_capacity * 2
+                              : 1024;
+        d_OcclusionTriangle *triangles = realloc(
+            buffer->triangles, sizeof(d_OcclusionTriangle) * capacity);
+        if (triangles == NULL) {
+          d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to realloc triangles.");
+          return;
+        }
+        buffer->triangles = triangles;
+        buffer->triangle_capacity = capacity;
+      }
+      buffer->triangles[buffer->triangle_count++] = triangle;
+    }
+  }
+}
+
+// Rasterizes every triangle into the rows of one band, keeping the nearest
+// depth. Bands do not overlap, so they can run on separate threads.
+void d_occlusion_band_internal(d_uint band, void *user_data) {
+  d_OcclusionBuffer *buffer = user_data;
+  float *depth = buffer->levels[0];
+  int band_top = (int)(band * buffer->band_height);
+  int band_bottom = band_top + (int)buffer->band_height;
+  if (band_bottom > (int)buffer->height)
+    band_bottom = (int)buffer->height;
+  float width = (float)buffer->width;
+  float top = (float)band_top;
+  float bottom = (float)band_bottom;
+
+  for (d_uint t = 0; t < buffer->triangle_count; t++) {
+    const d_OcclusionTriangle *triangle = &buffer->triangles[t];
+    float x0 = triangle->x[0], y0 = triangle->y[0];
+    float x1 = triangle->x[1], y1 = triangle->y[1];
+    float x2 = triangle->x[2], y2 = triangle->y[2];
+    float z0 = triangle->z[0], z1 = triangle->z[1], z2 = triangle->z[2];
+
+    float area = (x1 - x0) * (y2 - y0) - (y1 - y0) * (x2 - x0);
+    if (area == 0.0f) {
+      continue;
+    }
+    if (area < 0.0f) {
+      // both windings are rasterized, occluders may be open meshes
+      float swap = x1;
+      x1 = x2;
+      x2 = swap;
+      swap = y1;
+      y1 = y2;
+      y2 = swap;
+      swap = z1;
+      z1 = z2;
+      z2 = swap;
+      area = -area;
+    }
+
+    // clamped before the conversion, vertices close to w = 0 project far
+    // outside the range of int
+    int min_x = (int)floorf(fmaxf(fminf(x0, fminf(x1, x2)), 0.0f));
+    int max_x = (int)ceilf(fminf(fmaxf(x0, fmaxf(x1, x2)), width));
+    int min_y = (int)floorf(fmaxf(fminf(y0, fminf(y1, y2)), top));
+    int max_y = (int)ceilf(fminf(fmaxf(y0, fmaxf(y1, y2)), bottom));
+    if (min_x >= max_x || min_y >= max_y) {
+      continue;
+    }
+    // rows are processed 4 pixels at a time, the width is a multiple of 4
+    min_x &= ~3;
+
+    // edge functions `a * x + b * y + c`, positive inside
+    float a0 = y1 - y2, b0 = x2 - x1, c0 = x1 * y2 - x2 * y1;
+    float a1 = y2 - y0, b1 = x0 - x2, c1 = x2 * y0 - x0 * y2;
+    float a2 = y0 - y1, b2 = x1 - x0, c2 = x0 * y1 - x1 * y0;
+    // depth is linear in screen space, z = dz_dx * x + dz_dy * y + dz_c
+    float inverse_area = 1.0f / area;
+    float dz_dx = (a0 * z0 + a1 * z1 + a2 * z2) * inverse_area;
+    float dz_dy = (b0 * z0 + b1 * z1 + b2 * z2) * inverse_area;
+    float dz_c = (c0 * z0 + c1 * z1 + c2 * z2) * inverse_area;
+
+    for (int y = min_y; y < max_y; y++) {
+      float py = (float)y + 0.5f;
+      float *row = &depth[y * buffer->width];
+
+#ifdef D_CULL_SSE
+      __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+      __m128 zero = _mm_setzero_ps();
+      for (int x = min_x; x < max_x; x += 4) {
+        __m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+        __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a0), px),
+                               _mm_set1_ps(b0 * py + c0));
+        __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a1), px),
+                               _mm_set1_ps(b1 * py + c1));
+        __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a2), px),
+                               _mm_set1_ps(b2 * py + c2));
+        __m128 inside = _mm_and_ps(
+            _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)),
+            _mm_cmpge_ps(e2, zero));
+        if (_mm_movemask_ps(inside) == 0) {
+          continue;
+        }
+
+        __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(dz_dx), px),
+                              _mm_set1_ps(dz_dy * py + dz_c));
+        __m128 stored = _mm_loadu_ps(&row[x]);
+        __m128 nearest = _mm_min_ps(stored, z);
+        _mm_storeu_ps(&row[x], _mm_or_ps(_mm_and_ps(inside, nearest),
+                                         _mm_andnot_ps(inside, stored)));
+      }
+#else
+      for (int x = min_x; x < max_x; x++) {
+        float px = (float)x + 0.5f;
+        if (a0 * px + b0 * py + c0 < 0.0f || a1 * px + b1 * py + c1 < 0.0f ||
+            a2 * px + b2 * py + c2 < 0.0f) {
+          continue;
+        }
+        float z = dz_dx * px + dz_dy * py + dz_c;
+        if (z < row[x])
+          row[x] = z;
+      }
+#endif
+    }
+  }
+}
+
+void d_occlusion_buffer_rasterize(d_OcclusionBuffer *buffer) {
+  D_PROFILE_SCOPE("d_occlusion_buffer_rasterize");
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer is NULL.");
+    return;
+  }
+
+  float *depth = buffer->levels[0];
+  for (d_uint i = 0; i < buffer->width * buffer->height; i++) {
+    depth[i] = 1.0f;
+  }
+
+  d_occlusion_setup_internal(buffer);
+  if (buffer->triangle_count > 0) {
+    d_uint bands =
+        (buffer->height + buffer->band_height - 1) / buffer->band_height;
+    d_parallel_for(bands, d_occlusion_band_internal, buffer);
+  }
+
+  // each texel keeps the farthest of the 2x2 texels below it, so a test
+  // against one texel is conservative for everything it covers
+  for (d_uint level = 1; level < buffer->level_count; level++) {
+    const float *source = buffer->levels[level - 1];
+    d_uint source_width = buffer->level_widths[level - 1];
+    d_uint source_height = buffer->level_heights[level - 1];
+    float *target = buffer->levels[level];
+
+    for (d_uint y = 0; y < buffer->level_heights[level]; y++) {
+      d_uint sy0 = y * 2;
+      d_uint sy1 = sy0 + 1 < source_height ? sy0 + 1 : sy0;
+      for (d_uint x = 0; x < buffer->level_widths[level]; x++) {
+        d_uint sx0 = x * 2;
+        d_uint sx1 = sx0 + 1 < source_width ? sx0 + 1 : sx0;
+        float farthest = fmaxf(fmaxf(source[sy0 * source_width + sx0],
+                                     source[sy0 * source_width + sx1]),
+                               fmaxf(source[sy1 * source_width + sx0],
+                                     source[sy1 * source_width + sx1]));
+        target[y * buffer->level_widths[level] + x] = farthest;
+      }
+    }
+  }
+}
+
+bool d_occlusion_buffer_test(const d_OcclusionBuffer *buffer,
+                             const d_AABB *bounds) {
+  if (buffer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "buffer is NULL.");
+    return true;
+  }
+  if (bounds == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "bounds is NULL.");
+    return true;
+  }
+
+  const float *m = buffer->view_projection.data;
+  float min_x = INFINITY, min_y = INFINITY, nearest = INFINITY;
+  float max_x = -INFINITY, max_y = -INFINITY;
+
+  for (int corner = 0; corner < 8; corner++) {
+    float x = corner & 1 ? bounds->max.x : bounds->min.x;
+    float y = corner & 2 ? bounds->max.y : bounds->min.y;
+    float z = corner & 4 ? bounds->max.z : bounds->min.z;
+
+    float cx = m[0] * x + m[4] * y + m[8] * z + m[12];
+    float cy = m[1] * x + m[5] * y + m[9] * z + m[13];
+    float cz = m[2] * x + m[6] * y + m[10] * z + m[14];
+    float cw = m[3] * x + m[7] * y + m[11] * z + m[15];
+    // bounds reaching through the near plane cannot be tested
+    if (cw <= 0.0f || cz < -cw) {
+      return true;
+    }
+
+    float sx = (cx / cw * 0.5f + 0.5f) * (float)buffer->width;
+    float sy = (cy / cw * 0.5f + 0.5f) * (float)buffer->height;
+    float sz = cz / cw * 0.5f + 0.5f;
+    min_x = fminf(min_x, sx);
+    max_x = fmaxf(max_x, sx);
+    min_y = fminf(min_y, sy);
+    max_y = fmaxf(max_y, sy);
+    nearest = fminf(nearest, sz);
+  }
+
+  // clamped before the conversion to int, see `d_occlusion_band_internal`
+  float width = (float)buffer->width;
+  float height = (float)buffer->height;
+  min_x = fminf(fmaxf(min_x, 0.0f), width);
+  max_x = fminf(fmaxf(max_x, 0.0f), width);
+  min_y = fminf(fmaxf(min_y, 0.0f), height);
+  max_y = fminf(fmaxf(max_y, 0.0f), height);
+  int x0 = (int)floorf(min_x), x1 = (int)ceilf(max_x) - 1;
+  int y0 = (int)floorf(min_y), y1 = (int)ceilf(max_y) - 1;
+  if (x0 < 0)
+    x0 = 0;
+  if (y0 < 0)
+    y0 = 0;
+  if (x1 >= (int)buffer->width)
+    x1 = (int)buffer->width - 1;
+  if (y1 >= (int)buffer->height)
+    y1 = (int)buffer->height - 1;
+  if (x0 > x1 || y0 > y1) {
+    return true;
+  }
+
+  // the level where the rectangle covers at most 4x4 texels, coarser levels
+  // need fewer reads but reject less
+  d_uint level = 0;
+  int span = (x1 - x0) > (y1 - y0) ? (x1 - x0) : (y1 - y0);
+  while (span > 3 && level + 1 < buffer->level_count) {
+    span >>= 1;
+    level++;
+  }
+
+  const float *depth = buffer->levels[level];
+  d_uint level_width = buffer->level_widths[level];
+  for (int y = y0 >> level; y <= y1 >> level; y++) {
+    for (int x = x0 >> level; x <= x1 >> level; x++) {
+      if (nearest <= depth[y * level_width + x]) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+#pragma endregion
+
+#pragma region OcclusionQueries
+
+const char *d_query_vertex_source =
+    "#version 330 core\n"
+    "layout(location = 0) in vec3 aPos;\n"
+    "uniform mat4 mvp;\n"
+    "void main() { gl_Position = mvp * vec4(aPos, 1.0); }\n";
+
+const char *d_query_fragment_source =
+    "#version 330 core\n"
+    "out vec4 color;\n"
+    "void main() { color = vec4(1.0); }\n";
+
+d_OcclusionQueryManager *d_occlusion_query_manager_create() {
+  d_OcclusionQueryManager *manager = malloc(sizeof(d_OcclusionQueryManager));
+  if (manager == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc query manager.");
+    return NULL;
+  }
+
+  manager->queries = NULL;
+  manager->capacity = 0;
+  manager->requests = d_array_create(d_uint, 64);
+  manager->frame = 0;
+  manager->view_projection = d_mat4(true);
+  manager->camera_position = d_vec3(0.0f, 0.0f, 0.0f);
+
+  GLuint vertex = glCreateShader(GL_VERTEX_SHADER);
+  glShaderSource(vertex, 1, &d_query_vertex_source, NULL);
+  glCompileShader(vertex);
+  d_check_shader_compile(vertex, "VERTEX");
+  GLuint fragment = glCreateShader(GL_FRAGMENT_SHADER);
+  glShaderSource(fragment, 1, &d_query_fragment_source, NULL);
+  glCompileShader(fragment);
+  d_check_shader_compile(fragment, "FRAGMENT");
+
+  manager->program = glCreateProgram();
+  glAttachShader(manager->program, vertex);
+  glAttachShader(manager->program, fragment);
+  glLinkProgram(manager->program);
+  d_check_shader_link(manager->program);
+  glDeleteShader(vertex);
+  glDeleteShader(fragment);
+  manager->mvp_location = glGetUniformLocation(manager->program, "mvp");
+
+  // boxes are tested from inside too, so nothing is culled
+  d_PipelineState description = d_pipeline_state_opaque();
+  description.cull_mode = DUCKY_CULL_NONE;
+  description.depth_write = false;
+  description.depth_func = GL_LEQUAL;
+  manager->pipeline = d_pipeline_state_create(&description);
+
+  // unit cube, scaled and moved onto the bounds by the mvp
+  const float corners[24] = {0, 0, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0,
+                             0, 0, 1, 1, 0, 1, 1, 1, 1, 0, 1, 1};
+  const d_uint indices[36] = {0, 1, 2, 0, 2, 3, 4, 6, 5, 4, 7, 6,
+                              0, 4, 5, 0, 5, 1, 3, 2, 6, 3, 6, 7,
+                              0, 3, 7, 0, 7, 4, 1, 5, 6, 1, 6, 2};
+  manager->vao = d_vao_create();
+  d_vao_bind(manager->vao);
+  manager->vbo = d_vbo_create(corners, sizeof(corners));
+  manager->ebo = d_ebo_create(indices, sizeof(indices));
+  d_vao_link_attrib(manager->vao, manager->vbo, 0, 3, GL_FLOAT,
+                    3 * sizeof(float), (void *)0);
+  d_vao_unbind(manager->vao);
+
+  return manager;
+}
+
+void d_occlusion_query_manager_destroy(d_OcclusionQueryManager **manager) {
+  if (manager == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "manager (d_OcclusionQueryManager **) is NULL.");
+    return;
+  }
+  if (*manager == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "manager (d_OcclusionQueryManager *) is NULL.");
+    return;
+  }
+
+  for (d_uint i = 0; i < (*manager)->capacity; i++) {
+    d_OcclusionQuery *query = &(*manager)->queries[i];
+    if (query->ids[0] != 0) {
+      glDeleteQueries(D_QUERY_FRAMES, query->ids);
+    }
+  }
+  free((*manager)->queries);
+  d_array_destroy(&(*manager)->requests);
+
+  d_gl_state_forget(GL_PROGRAM, (*manager)->program);
+  glDeleteProgram((*manager)->program);
+  d_pipeline_state_destroy(&(*manager)->pipeline);
+  d_vao_destroy(&(*manager)->vao);
+  d_vbo_destroy(&(*manager)->vbo);
+  d_ebo_destroy(&(*manager)->ebo);
+  free(*manager);
+  *manager = NULL;
+}
+
+void d_occlusion_query_manager_begin(d_OcclusionQueryManager *manager,
+                                     d_Camera *camera) {
+  if (manager == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "manager is NULL.");
+    return;
+  }
+
+  manager->frame++;
+  manager->requests->length = 0;
+  if (camera != NULL) {
+    manager->view_projection =
+        d_mat4_multiply(&camera->projection, &camera->view);
+    manager->camera_position = camera->transform->position;
+  }
+
+  for (d_uint i = 0; i < manager->capacity; i++) {
+    d_OcclusionQuery *query = &manager->queries[i];
+    query->requested = false;
+
+    // oldest first, so the newest finished result wins. Slot `frame` was
+    // issued `D_QUERY_FRAMES` frames ago, slot `frame - 1` last frame.
+    for (d_uint k = 0; k < D_QUERY_FRAMES; k++) {
+      d_uint slot = (manager->frame + k) % D_QUERY_FRAMES;
+      if (query->pending[slot] == false) {
+        continue;
+      }
+
+      GLuint available = GL_FALSE;
+      glGetQueryObjectuiv(query->ids[slot], GL_QUERY_RESULT_AVAILABLE,
+                          &available);
+      if (available == GL_FALSE) {
+        continue;
+      }
+
+      GLuint passed = GL_FALSE;
+      glGetQueryObjectuiv(query->ids[slot], GL_QUERY_RESULT, &passed);
+      query->visible = passed != GL_FALSE;
+      query->pending[slot] = false;
+    }
+  }
+}
+
+bool d_occlusion_query_manager_test(d_OcclusionQueryManager *manager,
+                                    const d_uint id, const d_AABB *bounds) {
+  if (manager == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "manager is NULL.");
+    return true;
+  }
+  if (bounds == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "bounds is NULL.");
+    return true;
+  }
+
+  if (id >= manager->capacity) {
+    d_uint capacity = manager->capacity > 0 ? manager->capacity : 64;
+    while (capacity <= id)
+      capacity *= 2;
+    d_OcclusionQuery *queries =
+        realloc(manager->queries, sizeof(d_OcclusionQuery) * capacity);
+    if (queries == NULL) {
+      d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to realloc queries.");
+      return true;
+    }
+    memset(&queries[manager->capacity], 0,
+           sizeof(d_OcclusionQuery) * (capacity - manager->capacity));
+    for (d_uint i = manager->capacity; i < capacity; i++) {
+      queries[i].visible = true;
+    }
+    manager->queries = queries;
+    manager->capacity = capacity;
+  }
+
+  d_OcclusionQuery *query = &manager->queries[id];
+
+  // the box cannot be rasterized around a camera inside it
+  d_Vec3 eye = manager->camera_position;
+  if (eye.x >= bounds->min.x && eye.x <= bounds->max.x &&
+      eye.y >= bounds->min.y && eye.y <= bounds->max.y &&
+      eye.z >= bounds->min.z && eye.z <= bounds->max.z) {
+    query->visible = true;
+    return true;
+  }
+
+  // visible objects are staggered by id so their tests spread over frames
+  bool due = query->visible == false ||
+             (manager->frame + id) % D_QUERY_VISIBLE_INTERVAL == 0;
+  d_uint slot = manager->frame % D_QUERY_FRAMES;
+  if (due == true && query->requested == false &&
+      query->pending[slot] == false) {
+    query->requested = true;
+    query->bounds = *bounds;
+    d_array_add(manager->requests, (void *)&id);
+  }
+
+  return query->visible;
+}
+
+void d_occlusion_query_manager_issue(d_OcclusionQueryManager *manager) {
+  if (manager == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "manager is NULL.");
+    return;
+  }
+  if (manager->requests->length == 0) {
+    return;
+  }
+
+  d_pipeline_state_apply(manager->pipeline);
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  d_gl_use_program(manager->program);
+  d_vao_bind(manager->vao);
+
+  d_uint slot = manager->frame % D_QUERY_FRAMES;
+  for (size_t i = 0; i < manager->requests->length; i++) {
+    d_uint id = ((d_uint *)manager->requests->data)[i];
+    d_OcclusionQuery *query = &manager->queries[id];
+    if (query->ids[0] == 0) {
+      glGenQueries(D_QUERY_FRAMES, query->ids);
+    }
+
+    d_Vec3 size = d_vec3(query->bounds.max.x - query->bounds.min.x,
+                         query->bounds.max.y - query->bounds.min.y,
+                         query->bounds.max.z - query->bounds.min.z);
+    d_Mat4 model = d_mat4(true);
+    model.data[0] = size.x;
+    model.data[5] = size.y;
+    model.data[10] = size.z;
+    model.data[12] = query->bounds.min.x;
+    model.data[13] = query->bounds.min.y;
+    model.data[14] = query->bounds.min.z;
+    d_Mat4 mvp = d_mat4_multiply(&manager->view_projection, &model);
+    glUniformMatrix4fv(manager->mvp_location, 1, GL_FALSE, mvp.data);
+
+    glBeginQuery(GL_ANY_SAMPLES_PASSED, query->ids[slot]);
+    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, (void *)0);
+    glEndQuery(GL_ANY_SAMPLES_PASSED);
+    query->pending[slot] = true;
+  }
+
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+#pragma endregion
+
+#pragma region RenderQueue
+
+d_RenderQueue *d_render_queue_create() {
+  d_RenderQueue *queue = malloc(sizeof(d_RenderQueue));
+  if (queue == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc queue.");
+    return NULL;
+  }
+
+  queue->capacity = 256;
+  queue->count = 0;
+  queue->sorted = true;
+  queue->items = malloc(sizeof(d_DrawItem) * queue->capacity);
+  queue->entries = malloc(sizeof(d_RenderQueueEntry) * queue->capacity);
+  queue->scratch = malloc(sizeof(d_RenderQueueEntry) * queue->capacity);
+  if (queue->items == NULL || queue->entries == NULL ||
+      queue->scratch == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc queue storage.");
+    free(queue->items);
+    free(queue->entries);
+    free(queue->scratch);
+    free(queue);
+    return NULL;
+  }
+
+  d_PipelineState opaque = d_pipeline_state_opaque();
+  queue->default_pipeline = d_pipeline_state_create(&opaque);
+
+  queue->instance_stream =
+      d_stream_buffer_create(GL_ARRAY_BUFFER, sizeof(d_Mat4) * 1024);
+  queue->instance_offset = 0;
+  queue->cull = d_cull_set_create(queue->capacity);
+  queue->culling = false;
+  queue->occlusion = NULL;
+  queue->queries = NULL;
+  queue->light_manager = NULL;
+  queue->deferred = NULL;
+  queue->renderer = NULL;
+  queue->equal_pipelines = d_array_create(d_EqualPipeline, 4);
+  queue->lights = NULL;
+  queue->light_count = 0;
+  queue->light_capacity = 0;
+  queue->projection_scale = 0.0f;
+  queue->camera_position = d_vec3(0.0f, 0.0f, 0.0f);
+  queue->far_plane = 100.0f;
+
+  return queue;
+}
+
+void d_render_queue_destroy(d_RenderQueue **queue) {
+  if (queue == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "queue (d_RenderQueue **) is NULL.");
+    return;
+  }
+  if (*queue == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "queue (d_RenderQueue *) is NULL.");
+    return;
+  }
+
+  d_pipeline_state_destroy(&(*queue)->default_pipeline);
+  for (size_t i = 0; i < (*queue)->equal_pipelines->length; i++) {
+    d_pipeline_state_destroy(
+        &d_array_get((*queue)->equal_pipelines, d_EqualPipeline, i).state);
+  }
+  d_array_destroy(&(*queue)->equal_pipelines);
+  d_stream_buffer_destroy(&(*queue)->instance_stream);
+  d_cull_set_destroy(&(*queue)->cull);
+  free((*queue)->lights);
+  free((*queue)->items);
+  free((*queue)->entries);
+  free((*queue)->scratch);
+  free(*queue);
+  *queue = NULL;
+}
+
+void d_render_queue_begin(d_RenderQueue *queue, d_Camera *camera) {
+  if (queue == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "queue is NULL.");
+    return;
+  }
+
+  queue->count = 0;
+  queue->sorted = true;
+  d_stream_buffer_begin_frame(queue->instance_stream);
+  d_cull_set_clear(queue->cull);
+  queue->culling = camera != NULL;
+  queue->projection_scale = 0.0f;
+  if (camera != NULL) {
+    queue->camera_position = camera->transform->position;
+    queue->far_plane = camera->far_plane;
+    queue->projection_scale = camera->projection.data[5];
+
+    d_Mat4 view_projection =
+        d_mat4_multiply(&camera->projection, &camera->view);
+    queue->frustum = d_frustum_from_matrix(&view_projection);
+  }
+  if (queue->queries != NULL) {
+    d_occlusion_query_manager_begin(queue->queries, camera);
+  }
+}
+
+uint64_t d_render_queue_make_key(d_RenderQueue *queue, const d_DrawItem *item) {
+  const d_PipelineState *pipeline =
+      item->pipeline != NULL ? item->pipeline : queue->default_pipeline;
+
+  float depth = item->depth / queue->far_plane;
+  if (depth < 0.0f)
+    depth = 0.0f;
+  if (depth > 1.0f)
+    depth = 1.0f;
+  uint64_t max_depth = (1ULL << D_SORT_DEPTH_BITS) - 1;
+  uint64_t quantized_depth = (uint64_t)(depth * (float)max_depth);
+
+  uint64_t pass = (uint64_t)item->pass & 0x3;
+  uint64_t pipeline_id = (uint64_t)pipeline->id & 0x3F;
+  uint64_t shader_id = (uint64_t)d_shader_resolve(item->shader)->id & 0x3FF;
+  uint64_t material_id = (uint64_t)item->material->id & 0xFFF;
+  uint64_t mesh_id = (uint64_t)item->mesh_id & 0xFFF;
+
+  if (item->pass == DUCKY_PASS_TRANSPARENT) {
+    return pass << 62 | (max_depth - quantized_depth) << 40 |
+           pipeline_id << 34 | shader_id << 24 | material_id << 12 | mesh_id;
+  }
+
+  return pass << 62 | pipeline_id << 56 | shader_id << 46 | material_id << 34 |
+         mesh_id << 22 | quantized_depth;
+}
+
+void d_render_queue_push(d_RenderQueue *queue, const d_DrawItem *item) {
+  if (queue == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "queue is NULL.");
+    return;
+  }
+  if (item == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "item is NULL.");
+    return;
+  }
+
+  if (queue->count >= queue->capacity) {
+    d_uint capacity = queue->capacity * 2;
+    d_DrawItem *items = realloc(queue->items, sizeof(d_DrawItem) * capacity);
+    if (items == NULL) {
+      d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to realloc items.");
+      return;
+    }
+    queue->items = items;
+
+    d_RenderQueueEntry *entries =
+        realloc(queue->entries, sizeof(d_RenderQueueEntry) * capacity);
+    if (entries == NULL) {
+      d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to realloc entries.");
+      return;
+    }
+    queue->entries = entries;
+
+    d_RenderQueueEntry *scratch =
+        realloc(queue->scratch, sizeof(d_RenderQueueEntry) * capacity);
+    if (scratch == NULL) {
+      d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to realloc scratch.");
+      return;
+    }
+    queue->scratch = scratch;
+    queue->capacity = capacity;
+  }
+
+  d_DrawItem *queued = &queue->items[queue->count];
+  *queued = *item;
+  queued->light_count = 0;
+
+  d_Vec3 position =
+      d_vec3(item->model.data[12], item->model.data[13], item->model.data[14]);
+  d_Vec3 offset = d_vec3_sub(&position, &queue->camera_position);
+  queued->depth = d_vec3_len(&offset);
+
+  queue->entries[queue->count].key = d_render_queue_make_key(queue, queued);
+  queue->entries[queue->count].item = queue->count;
+  d_cull_set_add(queue->cull, item->has_bounds == true ? &item->bounds : NULL);
+  queue->count++;
+  queue->sorted = false;
+}
+
+void d_render_queue_sort(d_RenderQueue *queue) {
+  if (queue == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "queue is NULL.");
+    return;
+  }
+  if (queue->sorted == true || queue->count == 0) {
+    return;
+  }
+
+  // LSD radix sort, 8 bits per pass. Passes where every key has the same
+  // byte are skipped, which is most of them for small scenes.
+  d_RenderQueueEntry *source = queue->entries;
+  d_RenderQueueEntry *destination = queue->scratch;
+
+  for (int shift = 0; shift < 64; shift += 8) {
+    d_uint counts[256] = {0};
+    for (d_uint i = 0; i < queue->count; i++) {
+      counts[(source[i].key >> shift) & 0xFF]++;
+    }
+    if (counts[(source[0].key >> shift) & 0xFF] == queue->count) {
+      continue;
+    }
+
+    d_uint offsets[256];
+    d_uint total = 0;
+    for (int i = 0; i < 256; i++) {
+      offsets[i] = total;
+      total += counts[i];
+    }
+    for (d_uint i = 0; i < queue->count; i++) {
+      destination[offsets[(source[i].key >> shift) & 0xFF]++] = source[i];
+    }
+
+    d_RenderQueueEntry *swap = source;
+    source = destination;
+    destination = swap;
+  }
+
+  queue->entries = source;
+  queue->scratch = destination;
+  queue->sorted = true;
+}
+
+// The frame goes through the G-buffer of `queue->deferred`.
+bool d_render_queue_deferred_internal(const d_RenderQueue *queue) {
+  return queue->deferred != NULL &&
+         queue->deferred->renderer->render_path == DUCKY_RENDER_DEFERRED &&
+         queue->deferred->width > 0;
+}
+
+// Opaque items with a G-buffer variant are drawn with it in a deferred frame.
+bool d_render_queue_in_gbuffer_internal(const d_RenderQueue *queue,
+                                        const d_DrawItem *item) {
+  return item->pass == DUCKY_PASS_OPAQUE && item->shader->deferred != NULL &&
+         d_render_queue_deferred_internal(queue) == true;
+}
+
+d_Shader *d_render_queue_item_shader_internal(const d_RenderQueue *queue,
+                                              const d_DrawItem *item) {
+  return d_render_queue_in_gbuffer_internal(queue, item) == true
+             ? item->shader->deferred
+             : item->shader;
+}
+
+// Number of items from `start` that can be drawn as one instanced draw, `1`
+// when the item is not instanceable.
+d_uint d_render_queue_run_length_internal(d_RenderQueue *queue,
+                                          const d_uint start) {
+  d_DrawItem *first = &queue->items[queue->entries[start].item];
+  d_Shader *shader = d_render_queue_item_shader_internal(queue, first);
+  if (first->pass != DUCKY_PASS_OPAQUE || shader->instanced == NULL ||
+      d_shader_is_ready(shader->instanced) == false) {
+    return 1;
+  }
+
+  d_uint length = 1;
+  while (start + length < queue->count) {
+    d_DrawItem *item = &queue->items[queue->entries[start + length].item];
+    if (item->pass != first->pass || item->pipeline != first->pipeline ||
+        item->shader != first->shader || item->material != first->material ||
+        item->vao != first->vao || item->mesh_id != first->mesh_id ||
+        item->index_count != first->index_count ||
+        item->first_index != first->first_index ||
+        item->base_vertex != first->base_vertex ||
+        item->light_count != first->light_count ||
+        memcmp(item->lights, first->lights,
+               sizeof(d_uint) * item->light_count) != 0) {
+      break;
+    }
+    length++;
+  }
+
+  return length;
+}
+
+// Copies the model matrices of every instanced run into one buffer, uploaded
+// once for the frame.
+void d_render_queue_upload_instances_internal(d_RenderQueue *queue) {
+  d_uint instance_count = 0;
+  for (d_uint i = 0; i < queue->count;) {
+    d_uint length = d_render_queue_run_length_internal(queue, i);
+    if (length >= D_INSTANCING_MIN_COUNT) {
+      instance_count += length;
+    }
+    i += length;
+  }
+  if (instance_count == 0) {
+    return;
+  }
+
+  size_t size = sizeof(d_Mat4) * instance_count;
+  d_Mat4 *data = d_stream_buffer_alloc(queue->instance_stream, size,
+                                       sizeof(float), &queue->instance_offset);
+  if (data == NULL) {
+    // this frame does not fit, the old buffer is released once the GPU is
+    // done with it
+    size_t frame_size = queue->instance_stream->frame_size * 2;
+    while (frame_size < size)
+      frame_size *= 2;
+    d_stream_buffer_destroy(&queue->instance_stream);
+    queue->instance_stream =
+        d_stream_buffer_create(GL_ARRAY_BUFFER, frame_size);
+    d_stream_buffer_begin_frame(queue->instance_stream);
+    data = d_stream_buffer_alloc(queue->instance_stream, size, sizeof(float),
+                                 &queue->instance_offset);
+    if (data == NULL) {
+      d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to allocate instance data.");
+      return;
+    }
+  }
+
+  d_uint instance = 0;
+  for (d_uint i = 0; i < queue->count;) {
+    d_uint length = d_render_queue_run_length_internal(queue, i);
+    if (length >= D_INSTANCING_MIN_COUNT) {
+      for (d_uint j = 0; j < length; j++) {
+        data[instance++] = queue->items[queue->entries[i + j].item].model;
+      }
+    }
+    i += length;
+  }
+
+  d_stream_buffer_flush(queue->instance_stream);
+}
+
+// Picks the `object_light_count` lights that reach each item's bounding
+// sphere the strongest, for items drawn with a per-object light shader.
+void d_render_queue_select_lights_internal(d_RenderQueue *queue) {
+  d_LightManager *manager = queue->light_manager;
+  if (manager == NULL) {
+    return;
+  }
+
+  d_uint count = manager->point_lights->length + manager->spot_lights->length;
+  if (count > queue->light_capacity) {
+    d_ClusterLightData *lights =
+        realloc(queue->lights, sizeof(d_ClusterLightData) * count);
+    if (lights == NULL) {
+      d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to realloc queue lights.");
+      return;
+    }
+    queue->lights = lights;
+    queue->light_capacity = count;
+  }
+
+  d_Array *arrays[2] = {manager->point_lights, manager->spot_lights};
+  queue->light_count = 0;
+  for (int a = 0; a < 2; a++) {
+    for (size_t i = 0; i < arrays[a]->length; i++) {
+      d_cluster_light_write(d_array_get(arrays[a], d_Light *, i),
+                            queue->far_plane,
+                            &queue->lights[queue->light_count++]);
+    }
+  }
+
+  for (d_uint i = 0; i < queue->count; i++) {
+    d_DrawItem *item = &queue->items[queue->entries[i].item];
+    d_uint limit = item->shader->object_light_count;
+    if (limit > D_OBJECT_MAX_LIGHTS)
+      limit = D_OBJECT_MAX_LIGHTS;
+    if (limit == 0) {
+      continue;
+    }
+
+    d_Vec3 center;
+    float radius = 0.0f;
+    if (item->has_bounds == true) {
+      center = d_aabb_center(&item->bounds);
+      d_Vec3 extent = d_vec3_sub(&item->bounds.max, &center);
+      radius = d_vec3_len(&extent);
+    } else {
+      center = d_vec3(item->model.data[12], item->model.data[13],
+                      item->model.data[14]);
+    }
+
+    // insertion into a short list sorted by influence, strongest first
+    float influences[D_OBJECT_MAX_LIGHTS];
+    item->light_count = 0;
+    for (d_uint l = 0; l < queue->light_count; l++) {
+      const d_ClusterLightData *light = &queue->lights[l];
+      d_Vec3 position = d_vec3(light->position[0], light->position[1],
+                               light->position[2]);
+      d_Vec3 offset = d_vec3_sub(&position, &center);
+      float distance = d_vec3_len(&offset) - radius;
+      if (distance > light->range) {
+        continue;
+      }
+      if (distance < 0.0f)
+        distance = 0.0f;
+
+      float influence =
+          light->intensity /
+          (light->a * distance * distance + light->b * distance + 1.0f);
+      if (item->light_count == limit &&
+          influence <= influences[limit - 1]) {
+        continue;
+      }
+
+      d_uint slot = item->light_count < limit ? item->light_count++ : limit - 1;
+      while (slot > 0 && influences[slot - 1] < influence) {
+        influences[slot] = influences[slot - 1];
+        item->lights[slot] = item->lights[slot - 1];
+        slot--;
+      }
+      influences[slot] = influence;
+      item->lights[slot] = l;
+    }
+  }
+}
+
+// Uploads the item's selected lights to `object_lights`, unused slots get no
+// intensity so the shader can always loop over every slot.
+void d_render_queue_upload_object_lights_internal(d_RenderQueue *queue,
+                                                  d_Shader *shader,
+                                                  const d_DrawItem *item) {
+  GLint location = d_shader_get_uniform_location(shader, "object_lights");
+  if (location == -1) {
+    return;
+  }
+
+  d_uint slots = shader->object_light_count < D_OBJECT_MAX_LIGHTS
+                     ? shader->object_light_count
+                     : D_OBJECT_MAX_LIGHTS;
+  d_ClusterLightData data[D_OBJECT_MAX_LIGHTS];
+  memset(data, 0, sizeof(d_ClusterLightData) * slots);
+  for (d_uint i = 0; i < slots; i++) {
+    if (i < item->light_count) {
+      data[i] = queue->lights[item->lights[i]];
+    } else {
+      // keeps the shader's distance / range finite
+      data[i].range = 1.0f;
+      data[i].shadow_view = -1.0f;
+    }
+  }
+
+  glUniform4fv(location, slots * 4, (const float *)data);
+}
+
+void d_render_queue_cull(d_RenderQueue *queue) {
+  if (queue == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "queue is NULL.");
+    return;
+  }
+  if (queue->culling == false || queue->count == 0) {
+    return;
+  }
+
+  d_cull_set_test(queue->cull, &queue->frustum);
+
+  // compacting keeps the relative order, so a sorted queue stays sorted
+  d_uint visible = 0;
+  for (d_uint i = 0; i < queue->count; i++) {
+    d_uint index = queue->entries[i].item;
+    if (d_cull_set_is_visible(queue->cull, index) == false) {
+      continue;
+    }
+
+    d_DrawItem *item = &queue->items[index];
+    if (queue->occlusion != NULL && item->has_bounds == true &&
+        d_occlusion_buffer_test(queue->occlusion, &item->bounds) == false) {
+      continue;
+    }
+    // hidden items are not drawn, only their bounding box is tested
+    if (queue->queries != NULL && item->query_id != 0 &&
+        item->has_bounds == true &&
+        d_occlusion_query_manager_test(queue->queries, item->query_id,
+                                       &item->bounds) == false) {
+      continue;
+    }
+    queue->entries[visible++] = queue->entries[i];
+  }
+  queue->count = visible;
+  // the entries no longer line up with the cull set
+  queue->culling = false;
+}
+
+// The offset changes per run, so the instance attributes of the bound vertex
+// array are pointed at the run's matrices, from `instance` on, before each
+// draw.
+void d_render_queue_bind_instances_internal(d_RenderQueue *queue,
+                                            const d_uint instance) {
+  d_gl_bind_buffer(GL_ARRAY_BUFFER, queue->instance_stream->id);
+  for (d_uint column = 0; column < 4; column++) {
+    d_uint location = D_INSTANCE_ATTRIB_LOCATION + column;
+    glEnableVertexAttribArray(location);
+    glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(d_Mat4),
+                          (void *)(uintptr_t)(queue->instance_offset +
+                                              instance * sizeof(d_Mat4) +
+                                              column * 4 * sizeof(float)));
+    glVertexAttribDivisor(location, 1);
+  }
+}
+
+// Non-instanced draws of the vertex array must not source the matrices.
+void d_render_queue_unbind_instances_internal() {
+  for (d_uint column = 0; column < 4; column++) {
+    glDisableVertexAttribArray(D_INSTANCE_ATTRIB_LOCATION + column);
+  }
+}
+
+// Opaque forward items with a depth writing pipeline are drawn into depth by
+// the pre-pass, if the pre-pass and the item's own program are both ready.
+// The depth shader has no alpha test, so cut-out materials are left out.
+bool d_render_queue_prepassed_internal(const d_RenderQueue *queue,
+                                       const d_DrawItem *item,
+                                       const bool instanced) {
+  const d_Renderer *renderer = queue->renderer;
+  if (renderer == NULL || renderer->depth_prepass == false ||
+      renderer->depth_shader == NULL || item->pass != DUCKY_PASS_OPAQUE ||
+      d_render_queue_in_gbuffer_internal(queue, item) == true) {
+    return false;
+  }
+
+  const d_PipelineState *pipeline =
+      item->pipeline != NULL ? item->pipeline : queue->default_pipeline;
+  if (pipeline->depth_test == false || pipeline->depth_write == false) {
+    return false;
+  }
+  if (item->material != NULL && item->material->diffuse != NULL &&
+      item->material->diffuse->cutout == true) {
+    return false;
+  }
+
+  d_Shader *depth_shader = instanced == true
+                               ? renderer->depth_shader->instanced
+                               : renderer->depth_shader;
+  d_Shader *shader =
+      instanced == true ? item->shader->instanced : item->shader;
+  // an item that is not drawn must not leave its depth behind
+  return depth_shader != NULL && d_shader_is_ready(depth_shader) == true &&
+         d_shader_resolve(shader)->status == DUCKY_SHADER_READY;
+}
+
+// `pipeline` with `GL_EQUAL` and no depth write, for pre-passed items.
+const d_PipelineState *
+d_render_queue_equal_pipeline_internal(d_RenderQueue *queue,
+                                       const d_PipelineState *pipeline) {
+  for (size_t i = 0; i < queue->equal_pipelines->length; i++) {
+    d_EqualPipeline *equal =
+        &d_array_get(queue->equal_pipelines, d_EqualPipeline, i);
+    if (equal->source_id == pipeline->id) {
+      return equal->state;
+    }
+  }
+
+  d_PipelineState description = *pipeline;
+  description.depth_func = GL_EQUAL;
+  description.depth_write = false;
+  d_EqualPipeline equal = {pipeline->id,
+                           d_pipeline_state_create(&description)};
+  d_array_add(queue->equal_pipelines, &equal);
+  return equal.state;
+}
+
+// Draws the pre-passed items into depth only, with the position-only vertex
+// arrays and `renderer->depth_shader`.
+void d_render_queue_prepass_internal(d_RenderQueue *queue) {
+  if (queue->renderer == NULL || queue->renderer->depth_prepass == false ||
+      queue->renderer->depth_shader == NULL) {
+    return;
+  }
+
+  d_Shader *shader = NULL;
+  const d_PipelineState *pipeline = NULL;
+  d_uint instance = 0;
+  bool drawn = false;
+  for (d_uint i = 0; i < queue->count;) {
+    d_DrawItem *item = &queue->items[queue->entries[i].item];
+    d_uint length = d_render_queue_run_length_internal(queue, i);
+    bool instanced = length >= D_INSTANCING_MIN_COUNT;
+    if (instanced == false) {
+      length = 1;
+    }
+    if (d_render_queue_prepassed_internal(queue, item, instanced) == false) {
+      instance += instanced == true ? length : 0;
+      i += length;
+      continue;
+    }
+
+    if (drawn == false) {
+      glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+      drawn = true;
+    }
+
+    // same raster state as the shading pass, so both produce the same depth
+    const d_PipelineState *item_pipeline =
+        item->pipeline != NULL ? item->pipeline : queue->default_pipeline;
+    if (item_pipeline != pipeline) {
+      d_pipeline_state_apply(item_pipeline);
+      pipeline = item_pipeline;
+    }
+
+    d_Shader *item_shader = instanced == true
+                                ? queue->renderer->depth_shader->instanced
+                                : queue->renderer->depth_shader;
+    if (item_shader != shader) {
+      d_shader_activate(item_shader);
+      shader = item_shader;
+    }
+
+    d_vao_bind(item->position_vao != NULL ? item->position_vao : item->vao);
+    const void *indices =
+        (void *)(uintptr_t)(item->first_index * sizeof(d_uint));
+
+    if (instanced == true) {
+      d_render_queue_bind_instances_internal(queue, instance);
+      glDrawElementsInstancedBaseVertex(GL_TRIANGLES, item->index_count,
+                                        GL_UNSIGNED_INT, indices, length,
+                                        item->base_vertex);
+      instance += length;
+      d_render_queue_unbind_instances_internal();
+    } else {
+      d_shader_set_mat4(shader, "model", &item->model);
+      glDrawElementsBaseVertex(GL_TRIANGLES, item->index_count,
+                               GL_UNSIGNED_INT, indices, item->base_vertex);
+    }
+
+    i += length;
+  }
+
+  if (drawn == true) {
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  }
+}
+
+// Draws the runs of one pass: the G-buffer items when `geometry` is true,
+// everything drawn forward otherwise.
+void d_render_queue_draw_internal(d_RenderQueue *queue, const bool geometry) {
+  d_Shader *shader = NULL;
+  d_Material *material = NULL;
+  const d_PipelineState *pipeline = NULL;
+  d_uint instance = 0;
+  for (d_uint i = 0; i < queue->count;) {
+    d_DrawItem *item = &queue->items[queue->entries[i].item];
+    d_uint length = d_render_queue_run_length_internal(queue, i);
+    bool instanced = length >= D_INSTANCING_MIN_COUNT;
+    if (instanced == false) {
+      length = 1;
+    }
+    // runs of the other pass still own their instance matrices
+    if (d_render_queue_in_gbuffer_internal(queue, item) != geometry) {
+      instance += instanced == true ? length : 0;
+      i += length;
+      continue;
+    }
+
+    const d_PipelineState *item_pipeline =
+        item->pipeline != NULL ? item->pipeline : queue->default_pipeline;
+    if (geometry == false &&
+        d_render_queue_prepassed_internal(queue, item, instanced) == true) {
+      item_pipeline =
+          d_render_queue_equal_pipeline_internal(queue, item_pipeline);
+    }
+    if (item_pipeline != pipeline) {
+      d_pipeline_state_apply(item_pipeline);
+      pipeline = item_pipeline;
+    }
+
+    d_Shader *base_shader = d_render_queue_item_shader_internal(queue, item);
+    d_Shader *item_shader = d_shader_resolve(
+        instanced == true ? base_shader->instanced : base_shader);
+    if (item_shader->status != DUCKY_SHADER_READY) {
+      instance += instanced == true ? length : 0;
+      i += length;
+      continue;
+    }
+    if (item_shader != shader) {
+      d_shader_activate(item_shader);
+      shader = item_shader;
+      // uniforms are per program, so the material has to be set again
+      material = NULL;
+    }
+
+    if (item->material != material) {
+      d_material_bind(item->material);
+      d_material_set_uniforms(item->material, shader);
+      material = item->material;
+    }
+
+    // the whole run shares one light set, see the run length
+    if (shader->object_light_count > 0 && queue->light_manager != NULL) {
+      d_render_queue_upload_object_lights_internal(queue, shader, item);
+    }
+
+    d_vao_bind(item->vao);
+    const void *indices =
+        (void *)(uintptr_t)(item->first_index * sizeof(d_uint));
+
+    if (instanced == true) {
+      d_render_queue_bind_instances_internal(queue, instance);
+      glDrawElementsInstancedBaseVertex(GL_TRIANGLES, item->index_count,
+                                        GL_UNSIGNED_INT, indices, length,
+                                        item->base_vertex);
+      instance += length;
+      d_render_queue_unbind_instances_internal();
+    } else {
+      d_shader_set_mat4(shader, "model", &item->model);
+      glDrawElementsBaseVertex(GL_TRIANGLES, item->index_count,
+                               GL_UNSIGNED_INT, indices, item->base_vertex);
+    }
+
+    i += length;
+  }
+}
+
+void d_render_queue_submit(d_RenderQueue *queue) {
+  D_PROFILE_SCOPE("d_render_queue_submit");
+  if (queue == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "queue is NULL.");
+    return;
+  }
+
+  d_render_queue_cull(queue);
+  d_render_queue_sort(queue);
+  d_render_queue_select_lights_internal(queue);
+  d_render_queue_upload_instances_internal(queue);
+
+  if (d_render_queue_deferred_internal(queue) == true) {
+    D_PROFILE_GPU_BEGIN("G-buffer");
+    d_deferred_renderer_begin_geometry(queue->deferred);
+    d_render_queue_draw_internal(queue, true);
+    D_PROFILE_GPU_END();
+    D_PROFILE_GPU_BEGIN("deferred lighting");
+    d_deferred_renderer_shade(queue->deferred);
+    D_PROFILE_GPU_END();
+  }
+  D_PROFILE_GPU_BEGIN("depth pre-pass");
+  d_render_queue_prepass_internal(queue);
+  D_PROFILE_GPU_END();
+  D_PROFILE_GPU_BEGIN("forward");
+  d_render_queue_draw_internal(queue, false);
+  D_PROFILE_GPU_END();
+
+  if (queue->queries != NULL) {
+    d_occlusion_query_manager_issue(queue->queries);
+  }
+
+  // depth-equal shading and the queries end with depth writes off, leave the
+  // opaque default so whatever draws or clears next writes depth again
+  d_pipeline_state_apply(queue->default_pipeline);
+
+  // the GPU reads this frame's instance data until the fence passes
+  d_stream_buffer_end_frame(queue->instance_stream);
+}
+
+#pragma endregion
+
+#pragma region StaticBatch
+
+// Appends the mesh renderer's vertices, transformed into world space, and its
+// indices (rebased onto the batch) to the batch's CPU arrays.
+void d_static_batch_append_internal(d_StaticBatch *batch,
+                                    d_MeshRenderer *mesh_renderer,
+                                    d_Array *vertices, d_Array *indices) {
+  d_Mesh *mesh = mesh_renderer->mesh;
+  d_Mat4 model = d_transform_get_matrix(mesh_renderer->transform);
+  const float *m = model.data;
+
+  // normals use the inverse transpose of the upper 3x3, the cofactor matrix
+  // is it times the determinant and the result gets normalized anyway. Only
+  // the determinant's sign is kept, so mirrored transforms keep their normals
+  // pointing out.
+  float normal_matrix[9] = {
+      m[5] * m[10] - m[6] * m[9], m[6] * m[8] - m[4] * m[10],
+      m[4] * m[9] - m[5] * m[8],  m[9] * m[2] - m[10] * m[1],
+      m[10] * m[0] - m[8] * m[2], m[8] * m[1] - m[9] * m[0],
+      m[1] * m[6] - m[2] * m[5],  m[2] * m[4] - m[0] * m[6],
+      m[0] * m[5] - m[1] * m[4]};
+  float determinant = m[0] * normal_matrix[0] + m[1] * normal_matrix[1] +
+                      m[2] * normal_matrix[2];
+  if (determinant < 0.0f) {
+    for (int i = 0; i < 9; i++) {
+      normal_matrix[i] = -normal_matrix[i];
+    }
+  }
+
+  d_uint base_vertex = vertices->length;
+  for (size_t i = 0; i < mesh->vertices->length; i++) {
+    d_Vertex vertex = d_array_get(mesh->vertices, d_Vertex, i);
+    d_Vec3 p = vertex.position;
+    d_Vec3 n = vertex.normal;
+
+    vertex.position = d_vec3(m[0] * p.x + m[4] * p.y + m[8] * p.z + m[12],
+                             m[1] * p.x + m[5] * p.y + m[9] * p.z + m[13],
+                             m[2] * p.x + m[6] * p.y + m[10] * p.z + m[14]);
+    const float *nm = normal_matrix;
+    d_Vec3 normal = d_vec3(nm[0] * n.x + nm[3] * n.y + nm[6] * n.z,
+                           nm[1] * n.x + nm[4] * n.y + nm[7] * n.z,
+                           nm[2] * n.x + nm[5] * n.y + nm[8] * n.z);
+    vertex.normal = d_vec3_normalized(&normal);
+
+    d_aabb_grow(&batch->bounds, &vertex.position);
+    d_array_add(vertices, &vertex);
+  }
+
+  // full detail only, the batch is drawn as a whole
+  for (size_t i = 0; i < mesh->lods[0].index_count; i++) {
+    d_uint index = d_array_get(mesh->indices, d_uint, i) + base_vertex;
+    d_array_add(indices, &index);
+  }
+}
+
+d_Array *d_static_batch_build(d_MeshRenderer **mesh_renderers,
+                              const d_uint count) {
+  if (mesh_renderers == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "mesh_renderers is NULL.");
+    return NULL;
+  }
+
+  d_Array *batches = d_array_create(d_StaticBatch *, 4);
+  // vertices/indices of the batch at the same index, until uploaded
+  d_Array *batch_vertices = d_array_create(d_Array *, 4);
+  d_Array *batch_indices = d_array_create(d_Array *, 4);
+
+  for (d_uint i = 0; i < count; i++) {
+    d_MeshRenderer *mesh_renderer = mesh_renderers[i];
+    if (mesh_renderer == NULL || mesh_renderer->is_static == false ||
+        mesh_renderer->batched == true || mesh_renderer->mesh == NULL ||
+        mesh_renderer->material == NULL || mesh_renderer->shader == NULL) {
+      continue;
+    }
+
+    size_t batch_index = batches->length;
+    for (size_t j = 0; j < batches->length; j++) {
+      d_StaticBatch *batch = d_array_get(batches, d_StaticBatch *, j);
+      if (batch->material == mesh_renderer->material &&
+          batch->shader == mesh_renderer->shader &&
+          batch->pipeline == mesh_renderer->pipeline) {
+        batch_index = j;
+        break;
+      }
+    }
+
+    if (batch_index == batches->length) {
+      d_StaticBatch *batch = malloc(sizeof(d_StaticBatch));
+      if (batch == NULL) {
+        d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc batch.");
+        continue;
+      }
+      batch->material = mesh_renderer->material;
+      batch->shader = mesh_renderer->shader;
+      batch->pipeline = mesh_renderer->pipeline;
+      memset(&batch->geometry, 0, sizeof(d_GeometryRange));
+      batch->bounds = d_aabb_empty();
+
+      d_Array *vertices = d_array_create(d_Vertex, 1024);
+      d_Array *indices = d_array_create(d_uint, 1024);
+      d_array_add(batches, &batch);
+      d_array_add(batch_vertices, &vertices);
+      d_array_add(batch_indices, &indices);
+    }
+
+    d_static_batch_append_internal(
+        d_array_get(batches, d_StaticBatch *, batch_index), mesh_renderer,
+        d_array_get(batch_vertices, d_Array *, batch_index),
+        d_array_get(batch_indices, d_Array *, batch_index));
+    mesh_renderer->batched = true;
+
+    // the batch holds a copy of the geometry, the renderer's share of the
+    // mesh and its range is not needed anymore
+    d_mesh_release(mesh_renderer->mesh);
+    mesh_renderer->mesh = NULL;
+    memset(&mesh_renderer->geometry, 0, sizeof(d_GeometryRange));
+  }
+
+  for (size_t i = 0; i < batches->length; i++) {
+    d_StaticBatch *batch = d_array_get(batches, d_StaticBatch *, i);
+    d_Array *vertices = d_array_get(batch_vertices, d_Array *, i);
+    d_Array *indices = d_array_get(batch_indices, d_Array *, i);
+
+    d_geometry_buffer_alloc(d_mesh_geometry_get(), vertices->data,
+                            vertices->length, (const d_uint *)indices->data,
+                            indices->length, &batch->geometry);
+
+    d_array_destroy(&vertices);
+    d_array_destroy(&indices);
+  }
+
+  d_array_destroy(&batch_vertices);
+  d_array_destroy(&batch_indices);
+  return batches;
+}
+
+void d_static_batch_destroy(d_StaticBatch **batch) {
+  if (batch == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "batch (d_StaticBatch **) is NULL.");
+    return;
+  }
+  if (*batch == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "batch (d_StaticBatch *) is NULL.");
+    return;
+  }
+
+  if (d_mesh_geometry != NULL) {
+    d_geometry_buffer_free(d_mesh_geometry, &(*batch)->geometry);
+  }
+  free(*batch);
+  *batch = NULL;
+}
+
+void d_static_batches_destroy(d_Array **batches) {
+  if (batches == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "batches (d_Array **) is NULL.");
+    return;
+  }
+  if (*batches == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "batches (d_Array *) is NULL.");
+    return;
+  }
+
+  for (size_t i = 0; i < (*batches)->length; i++) {
+    d_StaticBatch *batch = d_array_get(*batches, d_StaticBatch *, i);
+    d_static_batch_destroy(&batch);
+  }
+  d_array_destroy(batches);
+}
+
+void d_static_batch_submit(d_StaticBatch *batch, d_RenderQueue *queue) {
+  if (batch == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "batch is NULL.");
+    return;
+  }
+  if (queue == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "queue is NULL.");
+    return;
+  }
+  if (batch->geometry.index_count == 0) {
+    return;
+  }
+
+  d_DrawItem item;
+  item.pipeline = batch->pipeline;
+  item.pass = item.pipeline != NULL && item.pipeline->blending == true
+                  ? DUCKY_PASS_TRANSPARENT
+                  : DUCKY_PASS_OPAQUE;
+  item.shader = batch->shader;
+  item.material = batch->material;
+  item.vao = d_mesh_geometry->vao;
+  item.position_vao = d_mesh_geometry->position_vao;
+  item.mesh_id = batch->geometry.id;
+  item.index_count = batch->geometry.index_count;
+  item.first_index = batch->geometry.first_index;
+  item.base_vertex = batch->geometry.base_vertex;
+  // vertices are already in world space
+  item.model = d_mat4(true);
+  item.bounds = batch->bounds;
+  item.has_bounds = true;
+  item.query_id = 0;
+
+  d_uint count = queue->count;
+  d_render_queue_push(queue, &item);
+  if (queue->count == count) {
+    return;
+  }
+
+  // the identity model would sort by the origin, use the bounds instead
+  d_DrawItem *queued = &queue->items[queue->count - 1];
+  d_Vec3 center = d_aabb_center(&batch->bounds);
+  d_Vec3 offset = d_vec3_sub(&center, &queue->camera_position);
+  queued->depth = d_vec3_len(&offset);
+  queue->entries[queue->count - 1].key =
+      d_render_queue_make_key(queue, queued);
+}
+
+#pragma endregion
+
+#pragma region Clusters
+
+d_ClusterGrid *d_cluster_grid_create() {
+  d_ClusterGrid *grid = malloc(sizeof(d_ClusterGrid));
+  if (grid == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc cluster grid.");
+    return NULL;
+  }
+
+  grid->lights = NULL;
+  grid->spheres = NULL;
+  grid->light_count = 0;
+  grid->light_capacity = 0;
+  grid->near_plane = 0.0f;
+  grid->far_plane = 0.0f;
+  grid->index_count = 0;
+  memset(grid->slice_counts, 0, sizeof(grid->slice_counts));
+  memset(&grid->projection, 0, sizeof(grid->projection));
+
+  grid->bounds = malloc(sizeof(d_AABB) * D_CLUSTER_COUNT);
+  grid->grid = malloc(sizeof(d_uint) * D_CLUSTER_COUNT * 2);
+  grid->indices =
+      malloc(sizeof(d_uint) * D_CLUSTER_COUNT * D_CLUSTER_MAX_LIGHTS);
+  if (grid->bounds == NULL || grid->grid == NULL || grid->indices == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc cluster data.");
+    free(grid->bounds);
+    free(grid->grid);
+    free(grid->indices);
+    free(grid);
+    return NULL;
+  }
+
+  // one buffer texture each for the grid, the index lists and the lights
+  GLuint buffers[3];
+  GLuint textures[3];
+  glGenBuffers(3, buffers);
+  glGenTextures(3, textures);
+  const GLenum formats[3] = {GL_RG32UI, GL_R32UI, GL_RGBA32F};
+  const size_t sizes[3] = {sizeof(d_uint) * D_CLUSTER_COUNT * 2,
+                           sizeof(d_uint) * 64,
+                           sizeof(d_ClusterLightData) * 16};
+  for (int i = 0; i < 3; i++) {
+    d_gl_bind_buffer(GL_TEXTURE_BUFFER, buffers[i]);
+    glBufferData(GL_TEXTURE_BUFFER, sizes[i], NULL, GL_STREAM_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+    glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+  }
+  grid->grid_buffer = buffers[0];
+  grid->grid_texture = textures[0];
+  grid->index_buffer = buffers[1];
+  grid->index_texture = textures[1];
+  grid->index_buffer_size = sizes[1];
+  grid->light_buffer = buffers[2];
+  grid->light_texture = textures[2];
+  grid->light_buffer_size = sizes[2];
+
+  grid->uniforms =
+      d_uniform_buffer_create(sizeof(d_ClusterData), D_UNIFORM_BLOCK_CLUSTERS);
+  d_gl_error("Failed to create cluster grid ");
+
+  return grid;
+}
+
+void d_cluster_grid_destroy(d_ClusterGrid **grid) {
+  if (grid == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "grid (d_ClusterGrid **) is NULL.");
+    return;
+  }
+  if (*grid == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "grid (d_ClusterGrid *) is NULL.");
+    return;
+  }
+
+  GLuint buffers[3] = {(*grid)->grid_buffer, (*grid)->index_buffer,
+                       (*grid)->light_buffer};
+  GLuint textures[3] = {(*grid)->grid_texture, (*grid)->index_texture,
+                        (*grid)->light_texture};
+  glDeleteTextures(3, textures);
+  glDeleteBuffers(3, buffers);
+  d_uniform_buffer_destroy(&(*grid)->uniforms);
+
+  free((*grid)->lights);
+  free((*grid)->spheres);
+  free((*grid)->bounds);
+  free((*grid)->grid);
+  free((*grid)->indices);
+  free(*grid);
+  *grid = NULL;
+}
+
+// Distance at which the light's falloff drops below
+// `D_CLUSTER_LIGHT_CUTOFF`.
+float d_cluster_light_range_internal(const d_Light *light, const float far) {
+  float k = light->intensity / D_CLUSTER_LIGHT_CUTOFF;
+  if (k <= 1.0f) {
+    return 0.0f;
+  }
+  if (light->a > 0.0f) {
+    return (-light->b +
+            sqrtf(light->b * light->b + 4.0f * light->a * (k - 1.0f))) /
+           (2.0f * light->a);
+  }
+  if (light->b > 0.0f) {
+    return (k - 1.0f) / light->b;
+  }
+  // no falloff, reaches everything the camera sees
+  return far;
+}
+
+void d_cluster_light_write(const d_Light *light, const float far,
+                           d_ClusterLightData *data) {
+  if (light == NULL || data == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "light or data is NULL.");
+    return;
+  }
+
+  d_Vec3 direction = d_vec3_normalized(&light->direction);
+  memcpy(data->position, light->position.data, sizeof(data->position));
+  memcpy(data->color, light->color.data, sizeof(data->color));
+  memcpy(data->direction, direction.data, sizeof(data->direction));
+  data->range = d_cluster_light_range_internal(light, far);
+  data->intensity = light->intensity;
+  data->a = light->a;
+  data->b = light->b;
+  data->shadow_view = (float)light->shadow_view;
+  data->spot_scale = 0.0f;
+  data->spot_offset = 1.0f;
+  if (light->type == DUCKY_LIGHT_SPOT) {
+    float cos_inner = cosf(light->inner_cone_angle);
+    float cos_outer = cosf(light->outer_cone_angle);
+    float difference = cos_inner - cos_outer;
+    data->spot_scale = 1.0f / (difference > 0.0001f ? difference : 0.0001f);
+    data->spot_offset = -cos_outer * data->spot_scale;
+  }
+}
+
+void d_cluster_grid_compute_bounds_internal(d_ClusterGrid *grid,
+                                            const d_Mat4 *projection,
+                                            const float near,
+                                            const float far) {
+  const float *p = projection->data;
+  for (d_uint z = 0; z < D_CLUSTER_Z; z++) {
+    float depths[2] = {near * powf(far / near, (float)z / D_CLUSTER_Z),
+                       near * powf(far / near, (float)(z + 1) / D_CLUSTER_Z)};
+    for (d_uint y = 0; y < D_CLUSTER_Y; y++) {
+      for (d_uint x = 0; x < D_CLUSTER_X; x++) {
+        float ndc_x[2] = {-1.0f + 2.0f * x / D_CLUSTER_X,
+                          -1.0f + 2.0f * (x + 1) / D_CLUSTER_X};
+        float ndc_y[2] = {-1.0f + 2.0f * y / D_CLUSTER_Y,
+                          -1.0f + 2.0f * (y + 1) / D_CLUSTER_Y};
+
+        d_AABB box = d_aabb_empty();
+        // the tile's corners on the slice's near and far planes
+        for (int d = 0; d < 2; d++) {
+          for (int i = 0; i < 4; i++) {
+            d_Vec3 corner =
+                d_vec3(depths[d] * (ndc_x[i & 1] + p[8]) / p[0],
+                       depths[d] * (ndc_y[i >> 1] + p[9]) / p[5], -depths[d]);
+            d_aabb_grow(&box, &corner);
+          }
+        }
+        grid->bounds[(z * D_CLUSTER_Y + y) * D_CLUSTER_X + x] = box;
+      }
+    }
+  }
+
+  grid->projection = *projection;
+  grid->near_plane = near;
+  grid->far_plane = far;
+}
+
+// Bins every light into the clusters of one slice, the slice writes to its
+// own part of `indices` so slices can run on any thread.
+void d_cluster_grid_bin_slice_internal(d_uint slice, void *user_data) {
+  d_ClusterGrid *grid = user_data;
+  const d_uint tiles = D_CLUSTER_X * D_CLUSTER_Y;
+  d_uint *list = &grid->indices[(size_t)slice * tiles * D_CLUSTER_MAX_LIGHTS];
+  d_uint count = 0;
+
+  for (d_uint tile = 0; tile < tiles; tile++) {
+    d_uint cluster = slice * tiles + tile;
+    const d_AABB *box = &grid->bounds[cluster];
+    d_uint start = count;
+
+    for (d_uint i = 0; i < grid->light_count; i++) {
+      const d_Vec4 *sphere = &grid->spheres[i];
+      if (sphere->z + sphere->w < box->min.z ||
+          sphere->z - sphere->w > box->max.z) {
+        continue;
+      }
+
+      float distance = 0.0f;
+      for (int axis = 0; axis < 3; axis++) {
+        float c = sphere->data[axis];
+        float v = c < box->min.data[axis]   ? box->min.data[axis] - c
+                  : c > box->max.data[axis] ? c - box->max.data[axis]
+                                            : 0.0f;
+        distance += v * v;
+      }
+      if (distance > sphere->w * sphere->w) {
+        continue;
+      }
+
+      list[count++] = i;
+      if (count - start == D_CLUSTER_MAX_LIGHTS) {
+        break;
+      }
+    }
+
+    // relative to the slice, made absolute once the slices are packed
+    grid->grid[cluster * 2] = start;
+    grid->grid[cluster * 2 + 1] = count - start;
+  }
+
+  grid->slice_counts[slice] = count;
+}
+
+void d_cluster_grid_build(d_ClusterGrid *grid, d_LightManager *manager,
+                          d_Camera *camera, const d_Viewport *viewport) {
+  D_PROFILE_SCOPE("d_cluster_grid_build");
+  if (grid == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "grid is NULL.");
+    return;
+  }
+  if (manager == NULL || camera == NULL || viewport == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "manager, camera or viewport is NULL.");
+    return;
+  }
+
+  d_uint count = manager->point_lights->length + manager->spot_lights->length;
+  if (count > grid->light_capacity) {
+    d_ClusterLightData *lights =
+        realloc(grid->lights, sizeof(d_ClusterLightData) * count);
+    if (lights == NULL) {
+      d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to realloc cluster lights.");
+      return;
+    }
+    grid->lights = lights;
+
+    d_Vec4 *spheres = realloc(grid->spheres, sizeof(d_Vec4) * count);
+    if (spheres == NULL) {
+      d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to realloc cluster lights.");
+      return;
+    }
+    grid->spheres = spheres;
+    grid->light_capacity = count;
+  }
+
+  // world space light data for the shader, view space spheres for binning
+  const float *v = camera->view.data;
+  d_Array *arrays[2] = {manager->point_lights, manager->spot_lights};
+  grid->light_count = 0;
+  for (int a = 0; a < 2; a++) {
+    for (size_t i = 0; i < arrays[a]->length; i++) {
+      const d_Light *light = d_array_get(arrays[a], d_Light *, i);
+      d_ClusterLightData *data = &grid->lights[grid->light_count];
+      d_Vec4 *sphere = &grid->spheres[grid->light_count];
+      grid->light_count++;
+      d_cluster_light_write(light, camera->far_plane, data);
+
+      const d_Vec3 *p = &light->position;
+      sphere->x = v[0] * p->x + v[4] * p->y + v[8] * p->z + v[12];
+      sphere->y = v[1] * p->x + v[5] * p->y + v[9] * p->z + v[13];
+      sphere->z = v[2] * p->x + v[6] * p->y + v[10] * p->z + v[14];
+      sphere->w = data->range;
+    }
+  }
+
+  if (memcmp(&grid->projection, &camera->projection, sizeof(d_Mat4)) != 0 ||
+      grid->near_plane != camera->near_plane ||
+      grid->far_plane != camera->far_plane) {
+    d_cluster_grid_compute_bounds_internal(grid, &camera->projection,
+                                           camera->near_plane,
+                                           camera->far_plane);
+  }
+
+  d_parallel_for(D_CLUSTER_Z, d_cluster_grid_bin_slice_internal, grid);
+
+  // pack the slice lists, each moves down to just after the previous one
+  const d_uint tiles = D_CLUSTER_X * D_CLUSTER_Y;
+  d_uint offset = 0;
+  for (d_uint slice = 0; slice < D_CLUSTER_Z; slice++) {
+    memmove(&grid->indices[offset],
+            &grid->indices[(size_t)slice * tiles * D_CLUSTER_MAX_LIGHTS],
+            sizeof(d_uint) * grid->slice_counts[slice]);
+    for (d_uint tile = 0; tile < tiles; tile++) {
+      grid->grid[(slice * tiles + tile) * 2] += offset;
+    }
+    offset += grid->slice_counts[slice];
+  }
+  grid->index_count = offset;
+
+  // orphan each buffer so the GPU can keep reading last frame's lists
+  d_gl_bind_buffer(GL_TEXTURE_BUFFER, grid->grid_buffer);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(d_uint) * D_CLUSTER_COUNT * 2, NULL,
+               GL_STREAM_DRAW);
+  glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(d_uint) * D_CLUSTER_COUNT * 2,
+                  grid->grid);
+
+  size_t index_size = sizeof(d_uint) * grid->index_count;
+  while (grid->index_buffer_size < index_size)
+    grid->index_buffer_size *= 2;
+  d_gl_bind_buffer(GL_TEXTURE_BUFFER, grid->index_buffer);
+  glBufferData(GL_TEXTURE_BUFFER, grid->index_buffer_size, NULL,
+               GL_STREAM_DRAW);
+  glBufferSubData(GL_TEXTURE_BUFFER, 0, index_size, grid->indices);
+
+  size_t light_size = sizeof(d_ClusterLightData) * grid->light_count;
+  while (grid->light_buffer_size < light_size)
+    grid->light_buffer_size *= 2;
+  d_gl_bind_buffer(GL_TEXTURE_BUFFER, grid->light_buffer);
+  glBufferData(GL_TEXTURE_BUFFER, grid->light_buffer_size, NULL,
+               GL_STREAM_DRAW);
+  glBufferSubData(GL_TEXTURE_BUFFER, 0, light_size, grid->lights);
+
+  d_ClusterData data;
+  data.size[0] = D_CLUSTER_X;
+  data.size[1] = D_CLUSTER_Y;
+  data.size[2] = D_CLUSTER_Z;
+  data.size[3] = grid->light_count;
+  float log_ratio = logf(camera->far_plane / camera->near_plane);
+  data.depth[0] = camera->near_plane;
+  data.depth[1] = camera->far_plane;
+  data.depth[2] = D_CLUSTER_Z / log_ratio;
+  data.depth[3] = -D_CLUSTER_Z * logf(camera->near_plane) / log_ratio;
+  data.viewport[0] = (float)viewport->viewport_x;
+  data.viewport[1] = (float)viewport->viewport_y;
+  data.viewport[2] = (float)viewport->viewport_w;
+  data.viewport[3] = (float)viewport->viewport_h;
+  d_uniform_buffer_update(grid->uniforms, 0, sizeof(data), &data);
+
+  // buffer textures are not shadowed, only the active unit is
+  const d_uint units[3] = {D_TEXTURE_UNIT_CLUSTER_GRID,
+                           D_TEXTURE_UNIT_CLUSTER_INDICES,
+                           D_TEXTURE_UNIT_CLUSTER_LIGHTS};
+  const GLuint textures[3] = {grid->grid_texture, grid->index_texture,
+                              grid->light_texture};
+  for (int i = 0; i < 3; i++) {
+    d_gl_active_texture(units[i]);
+    glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+  }
+}
+
+#pragma endregion
+
+#pragma region Shadows
+
+const char *d_shadow_vertex_source =
+    "#version 330 core\n"
+    "layout(location = 0) in vec3 aPos;\n"
+    "uniform mat4 model;\n"
+    "uniform mat4 view_projection;\n"
+    "void main() {\n"
+    "  gl_Position = view_projection * model * vec4(aPos, 1.0);\n"
+    "}\n";
+
+const char *d_shadow_fragment_source = "#version 330 core\n"
+                                       "void main() {}\n";
+
+// Depth texture the size of the atlas, with a framebuffer drawing into it.
+GLuint d_shadow_atlas_create_target_internal(d_ShadowAtlas *atlas,
+                                             GLuint *framebuffer,
+                                             const bool compare) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  d_gl_bind_texture(D_TEXTURE_UNIT_SHADOW_ATLAS, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, atlas->width,
+               atlas->height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+  // linear filtering of a compared texture blends four tests
+  GLint filter = compare == true ? GL_LINEAR : GL_NEAREST;
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  if (compare == true) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE,
+                    GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  }
+
+  glGenFramebuffers(1, framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, *framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+                         texture, 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    d_throw_error(DUCKY_FAILURE, "Shadow atlas framebuffer is incomplete.");
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, d_window_framebuffer);
+
+  return texture;
+}
+
+d_ShadowAtlas *d_shadow_atlas_create(d_Renderer *renderer) {
+  if (renderer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "renderer is NULL.");
+    return NULL;
+  }
+
+  d_ShadowAtlas *atlas = malloc(sizeof(d_ShadowAtlas));
+  if (atlas == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc shadow atlas.");
+    return NULL;
+  }
+
+  atlas->renderer = renderer;
+  atlas->width = renderer->shadow_map_size_w;
+  atlas->height = renderer->shadow_map_size_h;
+  atlas->tile_width = atlas->width / D_SHADOW_ATLAS_TILES;
+  atlas->tile_height = atlas->height / D_SHADOW_ATLAS_TILES;
+  atlas->view_count = 0;
+  for (d_uint i = 0; i < D_SHADOW_MAX_VIEWS; i++) {
+    atlas->views[i].cache_valid = false;
+  }
+  atlas->static_casters = d_array_create(d_ShadowCaster, 64);
+  atlas->dynamic_casters = d_array_create(d_ShadowCaster, 64);
+  atlas->static_hash = D_HASH_SEED;
+  atlas->cached_static_hash = D_HASH_SEED;
+  atlas->max_distance = 50.0f;
+  memset(&atlas->data, 0, sizeof(d_ShadowData));
+
+  // allocated once a light casts shadows
+  atlas->texture = 0;
+  atlas->framebuffer = 0;
+  atlas->static_texture = 0;
+  atlas->static_framebuffer = 0;
+
+  GLuint vertex = glCreateShader(GL_VERTEX_SHADER);
+  glShaderSource(vertex, 1, &d_shadow_vertex_source, NULL);
+  glCompileShader(vertex);
+  d_check_shader_compile(vertex, "VERTEX");
+  GLuint fragment = glCreateShader(GL_FRAGMENT_SHADER);
+  glShaderSource(fragment, 1, &d_shadow_fragment_source, NULL);
+  glCompileShader(fragment);
+  d_check_shader_compile(fragment, "FRAGMENT");
+
+  atlas->program = glCreateProgram();
+  glAttachShader(atlas->program, vertex);
+  glAttachShader(atlas->program, fragment);
+  glLinkProgram(atlas->program);
+  d_check_shader_link(atlas->program);
+  glDeleteShader(vertex);
+  glDeleteShader(fragment);
+  atlas->model_location = glGetUniformLocation(atlas->program, "model");
+  atlas->view_projection_location =
+      glGetUniformLocation(atlas->program, "view_projection");
+
+  d_PipelineState description = d_pipeline_state_shadow();
+  atlas->pipeline = d_pipeline_state_create(&description);
+
+  return atlas;
+}
+
+void d_shadow_atlas_destroy(d_ShadowAtlas **atlas) {
+  if (atlas == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "atlas (d_ShadowAtlas **) is NULL.");
+    return;
+  }
+  if (*atlas == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "atlas (d_ShadowAtlas *) is NULL.");
+    return;
+  }
+
+  if ((*atlas)->texture != 0) {
+    glDeleteFramebuffers(1, &(*atlas)->framebuffer);
+    glDeleteFramebuffers(1, &(*atlas)->static_framebuffer);
+    d_gl_state_forget(GL_TEXTURE, (*atlas)->texture);
+    d_gl_state_forget(GL_TEXTURE, (*atlas)->static_texture);
+    glDeleteTextures(1, &(*atlas)->texture);
+    glDeleteTextures(1, &(*atlas)->static_texture);
+  }
+  d_gl_state_forget(GL_PROGRAM, (*atlas)->program);
+  glDeleteProgram((*atlas)->program);
+  d_pipeline_state_destroy(&(*atlas)->pipeline);
+  d_array_destroy(&(*atlas)->static_casters);
+  d_array_destroy(&(*atlas)->dynamic_casters);
+
+  free(*atlas);
+  *atlas = NULL;
+}
+
+// View matrix at `eye` looking along `forward`. Shadows do not care about the
+// roll, so any up vector that is not parallel to `forward` works.
+d_Mat4 d_shadow_view_matrix_internal(const d_Vec3 *eye,
+                                     const d_Vec3 *forward) {
+  d_Vec3 f = d_vec3_normalized(forward);
+  d_Vec3 world_up = fabsf(f.y) > 0.99f ? d_vec3(1.0f, 0.0f, 0.0f)
+                                       : d_vec3(0.0f, 1.0f, 0.0f);
+  d_Vec3 right = d_vec3_cross(&f, &world_up);
+  right = d_vec3_normalized(&right);
+  d_Vec3 up = d_vec3_cross(&right, &f);
+
+  d_Mat4 view = d_mat4(true);
+  view.data[0] = right.x;
+  view.data[4] = right.y;
+  view.data[8] = right.z;
+  view.data[1] = up.x;
+  view.data[5] = up.y;
+  view.data[9] = up.z;
+  view.data[2] = -f.x;
+  view.data[6] = -f.y;
+  view.data[10] = -f.z;
+  view.data[12] = -d_vec3_dot(&right, eye);
+  view.data[13] = -d_vec3_dot(&up, eye);
+  view.data[14] = d_vec3_dot(&f, eye);
+  return view;
+}
+
+// Appends a view and its tile to the atlas and the `ShadowData` block.
+void d_shadow_atlas_push_view_internal(d_ShadowAtlas *atlas,
+                                       const d_Mat4 *view_projection) {
+  d_uint index = atlas->view_count++;
+  d_ShadowView *view = &atlas->views[index];
+  view->view_projection = *view_projection;
+  view->frustum = d_frustum_from_matrix(view_projection);
+
+  float *rect = atlas->data.rects[index];
+  rect[0] = (float)(index % D_SHADOW_ATLAS_TILES * atlas->tile_width) /
+            atlas->width;
+  rect[1] = (float)(index / D_SHADOW_ATLAS_TILES * atlas->tile_height) /
+            atlas->height;
+  rect[2] = (float)atlas->tile_width / atlas->width;
+  rect[3] = (float)atlas->tile_height / atlas->height;
+  memcpy(atlas->data.matrices[index], view_projection->data,
+         sizeof(atlas->data.matrices[index]));
+}
+
+// One orthographic view per cascade, each around a bounding sphere of its
+// slice of the camera frustum. The sphere's radius only depends on the
+// splits, so it stays the same while the camera turns, and its center is
+// snapped to a coarse light space grid so the view (and its cached static
+// tile) only changes once the camera has moved a fraction of the radius.
+void d_shadow_atlas_place_cascades_internal(d_ShadowAtlas *atlas,
+                                            const d_Light *light,
+                                            d_Camera *camera) {
+  const float *v = camera->view.data;
+  const float *p = camera->projection.data;
+  d_Vec3 eye = camera->transform->position;
+  d_Vec3 forward = d_vec3(-v[2], -v[6], -v[10]);
+  // squared tangent of half the diagonal field of view
+  float tangent = 1.0f / (p[0] * p[0]) + 1.0f / (p[5] * p[5]);
+
+  float near = camera->near_plane;
+  float far = fminf(camera->far_plane, atlas->max_distance);
+
+  // directional lights shine against their `direction`
+  d_Vec3 origin = d_vec3(0.0f, 0.0f, 0.0f);
+  d_Vec3 travel =
+      d_vec3(-light->direction.x, -light->direction.y, -light->direction.z);
+  d_Mat4 view = d_shadow_view_matrix_internal(&origin, &travel);
+  const float *l = view.data;
+
+  float split_near = near;
+  for (d_uint i = 0; i < D_SHADOW_CASCADES; i++) {
+    float t = (float)(i + 1) / D_SHADOW_CASCADES;
+    float split_far =
+        D_SHADOW_SPLIT_LAMBDA * near * powf(far / near, t) +
+        (1.0f - D_SHADOW_SPLIT_LAMBDA) * (near + (far - near) * t);
+
+    float middle = (split_near + split_far) * 0.5f;
+    float half = split_far - middle;
+    float radius = sqrtf(half * half + split_far * split_far * tangent);
+    d_Vec3 center = d_vec3(eye.x + forward.x * middle,
+                           eye.y + forward.y * middle,
+                           eye.z + forward.z * middle);
+
+    // the margin covers the snapping, the step is whole texels so the
+    // rasterization does not shimmer either
+    float extent = radius * (1.0f + D_SHADOW_CACHE_STEP);
+    float texel = 2.0f * extent / atlas->tile_width;
+    float step = floorf(radius * D_SHADOW_CACHE_STEP / texel) * texel;
+    if (step < texel) {
+      step = texel;
+    }
+    float snapped[3];
+    for (int axis = 0; axis < 3; axis++) {
+      float c = l[axis] * center.x + l[4 + axis] * center.y +
+                l[8 + axis] * center.z;
+      snapped[axis] = floorf(c / step + 0.5f) * step;
+    }
+
+    // casters in front of the near plane are kept by depth clamping
+    d_Mat4 projection = d_mat4(false);
+    d_mat4_orthogonal(&projection, snapped[0] - extent, snapped[0] + extent,
+                      snapped[1] - extent, snapped[1] + extent,
+                      -snapped[2] - extent, -snapped[2] + extent);
+    d_Mat4 view_projection = d_mat4_multiply(&projection, &view);
+    d_shadow_atlas_push_view_internal(atlas, &view_projection);
+
+    atlas->data.cascade_splits[i] = split_far;
+    split_near = split_far;
+  }
+}
+
+void d_shadow_atlas_place_spot_internal(d_ShadowAtlas *atlas,
+                                        const d_Light *light,
+                                        const float range) {
+  d_Mat4 view =
+      d_shadow_view_matrix_internal(&light->position, &light->direction);
+
+  // the cone plus a little margin for the filter taps
+  float fov = d_to_degrees(2.0f * light->outer_cone_angle) + 2.0f;
+  d_Mat4 projection = d_mat4(false);
+  d_mat4_perspective(&projection, fminf(fov, 170.0f), 1.0f,
+                     D_SHADOW_SPOT_NEAR, range);
+  d_Mat4 view_projection = d_mat4_multiply(&projection, &view);
+  d_shadow_atlas_push_view_internal(atlas, &view_projection);
+}
+
+void d_shadow_atlas_begin(d_ShadowAtlas *atlas, d_Camera *camera) {
+  if (atlas == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "atlas is NULL.");
+    return;
+  }
+  if (camera == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "camera is NULL.");
+    return;
+  }
+
+  atlas->static_casters->length = 0;
+  atlas->dynamic_casters->length = 0;
+  atlas->static_hash = D_HASH_SEED;
+  atlas->view_count = 0;
+  atlas->data.info[0] = 0;
+  atlas->data.info[1] = 0;
+  atlas->data.info[2] = -1;
+  atlas->data.info[3] = 0;
+
+  d_LightManager *manager = atlas->renderer->light_manager;
+
+  for (d_uint i = 0; i < manager->point_lights->length; i++) {
+    d_array_get(manager->point_lights, d_Light *, i)->shadow_view = -1;
+  }
+
+  for (d_uint i = 0; i < manager->directional_lights->length; i++) {
+    d_Light *light = d_array_get(manager->directional_lights, d_Light *, i);
+    light->shadow_view = -1;
+    if (light->cast_shadows == false || atlas->data.info[2] != -1 ||
+        atlas->view_count + D_SHADOW_CASCADES > D_SHADOW_MAX_VIEWS) {
+      continue;
+    }
+
+    light->shadow_view = atlas->view_count;
+    atlas->data.info[0] = D_SHADOW_CASCADES;
+    atlas->data.info[1] = atlas->view_count;
+    atlas->data.info[2] = i;
+    d_shadow_atlas_place_cascades_internal(atlas, light, camera);
+  }
+
+  for (d_uint i = 0; i < manager->spot_lights->length; i++) {
+    d_Light *light = d_array_get(manager->spot_lights, d_Light *, i);
+    light->shadow_view = -1;
+    if (light->cast_shadows == false ||
+        atlas->view_count >= D_SHADOW_MAX_VIEWS) {
+      continue;
+    }
+
+    float range = d_cluster_light_range_internal(light, camera->far_plane);
+    if (range <= D_SHADOW_SPOT_NEAR) {
+      continue;
+    }
+    light->shadow_view = atlas->view_count;
+    d_shadow_atlas_place_spot_internal(atlas, light, range);
+  }
+}
+
+void d_shadow_atlas_add(d_ShadowAtlas *atlas, const d_ShadowCaster *caster,
+                        const bool is_static) {
+  if (atlas == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "atlas is NULL.");
+    return;
+  }
+  if (caster == NULL || caster->vao == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "caster or its vao is NULL.");
+    return;
+  }
+
+  if (is_static == false) {
+    d_array_add(atlas->dynamic_casters, (void *)caster);
+    return;
+  }
+
+  d_array_add(atlas->static_casters, (void *)caster);
+  // field by field, the struct has padding
+  const d_uint range[4] = {caster->vao->id, caster->first_index,
+                           caster->index_count, caster->base_vertex};
+  atlas->static_hash = d_hash(range, sizeof(range), atlas->static_hash);
+  atlas->static_hash =
+      d_hash(caster->model.data, sizeof(caster->model.data),
+             atlas->static_hash);
+}
+
+void d_mesh_renderer_cast_shadow(d_MeshRenderer *mesh_renderer,
+                                 d_ShadowAtlas *atlas) {
+  if (mesh_renderer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "mesh_renderer is NULL.");
+    return;
+  }
+  if (mesh_renderer->geometry.index_count == 0 ||
+      mesh_renderer->batched == true) {
+    return;
+  }
+
+  const d_Mesh *mesh = mesh_renderer->mesh;
+  d_ShadowCaster caster;
+  caster.vao = d_mesh_geometry->vao;
+  caster.first_index =
+      mesh_renderer->geometry.first_index + mesh->lods[0].first_index;
+  caster.index_count = mesh->lods[0].index_count;
+  caster.base_vertex = mesh_renderer->geometry.base_vertex;
+  caster.model = d_transform_get_matrix(mesh_renderer->transform);
+  caster.bounds = d_aabb_transform(&mesh->bounds, &caster.model);
+
+  d_shadow_atlas_add(atlas, &caster, mesh_renderer->is_static);
+}
+
+void d_static_batch_cast_shadow(d_StaticBatch *batch, d_ShadowAtlas *atlas) {
+  if (batch == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "batch is NULL.");
+    return;
+  }
+  if (batch->geometry.index_count == 0) {
+    return;
+  }
+
+  d_ShadowCaster caster;
+  caster.vao = d_mesh_geometry->vao;
+  caster.first_index = batch->geometry.first_index;
+  caster.index_count = batch->geometry.index_count;
+  caster.base_vertex = batch->geometry.base_vertex;
+  // vertices are already in world space
+  caster.model = d_mat4(true);
+  caster.bounds = batch->bounds;
+
+  d_shadow_atlas_add(atlas, &caster, true);
+}
+
+// Frustum test without the near plane, whatever is between the light and
+// the view still casts into it.
+bool d_shadow_caster_visible_internal(const d_AABB *box,
+                                      const d_Frustum *frustum) {
+  for (int p = 0; p < 6; p++) {
+    if (p == 4) {
+      continue;
+    }
+    const d_Vec4 *plane = &frustum->planes[p];
+    float distance = plane->w;
+    float radius = 0.0f;
+    for (int i = 0; i < 3; i++) {
+      float center = (box->min.data[i] + box->max.data[i]) * 0.5f;
+      float extent = (box->max.data[i] - box->min.data[i]) * 0.5f;
+      distance += plane->data[i] * center;
+      radius += fabsf(plane->data[i]) * extent;
+    }
+    if (distance + radius < 0.0f)
+      return false;
+  }
+  return true;
+}
+
+void d_shadow_atlas_invalidate(d_ShadowAtlas *atlas, const d_AABB *bounds) {
+  if (atlas == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "atlas is NULL.");
+    return;
+  }
+
+  for (d_uint i = 0; i < D_SHADOW_MAX_VIEWS; i++) {
+    // unused views have no frustum to test against
+    if (bounds == NULL || i >= atlas->view_count ||
+        d_shadow_caster_visible_internal(bounds, &atlas->views[i].frustum)) {
+      atlas->views[i].cache_valid = false;
+    }
+  }
+}
+
+void d_shadow_atlas_draw_internal(d_ShadowAtlas *atlas, d_Array *casters,
+                                  const d_ShadowView *view) {
+  glUniformMatrix4fv(atlas->view_projection_location, 1, GL_FALSE,
+                     view->view_projection.data);
+
+  for (d_uint i = 0; i < casters->length; i++) {
+    d_ShadowCaster *caster = &d_array_get(casters, d_ShadowCaster, i);
+    if (d_shadow_caster_visible_internal(&caster->bounds, &view->frustum) ==
+        false) {
+      continue;
+    }
+
+    glUniformMatrix4fv(atlas->model_location, 1, GL_FALSE,
+                       caster->model.data);
+    d_vao_bind(caster->vao);
+    glDrawElementsBaseVertex(
+        GL_TRIANGLES, caster->index_count, GL_UNSIGNED_INT,
+        (void *)(uintptr_t)(caster->first_index * sizeof(d_uint)),
+        caster->base_vertex);
+  }
+}
+
+void d_shadow_atlas_render_view_internal(d_ShadowAtlas *atlas,
+                                         const d_uint index) {
+  d_ShadowView *view = &atlas->views[index];
+  GLint x = index % D_SHADOW_ATLAS_TILES * atlas->tile_width;
+  GLint y = index / D_SHADOW_ATLAS_TILES * atlas->tile_height;
+  GLint w = atlas->tile_width;
+  GLint h = atlas->tile_height;
+  // the scissor keeps clears and the copy inside the tile
+  glViewport(x, y, w, h);
+  glScissor(x, y, w, h);
+
+  if (view->cache_valid == false ||
+      memcmp(view->cached.data, view->view_projection.data,
+             sizeof(view->cached.data)) != 0) {
+    glBindFramebuffer(GL_FRAMEBUFFER, atlas->static_framebuffer);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    d_shadow_atlas_draw_internal(atlas, atlas->static_casters, view);
+    view->cached = view->view_projection;
+    view->cache_valid = true;
+  }
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, atlas->static_framebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, atlas->framebuffer);
+  glBlitFramebuffer(x, y, x + w, y + h, x, y, x + w, y + h,
+                    GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, atlas->framebuffer);
+  d_shadow_atlas_draw_internal(atlas, atlas->dynamic_casters, view);
+}
+
+void d_shadow_atlas_render(d_ShadowAtlas *atlas, const d_Viewport *viewport) {
+  D_PROFILE_SCOPE("d_shadow_atlas_render");
+  if (atlas == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "atlas is NULL.");
+    return;
+  }
+  if (viewport == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "viewport is NULL.");
+    return;
+  }
+
+  // a static caster was added, removed or moved
+  if (atlas->static_hash != atlas->cached_static_hash) {
+    d_shadow_atlas_invalidate(atlas, NULL);
+    atlas->cached_static_hash = atlas->static_hash;
+  }
+
+  if (atlas->view_count > 0 && atlas->texture == 0) {
+    atlas->static_texture = d_shadow_atlas_create_target_internal(
+        atlas, &atlas->static_framebuffer, false);
+    atlas->texture = d_shadow_atlas_create_target_internal(
+        atlas, &atlas->framebuffer, true);
+  }
+
+  if (atlas->view_count > 0) {
+    // depth writes have to be on before the tiles are cleared
+    D_PROFILE_GPU_BEGIN("shadow atlas");
+    d_pipeline_state_apply(atlas->pipeline);
+    d_gl_use_program(atlas->program);
+    glEnable(GL_DEPTH_CLAMP);
+    glEnable(GL_SCISSOR_TEST);
+
+    for (d_uint i = 0; i < atlas->view_count; i++) {
+      d_shadow_atlas_render_view_internal(atlas, i);
+    }
+
+    glDisable(GL_SCISSOR_TEST);
+    glDisable(GL_DEPTH_CLAMP);
+    glBindFramebuffer(GL_FRAMEBUFFER, d_window_framebuffer);
+    glViewport(viewport->viewport_x, viewport->viewport_y,
+               viewport->viewport_w, viewport->viewport_h);
+    D_PROFILE_GPU_END();
+  }
+
+  d_uniform_buffer_update(atlas->renderer->shadow_uniforms, 0,
+                          sizeof(d_ShadowData), &atlas->data);
+  d_gl_bind_texture(D_TEXTURE_UNIT_SHADOW_ATLAS, atlas->texture);
+}
+
+#pragma endregion
+
+#pragma region Deferred
+
+const char *d_deferred_stencil_vertex_source =
+    "#version 330 core\n"
+    "layout(location = 0) in vec3 aPos;\n"
+    "uniform mat4 mvp;\n"
+    "void main() { gl_Position = mvp * vec4(aPos, 1.0); }\n";
+
+const char *d_deferred_stencil_fragment_source = "#version 330 core\n"
+                                                 "void main() {}\n";
+
+// Vertex array of a light volume, positions only.
+void d_deferred_upload_volume_internal(d_VAO **vao, d_VBO **vbo, d_EBO **ebo,
+                                       const float *vertices,
+                                       const size_t vertices_size,
+                                       const d_uint *indices,
+                                       const size_t indices_size) {
+  *vao = d_vao_create();
+  d_vao_bind(*vao);
+  *vbo = d_vbo_create(vertices, vertices_size);
+  *ebo = d_ebo_create(indices, indices_size);
+  d_vao_link_attrib(*vao, *vbo, 0, 3, GL_FLOAT, 3 * sizeof(float),
+                    (void *)0);
+  d_vao_unbind(*vao);
+}
+
+// Unit sphere whose faces all lie outside radius 1, so a scaled sphere covers
+// the light's whole range.
+void d_deferred_build_sphere_internal(d_DeferredRenderer *deferred) {
+  const d_uint rings = D_DEFERRED_SPHERE_RINGS;
+  const d_uint segments = D_DEFERRED_SPHERE_SEGMENTS;
+  float scale = 1.0f / (cosf(D_PI / segments) * cosf(D_PI / (2 * rings)));
+
+  float vertices[(D_DEFERRED_SPHERE_RINGS + 1) *
+                 (D_DEFERRED_SPHERE_SEGMENTS + 1) * 3];
+  d_uint indices[D_DEFERRED_SPHERE_RINGS * D_DEFERRED_SPHERE_SEGMENTS * 6];
+
+  d_uint vertex = 0;
+  for (d_uint r = 0; r <= rings; r++) {
+    float theta = D_PI * r / rings;
+    for (d_uint s = 0; s <= segments; s++) {
+      float phi = 2.0f * D_PI * s / segments;
+      vertices[vertex++] = sinf(theta) * cosf(phi) * scale;
+      vertices[vertex++] = cosf(theta) * scale;
+      vertices[vertex++] = sinf(theta) * sinf(phi) * scale;
+    }
+  }
+
+  // counter clockwise seen from outside
+  d_uint index = 0;
+  for (d_uint r = 0; r < rings; r++) {
+    for (d_uint s = 0; s < segments; s++) {
+      d_uint a = r * (segments + 1) + s;
+      d_uint b = a + segments + 1;
+      indices[index++] = a;
+      indices[index++] = a + 1;
+      indices[index++] = b;
+      indices[index++] = a + 1;
+      indices[index++] = b + 1;
+      indices[index++] = b;
+    }
+  }
+
+  d_deferred_upload_volume_internal(
+      &deferred->sphere_vao, &deferred->sphere_vbo, &deferred->sphere_ebo,
+      vertices, sizeof(vertices), indices, sizeof(indices));
+  deferred->sphere_index_count = index;
+}
+
+// Unit cone with its apex at the origin, opening along -z to a base of
+// radius 1 (circumscribed again) at z = -1.
+void d_deferred_build_cone_internal(d_DeferredRenderer *deferred) {
+  const d_uint segments = D_DEFERRED_CONE_SEGMENTS;
+  float scale = 1.0f / cosf(D_PI / segments);
+
+  float vertices[(D_DEFERRED_CONE_SEGMENTS + 2) * 3];
+  d_uint indices[D_DEFERRED_CONE_SEGMENTS * 6];
+
+  // apex, base ring, base center
+  d_uint vertex = 0;
+  vertices[vertex++] = 0.0f;
+  vertices[vertex++] = 0.0f;
+  vertices[vertex++] = 0.0f;
+  for (d_uint s = 0; s < segments; s++) {
+    float phi = 2.0f * D_PI * s / segments;
+    vertices[vertex++] = cosf(phi) * scale;
+    vertices[vertex++] = sinf(phi) * scale;
+    vertices[vertex++] = -1.0f;
+  }
+  vertices[vertex++] = 0.0f;
+  vertices[vertex++] = 0.0f;
+  vertices[vertex++] = -1.0f;
+
+  d_uint center = segments + 1;
+  d_uint index = 0;
+  for (d_uint s = 0; s < segments; s++) {
+    d_uint next = (s + 1) % segments;
+    indices[index++] = 0;
+    indices[index++] = 1 + s;
+    indices[index++] = 1 + next;
+    indices[index++] = center;
+    indices[index++] = 1 + next;
+    indices[index++] = 1 + s;
+  }
+
+  d_deferred_upload_volume_internal(
+      &deferred->cone_vao, &deferred->cone_vbo, &deferred->cone_ebo, vertices,
+      sizeof(vertices), indices, sizeof(indices));
+  deferred->cone_index_count = index;
+}
+
+d_DeferredRenderer *d_deferred_renderer_create(d_Renderer *renderer,
+                                               const char *vertex_file_path,
+                                               const char *fragment_file_path) {
+  if (renderer == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "renderer is NULL.");
+    return NULL;
+  }
+  if (vertex_file_path == NULL || fragment_file_path == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "Shader file path is NULL.");
+    return NULL;
+  }
+
+  d_DeferredRenderer *deferred = malloc(sizeof(d_DeferredRenderer));
+  if (deferred == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE, "Failed to malloc deferred renderer.");
+    return NULL;
+  }
+
+  deferred->renderer = renderer;
+  deferred->width = 0;
+  deferred->height = 0;
+  memset(deferred->viewport, 0, sizeof(deferred->viewport));
+  deferred->framebuffer = 0;
+  deferred->albedo_texture = 0;
+  deferred->normal_texture = 0;
+  deferred->depth_texture = 0;
+  deferred->light_texture = 0;
+  deferred->depth_stencil = 0;
+  deferred->view_projection = d_mat4(true);
+  memset(&deferred->frustum, 0, sizeof(d_Frustum));
+  deferred->far_plane = 0.0f;
+
+  deferred->directional_shader =
+      d_shader_create_with_defines(renderer, vertex_file_path,
+                                   fragment_file_path,
+                                   "#define DEFERRED_DIRECTIONAL\n");
+  deferred->volume_shader = d_shader_create_with_defines(
+      renderer, vertex_file_path, fragment_file_path,
+      "#define DEFERRED_VOLUME\n");
+  deferred->composite_shader = d_shader_create_with_defines(
+      renderer, vertex_file_path, fragment_file_path,
+      "#define DEFERRED_COMPOSITE\n");
+
+  GLuint vertex = glCreateShader(GL_VERTEX_SHADER);
+  glShaderSource(vertex, 1, &d_deferred_stencil_vertex_source, NULL);
+  glCompileShader(vertex);
+  d_check_shader_compile(vertex, "VERTEX");
+  GLuint fragment = glCreateShader(GL_FRAGMENT_SHADER);
+  glShaderSource(fragment, 1, &d_deferred_stencil_fragment_source, NULL);
+  glCompileShader(fragment);
+  d_check_shader_compile(fragment, "FRAGMENT");
+
+  deferred->stencil_program = glCreateProgram();
+  glAttachShader(deferred->stencil_program, vertex);
+  glAttachShader(deferred->stencil_program, fragment);
+  glLinkProgram(deferred->stencil_program);
+  d_check_shader_link(deferred->stencil_program);
+  glDeleteShader(vertex);
+  glDeleteShader(fragment);
+  deferred->stencil_mvp_location =
+      glGetUniformLocation(deferred->stencil_program, "mvp");
+
+  d_deferred_build_sphere_internal(deferred);
+  d_deferred_build_cone_internal(deferred);
+  deferred->empty_vao = d_vao_create();
+
+  // both faces, depth tested against the G-buffer but not written
+  d_PipelineState description = d_pipeline_state_opaque();
+  description.cull_mode = DUCKY_CULL_NONE;
+  description.depth_write = false;
+  deferred->stencil_pipeline = d_pipeline_state_create(&description);
+
+  // back faces, so the camera can be inside the volume, added onto the
+  // directional lighting
+  description = d_pipeline_state_opaque();
+  description.cull_mode = DUCKY_CULL_FRONT;
+  description.depth_test = false;
+  description.depth_write = false;
+  description.blending = true;
+  description.blend_src = GL_ONE;
+  description.blend_dst = GL_ONE;
+  deferred->volume_pipeline = d_pipeline_state_create(&description);
+
+  description = d_pipeline_state_opaque();
+  description.cull_mode = DUCKY_CULL_NONE;
+  description.depth_test = false;
+  description.depth_write = false;
+  deferred->fullscreen_pipeline = d_pipeline_state_create(&description);
+
+  // depth is only written while the test is enabled
+  description = d_pipeline_state_opaque();
+  description.cull_mode = DUCKY_CULL_NONE;
+  description.depth_func = GL_ALWAYS;
+  deferred->composite_pipeline = d_pipeline_state_create(&description);
+
+  return deferred;
+}
+
+void d_deferred_renderer_release_internal(d_DeferredRenderer *deferred) {
+  if (deferred->framebuffer == 0) {
+    return;
+  }
+
+  glDeleteFramebuffers(1, &deferred->framebuffer);
+  GLuint *textures[4] = {&deferred->albedo_texture, &deferred->normal_texture,
+                         &deferred->depth_texture, &deferred->light_texture};
+  for (int i = 0; i < 4; i++) {
+    d_gl_state_forget(GL_TEXTURE, *textures[i]);
+    glDeleteTextures(1, textures[i]);
+    *textures[i] = 0;
+  }
+  glDeleteRenderbuffers(1, &deferred->depth_stencil);
+  deferred->framebuffer = 0;
+  deferred->depth_stencil = 0;
+  deferred->width = 0;
+  deferred->height = 0;
+}
+
+void d_deferred_renderer_destroy(d_DeferredRenderer **deferred) {
+  if (deferred == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "deferred (d_DeferredRenderer **) is NULL.");
+    return;
+  }
+  if (*deferred == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "deferred (d_DeferredRenderer *) is NULL.");
+    return;
+  }
+
+  d_deferred_renderer_release_internal(*deferred);
+  d_shader_destroy(&(*deferred)->directional_shader);
+  d_shader_destroy(&(*deferred)->volume_shader);
+  d_shader_destroy(&(*deferred)->composite_shader);
+  d_gl_state_forget(GL_PROGRAM, (*deferred)->stencil_program);
+  glDeleteProgram((*deferred)->stencil_program);
+  d_vao_destroy(&(*deferred)->sphere_vao);
+  d_vbo_destroy(&(*deferred)->sphere_vbo);
+  d_ebo_destroy(&(*deferred)->sphere_ebo);
+  d_vao_destroy(&(*deferred)->cone_vao);
+  d_vbo_destroy(&(*deferred)->cone_vbo);
+  d_ebo_destroy(&(*deferred)->cone_ebo);
+  d_vao_destroy(&(*deferred)->empty_vao);
+  d_pipeline_state_destroy(&(*deferred)->stencil_pipeline);
+  d_pipeline_state_destroy(&(*deferred)->volume_pipeline);
+  d_pipeline_state_destroy(&(*deferred)->fullscreen_pipeline);
+  d_pipeline_state_destroy(&(*deferred)->composite_pipeline);
+
+  free(*deferred);
+  *deferred = NULL;
+}
+
+// Screen sized texture attached to the bound framebuffer.
+GLuint d_deferred_renderer_target_internal(d_DeferredRenderer *deferred,
+                                           const GLint internal_format,
+                                           const GLenum format,
+                                           const GLenum type,
+                                           const GLenum attachment) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  d_gl_bind_texture(D_DEFERRED_UNIT_ALBEDO, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, internal_format, deferred->width,
+               deferred->height, 0, format, type, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture,
+                         0);
+  return texture;
+}
+
+void d_deferred_renderer_resize_internal(d_DeferredRenderer *deferred,
+                                         const d_uint width,
+                                         const d_uint height) {
+  d_deferred_renderer_release_internal(deferred);
+  deferred->width = width;
+  deferred->height = height;
+
+  glGenFramebuffers(1, &deferred->framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, deferred->framebuffer);
+  deferred->albedo_texture = d_deferred_renderer_target_internal(
+      deferred, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_COLOR_ATTACHMENT0);
+  deferred->normal_texture = d_deferred_renderer_target_internal(
+      deferred, GL_RGBA16F, GL_RGBA, GL_FLOAT, GL_COLOR_ATTACHMENT1);
+  deferred->depth_texture = d_deferred_renderer_target_internal(
+      deferred, GL_R32F, GL_RED, GL_FLOAT, GL_COLOR_ATTACHMENT2);
+  deferred->light_texture = d_deferred_renderer_target_internal(
+      deferred, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_COLOR_ATTACHMENT3);
+
+  glGenRenderbuffers(1, &deferred->depth_stencil);
+  glBindRenderbuffer(GL_RENDERBUFFER, deferred->depth_stencil);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                            GL_RENDERBUFFER, deferred->depth_stencil);
+
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    d_throw_error(DUCKY_FAILURE, "G-buffer framebuffer is incomplete.");
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, d_window_framebuffer);
+}
+
+void d_deferred_renderer_begin(d_DeferredRenderer *deferred, d_Camera *camera,
+                               const d_Viewport *viewport) {
+  if (deferred == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "deferred is NULL.");
+    return;
+  }
+  if (camera == NULL || viewport == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "camera or viewport is NULL.");
+    return;
+  }
+
+  deferred->view_projection =
+      d_mat4_multiply(&camera->projection, &camera->view);
+  deferred->frustum = d_frustum_from_matrix(&deferred->view_projection);
+  deferred->far_plane = camera->far_plane;
+  deferred->viewport[0] = viewport->viewport_x;
+  deferred->viewport[1] = viewport->viewport_y;
+  deferred->viewport[2] = viewport->viewport_w;
+  deferred->viewport[3] = viewport->viewport_h;
+
+  // the G-buffer is only allocated while it is used
+  if (deferred->renderer->render_path != DUCKY_RENDER_DEFERRED ||
+      viewport->viewport_w <= 0 || viewport->viewport_h <= 0) {
+    return;
+  }
+  if ((d_uint)viewport->viewport_w != deferred->width ||
+      (d_uint)viewport->viewport_h != deferred->height) {
+    d_deferred_renderer_resize_internal(deferred, viewport->viewport_w,
+                                        viewport->viewport_h);
+  }
+}
+
+void d_deferred_renderer_begin_geometry(d_DeferredRenderer *deferred) {
+  if (deferred == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "deferred is NULL.");
+    return;
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, deferred->framebuffer);
+  glViewport(0, 0, deferred->width, deferred->height);
+  const GLenum buffers[3] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
+                             GL_COLOR_ATTACHMENT2};
+  glDrawBuffers(3, buffers);
+
+  // depth writes have to be on for the clear
+  d_pipeline_state_apply(deferred->composite_pipeline);
+  const float zero[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+  for (int i = 0; i < 3; i++) {
+    glClearBufferfv(GL_COLOR, i, zero);
+  }
+  glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+}
+
+// Makes one of the light shader variants current with its samplers and the
+// area of the framebuffer it draws to.
+void d_deferred_renderer_use_internal(d_Shader *shader, const d_Vec4 rect) {
+  d_shader_activate(shader);
+  shader = d_shader_resolve(shader);
+  d_shader_set_int(shader, "gbuffer_albedo", D_DEFERRED_UNIT_ALBEDO);
+  d_shader_set_int(shader, "gbuffer_normal", D_DEFERRED_UNIT_NORMAL);
+  d_shader_set_int(shader, "gbuffer_depth", D_DEFERRED_UNIT_DEPTH);
+  d_shader_set_int(shader, "light_buffer", D_DEFERRED_UNIT_LIGHT);
+  d_shader_set_vec4(shader, "viewport_rect", rect);
+}
+
+// Model matrix placing the unit sphere or cone over the light's range.
+//
+// @return true for the cone.
+bool d_deferred_volume_internal(const d_Light *light, const float range,
+                                d_Mat4 *model) {
+  *model = d_mat4(true);
+  float *m = model->data;
+  m[12] = light->position.x;
+  m[13] = light->position.y;
+  m[14] = light->position.z;
+
+  // wide cones cover about as much as the sphere
+  if (light->type != DUCKY_LIGHT_SPOT ||
+      light->outer_cone_angle > d_to_radians(75.0f)) {
+    m[0] = range;
+    m[5] = range;
+    m[10] = range;
+    return false;
+  }
+
+  d_Vec3 f = d_vec3_normalized(&light->direction);
+  d_Vec3 world_up = fabsf(f.y) > 0.99f ? d_vec3(1.0f, 0.0f, 0.0f)
+                                       : d_vec3(0.0f, 1.0f, 0.0f);
+  d_Vec3 right = d_vec3_cross(&f, &world_up);
+  right = d_vec3_normalized(&right);
+  d_Vec3 up = d_vec3_cross(&right, &f);
+
+  // the cone's -z axis goes along the light
+  float radius = range * tanf(light->outer_cone_angle);
+  for (int i = 0; i < 3; i++) {
+    m[i] = right.data[i] * radius;
+    m[4 + i] = up.data[i] * radius;
+    m[8 + i] = -f.data[i] * range;
+  }
+  return true;
+}
+
+void d_deferred_renderer_shade_volumes_internal(d_DeferredRenderer *deferred) {
+  d_LightManager *manager = deferred->renderer->light_manager;
+  d_Shader *shader = d_shader_resolve(deferred->volume_shader);
+  GLint light_location = d_shader_get_uniform_location(shader, "volume_light");
+
+  glEnable(GL_STENCIL_TEST);
+  // back faces past the far plane still count
+  glEnable(GL_DEPTH_CLAMP);
+
+  d_Array *arrays[2] = {manager->point_lights, manager->spot_lights};
+  for (int a = 0; a < 2; a++) {
+    for (d_uint i = 0; i < arrays[a]->length; i++) {
+      d_Light *light = d_array_get(arrays[a], d_Light *, i);
+      d_ClusterLightData data;
+      d_cluster_light_write(light, deferred->far_plane, &data);
+      if (data.range <= 0.0f) {
+        continue;
+      }
+
+      bool visible = true;
+      for (int p = 0; p < 6 && visible == true; p++) {
+        const d_Vec4 *plane = &deferred->frustum.planes[p];
+        const d_Vec3 *center = &light->position;
+        visible = plane->x * center->x + plane->y * center->y +
+                      plane->z * center->z + plane->w >=
+                  -data.range;
+      }
+      if (visible == false) {
+        continue;
+      }
+
+      d_Mat4 model;
+      bool cone = d_deferred_volume_internal(light, data.range, &model);
+      d_VAO *vao = cone == true ? deferred->cone_vao : deferred->sphere_vao;
+      d_uint index_count = cone == true ? deferred->cone_index_count
+                                        : deferred->sphere_index_count;
+      d_Mat4 mvp = d_mat4_multiply(&deferred->view_projection, &model);
+
+      // counts the G-buffer surfaces behind the volume's front faces but in
+      // front of its back faces
+      d_pipeline_state_apply(deferred->stencil_pipeline);
+      d_gl_use_program(deferred->stencil_program);
+      glUniformMatrix4fv(deferred->stencil_mvp_location, 1, GL_FALSE,
+                         mvp.data);
+      glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+      glStencilFunc(GL_ALWAYS, 0, 0xFF);
+      glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+      glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+      d_vao_bind(vao);
+      glDrawElements(GL_TRIANGLES, index_count, GL_UNSIGNED_INT, (void *)0);
+
+      // shades them, zeroing the stencil again for the next light
+      glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+      glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+      glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+      d_pipeline_state_apply(deferred->volume_pipeline);
+      d_shader_activate(shader);
+      d_shader_set_mat4(shader, "model", &model);
+      glUniform4fv(light_location, 4, (const float *)&data);
+      glDrawElements(GL_TRIANGLES, index_count, GL_UNSIGNED_INT, (void *)0);
+    }
+  }
+
+  glDisable(GL_DEPTH_CLAMP);
+  glDisable(GL_STENCIL_TEST);
+}
+
+void d_deferred_renderer_shade(d_DeferredRenderer *deferred) {
+  if (deferred == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "deferred is NULL.");
+    return;
+  }
+
+  const int *viewport = deferred->viewport;
+  if (d_shader_is_ready(deferred->directional_shader) == false ||
+      d_shader_is_ready(deferred->volume_shader) == false ||
+      d_shader_is_ready(deferred->composite_shader) == false) {
+    glBindFramebuffer(GL_FRAMEBUFFER, d_window_framebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    return;
+  }
+
+  glDrawBuffer(GL_COLOR_ATTACHMENT3);
+  d_gl_bind_texture(D_DEFERRED_UNIT_ALBEDO, deferred->albedo_texture);
+  d_gl_bind_texture(D_DEFERRED_UNIT_NORMAL, deferred->normal_texture);
+  d_gl_bind_texture(D_DEFERRED_UNIT_DEPTH, deferred->depth_texture);
+
+  // ambient and directional lights everywhere, this also overwrites the
+  // light buffer so it needs no clear
+  d_Vec4 gbuffer = d_vec4(0.0f, 0.0f, deferred->width, deferred->height);
+  d_pipeline_state_apply(deferred->fullscreen_pipeline);
+  d_deferred_renderer_use_internal(deferred->directional_shader, gbuffer);
+  d_vao_bind(deferred->empty_vao);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  d_deferred_renderer_use_internal(deferred->volume_shader, gbuffer);
+  d_deferred_renderer_shade_volumes_internal(deferred);
+
+  // onto the default framebuffer, with the depth forward drawing tests
+  // against
+  glBindFramebuffer(GL_FRAMEBUFFER, d_window_framebuffer);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+  d_gl_bind_texture(D_DEFERRED_UNIT_LIGHT, deferred->light_texture);
+  d_pipeline_state_apply(deferred->composite_pipeline);
+  d_deferred_renderer_use_internal(
+      deferred->composite_shader,
+      d_vec4(viewport[0], viewport[1], viewport[2], viewport[3]));
+  d_vao_bind(deferred->empty_vao);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+#pragma endregion
+
+#pragma region DynamicResolution
+
+d_DynamicResolution *
+d_dynamic_resolution_create(const float target_frame_time) {
+  if (target_frame_time <= 0.0f) {
+    d_throw_error(DUCKY_FAILURE, "Target frame time must be positive.");
+    return NULL;
+  }
+
+  d_DynamicResolution *resolution = malloc(sizeof(d_DynamicResolution));
+  if (resolution == NULL) {
+    d_throw_error(DUCKY_MEMORY_FAILURE,
+                  "Failed to malloc dynamic resolution.");
+    return NULL;
+  }
+
+  resolution->target = NULL;
+  resolution->scale = 1.0f;
+  resolution->min_scale = 0.5f;
+  resolution->max_scale = 1.0f;
+  resolution->target_gpu_time = target_frame_time * 1000000.0;
+  resolution->gpu_time = 0.0;
+  resolution->cpu_time = 0.0;
+  resolution->frames_since_change = 0;
+  for (d_uint i = 0; i < D_DYNAMIC_RESOLUTION_QUERIES; i++) {
+    glGenQueries(2, resolution->queries[i]);
+    resolution->cpu_spans[i] = 0;
+    resolution->pending[i] = false;
+  }
+  resolution->cpu_start = 0;
+  resolution->next = 0;
+  resolution->timing = false;
+  resolution->viewport = NULL;
+  memset(resolution->window_rect, 0, sizeof(resolution->window_rect));
+  resolution->window_framebuffer = 0;
+  resolution->active = false;
+
+  return resolution;
+}
+
+void d_dynamic_resolution_destroy(d_DynamicResolution **resolution) {
+  if (resolution == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "resolution (d_DynamicResolution **) is NULL.");
+    return;
+  }
+  if (*resolution == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE,
+                  "resolution (d_DynamicResolution *) is NULL.");
+    return;
+  }
+
+  for (d_uint i = 0; i < D_DYNAMIC_RESOLUTION_QUERIES; i++) {
+    glDeleteQueries(2, (*resolution)->queries[i]);
+  }
+  if ((*resolution)->target != NULL) {
+    d_framebuffer_destroy(&(*resolution)->target);
+  }
+
+  free(*resolution);
+  *resolution = NULL;
+}
+
+void d_dynamic_resolution_set_scale_range(d_DynamicResolution *resolution,
+                                          const float min_scale,
+                                          const float max_scale) {
+  if (resolution == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "resolution is NULL.");
+    return;
+  }
+  if (min_scale <= 0.0f || min_scale > max_scale) {
+    d_throw_error(DUCKY_FAILURE, "Invalid dynamic resolution scale range.");
+    return;
+  }
+
+  resolution->min_scale = min_scale;
+  resolution->max_scale = max_scale;
+  resolution->scale = fmaxf(min_scale, fminf(resolution->scale, max_scale));
+  resolution->gpu_time = 0.0;
+  resolution->cpu_time = 0.0;
+  resolution->frames_since_change = 0;
+}
+
+// Reads the timestamps of finished frames without waiting on the GPU.
+void d_dynamic_resolution_collect_internal(d_DynamicResolution *resolution) {
+  for (d_uint i = 0; i < D_DYNAMIC_RESOLUTION_QUERIES; i++) {
+    if (resolution->pending[i] == false) {
+      continue;
+    }
+
+    // the end timestamp finishing implies the start did
+    GLint available = GL_FALSE;
+    glGetQueryObjectiv(resolution->queries[i][1], GL_QUERY_RESULT_AVAILABLE,
+                       &available);
+    if (available == GL_FALSE) {
+      continue;
+    }
+
+    GLuint64 start = 0;
+    GLuint64 end = 0;
+    glGetQueryObjectui64v(resolution->queries[i][0], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(resolution->queries[i][1], GL_QUERY_RESULT, &end);
+    resolution->pending[i] = false;
+
+    double elapsed = (double)(end - start);
+    double cpu_span = (double)resolution->cpu_spans[i];
+    if (resolution->gpu_time == 0.0) {
+      resolution->gpu_time = elapsed;
+      resolution->cpu_time = cpu_span;
+    } else {
+      resolution->gpu_time = resolution->gpu_time * 0.8 + elapsed * 0.2;
+      resolution->cpu_time = resolution->cpu_time * 0.8 + cpu_span * 0.2;
+    }
+  }
+}
+
+// Pixel cost goes with the square of the scale. The scale moves once the
+// frames rendered at the current one have been measured, and only while the
+// GPU time is outside 80-100% of the target, so it settles instead of
+// resizing every frame. A GPU that sat idle waiting for a slow CPU shows the
+// CPU's time, fewer pixels would not help there, so the scale is only
+// lowered while the GPU time is clearly above the CPU time.
+void d_dynamic_resolution_adjust_internal(d_DynamicResolution *resolution) {
+  if (resolution->frames_since_change < D_DYNAMIC_RESOLUTION_QUERIES + 1 ||
+      resolution->gpu_time == 0.0) {
+    return;
+  }
+
+  double target = resolution->target_gpu_time;
+  if (resolution->gpu_time <= target && resolution->gpu_time >= target * 0.8) {
+    return;
+  }
+  if (resolution->gpu_time > target &&
+      resolution->gpu_time < resolution->cpu_time * 1.1) {
+    return;
+  }
+
+  float scale = resolution->scale *
+                (float)sqrt(target * 0.9 / resolution->gpu_time);
+  // drops fast under load, recovers slowly
+  scale = fmaxf(resolution->scale - 0.25f,
+                fminf(scale, resolution->scale + 0.1f));
+  scale = roundf(scale / D_DYNAMIC_RESOLUTION_STEP) * D_DYNAMIC_RESOLUTION_STEP;
+  scale = fmaxf(resolution->min_scale, fminf(scale, resolution->max_scale));
+  if (fabsf(scale - resolution->scale) < D_DYNAMIC_RESOLUTION_STEP * 0.5f) {
+    return;
+  }
+
+  resolution->scale = scale;
+  resolution->gpu_time = 0.0;
+  resolution->cpu_time = 0.0;
+  resolution->frames_since_change = 0;
+}
+
+void d_dynamic_resolution_begin(d_DynamicResolution *resolution,
+                                d_Viewport *viewport) {
+  if (resolution == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "resolution is NULL.");
+    return;
+  }
+  if (viewport == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "viewport is NULL.");
+    return;
+  }
+  D_PROFILE_SCOPE("d_dynamic_resolution_begin");
+
+  resolution->active = false;
+  if (viewport->viewport_w <= 0 || viewport->viewport_h <= 0) {
+    return;
+  }
+
+  d_dynamic_resolution_collect_internal(resolution);
+  d_dynamic_resolution_adjust_internal(resolution);
+  resolution->frames_since_change++;
+
+  d_uint target_w = (d_uint)ceilf(viewport->viewport_w * resolution->max_scale);
+  d_uint target_h = (d_uint)ceilf(viewport->viewport_h * resolution->max_scale);
+  if (resolution->target == NULL) {
+    resolution->target = d_framebuffer_create(target_w, target_h);
+    if (resolution->target == NULL) {
+      return;
+    }
+  } else {
+    d_framebuffer_resize(resolution->target, target_w, target_h);
+  }
+
+  int width = (int)roundf(viewport->viewport_w * resolution->scale);
+  int height = (int)roundf(viewport->viewport_h * resolution->scale);
+  width = width < 1 ? 1 : width;
+  height = height < 1 ? 1 : height;
+
+  resolution->viewport = viewport;
+  resolution->window_rect[0] = viewport->viewport_x;
+  resolution->window_rect[1] = viewport->viewport_y;
+  resolution->window_rect[2] = viewport->viewport_w;
+  resolution->window_rect[3] = viewport->viewport_h;
+  resolution->window_framebuffer = d_window_framebuffer;
+  resolution->active = true;
+
+  viewport->viewport_x = 0;
+  viewport->viewport_y = 0;
+  viewport->viewport_w = width;
+  viewport->viewport_h = height;
+  d_window_framebuffer = resolution->target->id;
+  glBindFramebuffer(GL_FRAMEBUFFER, d_window_framebuffer);
+  glViewport(0, 0, width, height);
+
+  // a slot still waiting for its result leaves this frame untimed
+  d_uint slot = resolution->next;
+  resolution->timing = resolution->pending[slot] == false;
+  if (resolution->timing == true) {
+    glQueryCounter(resolution->queries[slot][0], GL_TIMESTAMP);
+    resolution->cpu_start = d_profiler_now();
+  }
+}
+
+void d_dynamic_resolution_end(d_DynamicResolution *resolution) {
+  if (resolution == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "resolution is NULL.");
+    return;
+  }
+  if (resolution->active == false) {
+    return;
+  }
+  D_PROFILE_SCOPE("d_dynamic_resolution_end");
+
+  if (resolution->timing == true) {
+    d_uint slot = resolution->next;
+    glQueryCounter(resolution->queries[slot][1], GL_TIMESTAMP);
+    resolution->cpu_spans[slot] = d_profiler_now() - resolution->cpu_start;
+    resolution->pending[slot] = true;
+    resolution->next = (slot + 1) % D_DYNAMIC_RESOLUTION_QUERIES;
+    resolution->timing = false;
+  }
+
+  d_Viewport *viewport = resolution->viewport;
+  int width = viewport->viewport_w;
+  int height = viewport->viewport_h;
+  const int *rect = resolution->window_rect;
+  viewport->viewport_x = rect[0];
+  viewport->viewport_y = rect[1];
+  viewport->viewport_w = rect[2];
+  viewport->viewport_h = rect[3];
+  d_window_framebuffer = resolution->window_framebuffer;
+  resolution->active = false;
+
+  D_PROFILE_GPU_BEGIN("upscale");
+  // the bars around a letter- or pillarboxed viewport are not blitted over
+  glBindFramebuffer(GL_FRAMEBUFFER, d_window_framebuffer);
+  glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, resolution->target->id);
+  glBlitFramebuffer(0, 0, width, height, rect[0], rect[1], rect[0] + rect[2],
+                    rect[1] + rect[3], GL_COLOR_BUFFER_BIT, GL_LINEAR);
+  glBindFramebuffer(GL_FRAMEBUFFER, d_window_framebuffer);
+  glViewport(rect[0], rect[1], rect[2], rect[3]);
+  D_PROFILE_GPU_END();
 }
 
 #pragma endregion
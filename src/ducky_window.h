@@ -13,6 +13,10 @@
 #ifdef DUCKY_GLAD_IMPL
 #include DUCKY_GLAD_IMPL
 #endif
+#ifdef DUCKY_HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 #pragma region Types
 
@@ -34,6 +38,34 @@ typedef struct d_Viewport {
   d_ViewportState state;
 } Viewport, d_Viewport;
 
+// presented frames whose completion is tracked with a fence
+#define D_MAX_FRAMES_IN_FLIGHT 4
+// the frame limiter sleeps until this long before its deadline and spins the
+// rest, sleeps can overshoot by a scheduler tick
+#define D_FRAME_SPIN_NS 2000000ULL
+
+typedef enum d_SwapInterval {
+  // late frames are shown right away (and tear) instead of a refresh later
+  DUCKY_VSYNC_ADAPTIVE = -1,
+  DUCKY_VSYNC_OFF = 0,
+  DUCKY_VSYNC_ON = 1
+} SwapInterval,
+    d_SwapInterval;
+
+// A presented frame whose GPU work has not been seen finishing yet.
+typedef struct d_FrameFence {
+  // GLsync, `NULL` for a free slot
+  void *sync;
+  // timestamp of the frame's first input event, `0` without input
+  uint64_t input_time;
+} FrameFence, d_FrameFence;
+
+// Framebuffer that stands in for the window's default one: the offscreen
+// target of a headless window, `0` otherwise, or the scene target while
+// dynamic resolution redirects a frame. Passes that draw into their own
+// framebuffers bind it again when they are done.
+d_uint d_window_framebuffer;
+
 typedef struct d_Window {
   const char *title;
   int width;
@@ -42,8 +74,39 @@ typedef struct d_Window {
   bool fullscreen;
   void *native_window;
   void *gl_context;
+
+  // created by `d_window_create_headless`, there is no native window and
+  // frames go to `framebuffer`
+  bool headless;
+  // EGLDisplay and EGLSurface of a headless window, the surface is
+  // `EGL_NO_SURFACE` with `EGL_KHR_surfaceless_context`
+  void *egl_display;
+  void *egl_surface;
+  d_uint framebuffer;
+  d_uint color_renderbuffer;
+  d_uint depth_renderbuffer;
+
   d_Viewport *viewport;
   bool running;
+
+  d_SwapInterval swap_interval;
+  // nanoseconds between presents, `0` for no CPU frame limit
+  uint64_t target_frame_time;
+  // `SDL_GetTicksNS` time the next frame is presented at when limited
+  uint64_t next_frame_time;
+  // presented frames the GPU may still be working on once
+  // `d_window_swap_buffers` returns, `0` for no limit
+  d_uint max_frames_in_flight;
+  // ring of the last presented frames, indexed by `frame_index`
+  d_FrameFence fences[D_MAX_FRAMES_IN_FLIGHT];
+  d_uint frame_index;
+  // first input event since the last swap, `0` without input
+  uint64_t input_time;
+  // nanoseconds from an input event to the GPU finishing the frame it was
+  // handled in, for the newest finished frame that had input. Fences are
+  // polled at each swap, so it can read up to a frame high unless
+  // `max_frames_in_flight` waits on them.
+  uint64_t input_latency;
 } Window, d_Window;
 
 typedef enum d_WindowPopupType {
@@ -80,6 +143,19 @@ void d_viewport_destroy(d_Viewport **viewport);
 */
 d_Window *d_window_create(const char *title, const int width, const int height,
                           const bool resizable, const bool fullscreen);
+/*
+  Create a window without a display: an EGL context on a surfaceless display
+  (or a 1x1 pbuffer) that draws into an offscreen framebuffer of the given
+  size, e.g. for benchmarks and thumbnails on machines without a window
+  system. Needs `DUCKY_HEADLESS` and EGL.
+  #### Parameters:
+  - `width`: The width of the offscreen framebuffer.
+  - `height`: The height of the offscreen framebuffer.
+  #### Throws:
+  - `DUCKY_CRITICAL`: If EGL, the context or GLAD fails to initialize.
+  - `DUCKY_FAILURE`: If built without `DUCKY_HEADLESS`.
+*/
+d_Window *d_window_create_headless(const int width, const int height);
 /*
   Destroy the specified window and free its resources.
   #### Parameters:
@@ -107,13 +183,61 @@ void d_window_update(d_Window *window);
 */
 void d_window_get_dimensions(d_Window *window, int *width, int *height);
 /*
-  Swap the buffers of the specified window.
+  Present the frame drawn into the back buffer. Waits for the frame limit
+  first, and afterwards for the GPU when more than `max_frames_in_flight`
+  frames are unfinished.
   #### Parameters:
   - `window`: The window to swap buffers for.
   #### Throws:
   - `DUCKY_NULL_REFERENCE`: If the `window` argument is NULL.
 */
 void d_window_swap_buffers(d_Window *window);
+/*
+  Read a headless window's current frame as tightly packed RGBA8 rows, bottom
+  row first. A native window's back buffer is undefined once it has been
+  swapped, so those cannot be read.
+  #### Parameters:
+  - `window`: The headless window to read from.
+  - `pixels`: `width * height * 4` bytes.
+  #### Throws:
+  - `DUCKY_NULL_REFERENCE`: If `window` or `pixels` is NULL.
+  - `DUCKY_FAILURE`: If `window` is not headless.
+*/
+void d_window_read_pixels(d_Window *window, unsigned char *pixels);
+/*
+  Set how presents wait for the display refresh. Adaptive vsync falls back to
+  vsync on when the driver does not support it.
+  #### Parameters:
+  - `window`: The window to set the swap interval of.
+  - `interval`: `DUCKY_VSYNC_OFF`, `DUCKY_VSYNC_ON` or `DUCKY_VSYNC_ADAPTIVE`.
+  #### Returns:
+  - `false` if the interval (or its fallback) could not be set.
+  #### Throws:
+  - `DUCKY_NULL_REFERENCE`: If the `window` argument is NULL.
+*/
+bool d_window_set_swap_interval(d_Window *window,
+                                const d_SwapInterval interval);
+/*
+  Limit how often frames are presented, with a sleep followed by a short spin
+  so the deadline is met precisely.
+  #### Parameters:
+  - `window`: The window to limit.
+  - `frames_per_second`: Present rate, `0` to remove the limit.
+  #### Throws:
+  - `DUCKY_NULL_REFERENCE`: If the `window` argument is NULL.
+*/
+void d_window_set_frame_limit(d_Window *window, const float frames_per_second);
+/*
+  Limit how far the CPU can run ahead of the GPU. `1` waits at every swap
+  until the previous frame has finished on the GPU.
+  #### Parameters:
+  - `window`: The window to limit.
+  - `count`: Unfinished frames allowed after a swap, up to
+  `D_MAX_FRAMES_IN_FLIGHT - 1`, `0` for no limit.
+  #### Throws:
+  - `DUCKY_NULL_REFERENCE`: If the `window` argument is NULL.
+*/
+void d_window_set_max_frames_in_flight(d_Window *window, const d_uint count);
 
 bool d_window_running(d_Window *window);
 
@@ -122,6 +246,37 @@ void d_window_popup(d_WindowPopupType type, const char *title,
 void d_window_popup_error();
 #pragma endregion
 
+#pragma region Thread Functions
+#define D_MAX_THREADS 64
+
+typedef void (*d_ParallelFunction)(d_uint index, void *user_data);
+
+/*
+  Number of threads `d_parallel_for` spreads work over.
+*/
+d_uint d_thread_count();
+/*
+  Calls `function` once for every index in `[0, count)`, spread over up to
+  `d_thread_count()` threads. Returns when every call has finished. The
+  worker threads are started by the first call and wait for the next one
+  until `d_thread_pool_shutdown`. A call from inside `function` runs on the
+  calling thread.
+  #### Parameters:
+  - `count`: Number of indices.
+  - `function`: Called with each index and `user_data`, from any thread.
+  - `user_data`: Passed through to `function`.
+  #### Throws:
+  - `DUCKY_NULL_REFERENCE`: If the `function` argument is NULL.
+*/
+void d_parallel_for(const d_uint count, d_ParallelFunction function,
+                    void *user_data);
+/*
+  Stops and joins the worker threads of `d_parallel_for`. Called by
+  `d_window_destroy`, a later `d_parallel_for` starts them again.
+*/
+void d_thread_pool_shutdown();
+#pragma endregion
+
 #endif
 
 #ifdef DUCKY_WINDOW_IMPL
@@ -146,6 +301,17 @@ void d_viewport_destroy(d_Viewport **viewport) {
   free(*viewport);
 }
 
+void d_window_init_pacing_internal(d_Window *window) {
+  window->swap_interval = DUCKY_VSYNC_ON;
+  window->target_frame_time = 0;
+  window->next_frame_time = 0;
+  window->max_frames_in_flight = 0;
+  memset(window->fences, 0, sizeof(window->fences));
+  window->frame_index = 0;
+  window->input_time = 0;
+  window->input_latency = 0;
+}
+
 d_Window *d_window_create(const char *title, const int width, const int height,
                           const bool resizable, const bool fullscreen) {
 
@@ -212,8 +378,17 @@ d_Window *d_window_create(const char *title, const int width, const int height,
   window->fullscreen = fullscreen;
   window->native_window = (void *)sdl_window;
   window->gl_context = (void *)gl_context;
+  window->headless = false;
+  window->egl_display = NULL;
+  window->egl_surface = NULL;
+  window->framebuffer = 0;
+  window->color_renderbuffer = 0;
+  window->depth_renderbuffer = 0;
+  d_window_framebuffer = 0;
   window->viewport = d_viewport_create(1920, 1080);
   window->running = true;
+  d_window_init_pacing_internal(window);
+  d_window_set_swap_interval(window, DUCKY_VSYNC_ON);
 
   d_event_add_listener(
       d_event_system_get_event(d_event_system, "on_throw_error"),
@@ -222,6 +397,178 @@ d_Window *d_window_create(const char *title, const int width, const int height,
   return window;
 }
 
+#ifdef DUCKY_HEADLESS
+bool d_egl_has_extension_internal(EGLDisplay display, const char *name) {
+  const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+  if (extensions == NULL) {
+    return false;
+  }
+
+  size_t length = strlen(name);
+  for (const char *found = strstr(extensions, name); found != NULL;
+       found = strstr(found + length, name)) {
+    bool starts = found == extensions || found[-1] == ' ';
+    bool ends = found[length] == ' ' || found[length] == '\0';
+    if (starts == true && ends == true) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Surfaceless Mesa needs no window system or GPU, e.g. llvmpipe in CI.
+EGLDisplay d_egl_get_display_internal() {
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+          "eglGetPlatformDisplayEXT");
+  if (get_platform_display != NULL &&
+      d_egl_has_extension_internal(EGL_NO_DISPLAY,
+                                   "EGL_MESA_platform_surfaceless")) {
+    EGLDisplay display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                              EGL_DEFAULT_DISPLAY, NULL);
+    if (display != EGL_NO_DISPLAY) {
+      return display;
+    }
+  }
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+#endif
+
+d_Window *d_window_create_headless(const int width, const int height) {
+#ifndef DUCKY_HEADLESS
+  (void)width;
+  (void)height;
+  d_throw_error(DUCKY_FAILURE, "Headless windows need DUCKY_HEADLESS.");
+  return NULL;
+#else
+  if (width <= 0 || height <= 0) {
+    d_throw_error(DUCKY_FAILURE, "Headless window size must be positive.");
+    return NULL;
+  }
+
+  EGLDisplay display = d_egl_get_display_internal();
+  if (display == EGL_NO_DISPLAY ||
+      eglInitialize(display, NULL, NULL) == EGL_FALSE) {
+    d_throw_error(DUCKY_CRITICAL, "Failed to initialize EGL.");
+    return NULL;
+  }
+  if (eglBindAPI(EGL_OPENGL_API) == EGL_FALSE) {
+    eglTerminate(display);
+    d_throw_error(DUCKY_CRITICAL, "EGL does not support desktop OpenGL.");
+    return NULL;
+  }
+
+  bool surfaceless =
+      d_egl_has_extension_internal(display, "EGL_KHR_surfaceless_context");
+  EGLint config_attributes[] = {EGL_SURFACE_TYPE,
+                                surfaceless == true ? 0 : EGL_PBUFFER_BIT,
+                                EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+  EGLConfig config;
+  EGLint config_count = 0;
+  if (eglChooseConfig(display, config_attributes, &config, 1,
+                      &config_count) == EGL_FALSE ||
+      config_count == 0) {
+    eglTerminate(display);
+    d_throw_error(DUCKY_CRITICAL, "No EGL config for OpenGL.");
+    return NULL;
+  }
+
+  EGLint context_attributes[] = {EGL_CONTEXT_MAJOR_VERSION,
+                                 3,
+                                 EGL_CONTEXT_MINOR_VERSION,
+                                 3,
+                                 EGL_CONTEXT_OPENGL_PROFILE_MASK,
+                                 EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                 EGL_NONE};
+  EGLContext context =
+      eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
+  if (context == EGL_NO_CONTEXT) {
+    eglTerminate(display);
+    d_throw_error(DUCKY_CRITICAL, "Failed to create EGL context.");
+    return NULL;
+  }
+
+  // frames go to the framebuffer below, the surface only makes the context
+  // current where surfaceless contexts are not supported
+  EGLSurface surface = EGL_NO_SURFACE;
+  if (surfaceless == false) {
+    EGLint pbuffer_attributes[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+    surface = eglCreatePbufferSurface(display, config, pbuffer_attributes);
+  }
+  if ((surfaceless == false && surface == EGL_NO_SURFACE) ||
+      eglMakeCurrent(display, surface, surface, context) == EGL_FALSE) {
+    if (surface != EGL_NO_SURFACE) {
+      eglDestroySurface(display, surface);
+    }
+    eglDestroyContext(display, context);
+    eglTerminate(display);
+    d_throw_error(DUCKY_CRITICAL, "Failed to make EGL context current.");
+    return NULL;
+  }
+
+#ifdef DUCKY_GLAD_IMPL
+  if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (surface != EGL_NO_SURFACE) {
+      eglDestroySurface(display, surface);
+    }
+    eglDestroyContext(display, context);
+    eglTerminate(display);
+    d_throw_error(DUCKY_CRITICAL, "Failed to initialize GLAD");
+    return NULL;
+  }
+#endif
+
+  d_Window *window = malloc(sizeof(d_Window));
+  if (window == NULL) {
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (surface != EGL_NO_SURFACE) {
+      eglDestroySurface(display, surface);
+    }
+    eglDestroyContext(display, context);
+    eglTerminate(display);
+    d_throw_error(DUCKY_MEMORY_FAILURE, "malloc failed.");
+    return NULL;
+  }
+  window->title = "Ducky Headless";
+  window->width = width;
+  window->height = height;
+  window->resizable = false;
+  window->fullscreen = false;
+  window->native_window = NULL;
+  window->gl_context = (void *)context;
+  window->headless = true;
+  window->egl_display = (void *)display;
+  window->egl_surface = (void *)surface;
+  window->viewport = d_viewport_create(1920, 1080);
+  window->running = true;
+  d_window_init_pacing_internal(window);
+  window->swap_interval = DUCKY_VSYNC_OFF;
+
+  glGenRenderbuffers(1, &window->color_renderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, window->color_renderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glGenRenderbuffers(1, &window->depth_renderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, window->depth_renderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &window->framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, window->framebuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, window->color_renderbuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                            GL_RENDERBUFFER, window->depth_renderbuffer);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    d_throw_error(DUCKY_FAILURE, "Headless framebuffer is incomplete.");
+  }
+  // left bound, it is the window's framebuffer from here on
+  d_window_framebuffer = window->framebuffer;
+
+  return window;
+#endif
+}
+
 void d_window_destroy(d_Window **window) {
   if (window == NULL) {
     d_throw_error(DUCKY_NULL_REFERENCE, "window (d_Window **) is NULL.");
@@ -232,16 +579,60 @@ void d_window_destroy(d_Window **window) {
     return;
   }
 
-  SDL_DestroyWindow((SDL_Window *)(*window)->native_window);
-  SDL_GL_DestroyContext((SDL_GLContext)(*window)->gl_context);
+  for (d_uint i = 0; i < D_MAX_FRAMES_IN_FLIGHT; i++) {
+    if ((*window)->fences[i].sync != NULL) {
+      glDeleteSync((GLsync)(*window)->fences[i].sync);
+    }
+  }
+
+  d_thread_pool_shutdown();
+
+  if ((*window)->headless == true) {
+#ifdef DUCKY_HEADLESS
+    glDeleteFramebuffers(1, &(*window)->framebuffer);
+    glDeleteRenderbuffers(1, &(*window)->color_renderbuffer);
+    glDeleteRenderbuffers(1, &(*window)->depth_renderbuffer);
+    d_window_framebuffer = 0;
+
+    EGLDisplay display = (EGLDisplay)(*window)->egl_display;
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if ((EGLSurface)(*window)->egl_surface != EGL_NO_SURFACE) {
+      eglDestroySurface(display, (EGLSurface)(*window)->egl_surface);
+    }
+    eglDestroyContext(display, (EGLContext)(*window)->gl_context);
+    eglTerminate(display);
+#endif
+  } else {
+    SDL_DestroyWindow((SDL_Window *)(*window)->native_window);
+    SDL_GL_DestroyContext((SDL_GLContext)(*window)->gl_context);
+    SDL_Quit();
+  }
   d_viewport_destroy(&(*window)->viewport);
-  SDL_Quit();
 
   free(*window);
   *window = NULL;
 }
 
+// Events the latency measurement starts from.
+bool d_window_is_input_event_internal(const SDL_Event *event) {
+  switch (event->type) {
+  case SDL_EVENT_KEY_DOWN:
+  case SDL_EVENT_KEY_UP:
+  case SDL_EVENT_MOUSE_MOTION:
+  case SDL_EVENT_MOUSE_BUTTON_DOWN:
+  case SDL_EVENT_MOUSE_BUTTON_UP:
+  case SDL_EVENT_MOUSE_WHEEL:
+  case SDL_EVENT_GAMEPAD_AXIS_MOTION:
+  case SDL_EVENT_GAMEPAD_BUTTON_DOWN:
+  case SDL_EVENT_GAMEPAD_BUTTON_UP:
+    return true;
+  default:
+    return false;
+  }
+}
+
 void d_window_update(d_Window *window) {
+  D_PROFILE_SCOPE("d_window_update");
   if (window == NULL) {
     d_throw_error(DUCKY_NULL_REFERENCE, "window is NULL.");
     return;
@@ -249,9 +640,15 @@ void d_window_update(d_Window *window) {
 
   SDL_Event event;
 
-  while (SDL_PollEvent(&event)) {
+  // no events without a native window, the size stays fixed
+  while (window->headless == false && SDL_PollEvent(&event)) {
     if (event.type == SDL_EVENT_QUIT)
       window->running = false;
+    // event timestamps are on the `SDL_GetTicksNS` clock
+    if (window->input_time == 0 &&
+        d_window_is_input_event_internal(&event) == true) {
+      window->input_time = event.common.timestamp;
+    }
   }
 
   d_window_get_dimensions(window, &window->width, &window->height);
@@ -288,16 +685,170 @@ void d_window_get_dimensions(d_Window *window, int *width, int *height) {
     return;
   }
 
+  if (window->headless == true) {
+    *width = window->width;
+    *height = window->height;
+    return;
+  }
   SDL_GetWindowSize((SDL_Window *)window->native_window, width, height);
 }
 
+// Sleeps, then spins, until the frame's present deadline.
+void d_window_limit_frame_internal(d_Window *window) {
+  if (window->target_frame_time == 0) {
+    return;
+  }
+
+  uint64_t now = SDL_GetTicksNS();
+  uint64_t deadline = window->next_frame_time;
+  if (now < deadline) {
+    if (deadline - now > D_FRAME_SPIN_NS) {
+      SDL_DelayNS(deadline - now - D_FRAME_SPIN_NS);
+    }
+    while (SDL_GetTicksNS() < deadline) {
+    }
+    window->next_frame_time = deadline + window->target_frame_time;
+  } else if (now - deadline < window->target_frame_time) {
+    // a little late, the next deadline keeps the cadence
+    window->next_frame_time = deadline + window->target_frame_time;
+  } else {
+    // a hitch, or the limit was just set
+    window->next_frame_time = now + window->target_frame_time;
+  }
+}
+
+void d_window_retire_fence_internal(d_Window *window, d_FrameFence *fence,
+                                    const uint64_t now) {
+  if (fence->input_time != 0 && now > fence->input_time) {
+    window->input_latency = now - fence->input_time;
+  }
+  glDeleteSync((GLsync)fence->sync);
+  fence->sync = NULL;
+}
+
+// Fences the frame just presented, retires finished frames oldest first and
+// waits on the oldest ones while too many are unfinished.
+void d_window_fence_frame_internal(d_Window *window) {
+  d_FrameFence *current =
+      &window->fences[window->frame_index % D_MAX_FRAMES_IN_FLIGHT];
+  // without a limit the GPU can be further behind than the ring
+  if (current->sync != NULL) {
+    glDeleteSync((GLsync)current->sync);
+  }
+  current->sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  current->input_time = window->input_time;
+  window->input_time = 0;
+  window->frame_index++;
+
+  for (d_uint i = 0; i < D_MAX_FRAMES_IN_FLIGHT; i++) {
+    d_FrameFence *fence =
+        &window->fences[(window->frame_index + i) % D_MAX_FRAMES_IN_FLIGHT];
+    if (fence->sync == NULL) {
+      continue;
+    }
+
+    GLenum status = glClientWaitSync((GLsync)fence->sync, 0, 0);
+    if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+      d_window_retire_fence_internal(window, fence, SDL_GetTicksNS());
+      continue;
+    }
+
+    if (window->max_frames_in_flight > 0 &&
+        D_MAX_FRAMES_IN_FLIGHT - i > window->max_frames_in_flight) {
+      // older than the limit allows, flushes so the wait can end
+      while (glClientWaitSync((GLsync)fence->sync,
+                              GL_SYNC_FLUSH_COMMANDS_BIT,
+                              1000000000ULL) == GL_TIMEOUT_EXPIRED) {
+      }
+      d_window_retire_fence_internal(window, fence, SDL_GetTicksNS());
+    }
+  }
+}
+
 void d_window_swap_buffers(d_Window *window) {
+  D_PROFILE_SCOPE("d_window_swap_buffers");
+  if (window == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "window is NULL.");
+    return;
+  }
+
+  // the back buffer is cleared by the renderer at the start of each frame
+  d_window_limit_frame_internal(window);
+  if (window->headless == false) {
+    SDL_GL_SwapWindow((SDL_Window *)window->native_window);
+  }
+  d_window_fence_frame_internal(window);
+}
+
+void d_window_read_pixels(d_Window *window, unsigned char *pixels) {
+  if (window == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "window is NULL.");
+    return;
+  }
+  if (pixels == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "pixels is NULL.");
+    return;
+  }
+  if (window->headless == false) {
+    d_throw_error(DUCKY_FAILURE, "Only headless windows can be read back.");
+    return;
+  }
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, window->framebuffer);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, window->width, window->height, GL_RGBA, GL_UNSIGNED_BYTE,
+               pixels);
+}
+
+bool d_window_set_swap_interval(d_Window *window,
+                                const d_SwapInterval interval) {
+  if (window == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "window is NULL.");
+    return false;
+  }
+  // nothing is presented, frames are only paced by the frame limit
+  if (window->headless == true) {
+    window->swap_interval = DUCKY_VSYNC_OFF;
+    return interval == DUCKY_VSYNC_OFF;
+  }
+
+  d_SwapInterval applied = interval;
+  if (SDL_GL_SetSwapInterval((int)interval) == false) {
+    if (interval != DUCKY_VSYNC_ADAPTIVE ||
+        SDL_GL_SetSwapInterval(DUCKY_VSYNC_ON) == false) {
+      d_throw_error_silent(DUCKY_FAILURE, "Failed to set swap interval.");
+      return false;
+    }
+    applied = DUCKY_VSYNC_ON;
+  }
+
+  window->swap_interval = applied;
+  return true;
+}
+
+void d_window_set_frame_limit(d_Window *window,
+                              const float frames_per_second) {
   if (window == NULL) {
     d_throw_error(DUCKY_NULL_REFERENCE, "window is NULL.");
     return;
   }
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  SDL_GL_SwapWindow((SDL_Window *)window->native_window);
+
+  window->target_frame_time =
+      frames_per_second > 0.0f
+          ? (uint64_t)(1000000000.0 / (double)frames_per_second)
+          : 0;
+  window->next_frame_time = 0;
+}
+
+void d_window_set_max_frames_in_flight(d_Window *window, const d_uint count) {
+  if (window == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "window is NULL.");
+    return;
+  }
+
+  window->max_frames_in_flight = count < D_MAX_FRAMES_IN_FLIGHT
+                                     ? count
+                                     : D_MAX_FRAMES_IN_FLIGHT - 1;
 }
 
 bool d_window_running(d_Window *window) {
@@ -337,4 +888,182 @@ void d_window_popup_error() {
                    "No error information available.");
   }
 }
+
+// Worker threads of `d_parallel_for`. The caller publishes a call and bumps
+// `generation`, worker `i` takes indices `i, i + stride, ...` (the caller
+// takes `0`) and the last one to finish wakes the caller.
+typedef struct d_ThreadPool {
+  SDL_Thread *threads[D_MAX_THREADS];
+  // worker slots started, slot `0` is the calling thread
+  d_uint thread_count;
+  SDL_Mutex *mutex;
+  SDL_Condition *work_ready;
+  SDL_Condition *work_done;
+
+  d_ParallelFunction function;
+  void *user_data;
+  d_uint count;
+  // threads taking part in the current call, the caller included
+  d_uint stride;
+  uint64_t generation;
+  // workers still running the current call
+  d_uint pending;
+  // a call is running, nested calls run inline
+  bool busy;
+  bool quit;
+} ThreadPool, d_ThreadPool;
+
+d_ThreadPool d_thread_pool;
+
+void d_parallel_run_internal(const d_uint slot) {
+  D_PROFILE_SCOPE("d_parallel_for");
+  for (d_uint i = slot; i < d_thread_pool.count; i += d_thread_pool.stride) {
+    d_thread_pool.function(i, d_thread_pool.user_data);
+  }
+}
+
+int d_parallel_worker_internal(void *data) {
+  d_uint slot = (d_uint)(uintptr_t)data;
+  uint64_t generation = 0;
+
+  SDL_LockMutex(d_thread_pool.mutex);
+  while (true) {
+    while (d_thread_pool.quit == false &&
+           d_thread_pool.generation == generation) {
+      SDL_WaitCondition(d_thread_pool.work_ready, d_thread_pool.mutex);
+    }
+    if (d_thread_pool.quit == true) {
+      break;
+    }
+    generation = d_thread_pool.generation;
+    if (slot >= d_thread_pool.stride) {
+      continue;
+    }
+
+    // the call's fields do not change until every worker is done
+    SDL_UnlockMutex(d_thread_pool.mutex);
+    d_parallel_run_internal(slot);
+    SDL_LockMutex(d_thread_pool.mutex);
+
+    d_thread_pool.pending--;
+    if (d_thread_pool.pending == 0) {
+      SDL_SignalCondition(d_thread_pool.work_done);
+    }
+  }
+  SDL_UnlockMutex(d_thread_pool.mutex);
+
+  d_profiler_thread_exit();
+  return 0;
+}
+
+d_uint d_thread_count() {
+  int cores = SDL_GetNumLogicalCPUCores();
+  if (cores < 1)
+    return 1;
+  if (cores > D_MAX_THREADS)
+    return D_MAX_THREADS;
+  return (d_uint)cores;
+}
+
+bool d_thread_pool_start_internal() {
+  d_thread_pool.mutex = SDL_CreateMutex();
+  d_thread_pool.work_ready = SDL_CreateCondition();
+  d_thread_pool.work_done = SDL_CreateCondition();
+  if (d_thread_pool.mutex == NULL || d_thread_pool.work_ready == NULL ||
+      d_thread_pool.work_done == NULL) {
+    d_thread_pool_shutdown();
+    return false;
+  }
+
+  d_thread_pool.generation = 0;
+  d_thread_pool.busy = false;
+  d_thread_pool.quit = false;
+  d_thread_pool.thread_count = 1;
+  d_uint threads = d_thread_count();
+  for (d_uint i = 1; i < threads; i++) {
+    d_thread_pool.threads[i] = SDL_CreateThread(
+        d_parallel_worker_internal, "ducky_worker", (void *)(uintptr_t)i);
+    // slots are handed out in order, so stop at the first failure
+    if (d_thread_pool.threads[i] == NULL) {
+      break;
+    }
+    d_thread_pool.thread_count++;
+  }
+  return true;
+}
+
+void d_parallel_for(const d_uint count, d_ParallelFunction function,
+                    void *user_data) {
+  if (function == NULL) {
+    d_throw_error(DUCKY_NULL_REFERENCE, "function is NULL.");
+    return;
+  }
+  if (count == 0) {
+    return;
+  }
+
+  if (d_thread_pool.mutex == NULL && d_thread_pool_start_internal() == false) {
+    for (d_uint i = 0; i < count; i++) {
+      function(i, user_data);
+    }
+    return;
+  }
+
+  SDL_LockMutex(d_thread_pool.mutex);
+  if (d_thread_pool.busy == true) {
+    SDL_UnlockMutex(d_thread_pool.mutex);
+    for (d_uint i = 0; i < count; i++) {
+      function(i, user_data);
+    }
+    return;
+  }
+  d_uint stride = d_thread_pool.thread_count;
+  if (stride > count)
+    stride = count;
+  d_thread_pool.function = function;
+  d_thread_pool.user_data = user_data;
+  d_thread_pool.count = count;
+  d_thread_pool.stride = stride;
+  d_thread_pool.pending = stride - 1;
+  d_thread_pool.busy = true;
+  d_thread_pool.generation++;
+  SDL_BroadcastCondition(d_thread_pool.work_ready);
+  SDL_UnlockMutex(d_thread_pool.mutex);
+
+  // the calling thread takes the first share
+  d_parallel_run_internal(0);
+
+  SDL_LockMutex(d_thread_pool.mutex);
+  while (d_thread_pool.pending > 0) {
+    SDL_WaitCondition(d_thread_pool.work_done, d_thread_pool.mutex);
+  }
+  d_thread_pool.busy = false;
+  SDL_UnlockMutex(d_thread_pool.mutex);
+}
+
+void d_thread_pool_shutdown() {
+  if (d_thread_pool.mutex != NULL) {
+    SDL_LockMutex(d_thread_pool.mutex);
+    d_thread_pool.quit = true;
+    SDL_BroadcastCondition(d_thread_pool.work_ready);
+    SDL_UnlockMutex(d_thread_pool.mutex);
+  }
+  for (d_uint i = 1; i < d_thread_pool.thread_count; i++) {
+    SDL_WaitThread(d_thread_pool.threads[i], NULL);
+  }
+  d_thread_pool.thread_count = 0;
+
+  if (d_thread_pool.work_ready != NULL) {
+    SDL_DestroyCondition(d_thread_pool.work_ready);
+  }
+  if (d_thread_pool.work_done != NULL) {
+    SDL_DestroyCondition(d_thread_pool.work_done);
+  }
+  if (d_thread_pool.mutex != NULL) {
+    SDL_DestroyMutex(d_thread_pool.mutex);
+  }
+  d_thread_pool.work_ready = NULL;
+  d_thread_pool.work_done = NULL;
+  d_thread_pool.mutex = NULL;
+}
 #endif
@@ -1,34 +1,144 @@
 #include "ducky.h"
 
+#ifdef DUCKY_HEADLESS
+// frames drawn offscreen before the headless benchmark exits
+#define D_BENCHMARK_FRAMES 300
+#endif
+
 int main(int argc, char **argv) {
   d_core_init();
 
+#ifdef DUCKY_HEADLESS
+  // needs no display, for benchmarks on CI machines, see `make headless`
+  Window *window = d_window_create_headless(800, 600);
+  if (window == NULL) {
+    d_core_shutdown();
+    return 1;
+  }
+#else
   Window *window = d_window_create("Ducky Window", 800, 600, true, false);
+#endif
+  // keeps input latency low without stalling the GPU every frame
+  d_window_set_max_frames_in_flight(window, 2);
   Renderer *renderer = d_renderer_create();
   d_renderer_set_max_lights(renderer, 1, 16, 16);
 
   d_Shader *shader = d_shader_create(renderer, "assets/shaders/vertex.glsl",
                                      "assets/shaders/fragment.glsl");
+  shader->instanced =
+      d_shader_create(renderer, "assets/shaders/vertex_instanced.glsl",
+                      "assets/shaders/fragment.glsl");
+  // G-buffer variants, drawn with when the render path is deferred
+  shader->deferred = d_shader_create(renderer, "assets/shaders/vertex.glsl",
+                                     "assets/shaders/gbuffer.glsl");
+  shader->deferred->instanced =
+      d_shader_create(renderer, "assets/shaders/vertex_instanced.glsl",
+                      "assets/shaders/gbuffer.glsl");
+  renderer->depth_shader =
+      d_shader_create(renderer, "assets/shaders/depth_vertex.glsl",
+                      "assets/shaders/depth_fragment.glsl");
+  renderer->depth_shader->instanced = d_shader_create_with_defines(
+      renderer, "assets/shaders/depth_vertex.glsl",
+      "assets/shaders/depth_fragment.glsl", "#define INSTANCED\n");
+  d_renderer_set_depth_prepass(renderer, true);
 
   d_shader_activate(shader);
 
+  d_Camera *camera = d_camera_create(60.0f, 0.01f, 100.0f);
+  camera->transform->position = d_vec3(0.0f, 0.0f, 5.0f);
+
+  d_RenderQueue *queue = d_render_queue_create();
+  d_ClusterGrid *clusters = d_cluster_grid_create();
+  d_ShadowAtlas *shadows = d_shadow_atlas_create(renderer);
+  d_DeferredRenderer *deferred = d_deferred_renderer_create(
+      renderer, "assets/shaders/deferred/light_vertex.glsl",
+      "assets/shaders/deferred/light_fragment.glsl");
+  queue->deferred = deferred;
+  queue->renderer = renderer;
+  // drops resolution before frame rate on slow GPUs
+  d_DynamicResolution *resolution = d_dynamic_resolution_create(16.0f);
+
   d_MeshRenderer *mesh = d_mesh_renderer_create("assets/models/cube.fbx");
-  mesh->material = d_material_create("assets/textures/demo_diffuse.png",
-                                     "assets/textures/demo_specular.png",
-                                     d_color(1.0f, 1.0f, 1.0f, 1.0f));
+  // renderers borrow their material
+  d_Material *material = d_material_create("assets/textures/demo_diffuse.png",
+                                           "assets/textures/demo_specular.png",
+                                           d_color(1.0f, 1.0f, 1.0f, 1.0f));
+  mesh->material = material;
+  mesh->shader = shader;
 
+#ifdef DUCKY_PROFILE
+  // a few frames once loading has settled, written out at exit
+  d_uint frame = 0;
+#endif
+#ifdef DUCKY_HEADLESS
+  d_uint benchmark_frame = 0;
+  uint64_t benchmark_start = d_profiler_now();
+#endif
   while (d_window_running(window)) {
+#ifdef DUCKY_HEADLESS
+    if (benchmark_frame++ == D_BENCHMARK_FRAMES)
+      break;
+#endif
+#ifdef DUCKY_PROFILE
+    if (frame == 120)
+      d_profiler_begin_capture();
+    if (frame == 124)
+      d_profiler_end_capture();
+    frame++;
+#endif
     d_window_update(window);
+    d_dynamic_resolution_begin(resolution, window->viewport);
 
-    d_renderer_clear(d_color(0.2f, 0.3f, 0.3f, 1.0f));
+    d_camera_update(camera, (float)window->viewport->viewport_w /
+                                window->viewport->viewport_h);
+    d_renderer_update_frame(renderer, &camera->view, &camera->projection,
+                            camera->transform->position);
+    d_shadow_atlas_begin(shadows, camera);
+    d_cluster_grid_build(clusters, renderer->light_manager, camera,
+                         window->viewport);
+    d_deferred_renderer_begin(deferred, camera, window->viewport);
 
     d_mesh_renderer_update(mesh);
 
+    d_mesh_renderer_cast_shadow(mesh, shadows);
+    d_shadow_atlas_render(shadows, window->viewport);
+
+    d_renderer_clear(d_color(0.2f, 0.3f, 0.3f, 1.0f));
+
+    d_render_queue_begin(queue, camera);
+
+    d_mesh_renderer_submit(mesh, queue);
+
+    d_render_queue_submit(queue);
+
+    d_dynamic_resolution_end(resolution);
     d_window_swap_buffers(window);
   }
 
+#ifdef DUCKY_PROFILE
+  d_profiler_export_chrome_trace("profile.json");
+#endif
+#ifdef DUCKY_HEADLESS
+  printf("%d frames, %.3f ms per frame\n", D_BENCHMARK_FRAMES,
+         (double)(d_profiler_now() - benchmark_start) / 1000000.0 /
+             D_BENCHMARK_FRAMES);
+#endif
+
   d_mesh_renderer_destroy(&mesh);
+  d_material_destroy(&material);
+  d_render_queue_destroy(&queue);
+  d_cluster_grid_destroy(&clusters);
+  d_shadow_atlas_destroy(&shadows);
+  d_deferred_renderer_destroy(&deferred);
+  d_dynamic_resolution_destroy(&resolution);
+  d_mesh_geometry_destroy();
+  d_camera_destroy(&camera);
 
+  d_shader_destroy(&shader->deferred->instanced);
+  d_shader_destroy(&shader->deferred);
+  d_shader_destroy(&shader->instanced);
+  d_shader_destroy(&renderer->depth_shader->instanced);
+  d_shader_destroy(&renderer->depth_shader);
   d_shader_destroy(&shader);
   d_renderer_destroy(&renderer);
   d_window_destroy(&window);